@@ -0,0 +1,305 @@
+//
+// The bootloader, see bootloader.h for what it does and the protocol.
+//
+// This is an image of its own, linked to BOOT_START. It never enables interrupts, since the vectors belong to the
+// firmware, and only touches the TWI, the flash and the EEPROM, so the relays stay as the firmware left them.
+// The watchdog may still be running after a handover, so it is reset on every pass of the loop.
+// On the host, this runs against the simulated TWI, flash and EEPROM, see test/test_bootloader.c.
+//
+
+#include "hal.h"
+#include "bootloader.h"
+#include "diagnostics.h"
+
+// Set before .data and .bss are initialized if the firmware handed over to us, see read_handoff.
+// In .noinit, so clearing .bss doesn't undo it.
+static uint8_t handed_over NOINIT;
+
+// The last write. A page stays here until it has gone to the page buffer, and a commit until it has been checked.
+static uint8_t frame[BOOT_PAGE_FRAME_SIZE];
+// Number of bytes in it. This keeps counting past the size of frame, so oversized writes are rejected.
+static uint8_t frame_len;
+// Whether frame holds a page that still has to be programmed.
+static uint8_t page_pending;
+// BOOT_CMD_COMMIT or BOOT_CMD_RUN if that is still to be done, 0 if nothing is.
+static uint8_t command_pending;
+// At BOOT_INFO_STATUS.
+static uint8_t status = BOOT_STATUS_READY;
+// Whether the trailer has been invalidated since the last commit.
+static uint8_t trailer_invalidated;
+// The next byte of the info block to send.
+static uint8_t tx_index;
+
+// What the flash is doing. The page buffer is filled before the erase, so frame is free as soon as the erase starts.
+#define FLASH_IDLE 0
+#define FLASH_ERASING 1
+#define FLASH_WRITING 2
+static uint8_t flash_state = FLASH_IDLE;
+static uint16_t flash_addr;
+
+#define TWCR_ACK ((1 << TWINT) | (1 << TWEA) | (1 << TWEN))
+#define TWCR_RESET (TWCR_ACK | (1 << TWSTO))
+
+// Runs right after the stack pointer is set up, before anything is pushed and before .data and .bss are initialized,
+// so whatever the firmware left at the top of the stack is still there. There's no startup code on the host, so
+// fan_control_boot_setup calls it there.
+#ifdef FAN_CONTROL_HOST
+static void read_handoff(void);
+#else
+static void read_handoff(void) __attribute__((naked, used, section(".init3")));
+#endif
+static void read_handoff(void) {
+    // Every reset sets at least one of the flags, and the firmware clears them at startup.
+    handed_over = BOOT_HANDOFF_WORD == BOOT_HANDOFF_KEY && !(MCUCSR & DIAGNOSTICS_RESET_FLAGS);
+    BOOT_HANDOFF_WORD = 0;
+}
+
+static uint16_t read_le16(const uint8_t *data) {
+    return data[0] | data[1] << 8;
+}
+
+// CRC-16/XMODEM over the first length bytes of flash.
+static uint16_t firmware_crc(uint16_t length) {
+    uint16_t crc = 0;
+
+    for (uint16_t addr = 0; addr < length; addr++) {
+        if ((addr & 0xFF) == 0) {
+            wdt_reset();
+        }
+        crc = _crc_xmodem_update(crc, FLASH_READ_BYTE(addr));
+    }
+    return crc;
+}
+
+// Whether the firmware is intact, according to the trailer.
+static uint8_t firmware_valid(void) {
+    uint16_t length = eeprom_read_word((const uint16_t *) (BOOT_TRAILER_ADDR + BOOT_TRAILER_LENGTH));
+
+    if (length == 0xFFFF) {
+        // No trailer, programmed by ISP. Trust the firmware if there is one.
+        return FLASH_READ_WORD(0) != 0xFFFF;
+    }
+    // The length is only saved once the CRC matched, and the first page of an update clears it before touching the
+    // flash, so there is no need to check the CRC again. If saving it is interrupted, only its low byte has been
+    // written, which is nonzero or leaves it at 0, and the firmware was verified either way.
+    return length != 0;
+}
+
+// Does not return, except on the host.
+static void start_firmware(void) {
+    // The firmware sets the TWI up again.
+    TWCR = 0;
+    boot_rww_enable_safe();
+#ifdef FAN_CONTROL_HOST
+    hal_host_firmware_starts++;
+#else
+    __asm__ __volatile__ ("ijmp" :: "z" (0));
+#endif
+}
+
+// Moves the page in frame to the page buffer and starts erasing its page. flash_poll does the rest.
+static void program_page(void) {
+    if (!trailer_invalidated) {
+        eeprom_write_word((uint16_t *) (BOOT_TRAILER_ADDR + BOOT_TRAILER_LENGTH), 0);
+        trailer_invalidated = 1;
+    }
+
+    flash_addr = read_le16(&frame[1]);
+    // The _safe variants wait for the EEPROM, SPM must not run while it is being written.
+    for (uint8_t i = 0; i < BOOT_PAGE_SIZE; i += 2) {
+        boot_page_fill_safe(flash_addr + i, read_le16(&frame[3 + i]));
+    }
+    boot_page_erase_safe(flash_addr);
+    flash_state = FLASH_ERASING;
+    page_pending = 0;
+}
+
+// Takes the flash through erase, write and re-enabling the RWW section, one step whenever the last one is done.
+// This runs from the boot section, which stays readable while the RWW section is busy, so the TWI keeps going.
+static void flash_poll(void) {
+    if (boot_spm_busy()) {
+        return;
+    }
+
+    switch (flash_state) {
+        case FLASH_ERASING:
+            boot_page_write(flash_addr);
+            flash_state = FLASH_WRITING;
+            break;
+        case FLASH_WRITING:
+            boot_rww_enable();
+            flash_state = FLASH_IDLE;
+            break;
+        default:
+            if (page_pending) {
+                program_page();
+            }
+            break;
+    }
+}
+
+// Runs a commit or run command. Only call this while the flash is idle, so the firmware can be read.
+static void run_command(void) {
+    uint8_t command = command_pending;
+
+    command_pending = 0;
+    if (command == BOOT_CMD_COMMIT) {
+        uint16_t length = read_le16(&frame[1]);
+        uint16_t crc = read_le16(&frame[3]);
+
+        if (length != 0 && length <= BOOT_START && firmware_crc(length) == crc) {
+            // The length goes last, so the trailer is never valid with the wrong CRC.
+            eeprom_write_word((uint16_t *) (BOOT_TRAILER_ADDR + BOOT_TRAILER_CRC), crc);
+            eeprom_write_word((uint16_t *) (BOOT_TRAILER_ADDR + BOOT_TRAILER_LENGTH), length);
+            trailer_invalidated = 0;
+            status = BOOT_STATUS_VERIFIED;
+        } else {
+            status = BOOT_STATUS_BAD_IMAGE;
+        }
+    } else if (firmware_valid()) {
+        start_firmware();
+    } else {
+        status = BOOT_STATUS_BAD_IMAGE;
+    }
+}
+
+// Checks a complete write and queues what it asks for.
+static void handle_frame(void) {
+    uint8_t len = frame_len;
+
+    if (len == 0) {
+        return;
+    }
+
+    switch (frame[0]) {
+        case BOOT_CMD_PAGE: {
+            uint16_t addr = read_le16(&frame[1]);
+            if (len == BOOT_PAGE_FRAME_SIZE && addr % BOOT_PAGE_SIZE == 0 && addr < BOOT_START) {
+                page_pending = 1;
+                status = BOOT_STATUS_READY;
+                return;
+            }
+            break;
+        }
+        case BOOT_CMD_COMMIT:
+            if (len == BOOT_COMMIT_FRAME_SIZE) {
+                command_pending = BOOT_CMD_COMMIT;
+                return;
+            }
+            break;
+        case BOOT_CMD_RUN:
+            if (len == 1) {
+                command_pending = BOOT_CMD_RUN;
+                return;
+            }
+            break;
+    }
+    status = BOOT_STATUS_BAD_COMMAND;
+}
+
+static uint8_t info_byte(uint8_t index) {
+    switch (index) {
+        case BOOT_INFO_ID:
+            return BOOT_ID;
+        case BOOT_INFO_STATUS:
+            return status;
+        case BOOT_INFO_PAGE_SIZE:
+            return BOOT_PAGE_SIZE;
+        case BOOT_INFO_PAGES:
+            return BOOT_START / BOOT_PAGE_SIZE;
+        default:
+            return 0xFF;
+    }
+}
+
+// Handles one TWI event, like TWI_vect does in the firmware.
+static void twi_poll(void) {
+    switch (TW_STATUS) {
+        case TW_SR_SLA_ACK:
+            if (page_pending || command_pending) {
+                // frame is still in use. Leave TWINT set, which holds SCL low until we get back here.
+                return;
+            }
+            frame_len = 0;
+            break;
+        case TW_SR_DATA_ACK: {
+            uint8_t len = frame_len;
+            if (len < sizeof(frame)) {
+                frame[len] = TWDR;
+            }
+            if (len < 0xFF) {
+                frame_len = len + 1;
+            }
+            break;
+        }
+        case TW_SR_STOP:
+            TWCR = TWCR_ACK;
+            handle_frame();
+            frame_len = 0;
+            return;
+        case TW_ST_SLA_ACK:
+            tx_index = 0;
+            // fallthrough
+        case TW_ST_DATA_ACK:
+            TWDR = info_byte(tx_index);
+            if (tx_index < 0xFF) {
+                tx_index++;
+            }
+            break;
+        case TW_ST_DATA_NACK:
+        case TW_ST_LAST_DATA:
+            break;
+        default:
+            TWCR = TWCR_RESET;
+            return;
+    }
+    TWCR = TWCR_ACK;
+}
+
+// Starts the firmware, unless it was the one that handed over or isn't intact, and otherwise sets the TWI up.
+void fan_control_boot_setup(void) {
+#ifdef FAN_CONTROL_HOST
+    // On the AVR, the startup code does this on every reset.
+    read_handoff();
+    frame_len = 0;
+    page_pending = 0;
+    command_pending = 0;
+    status = BOOT_STATUS_READY;
+    trailer_invalidated = 0;
+    flash_state = FLASH_IDLE;
+#endif
+
+    if (!handed_over && firmware_valid()) {
+        start_firmware();
+        return;
+    }
+
+    // TWAR still holds the address of the firmware after a handover. General calls are not for us.
+    if (handed_over) {
+        TWAR &= ~(1 << TWGCE);
+    } else {
+        TWAR = BOOT_DEFAULT_ADDRESS << 1;
+    }
+    TWCR = TWCR_ACK;
+}
+
+// One pass of the loop: the next flash step, a pending command once the flash is idle, and the next TWI event.
+void fan_control_boot_loop(void) {
+    wdt_reset();
+    flash_poll();
+    if (command_pending && !page_pending && flash_state == FLASH_IDLE) {
+        run_command();
+    }
+    if (TWCR & (1 << TWINT)) {
+        twi_poll();
+    }
+}
+
+#ifndef FAN_CONTROL_HOST
+int main(void) {
+    fan_control_boot_setup();
+    for (;;) {
+        fan_control_boot_loop();
+    }
+}
+#endif
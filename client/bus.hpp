@@ -0,0 +1,33 @@
+//
+// An I2C bus, as far as the client is concerned.
+//
+
+#ifndef FAN_CONTROL_CLIENT_BUS_HPP
+#define FAN_CONTROL_CLIENT_BUS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace fan_control {
+
+// One segment of a combined transaction, like struct i2c_msg.
+struct Message {
+    uint8_t address;
+    bool read;
+    uint8_t *data;
+    size_t len;
+};
+
+class Bus {
+public:
+    virtual ~Bus() = default;
+
+    // Executes all messages as one combined transaction: START, the messages separated by repeated STARTs, STOP.
+    // No other master can get in between, and the slave sees the repeated STARTs, not STOPs.
+    // Throws std::system_error if the transfer fails, with ENXIO if a slave didn't acknowledge its address.
+    virtual void transfer(Message *messages, size_t count) = 0;
+};
+
+} // namespace fan_control
+
+#endif //FAN_CONTROL_CLIENT_BUS_HPP
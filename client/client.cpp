@@ -0,0 +1,405 @@
+#include "client.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace fan_control {
+
+Client::Client(Bus &bus, uint8_t address) : bus_(bus), address_(address) {}
+
+Client::~Client() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        stopping_ = true;
+    }
+    queue_cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+void Client::read_registers(uint8_t reg, uint8_t *data, size_t len) {
+    Message msgs[] = {
+            {address_, false, &reg, 1},
+            {address_, true, data, len},
+    };
+    bus_.transfer(msgs, 2);
+}
+
+// Decodes status, air in, air out and change sequence, as read from register 0.
+State Client::decode_state(const uint8_t *data) {
+    State state;
+    state.status.raw = data[REG_STATUS];
+    state.air_in = data[REG_AIR_IN];
+    state.air_out = data[REG_AIR_OUT];
+    state.change_seq = data[REG_CHANGE_SEQ];
+    cached_ = state;
+    return state;
+}
+
+State Client::read_state() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    uint8_t data[4];
+    read_registers(REG_STATUS, data, sizeof(data));
+    return decode_state(data);
+}
+
+State Client::set_modes(uint8_t air_in, uint8_t air_out) {
+    if (air_in >= NUM_AIR_IN_MODES || air_out >= NUM_AIR_OUT_MODES) {
+        throw std::invalid_argument("mode out of range");
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // The write is applied on the repeated START, and the read after it starts at the status register again.
+    uint8_t out[] = {REG_AIR_IN, air_in, air_out};
+    uint8_t in[4];
+    Message msgs[] = {
+            {address_, false, out, sizeof(out)},
+            {address_, true, in, sizeof(in)},
+    };
+    bus_.transfer(msgs, 2);
+    return decode_state(in);
+}
+
+std::optional<State> Client::poll() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    uint8_t seq;
+    read_registers(REG_CHANGE_SEQ, &seq, 1);
+    if (cached_ && cached_->change_seq == seq) {
+        return std::nullopt;
+    }
+
+    uint8_t data[4];
+    read_registers(REG_STATUS, data, sizeof(data));
+    return decode_state(data);
+}
+
+void Client::acknowledge_watchdog_reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    uint8_t out[] = {REG_STATUS, BIT_WDT_RESET};
+    Message msg{address_, false, out, sizeof(out)};
+    bus_.transfer(&msg, 1);
+    if (cached_) {
+        cached_->status.raw |= BIT_WDT_RESET;
+    }
+}
+
+Telemetry Client::read_telemetry() {
+    uint8_t data[TELEMETRY_SIZE];
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        read_registers(REG_TELEMETRY, data, sizeof(data));
+    }
+
+    auto u16 = [&data](uint8_t offset) { return static_cast<uint16_t>(data[offset] | data[offset + 1] << 8); };
+    return Telemetry{
+            u16(TELEMETRY_LOOPS_PER_SECOND),
+            u16(TELEMETRY_LOOP_TIME_MAX),
+            u16(TELEMETRY_LOOP_TIME_AVG),
+            u16(TELEMETRY_TWI_ISR_COUNT),
+            u16(TELEMETRY_TIMER_ISR_COUNT),
+            u16(TELEMETRY_TWI_ISR_TIME_MAX),
+            u16(TELEMETRY_TIMER_ISR_TIME_MAX),
+            u16(TELEMETRY_TWI_NACK_COUNT),
+            u16(TELEMETRY_RELAY_CHANGE_COUNT),
+            u16(TELEMETRY_PEC_ERROR_COUNT),
+    };
+}
+
+std::array<uint16_t, NUM_RELAYS> Client::read_relay_actuations() {
+    uint8_t data[NUM_RELAYS * 2];
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        read_registers(REG_RELAY_ACTUATIONS, data, sizeof(data));
+    }
+
+    std::array<uint16_t, NUM_RELAYS> counts{};
+    for (size_t i = 0; i < NUM_RELAYS; i++) {
+        counts[i] = static_cast<uint16_t>(data[2 * i] | data[2 * i + 1] << 8);
+    }
+    return counts;
+}
+
+void Client::set_address(uint8_t address) {
+    if (address < ADDRESS_MIN || address > ADDRESS_MAX) {
+        throw std::invalid_argument("address out of range");
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint8_t out[] = {REG_ADDRESS, address};
+    Message msg{address_, false, out, sizeof(out)};
+    bus_.transfer(&msg, 1);
+}
+
+void Client::set_groups(uint8_t groups) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint8_t out[] = {REG_GROUPS, groups};
+    Message msg{address_, false, out, sizeof(out)};
+    bus_.transfer(&msg, 1);
+}
+
+uint8_t Client::read_groups() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint8_t groups;
+    read_registers(REG_GROUPS, &groups, 1);
+    return groups;
+}
+
+void Client::write_schedule(const std::vector<ScheduleEntry> &entries) {
+    if (entries.size() > SCHEDULE_MAX_ENTRIES) {
+        throw std::invalid_argument("too many schedule entries");
+    }
+    std::vector<uint8_t> table;
+    for (const ScheduleEntry &entry : entries) {
+        if (entry.minutes == 0 || entry.air_in >= NUM_AIR_IN_MODES || entry.air_out >= NUM_AIR_OUT_MODES) {
+            throw std::invalid_argument("invalid schedule entry");
+        }
+        table.push_back(entry.minutes);
+        table.push_back(static_cast<uint8_t>(entry.air_in | entry.air_out << 4));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // The device takes at most RX_SIZE data bytes per write, so stage the table in chunks.
+    for (size_t offset = 0; offset < table.size(); offset += RX_SIZE) {
+        size_t len = std::min(RX_SIZE, table.size() - offset);
+        uint8_t out[1 + RX_SIZE];
+        out[0] = static_cast<uint8_t>(REG_SCHEDULE + offset);
+        std::copy(table.begin() + offset, table.begin() + offset + len, out + 1);
+        Message msg{address_, false, out, 1 + len};
+        bus_.transfer(&msg, 1);
+    }
+
+    // Commit, and read back whether it was accepted.
+    uint8_t out[] = {REG_SCHEDULE_LENGTH, static_cast<uint8_t>(entries.size())};
+    uint8_t reg = REG_SCHEDULE_LENGTH;
+    uint8_t length;
+    Message msgs[] = {
+            {address_, false, out, sizeof(out)},
+            {address_, false, &reg, 1},
+            {address_, true, &length, 1},
+    };
+    bus_.transfer(msgs, 3);
+    if (length != entries.size()) {
+        throw std::runtime_error("schedule rejected by device");
+    }
+}
+
+void Client::set_schedule_enabled(bool enabled) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint8_t out[] = {REG_SCHEDULE_CONTROL, uint8_t(enabled ? SCHEDULE_CONTROL_ENABLED : 0)};
+    Message msg{address_, false, out, sizeof(out)};
+    bus_.transfer(&msg, 1);
+}
+
+void Client::align_schedule(uint8_t entry, uint8_t remaining_minutes) {
+    if (remaining_minutes == 0) {
+        throw std::invalid_argument("remaining minutes must be at least 1");
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint8_t out[] = {REG_SCHEDULE_ENTRY, entry, remaining_minutes};
+    Message msg{address_, false, out, sizeof(out)};
+    bus_.transfer(&msg, 1);
+}
+
+ScheduleState Client::read_schedule() {
+    uint8_t control[4];
+    uint8_t table[SCHEDULE_MAX_ENTRIES * SCHEDULE_ENTRY_SIZE];
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        read_registers(REG_SCHEDULE_CONTROL, control, sizeof(control));
+        read_registers(REG_SCHEDULE, table, sizeof(table));
+    }
+
+    ScheduleState state;
+    state.enabled = control[0] & SCHEDULE_CONTROL_ENABLED;
+    state.running = control[0] & SCHEDULE_CONTROL_RUNNING;
+    state.entry = control[REG_SCHEDULE_ENTRY - REG_SCHEDULE_CONTROL];
+    state.remaining_minutes = control[REG_SCHEDULE_REMAINING - REG_SCHEDULE_CONTROL];
+    uint8_t length = control[REG_SCHEDULE_LENGTH - REG_SCHEDULE_CONTROL];
+    for (uint8_t i = 0; i < length && i < SCHEDULE_MAX_ENTRIES; i++) {
+        uint8_t modes = table[i * SCHEDULE_ENTRY_SIZE + 1];
+        state.entries.push_back(ScheduleEntry{table[i * SCHEDULE_ENTRY_SIZE], static_cast<uint8_t>(modes & 0x0F),
+                                              static_cast<uint8_t>(modes >> 4)});
+    }
+    return state;
+}
+
+void Client::set_button_thresholds(uint8_t debounce, uint8_t long_press, uint8_t repeat) {
+    if (debounce == 0 || long_press == 0) {
+        throw std::invalid_argument("button thresholds must be at least 1");
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint8_t out[] = {REG_BUTTON_DEBOUNCE, debounce, long_press, repeat};
+    Message msg{address_, false, out, sizeof(out)};
+    bus_.transfer(&msg, 1);
+}
+
+ButtonLog Client::read_button_log() {
+    uint8_t data[BUTTON_LOG_SIZE];
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        read_registers(REG_BUTTON_LOG, data, sizeof(data));
+    }
+
+    ButtonLog log{data[0], {}};
+    for (size_t i = 0; i < BUTTON_LOG_EVENTS; i++) {
+        const uint8_t *entry = &data[1 + i * BUTTON_LOG_EVENT_SIZE];
+        if (entry[0] < ButtonEvent::SHORT || entry[0] > ButtonEvent::REPEAT) {
+            break;
+        }
+        log.events.push_back(ButtonEvent{static_cast<ButtonEvent::Type>(entry[0]),
+                                         static_cast<uint16_t>(entry[1] | entry[2] << 8)});
+    }
+    return log;
+}
+
+void Client::set_brightness(uint8_t left, uint8_t right) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint8_t out[] = {REG_BRIGHTNESS, left, right};
+    Message msg{address_, false, out, sizeof(out)};
+    bus_.transfer(&msg, 1);
+}
+
+Diagnostics Client::read_diagnostics() {
+    uint8_t data[DIAGNOSTICS_SIZE];
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        read_registers(REG_DIAGNOSTICS, data, sizeof(data));
+    }
+
+    return Diagnostics{data[0], data[1], data[2],
+                       static_cast<uint16_t>(data[3] | data[4] << 8)};
+}
+
+MemoryUsage Client::read_memory_usage() {
+    uint8_t data[STACK_MONITOR_SIZE];
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        read_registers(REG_STACK_MONITOR, data, sizeof(data));
+    }
+
+    return MemoryUsage{static_cast<uint16_t>(data[0] | data[1] << 8), static_cast<uint16_t>(data[2] | data[3] << 8),
+                       static_cast<uint16_t>(data[4] | data[5] << 8), static_cast<uint16_t>(data[6] | data[7] << 8)};
+}
+
+void Client::set_trace_enabled(bool enabled) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint8_t config;
+    read_registers(REG_CONFIG, &config, 1);
+    config = enabled ? config | CONFIG_TRACE : config & ~CONFIG_TRACE;
+    uint8_t out[] = {REG_CONFIG, config};
+    Message msg{address_, false, out, sizeof(out)};
+    bus_.transfer(&msg, 1);
+}
+
+Trace Client::read_trace() {
+    uint8_t data[TRACE_SIZE];
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        read_registers(REG_TRACE, data, sizeof(data));
+    }
+
+    Trace trace{data[0], {}};
+    for (size_t i = 0; i < TRACE_ENTRIES; i++) {
+        const uint8_t *entry = &data[1 + ((data[0] - 1 - i) % TRACE_ENTRIES) * TRACE_ENTRY_SIZE];
+        if (entry[0] == TRACE_UNUSED) {
+            break;
+        }
+        trace.events.push_back(TraceEvent{entry[0], entry[1], static_cast<uint16_t>(entry[2] | entry[3] << 8)});
+    }
+    return trace;
+}
+
+uint16_t Client::read_twi_recoveries() {
+    uint8_t data[TWI_RECOVERIES_SIZE];
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        read_registers(REG_TWI_RECOVERIES, data, sizeof(data));
+    }
+
+    return static_cast<uint16_t>(data[0] | data[1] << 8);
+}
+
+std::optional<State> Client::cached_state() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cached_;
+}
+
+Status Client::status() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cached_) {
+            return cached_->status;
+        }
+    }
+    return read_state().status;
+}
+
+std::future<State> Client::read_state_async() {
+    return enqueue<State>([this] { return read_state(); });
+}
+
+std::future<State> Client::set_modes_async(uint8_t air_in, uint8_t air_out) {
+    return enqueue<State>([this, air_in, air_out] { return set_modes(air_in, air_out); });
+}
+
+std::future<std::optional<State>> Client::poll_async() {
+    return enqueue<std::optional<State>>([this] { return poll(); });
+}
+
+template<typename T>
+std::future<T> Client::enqueue(std::function<T()> op) {
+    auto task = std::make_shared<std::packaged_task<T()>>(std::move(op));
+    std::future<T> result = task->get_future();
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        queue_.emplace_back([task] { (*task)(); });
+        // Start the worker on first use, so purely synchronous clients don't pay for a thread.
+        if (!worker_.joinable()) {
+            worker_ = std::thread(&Client::run_worker, this);
+        }
+    }
+    queue_cv_.notify_one();
+    return result;
+}
+
+void Client::run_worker() {
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    while (true) {
+        queue_cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            // Stopping, and everything queued has been done.
+            return;
+        }
+        auto op = std::move(queue_.front());
+        queue_.pop_front();
+
+        lock.unlock();
+        op();
+        lock.lock();
+    }
+}
+
+void group_set_modes(Bus &bus, uint8_t groups, uint8_t air_in, uint8_t air_out, uint8_t master_address) {
+    if (air_in >= NUM_AIR_IN_MODES || air_out >= NUM_AIR_OUT_MODES) {
+        throw std::invalid_argument("mode out of range");
+    }
+
+    // A "hardware general call": The first byte is our own address, with bit 0 set.
+    uint8_t frame[GCALL_FRAME_SIZE];
+    frame[GCALL_FRAME_MASTER] = static_cast<uint8_t>(master_address << 1 | 1);
+    frame[GCALL_FRAME_GROUPS] = groups;
+    frame[GCALL_FRAME_AIR_IN] = air_in;
+    frame[GCALL_FRAME_AIR_OUT] = air_out;
+    Message msg{GENERAL_CALL_ADDRESS, false, frame, sizeof(frame)};
+    bus.transfer(&msg, 1);
+}
+
+} // namespace fan_control
@@ -0,0 +1,236 @@
+//
+// Host-side client for the fan controller.
+//
+// Every operation is a single combined transaction (see Bus::transfer), so e.g. setting the modes and reading back
+// what the device actually does costs one START/STOP pair and one system call, and no other master can interleave.
+// The last status byte seen is cached, and poll() only reads the change sequence register, so a master watching many
+// devices moves one data byte per device and poll until something actually changes.
+//
+// All methods are thread-safe. The *_async variants queue the operation on a worker thread owned by the client, which
+// also keeps asynchronous operations on one device in order.
+//
+
+#ifndef FAN_CONTROL_CLIENT_CLIENT_HPP
+#define FAN_CONTROL_CLIENT_CLIENT_HPP
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "bus.hpp"
+#include "registers.hpp"
+
+namespace fan_control {
+
+// The status register, decoded.
+struct Status {
+    uint8_t raw = BIT_WDT_RESET;
+
+    // The button override is active, writes to the modes are ignored.
+    bool i2c_disabled() const { return raw & BIT_I2C_DISABLED; }
+    // The device was reset by its watchdog, and nobody acknowledged that yet.
+    bool watchdog_reset() const { return !(raw & BIT_WDT_RESET); }
+};
+
+struct State {
+    Status status;
+    uint8_t air_in = 0;
+    uint8_t air_out = 0;
+    uint8_t change_seq = 0;
+};
+
+// The telemetry block, see src/telemetry.h. Times are in microseconds.
+struct Telemetry {
+    uint16_t loops_per_second;
+    uint16_t loop_time_max;
+    uint16_t loop_time_avg;
+    uint16_t twi_isr_count;
+    uint16_t timer_isr_count;
+    uint16_t twi_isr_time_max;
+    uint16_t timer_isr_time_max;
+    uint16_t twi_nack_count;
+    uint16_t relay_change_count;
+    uint16_t pec_error_count;
+};
+
+// One entry of the on-device schedule, see src/schedule.h.
+struct ScheduleEntry {
+    // 1 to 255 minutes.
+    uint8_t minutes;
+    uint8_t air_in;
+    uint8_t air_out;
+};
+
+struct ScheduleState {
+    bool enabled;
+    // Enabled, not empty, and not overridden by the button.
+    bool running;
+    uint8_t entry;
+    uint8_t remaining_minutes;
+    std::vector<ScheduleEntry> entries;
+};
+
+// A button event from the log, see src/button.h.
+struct ButtonEvent {
+    enum Type : uint8_t {
+        SHORT = 1,
+        LONG = 2,
+        REPEAT = 3,
+    };
+
+    Type type;
+    // In ticks of 10 ms since the device started, wrapping around.
+    uint16_t time;
+};
+
+struct ButtonLog {
+    // Number of events since the device started, wrapping around.
+    uint8_t count;
+    // Newest first.
+    std::vector<ButtonEvent> events;
+};
+
+// Why the device was last reset, and what it was doing at the time. See src/diagnostics.h.
+struct Diagnostics {
+    // RESET_* flags.
+    uint8_t reset_cause;
+    // CHECKPOINT_*, where the main loop was when the device was reset. CHECKPOINT_NONE after a power-on reset.
+    uint8_t checkpoint;
+    // The last TWI status code the device handled before the reset, 0 if none.
+    uint8_t twi_status;
+    // Resets since power-on.
+    uint16_t reboots;
+};
+
+// RAM usage of the device in bytes, see src/stack_monitor.h.
+struct MemoryUsage {
+    uint16_t data;
+    // Including .noinit.
+    uint16_t bss;
+    // The stack high-water mark since the last reset, updated once per second.
+    uint16_t stack_used;
+    // What's left between the high-water mark and the static data.
+    uint16_t stack_free;
+};
+
+// An event from the TWI trace, see src/twi_trace.h.
+struct TraceEvent {
+    // The TWSR status code.
+    uint8_t status;
+    // The register address selected at the time, or of the byte sent. 0xFF if none.
+    uint8_t reg;
+    // TCNT1 when the device handled the event, in microseconds at 8 MHz. This wraps around every 10 ms.
+    uint16_t time;
+};
+
+struct Trace {
+    // Number of events recorded since the device started, wrapping around.
+    uint8_t count;
+    // Newest first.
+    std::vector<TraceEvent> events;
+};
+
+class Client {
+public:
+    explicit Client(Bus &bus, uint8_t address = DEFAULT_ADDRESS);
+    ~Client();
+
+    Client(const Client &) = delete;
+    Client &operator=(const Client &) = delete;
+
+    uint8_t address() const { return address_; }
+
+    // Reads status, modes and the change sequence.
+    State read_state();
+    // Sets both modes and reads back status and modes in the same transaction.
+    // If the button override is active, the write is ignored by the device. The returned state then shows the modes
+    // selected by button and has status.i2c_disabled() set. Throws std::invalid_argument for out of range modes, which
+    // the device would silently ignore.
+    State set_modes(uint8_t air_in, uint8_t air_out);
+    // Reads the change sequence register. If it changed since the last state we saw, reads the state and returns it.
+    // Otherwise, returns nothing.
+    std::optional<State> poll();
+    // Sets the WDT bit in the status register again, so the next watchdog reset can be noticed.
+    void acknowledge_watchdog_reset();
+    Telemetry read_telemetry();
+    // How often each relay switched since the device was last reset, relay 1 first. These wrap around at 65536.
+    std::array<uint16_t, NUM_RELAYS> read_relay_actuations();
+
+    // Changes the address of the device, which takes effect after its next reset. Until then, keep using this client.
+    void set_address(uint8_t address);
+    // Sets the groups the device is a member of, bit n for group n.
+    void set_groups(uint8_t groups);
+    uint8_t read_groups();
+
+    // Uploads and commits a new schedule, which starts with its first entry. Throws std::invalid_argument for invalid
+    // entries, and std::runtime_error if the device rejected the table anyway.
+    void write_schedule(const std::vector<ScheduleEntry> &entries);
+    void set_schedule_enabled(bool enabled);
+    // Starts the given entry with the given number of minutes left, to align the schedule with the time of day.
+    void align_schedule(uint8_t entry, uint8_t remaining_minutes);
+    ScheduleState read_schedule();
+
+    // Sets the button thresholds, in ticks of 10 ms. Repeat 0 disables repeat events. They return to the defaults when
+    // the device is reset. Throws std::invalid_argument for zero debounce or long press thresholds.
+    void set_button_thresholds(uint8_t debounce, uint8_t long_press, uint8_t repeat);
+    ButtonLog read_button_log();
+
+    // Dims the display, 0 (off) to 255 (full, the default). This returns to full brightness when the device is reset.
+    void set_brightness(uint8_t left, uint8_t right);
+
+    Diagnostics read_diagnostics();
+    MemoryUsage read_memory_usage();
+
+    // Starts or stops recording the TWI trace. This is not saved, the device starts with tracing disabled.
+    void set_trace_enabled(bool enabled);
+    // Reads the trace. It includes the start of the read itself, i.e. its SLA+W and register address.
+    Trace read_trace();
+    // How often the device reset its TWI because the bus hung since it was last reset. See src/twislave.c.
+    uint16_t read_twi_recoveries();
+
+    // The state from the last successful operation, without touching the bus.
+    std::optional<State> cached_state() const;
+    // The cached status byte, or the status read from the device if there is nothing cached yet.
+    Status status();
+
+    std::future<State> read_state_async();
+    std::future<State> set_modes_async(uint8_t air_in, uint8_t air_out);
+    std::future<std::optional<State>> poll_async();
+
+private:
+    // Writes the register address, then reads len bytes from there, as one combined transaction.
+    void read_registers(uint8_t reg, uint8_t *data, size_t len);
+    State decode_state(const uint8_t *data);
+
+    template<typename T>
+    std::future<T> enqueue(std::function<T()> op);
+    void run_worker();
+
+    Bus &bus_;
+    const uint8_t address_;
+
+    mutable std::mutex mutex_;
+    std::optional<State> cached_;
+
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+    std::deque<std::function<void()>> queue_;
+    bool stopping_ = false;
+    std::thread worker_;
+};
+
+// Sets the modes of all devices on the bus that are a member of at least one of the given groups, in one general call.
+// They all switch at the same time. Devices with the button override active keep their modes.
+// master_address is only informational, it identifies the sender to the devices.
+void group_set_modes(Bus &bus, uint8_t groups, uint8_t air_in, uint8_t air_out, uint8_t master_address = 0x01);
+
+} // namespace fan_control
+
+#endif //FAN_CONTROL_CLIENT_CLIENT_HPP
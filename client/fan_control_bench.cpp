@@ -0,0 +1,205 @@
+//
+// Benchmark for the client library, running against MockBus.
+//
+// Compares setting the modes and reading them back in one combined transaction against doing it in two, and polling
+// the change sequence against reading the full state, in transactions and modelled wire time at 100 kHz and 400 kHz.
+// Also compares a group commit via general call against setting every device on its own, and measures how many
+// operations per second the client itself manages, synchronously and asynchronously.
+// Finally, flashes a firmware image through the bootloader, and compares sending the pages back to back against waiting
+// for each one to be programmed.
+//
+// Exits non-zero if a benchmark did not get the result it should have. What the client and the mock do is checked by
+// test/test_client.cpp.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <random>
+#include <vector>
+
+#include "client.hpp"
+#include "flasher.hpp"
+#include "mock_bus.hpp"
+
+using namespace fan_control;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        std::exit(1); \
+    } \
+} while (0)
+
+static constexpr int ITERATIONS = 10000;
+static constexpr int FLEET_SIZE = 100;
+// Erasing and writing a page, per the ATmega8 datasheet.
+static constexpr double PAGE_PROGRAM_US = 9000;
+
+static void report(const char *name, const MockBus &bus100, const MockBus &bus400, int ops) {
+    MockBus::Stats stats = bus100.stats();
+    std::printf("  %-28s %5.2f transfers/op %6.1f bytes/op %8.1f us/op @100k %7.1f us/op @400k\n", name,
+                static_cast<double>(stats.transfers) / ops, static_cast<double>(stats.bytes) / ops,
+                bus100.wire_time_us() / ops, bus400.wire_time_us() / ops);
+}
+
+// Sets the modes and reads them back, either combined or as two separate transactions.
+static void bench_set_modes() {
+    std::printf("set modes and read back:\n");
+
+    for (int combined = 1; combined >= 0; combined--) {
+        MockBus bus100(100000), bus400(400000);
+        bus100.add_slave();
+        bus400.add_slave();
+
+        for (MockBus *bus : {&bus100, &bus400}) {
+            Client client(*bus);
+            for (int i = 0; i < ITERATIONS; i++) {
+                uint8_t in = i % NUM_AIR_IN_MODES;
+                uint8_t out = i % NUM_AIR_OUT_MODES;
+                if (combined) {
+                    State state = client.set_modes(in, out);
+                    CHECK(state.air_in == in);
+                } else {
+                    uint8_t data[] = {REG_AIR_IN, in, out};
+                    Message msg{DEFAULT_ADDRESS, false, data, sizeof(data)};
+                    bus->transfer(&msg, 1);
+                    CHECK(client.read_state().air_in == in);
+                }
+            }
+        }
+        report(combined ? "combined transaction" : "write, then read", bus100, bus400, ITERATIONS);
+    }
+}
+
+// Watches a fleet of devices where nothing changes, by polling the change sequence or reading the full state.
+static void bench_poll() {
+    std::printf("poll %d devices, nothing changed:\n", FLEET_SIZE);
+
+    for (int by_seq = 1; by_seq >= 0; by_seq--) {
+        MockBus bus100(100000), bus400(400000);
+        std::vector<std::unique_ptr<Client>> clients;
+        for (MockBus *bus : {&bus100, &bus400}) {
+            for (int i = 0; i < FLEET_SIZE; i++) {
+                bus->add_slave(static_cast<uint8_t>(0x08 + i));
+                clients.push_back(std::make_unique<Client>(*bus, static_cast<uint8_t>(0x08 + i)));
+                clients.back()->read_state();
+            }
+            bus->reset_stats();
+        }
+
+        int rounds = ITERATIONS / FLEET_SIZE;
+        for (int round = 0; round < rounds; round++) {
+            for (auto &client : clients) {
+                if (by_seq) {
+                    CHECK(!client->poll());
+                } else {
+                    client->read_state();
+                }
+            }
+        }
+        report(by_seq ? "change sequence" : "full state", bus100, bus400, rounds * FLEET_SIZE);
+    }
+}
+
+// Switches a fleet of devices on one bus to new modes, one by one or with one group commit.
+static void bench_group() {
+    std::printf("switch %d devices:\n", FLEET_SIZE);
+
+    for (int group = 1; group >= 0; group--) {
+        MockBus bus100(100000), bus400(400000);
+        for (MockBus *bus : {&bus100, &bus400}) {
+            for (int i = 0; i < FLEET_SIZE; i++) {
+                bus->add_slave(static_cast<uint8_t>(0x08 + i));
+            }
+
+            if (group) {
+                group_set_modes(*bus, 0x01, 2, 2);
+            } else {
+                for (int i = 0; i < FLEET_SIZE; i++) {
+                    Client(*bus, static_cast<uint8_t>(0x08 + i)).set_modes(2, 2);
+                }
+            }
+            for (int i = 0; i < FLEET_SIZE; i++) {
+                CHECK(bus->slave(static_cast<uint8_t>(0x08 + i))->air_in() == 2);
+            }
+        }
+        report(group ? "group commit" : "one by one, with read-back", bus100, bus400, 1);
+    }
+}
+
+// Raw client throughput against the mock, without simulated bus time.
+static void bench_throughput() {
+    std::printf("client throughput, no bus time:\n");
+
+    MockBus bus;
+    bus.add_slave();
+    Client client(bus);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        client.set_modes(i % NUM_AIR_IN_MODES, i % NUM_AIR_OUT_MODES);
+    }
+    std::chrono::duration<double> sync = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    std::vector<std::future<State>> results;
+    results.reserve(ITERATIONS);
+    for (int i = 0; i < ITERATIONS; i++) {
+        results.push_back(client.set_modes_async(i % NUM_AIR_IN_MODES, i % NUM_AIR_OUT_MODES));
+    }
+    for (auto &result : results) {
+        result.get();
+    }
+    std::chrono::duration<double> async = std::chrono::steady_clock::now() - start;
+
+    std::printf("  sync  %10.0f ops/s\n", ITERATIONS / sync.count());
+    std::printf("  async %10.0f ops/s\n", ITERATIONS / async.count());
+}
+
+// Flashes an image of almost the whole application section.
+static void bench_flash() {
+    std::printf("flash a %zu byte image:\n", MOCK_BOOT_START - 100);
+
+    std::vector<uint8_t> image(MOCK_BOOT_START - 100);
+    std::mt19937 random(1);
+    for (auto &byte : image) {
+        byte = static_cast<uint8_t>(random());
+    }
+    size_t pages = (image.size() + MOCK_BOOT_PAGE_SIZE - 1) / MOCK_BOOT_PAGE_SIZE;
+
+    MockBus bus100(100000), bus400(400000);
+    for (MockBus *bus : {&bus100, &bus400}) {
+        MockSlave &slave = bus->add_slave();
+        Client(*bus).set_modes(2, 1);
+        uint16_t relay_changes = slave.relay_changes();
+
+        Flasher flasher(*bus);
+        bus->reset_stats();
+        Flasher::Result result = flasher.flash(image);
+        CHECK(result.pages == pages);
+        CHECK(!slave.in_bootloader() && slave.relay_changes() == relay_changes);
+    }
+
+    MockBus::Stats stats = bus100.stats();
+    std::printf("  %-28s %5zu transfers %8zu bytes %8.1f ms @100k %7.1f ms @400k\n", "whole update",
+                static_cast<size_t>(stats.transfers), static_cast<size_t>(stats.bytes), bus100.wire_time_us() / 1000,
+                bus400.wire_time_us() / 1000);
+
+    // Pipelined, a page goes out while the one before is programmed, so only the first transfer adds to the time.
+    // Otherwise, every page is sent, programmed, and polled for once.
+    double page_us = (2 + 9 * (1 + BOOT_PAGE_HEADER_SIZE + MOCK_BOOT_PAGE_SIZE)) * 1e6 / 400000;
+    double poll_us = (2 + 9 * (1 + BOOT_INFO_SIZE)) * 1e6 / 400000;
+    std::printf("  %-28s %7.1f ms @400k\n", "pages back to back", (page_us + pages * PAGE_PROGRAM_US) / 1000);
+    std::printf("  %-28s %7.1f ms @400k\n", "wait for every page", pages * (page_us + PAGE_PROGRAM_US + poll_us) / 1000);
+}
+
+int main() {
+    bench_set_modes();
+    bench_poll();
+    bench_group();
+    bench_throughput();
+    bench_flash();
+    return 0;
+}
@@ -0,0 +1,193 @@
+//
+// Command line tool to talk to a fan controller on a Linux I2C bus.
+//
+// Usage:
+//   fan_control_ctl <device> [-a address] status
+//   fan_control_ctl <device> [-a address] set <air in> <air out>
+//   fan_control_ctl <device> [-a address] telemetry
+//   fan_control_ctl <device> [-a address] ack-wdt
+//   fan_control_ctl <device> [-a address] schedule [<minutes>:<air in>:<air out> ...]
+//   fan_control_ctl <device> [-a address] schedule-enable|schedule-disable
+//   fan_control_ctl <device> [-a address] schedule-align <entry> <minutes left>
+//   fan_control_ctl <device> [-a address] buttons
+//   fan_control_ctl <device> [-a address] button-thresholds <debounce> <long press> <repeat>
+//   fan_control_ctl <device> [-a address] brightness <left> <right>
+//   fan_control_ctl <device> [-a address] diagnostics
+//   fan_control_ctl <device> [-a address] memory
+//   fan_control_ctl <device> [-a address] trace [on|off]
+//   fan_control_ctl <device> [-a address] recoveries
+//   fan_control_ctl <device> [-a address] flash <image.bin>
+//
+// flash takes the raw image built along with the firmware (fan_control.bin), see src/bootloader.h.
+//
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "client.hpp"
+#include "flasher.hpp"
+#include "linux_i2c_bus.hpp"
+
+using namespace fan_control;
+
+static int usage() {
+    std::fprintf(stderr, "usage: fan_control_ctl <device> [-a address] status|set <in> <out>|telemetry|ack-wdt|\n"
+                         "       schedule [<minutes>:<in>:<out> ...]|schedule-enable|schedule-disable|\n"
+                         "       schedule-align <entry> <minutes left>|buttons|\n"
+                         "       button-thresholds <debounce> <long press> <repeat>|brightness <left> <right>|\n"
+                         "       diagnostics|memory|trace [on|off]|recoveries|\n"
+                         "       flash <image.bin>\n");
+    return 2;
+}
+
+static void print_state(const State &state) {
+    std::printf("air in %u, air out %u, change %u%s%s\n", state.air_in, state.air_out, state.change_seq,
+                state.status.i2c_disabled() ? ", button override active" : "",
+                state.status.watchdog_reset() ? ", watchdog reset" : "");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        return usage();
+    }
+
+    int arg = 2;
+    uint8_t address = DEFAULT_ADDRESS;
+    if (std::strcmp(argv[arg], "-a") == 0) {
+        if (argc < 5) {
+            return usage();
+        }
+        address = static_cast<uint8_t>(std::strtoul(argv[arg + 1], nullptr, 0));
+        arg += 2;
+    }
+    const char *command = argv[arg++];
+
+    try {
+        LinuxI2cBus bus(argv[1]);
+        Client client(bus, address);
+
+        if (std::strcmp(command, "status") == 0) {
+            print_state(client.read_state());
+        } else if (std::strcmp(command, "set") == 0 && argc - arg == 2) {
+            State state = client.set_modes(static_cast<uint8_t>(std::atoi(argv[arg])),
+                                           static_cast<uint8_t>(std::atoi(argv[arg + 1])));
+            print_state(state);
+            if (state.status.i2c_disabled()) {
+                std::fprintf(stderr, "button override active, modes not changed\n");
+                return 1;
+            }
+        } else if (std::strcmp(command, "telemetry") == 0) {
+            Telemetry t = client.read_telemetry();
+            std::printf("loops/s %u, loop time max %u us avg %u us\n", t.loops_per_second, t.loop_time_max,
+                        t.loop_time_avg);
+            std::printf("TWI ISRs %u (max %u us), timer ISRs %u (max %u us)\n", t.twi_isr_count,
+                        t.twi_isr_time_max, t.timer_isr_count, t.timer_isr_time_max);
+            std::printf("NACKs %u, PEC errors %u, relay changes %u\n", t.twi_nack_count, t.pec_error_count,
+                        t.relay_change_count);
+            std::array<uint16_t, NUM_RELAYS> actuations = client.read_relay_actuations();
+            std::printf("relay actuations");
+            for (size_t i = 0; i < NUM_RELAYS; i++) {
+                std::printf(" %u:%u", static_cast<unsigned>(i + 1), actuations[i]);
+            }
+            std::printf("\n");
+        } else if (std::strcmp(command, "ack-wdt") == 0) {
+            client.acknowledge_watchdog_reset();
+        } else if (std::strcmp(command, "schedule") == 0) {
+            if (arg < argc) {
+                std::vector<ScheduleEntry> entries;
+                for (; arg < argc; arg++) {
+                    unsigned minutes, in, out;
+                    if (std::sscanf(argv[arg], "%u:%u:%u", &minutes, &in, &out) != 3 || minutes > 255) {
+                        return usage();
+                    }
+                    entries.push_back(ScheduleEntry{static_cast<uint8_t>(minutes), static_cast<uint8_t>(in),
+                                                    static_cast<uint8_t>(out)});
+                }
+                client.write_schedule(entries);
+            }
+            ScheduleState schedule = client.read_schedule();
+            std::printf("%s%s, entry %u, %u min left\n", schedule.enabled ? "enabled" : "disabled",
+                        schedule.running ? ", running" : "", schedule.entry, schedule.remaining_minutes);
+            for (const ScheduleEntry &entry : schedule.entries) {
+                std::printf("  %3u min: air in %u, air out %u\n", entry.minutes, entry.air_in, entry.air_out);
+            }
+        } else if (std::strcmp(command, "schedule-enable") == 0 || std::strcmp(command, "schedule-disable") == 0) {
+            client.set_schedule_enabled(std::strcmp(command, "schedule-enable") == 0);
+        } else if (std::strcmp(command, "schedule-align") == 0 && argc - arg == 2) {
+            client.align_schedule(static_cast<uint8_t>(std::atoi(argv[arg])),
+                                  static_cast<uint8_t>(std::atoi(argv[arg + 1])));
+        } else if (std::strcmp(command, "buttons") == 0) {
+            static const char *const names[] = {"", "short", "long", "repeat"};
+            ButtonLog log = client.read_button_log();
+            std::printf("%u events\n", log.count);
+            for (const ButtonEvent &event : log.events) {
+                std::printf("  %-6s at tick %u\n", names[event.type], event.time);
+            }
+        } else if (std::strcmp(command, "button-thresholds") == 0 && argc - arg == 3) {
+            client.set_button_thresholds(static_cast<uint8_t>(std::atoi(argv[arg])),
+                                         static_cast<uint8_t>(std::atoi(argv[arg + 1])),
+                                         static_cast<uint8_t>(std::atoi(argv[arg + 2])));
+        } else if (std::strcmp(command, "brightness") == 0 && argc - arg == 2) {
+            client.set_brightness(static_cast<uint8_t>(std::atoi(argv[arg])),
+                                  static_cast<uint8_t>(std::atoi(argv[arg + 1])));
+        } else if (std::strcmp(command, "diagnostics") == 0) {
+            static const char *const causes[] = {"power-on", "external", "brown-out", "watchdog"};
+            static const char *const checkpoints[] = {"none",    "setup",    "loop",   "button",
+                                                      "schedule", "outputs", "eeprom", "sleep"};
+            Diagnostics diagnostics = client.read_diagnostics();
+            std::printf("reset cause:");
+            for (int i = 0; i < 4; i++) {
+                if (diagnostics.reset_cause & (1 << i)) {
+                    std::printf(" %s", causes[i]);
+                }
+            }
+            std::printf("\ncheckpoint:  %s\ntwi status:  0x%02x\nreboots:     %u\n",
+                        diagnostics.checkpoint <= CHECKPOINT_SLEEP ? checkpoints[diagnostics.checkpoint] : "?",
+                        diagnostics.twi_status, diagnostics.reboots);
+        } else if (std::strcmp(command, "memory") == 0) {
+            MemoryUsage memory = client.read_memory_usage();
+            std::printf(".data:       %4u bytes\n.bss:        %4u bytes\nstack used:  %4u bytes\nstack free:  %4u bytes\n",
+                        memory.data, memory.bss, memory.stack_used, memory.stack_free);
+        } else if (std::strcmp(command, "trace") == 0 && argc - arg <= 1) {
+            if (argc - arg == 1) {
+                if (std::strcmp(argv[arg], "on") != 0 && std::strcmp(argv[arg], "off") != 0) {
+                    return usage();
+                }
+                client.set_trace_enabled(std::strcmp(argv[arg], "on") == 0);
+            } else {
+                Trace trace = client.read_trace();
+                std::printf("%u events\n", trace.count);
+                for (const TraceEvent &event : trace.events) {
+                    std::printf("  status 0x%02x, register 0x%02x, at %5u\n", event.status, event.reg, event.time);
+                }
+            }
+        } else if (std::strcmp(command, "recoveries") == 0) {
+            std::printf("%u TWI recoveries\n", client.read_twi_recoveries());
+        } else if (std::strcmp(command, "flash") == 0 && argc - arg == 1) {
+            std::ifstream file(argv[arg], std::ios::binary);
+            if (!file) {
+                std::fprintf(stderr, "can't open %s\n", argv[arg]);
+                return 1;
+            }
+            std::vector<uint8_t> image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            Flasher flasher(bus, address);
+            Flasher::Result result = flasher.flash(image, [](size_t done, size_t total) {
+                std::fprintf(stderr, "\rpage %zu/%zu", done, total);
+            });
+            std::fprintf(stderr, "\n");
+            std::printf("%zu bytes in %zu pages, %.2f s\n", image.size(), result.pages, result.duration.count());
+        } else {
+            return usage();
+        }
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
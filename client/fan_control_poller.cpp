@@ -0,0 +1,180 @@
+//
+// Daemon polling fan controllers on any number of I2C buses, logging every change.
+//
+// Usage:
+//   fan_control_poller [options] <device>=<address>[,<address>...] ...
+//   fan_control_poller [options] --mock <buses>x<devices>
+//
+// Options:
+//   --min-interval <ms>  Poll interval right after a change (default 100).
+//   --max-interval <ms>  Poll interval for devices that don't change (default 5000).
+//   --stats <s>          Print per-device statistics every s seconds (default 60, 0 to disable).
+//
+// Events are printed to stdout, one per line. Statistics go to stderr.
+// With --mock, the devices are simulated, with someone randomly pressing buttons.
+//
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "linux_i2c_bus.hpp"
+#include "mock_bus.hpp"
+#include "poller.hpp"
+
+using namespace fan_control;
+
+static std::atomic<bool> running{true};
+
+static void on_signal(int) {
+    running = false;
+}
+
+static int usage() {
+    std::fprintf(stderr, "usage: fan_control_poller [--min-interval ms] [--max-interval ms] [--stats s]\n"
+                         "                          <device>=<address>[,<address>...] ... | --mock <buses>x<devices>\n");
+    return 2;
+}
+
+static void print_event(const PollEvent &event) {
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::printf("%s 0x%02x %s", event.bus.c_str(), event.address, to_string(event.kind));
+    if (event.state) {
+        std::printf(" in=%u out=%u", event.state->air_in, event.state->air_out);
+        if (event.previous) {
+            std::printf(" (was in=%u out=%u)", event.previous->air_in, event.previous->air_out);
+        }
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+}
+
+static void print_stats(const Poller &poller) {
+    LatencyHistogram total;
+    for (const DeviceStats &device : poller.stats()) {
+        std::fprintf(stderr, "%s 0x%02x %s polls=%llu changes=%llu errors=%llu interval=%lldms "
+                             "rtt p50<%uus p99<%uus max=%uus\n",
+                     device.bus.c_str(), device.address, device.online ? "online" : "offline",
+                     static_cast<unsigned long long>(device.polls), static_cast<unsigned long long>(device.changes),
+                     static_cast<unsigned long long>(device.errors),
+                     static_cast<long long>(device.interval.count() / 1000), device.latency.percentile_us(50),
+                     device.latency.percentile_us(99), device.latency.max_us());
+        total.merge(device.latency);
+    }
+    std::fprintf(stderr, "total polls=%llu rtt mean=%.0fus p99<%uus\n", static_cast<unsigned long long>(total.count()),
+                 total.mean_us(), total.percentile_us(99));
+}
+
+int main(int argc, char **argv) {
+    PollPolicy policy;
+    int stats_interval = 60;
+    int mock_buses = 0, mock_devices = 0;
+    std::vector<std::string> specs;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--min-interval" && i + 1 < argc) {
+            policy.min_interval = std::chrono::milliseconds(std::atoi(argv[++i]));
+        } else if (arg == "--max-interval" && i + 1 < argc) {
+            policy.max_interval = std::chrono::milliseconds(std::atoi(argv[++i]));
+        } else if (arg == "--stats" && i + 1 < argc) {
+            stats_interval = std::atoi(argv[++i]);
+        } else if (arg == "--mock" && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%dx%d", &mock_buses, &mock_devices) != 2 || mock_buses < 1 ||
+                mock_devices < 1 || mock_devices > 0x70) {
+                return usage();
+            }
+        } else if (arg.find('=') != std::string::npos) {
+            specs.push_back(arg);
+        } else {
+            return usage();
+        }
+    }
+    if (specs.empty() == (mock_buses == 0)) {
+        return usage();
+    }
+
+    // The buses must outlive the poller.
+    std::vector<std::unique_ptr<Bus>> buses;
+    std::vector<MockSlave *> mock_slaves;
+    Poller poller(policy, print_event);
+
+    try {
+        for (const std::string &spec : specs) {
+            std::string device = spec.substr(0, spec.find('='));
+            buses.push_back(std::make_unique<LinuxI2cBus>(device));
+            size_t bus = poller.add_bus(device, *buses.back());
+
+            const char *addresses = spec.c_str() + device.size() + 1;
+            while (*addresses) {
+                char *end;
+                unsigned long address = std::strtoul(addresses, &end, 0);
+                if (end == addresses || address > 0x7F) {
+                    return usage();
+                }
+                poller.add_device(bus, static_cast<uint8_t>(address));
+                addresses = *end == ',' ? end + 1 : end;
+            }
+        }
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    for (int b = 0; b < mock_buses; b++) {
+        auto bus = std::make_unique<MockBus>(100000, true);
+        size_t index = poller.add_bus("mock" + std::to_string(b), *bus);
+        for (int d = 0; d < mock_devices; d++) {
+            uint8_t address = static_cast<uint8_t>(0x08 + d);
+            mock_slaves.push_back(&bus->add_slave(address));
+            poller.add_device(index, address);
+        }
+        buses.push_back(std::move(bus));
+    }
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+    poller.start();
+
+    std::mt19937 rng(std::random_device{}());
+    auto next_stats = std::chrono::steady_clock::now() + std::chrono::seconds(stats_interval);
+    while (running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        if (!mock_slaves.empty()) {
+            // Every now and then, somebody walks up to one of the boxes.
+            MockSlave *slave = mock_slaves[rng() % mock_slaves.size()];
+            switch (rng() % 20) {
+                case 0:
+                    slave->set_button_override(true);
+                    slave->set_modes_by_button(rng() % NUM_AIR_IN_MODES, rng() % NUM_AIR_OUT_MODES);
+                    break;
+                case 1:
+                    slave->set_button_override(false);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if (stats_interval > 0 && std::chrono::steady_clock::now() >= next_stats) {
+            print_stats(poller);
+            next_stats += std::chrono::seconds(stats_interval);
+        }
+    }
+
+    poller.stop();
+    print_stats(poller);
+    return 0;
+}
@@ -0,0 +1,149 @@
+//
+// Throughput benchmark for the poller, against simulated buses that take as long as real ones.
+//
+// Measures devices polled per second with a growing number of buses, each with 100 mock devices, and compares against
+// polling everything serially from one thread. Then shows how adaptive intervals cut the load when most devices are
+// idle. Measurement only; which events the poller reports is tested in test/test_poller.cpp.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "mock_bus.hpp"
+#include "poller.hpp"
+
+using namespace fan_control;
+using namespace std::chrono_literals;
+
+static constexpr int DEVICES_PER_BUS = 100;
+static constexpr auto RUN_TIME = 2s;
+
+struct Fleet {
+    std::vector<std::unique_ptr<MockBus>> buses;
+    std::vector<MockSlave *> slaves;
+
+    Fleet(int buses_count, uint32_t scl_hz) {
+        for (int b = 0; b < buses_count; b++) {
+            buses.push_back(std::make_unique<MockBus>(scl_hz, true));
+            for (int d = 0; d < DEVICES_PER_BUS; d++) {
+                slaves.push_back(&buses.back()->add_slave(static_cast<uint8_t>(0x08 + d)));
+            }
+        }
+    }
+
+    void add_to(Poller &poller) {
+        for (size_t b = 0; b < buses.size(); b++) {
+            size_t index = poller.add_bus("bus" + std::to_string(b), *buses[b]);
+            for (int d = 0; d < DEVICES_PER_BUS; d++) {
+                poller.add_device(index, static_cast<uint8_t>(0x08 + d));
+            }
+        }
+    }
+};
+
+// One thread going through all devices on all buses, as fast as it can.
+static double serial_rate(int buses_count, uint32_t scl_hz) {
+    Fleet fleet(buses_count, scl_hz);
+    std::vector<std::unique_ptr<Client>> clients;
+    for (auto &bus : fleet.buses) {
+        for (int d = 0; d < DEVICES_PER_BUS; d++) {
+            clients.push_back(std::make_unique<Client>(*bus, static_cast<uint8_t>(0x08 + d)));
+        }
+    }
+
+    uint64_t polls = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < RUN_TIME) {
+        for (auto &client : clients) {
+            client->poll();
+            polls++;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return polls / elapsed.count();
+}
+
+// The poller with no minimum interval, i.e. every bus is kept busy all the time.
+static double poller_rate(int buses_count, uint32_t scl_hz, LatencyHistogram *latency) {
+    Fleet fleet(buses_count, scl_hz);
+    PollPolicy policy;
+    policy.min_interval = 0us;
+    policy.max_interval = 0us;
+    Poller poller(policy);
+    fleet.add_to(poller);
+
+    poller.start();
+    std::this_thread::sleep_for(RUN_TIME);
+    poller.stop();
+
+    for (const DeviceStats &device : poller.stats()) {
+        latency->merge(device.latency);
+    }
+    return poller.polls() / std::chrono::duration<double>(RUN_TIME).count();
+}
+
+static void bench_throughput(uint32_t scl_hz) {
+    std::printf("devices polled per second at %u kHz, %d devices per bus:\n", scl_hz / 1000, DEVICES_PER_BUS);
+    std::printf("  buses     serial     poller  rtt mean  rtt p99\n");
+
+    for (int buses_count : {1, 2, 4, 8}) {
+        LatencyHistogram latency;
+        double serial = serial_rate(buses_count, scl_hz);
+        double parallel = poller_rate(buses_count, scl_hz, &latency);
+        std::printf("  %5d %10.0f %10.0f %7.0fus %6uus\n", buses_count, serial, parallel, latency.mean_us(),
+                    latency.percentile_us(99));
+    }
+}
+
+// 4 buses with 100 devices each, of which only a few are busy.
+static void bench_adaptive() {
+    std::printf("adaptive intervals, 400 devices, 10 busy:\n");
+
+    Fleet fleet(4, 100000);
+    PollPolicy policy;
+    policy.min_interval = 20ms;
+    policy.max_interval = 1s;
+
+    std::atomic<int> overrides{0};
+    Poller poller(policy, [&overrides](const PollEvent &event) {
+        if (event.kind == PollEvent::OVERRIDE_STARTED) {
+            overrides++;
+        }
+    });
+    fleet.add_to(poller);
+    poller.start();
+    // Let the poller discover everything first.
+    std::this_thread::sleep_for(500ms);
+
+    // Each state is held long enough for the poller to see it: Right after a change, a device is polled within 320ms
+    // at most, until 620ms after the change.
+    int toggles = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < RUN_TIME) {
+        for (int i = 0; i < 10; i++) {
+            fleet.slaves[i * 37]->set_button_override(toggles % 2 == 0);
+        }
+        toggles++;
+        std::this_thread::sleep_for(400ms);
+    }
+    // Let the last state be seen.
+    std::this_thread::sleep_for(1200ms);
+    poller.stop();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    double fixed = 400 / std::chrono::duration<double>(policy.min_interval).count();
+    std::printf("  %.0f polls/s adaptive, %.0f polls/s at a fixed %lldms interval\n", poller.polls() / elapsed.count(),
+                fixed, static_cast<long long>(policy.min_interval.count() / 1000));
+    std::printf("  %d of %d override activations reported\n", overrides.load(), (toggles + 1) / 2 * 10);
+}
+
+int main() {
+    bench_throughput(100000);
+    bench_throughput(400000);
+    bench_adaptive();
+    return 0;
+}
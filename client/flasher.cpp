@@ -0,0 +1,192 @@
+#include "flasher.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+namespace fan_control {
+
+uint16_t crc16_xmodem(const uint8_t *data, size_t len) {
+    uint16_t crc = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= static_cast<uint16_t>(data[i] << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? static_cast<uint16_t>(crc << 1 ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+        }
+    }
+    return crc;
+}
+
+Flasher::Flasher(Bus &bus, uint8_t address) : bus_(bus), address_(address), boot_address_(address) {}
+
+uint8_t Flasher::boot_address() const {
+    return boot_address_;
+}
+
+void Flasher::write_command(const uint8_t *frame, size_t len) {
+    Message msg{boot_address_, false, const_cast<uint8_t *>(frame), len};
+    bus_.transfer(&msg, 1);
+}
+
+std::optional<BootInfo> Flasher::read_info() {
+    try {
+        return read_info(boot_address_);
+    } catch (const std::system_error &) {
+        if (boot_address_ == DEFAULT_ADDRESS) {
+            throw;
+        }
+        // Maybe the device was reset, and the bootloader stayed. A firmware at DEFAULT_ADDRESS is someone else.
+        std::optional<BootInfo> info;
+        try {
+            info = read_info(DEFAULT_ADDRESS);
+        } catch (const std::system_error &) {
+        }
+        if (!info) {
+            throw;
+        }
+        boot_address_ = DEFAULT_ADDRESS;
+        return info;
+    }
+}
+
+std::optional<BootInfo> Flasher::read_info(uint8_t address) {
+    // Without a register address, the firmware returns its status register, which never reads as BOOT_ID.
+    uint8_t info[BOOT_INFO_SIZE];
+    Message msg{address, true, info, sizeof(info)};
+    bus_.transfer(&msg, 1);
+
+    if (info[BOOT_INFO_ID] != BOOT_ID) {
+        return std::nullopt;
+    }
+    return BootInfo{info[BOOT_INFO_STATUS], info[BOOT_INFO_PAGE_SIZE],
+                    static_cast<size_t>(info[BOOT_INFO_PAGE_SIZE]) * info[BOOT_INFO_PAGES]};
+}
+
+BootInfo Flasher::enter(std::chrono::milliseconds timeout) {
+    if (auto info = read_info()) {
+        return *info;
+    }
+
+    uint8_t frame[] = {REG_BOOT, BOOT_ENTER_KEY};
+    write_command(frame, sizeof(frame));
+
+    // The device doesn't answer for a moment while it hands over.
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline) {
+        try {
+            if (auto info = read_info()) {
+                return *info;
+            }
+        } catch (const std::system_error &) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    throw std::runtime_error("bootloader did not answer");
+}
+
+void Flasher::write_page(uint16_t address, const uint8_t *page, size_t page_size) {
+    if (page_size == 0 || address % page_size != 0) {
+        throw std::invalid_argument("page not aligned");
+    }
+
+    std::vector<uint8_t> frame(BOOT_PAGE_HEADER_SIZE + page_size);
+    frame[0] = BOOT_CMD_PAGE;
+    frame[1] = static_cast<uint8_t>(address);
+    frame[2] = static_cast<uint8_t>(address >> 8);
+    std::copy(page, page + page_size, frame.begin() + BOOT_PAGE_HEADER_SIZE);
+    write_command(frame.data(), frame.size());
+}
+
+void Flasher::commit(uint16_t length, uint16_t crc, std::chrono::milliseconds timeout) {
+    uint8_t frame[BOOT_COMMIT_FRAME_SIZE] = {
+            BOOT_CMD_COMMIT,
+            static_cast<uint8_t>(length), static_cast<uint8_t>(length >> 8),
+            static_cast<uint8_t>(crc), static_cast<uint8_t>(crc >> 8),
+    };
+    write_command(frame, sizeof(frame));
+
+    // The status stays READY until the bootloader has checked the CRC.
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline) {
+        auto info = read_info();
+        if (!info) {
+            throw std::runtime_error("bootloader not running");
+        }
+        switch (info->status) {
+            case BOOT_STATUS_READY:
+                break;
+            case BOOT_STATUS_VERIFIED:
+                return;
+            case BOOT_STATUS_BAD_IMAGE:
+                throw std::runtime_error("CRC mismatch, the image was not written correctly");
+            default:
+                throw std::runtime_error("bootloader rejected a command");
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    throw std::runtime_error("bootloader did not finish the commit");
+}
+
+void Flasher::run(std::chrono::milliseconds timeout) {
+    uint8_t frame[] = {BOOT_CMD_RUN};
+    write_command(frame, sizeof(frame));
+
+    // The firmware answers at its own address, which is not where the bootloader was if that was at DEFAULT_ADDRESS.
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline) {
+        try {
+            auto info = read_info(boot_address_);
+            if (!info) {
+                return;
+            }
+            if (info->status == BOOT_STATUS_BAD_IMAGE) {
+                throw std::runtime_error("bootloader refused to start the firmware");
+            }
+        } catch (const std::system_error &) {
+        }
+        if (boot_address_ != address_) {
+            try {
+                if (!read_info(address_)) {
+                    boot_address_ = address_;
+                    return;
+                }
+            } catch (const std::system_error &) {
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    throw std::runtime_error("firmware did not answer");
+}
+
+Flasher::Result Flasher::flash(const std::vector<uint8_t> &image, const std::function<void(size_t, size_t)> &progress) {
+    if (image.empty()) {
+        throw std::invalid_argument("empty image");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    BootInfo info = enter();
+    if (image.size() > info.max_image_size) {
+        // Nothing was written yet, so the old firmware can go on.
+        run();
+        throw std::invalid_argument("image does not fit below the bootloader");
+    }
+
+    // Erased flash reads as 0xFF, so that's what the last page is padded with.
+    size_t pages = (image.size() + info.page_size - 1) / info.page_size;
+    std::vector<uint8_t> padded(image);
+    padded.resize(pages * info.page_size, 0xFF);
+    for (size_t i = 0; i < pages; i++) {
+        write_page(static_cast<uint16_t>(i * info.page_size), &padded[i * info.page_size], info.page_size);
+        if (progress) {
+            progress(i + 1, pages);
+        }
+    }
+
+    commit(static_cast<uint16_t>(image.size()), crc16_xmodem(image.data(), image.size()));
+    run();
+    return Result{pages, std::chrono::steady_clock::now() - start};
+}
+
+} // namespace fan_control
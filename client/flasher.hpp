@@ -0,0 +1,93 @@
+//
+// Firmware updates over I2C, via the bootloader. See src/bootloader.h for the protocol.
+//
+// flash() hands over to the bootloader, writes the image one page per transaction, has the bootloader check its CRC and
+// starts it. The pages go out back to back, without polling in between: the bootloader receives a page while it
+// programs the one before, and holds SCL until it can take the next, so sending a page costs no time on top of
+// programming the previous one. A full ATmega8 firmware takes about a second, most of it spent programming flash.
+//
+// The relays keep their pattern throughout, and the modes and everything else in EEPROM survive the update.
+// A Flasher is not thread-safe, and nothing else should talk to the device while it runs.
+//
+// After a reset, the bootloader answers at DEFAULT_ADDRESS instead of the address of the firmware, e.g. if a reset
+// interrupted an update. So if the device doesn't answer at its address, enter() and read_info() look for the
+// bootloader there, and the Flasher talks to it at that address until the firmware runs again. That goes wrong if
+// another device at DEFAULT_ADDRESS is stuck in its bootloader as well, so recover those one at a time.
+//
+
+#ifndef FAN_CONTROL_CLIENT_FLASHER_HPP
+#define FAN_CONTROL_CLIENT_FLASHER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <vector>
+
+#include "bus.hpp"
+#include "registers.hpp"
+
+namespace fan_control {
+
+// CRC-16/XMODEM, as the bootloader computes it over the firmware.
+uint16_t crc16_xmodem(const uint8_t *data, size_t len);
+
+// The info block of the bootloader.
+struct BootInfo {
+    // BOOT_STATUS_*, how the last command went.
+    uint8_t status;
+    size_t page_size;
+    // Everything below the bootloader.
+    size_t max_image_size;
+};
+
+class Flasher {
+public:
+    explicit Flasher(Bus &bus, uint8_t address = DEFAULT_ADDRESS);
+
+    // Hands over to the bootloader, unless it is running already, at the device's address or DEFAULT_ADDRESS. Throws
+    // std::runtime_error if it doesn't answer within the timeout. The firmware only hands over once the relays have
+    // settled and its EEPROM writes are done.
+    BootInfo enter(std::chrono::milliseconds timeout = std::chrono::milliseconds(2000));
+    // The info block, or nothing if the firmware answers instead of the bootloader. Throws std::system_error if nobody
+    // answers, neither at the device's address nor as a bootloader at DEFAULT_ADDRESS.
+    std::optional<BootInfo> read_info();
+    // Where the bootloader answered last, or the device's address if it didn't yet.
+    uint8_t boot_address() const;
+
+    // Queues one page at the given flash address, which must be page aligned. This returns as soon as the page is on the
+    // wire; the bootloader holds the bus while it is still busy with the one before.
+    void write_page(uint16_t address, const uint8_t *page, size_t page_size);
+    // Has the bootloader check the CRC of the first length bytes of flash. Throws std::runtime_error if they don't
+    // match, in which case the bootloader won't start the firmware.
+    void commit(uint16_t length, uint16_t crc, std::chrono::milliseconds timeout = std::chrono::milliseconds(1000));
+    // Starts the firmware, and waits until it answers. Throws std::runtime_error if the bootloader refuses, or the
+    // firmware doesn't come up within the timeout.
+    void run(std::chrono::milliseconds timeout = std::chrono::milliseconds(2000));
+
+    struct Result {
+        size_t pages;
+        // From entering the bootloader to the firmware answering again.
+        std::chrono::duration<double> duration;
+    };
+
+    // Writes a raw image (avr-objcopy -O binary) and starts it. The progress callback is called after every page with
+    // the number of pages written so far and the total. Throws std::invalid_argument if the image is empty or doesn't
+    // fit, and std::runtime_error if the update fails. If it fails after the first page, the device stays in the
+    // bootloader, also across resets, until an update succeeds.
+    Result flash(const std::vector<uint8_t> &image, const std::function<void(size_t, size_t)> &progress = {});
+
+private:
+    void write_command(const uint8_t *frame, size_t len);
+    std::optional<BootInfo> read_info(uint8_t address);
+
+    Bus &bus_;
+    // Of the firmware.
+    const uint8_t address_;
+    uint8_t boot_address_;
+};
+
+} // namespace fan_control
+
+#endif //FAN_CONTROL_CLIENT_FLASHER_HPP
@@ -0,0 +1,70 @@
+//
+// A histogram of round-trip times with power-of-two buckets, cheap enough to update on every poll.
+//
+
+#ifndef FAN_CONTROL_CLIENT_LATENCY_HISTOGRAM_HPP
+#define FAN_CONTROL_CLIENT_LATENCY_HISTOGRAM_HPP
+
+#include <array>
+#include <cstdint>
+
+namespace fan_control {
+
+class LatencyHistogram {
+public:
+    // Bucket i counts latencies below 2^i microseconds (and at least 2^(i-1)). The last bucket takes everything else,
+    // i.e. anything above half a second.
+    static constexpr int BUCKETS = 20;
+
+    void record(uint32_t us) {
+        int bucket = 0;
+        while (bucket < BUCKETS - 1 && us >= (1u << bucket)) {
+            bucket++;
+        }
+        buckets_[bucket]++;
+        count_++;
+        total_us_ += us;
+        if (us > max_us_) {
+            max_us_ = us;
+        }
+    }
+
+    void merge(const LatencyHistogram &other) {
+        for (int i = 0; i < BUCKETS; i++) {
+            buckets_[i] += other.buckets_[i];
+        }
+        count_ += other.count_;
+        total_us_ += other.total_us_;
+        if (other.max_us_ > max_us_) {
+            max_us_ = other.max_us_;
+        }
+    }
+
+    uint64_t count() const { return count_; }
+    uint32_t max_us() const { return max_us_; }
+    double mean_us() const { return count_ ? static_cast<double>(total_us_) / count_ : 0; }
+    uint64_t bucket(int i) const { return buckets_[i]; }
+
+    // Upper bound of the bucket containing the given percentile (0-100), in microseconds, but at most the maximum.
+    uint32_t percentile_us(double p) const {
+        uint64_t rank = static_cast<uint64_t>(p / 100 * count_);
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS - 1; i++) {
+            seen += buckets_[i];
+            if (seen > rank) {
+                return (1u << i) < max_us_ ? (1u << i) : max_us_;
+            }
+        }
+        return max_us_;
+    }
+
+private:
+    std::array<uint64_t, BUCKETS> buckets_{};
+    uint64_t count_ = 0;
+    uint64_t total_us_ = 0;
+    uint32_t max_us_ = 0;
+};
+
+} // namespace fan_control
+
+#endif //FAN_CONTROL_CLIENT_LATENCY_HISTOGRAM_HPP
@@ -0,0 +1,44 @@
+#include "linux_i2c_bus.hpp"
+
+#include <cerrno>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+namespace fan_control {
+
+LinuxI2cBus::LinuxI2cBus(const std::string &device) : device_(device) {
+    fd_ = open(device.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd_ < 0) {
+        throw std::system_error(errno, std::generic_category(), "open " + device);
+    }
+}
+
+LinuxI2cBus::~LinuxI2cBus() {
+    close(fd_);
+}
+
+void LinuxI2cBus::transfer(Message *messages, size_t count) {
+    std::vector<i2c_msg> msgs(count);
+    for (size_t i = 0; i < count; i++) {
+        msgs[i].addr = messages[i].address;
+        msgs[i].flags = messages[i].read ? I2C_M_RD : 0;
+        msgs[i].len = static_cast<__u16>(messages[i].len);
+        msgs[i].buf = messages[i].data;
+    }
+
+    i2c_rdwr_ioctl_data data{msgs.data(), static_cast<__u32>(count)};
+    if (ioctl(fd_, I2C_RDWR, &data) < 0) {
+        // Most adapters report a missing ACK as ENXIO, some as EREMOTEIO. Normalize, so callers only check one.
+        int err = errno == EREMOTEIO ? ENXIO : errno;
+        throw std::system_error(err, std::generic_category(), "I2C_RDWR on " + device_);
+    }
+}
+
+} // namespace fan_control
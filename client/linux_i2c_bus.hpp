@@ -0,0 +1,35 @@
+//
+// A Bus backed by a Linux i2c-dev device, e.g. /dev/i2c-1.
+//
+
+#ifndef FAN_CONTROL_CLIENT_LINUX_I2C_BUS_HPP
+#define FAN_CONTROL_CLIENT_LINUX_I2C_BUS_HPP
+
+#include <string>
+
+#include "bus.hpp"
+
+namespace fan_control {
+
+class LinuxI2cBus : public Bus {
+public:
+    // Opens the given device node. Throws std::system_error if that fails.
+    explicit LinuxI2cBus(const std::string &device);
+    ~LinuxI2cBus() override;
+
+    LinuxI2cBus(const LinuxI2cBus &) = delete;
+    LinuxI2cBus &operator=(const LinuxI2cBus &) = delete;
+
+    // Uses the I2C_RDWR ioctl, so the whole transaction is one system call and the adapter keeps the bus in between.
+    void transfer(Message *messages, size_t count) override;
+
+    const std::string &device() const { return device_; }
+
+private:
+    std::string device_;
+    int fd_;
+};
+
+} // namespace fan_control
+
+#endif //FAN_CONTROL_CLIENT_LINUX_I2C_BUS_HPP
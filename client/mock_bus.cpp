@@ -0,0 +1,471 @@
+#include "mock_bus.hpp"
+
+#include "flasher.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+namespace fan_control {
+
+MockSlave::MockSlave(uint8_t address) : address_(address), flash_(MOCK_BOOT_START, 0xFF) {
+    // Some reset vector, so the bootloader starts the firmware.
+    flash_[0] = 0x12;
+    flash_[1] = 0xC0;
+    regs_[REG_STATUS] = BIT_WDT_RESET;
+    regs_[REG_PEC_READ_LENGTH] = 3;
+    regs_[REG_ADDRESS] = address;
+    regs_[REG_GROUPS] = DEFAULT_GROUPS;
+    regs_[REG_BUTTON_DEBOUNCE] = BUTTON_DEBOUNCE_DEFAULT;
+    regs_[REG_BUTTON_LONG_PRESS] = BUTTON_LONG_PRESS_DEFAULT;
+    regs_[REG_BUTTON_REPEAT] = BUTTON_REPEAT_DEFAULT;
+    regs_[REG_BRIGHTNESS] = 255;
+    regs_[REG_BRIGHTNESS + 1] = 255;
+    regs_[REG_DIAGNOSTICS] = RESET_POWER_ON;
+    for (size_t i = 0; i < TRACE_ENTRIES; i++) {
+        regs_[REG_TRACE + 1 + i * TRACE_ENTRY_SIZE] = TRACE_UNUSED;
+    }
+}
+
+uint8_t MockSlave::address() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return address_;
+}
+
+uint8_t MockSlave::configured_address() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return regs_[REG_ADDRESS];
+}
+
+void MockSlave::write(const uint8_t *data, size_t len) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (bootloader_) {
+        boot_write(data, len);
+        return;
+    }
+
+    // SLA+W resets the register pointer.
+    buffer_addr_ = 0xFF;
+    if (len == 0) {
+        return;
+    }
+    if (data[0] < REGISTER_FILE_SIZE) {
+        buffer_addr_ = data[0];
+    }
+    if (len == 1) {
+        // Register-only write, a following read starts there.
+        return;
+    }
+
+    size_t count = len - 1 < RX_SIZE ? len - 1 : RX_SIZE;
+    uint8_t addr = buffer_addr_;
+    for (size_t i = 0; i < count; i++, addr++) {
+        uint8_t value = data[1 + i];
+        switch (addr) {
+            case REG_STATUS:
+                regs_[REG_STATUS] |= value & BIT_WDT_RESET;
+                break;
+            case REG_AIR_IN:
+                if (!locked_) {
+                    staging_[REG_AIR_IN] = value;
+                }
+                break;
+            case REG_AIR_OUT:
+                if (!locked_) {
+                    staging_[REG_AIR_OUT] = value;
+                    commit(staging_[REG_AIR_IN], value);
+                }
+                break;
+            case REG_CONFIG:
+                regs_[REG_CONFIG] = value & CONFIG_MASK;
+                break;
+            case REG_PEC_READ_LENGTH:
+                regs_[REG_PEC_READ_LENGTH] = value;
+                break;
+            case REG_ADDRESS:
+                if (value >= ADDRESS_MIN && value <= ADDRESS_MAX) {
+                    regs_[REG_ADDRESS] = value;
+                }
+                break;
+            case REG_GROUPS:
+                regs_[REG_GROUPS] = value;
+                break;
+            case REG_BUTTON_DEBOUNCE:
+            case REG_BUTTON_LONG_PRESS:
+                if (value) {
+                    regs_[addr] = value;
+                }
+                break;
+            case REG_BUTTON_REPEAT:
+                regs_[REG_BUTTON_REPEAT] = value;
+                break;
+            case REG_BRIGHTNESS:
+            case REG_BRIGHTNESS + 1:
+                regs_[addr] = value;
+                break;
+            case REG_BOOT:
+                if (value == BOOT_ENTER_KEY) {
+                    boot_request_ = true;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    buffer_addr_ = 0xFF;
+}
+
+void MockSlave::general_call(const uint8_t *data, size_t len) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    buffer_addr_ = 0xFF;
+    if (bootloader_) {
+        return;
+    }
+    if (len != GCALL_FRAME_SIZE || !(data[GCALL_FRAME_MASTER] & 0x01) ||
+        !(data[GCALL_FRAME_GROUPS] & regs_[REG_GROUPS]) || locked_) {
+        return;
+    }
+    staging_[REG_AIR_IN] = data[GCALL_FRAME_AIR_IN];
+    staging_[REG_AIR_OUT] = data[GCALL_FRAME_AIR_OUT];
+    commit(staging_[REG_AIR_IN], staging_[REG_AIR_OUT]);
+}
+
+void MockSlave::read(uint8_t *data, size_t len) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (bootloader_) {
+        for (size_t i = 0; i < len; i++) {
+            switch (i) {
+                case BOOT_INFO_ID:
+                    data[i] = BOOT_ID;
+                    break;
+                case BOOT_INFO_STATUS:
+                    data[i] = boot_status_;
+                    break;
+                case BOOT_INFO_PAGE_SIZE:
+                    data[i] = MOCK_BOOT_PAGE_SIZE;
+                    break;
+                case BOOT_INFO_PAGES:
+                    data[i] = MOCK_BOOT_START / MOCK_BOOT_PAGE_SIZE;
+                    break;
+                default:
+                    data[i] = 0xFF;
+                    break;
+            }
+        }
+        return;
+    }
+
+    size_t addr = buffer_addr_ == 0xFF ? 0 : buffer_addr_;
+    for (size_t i = 0; i < len; i++, addr++) {
+        if (addr >= REGISTER_FILE_SIZE) {
+            data[i] = 0xFF;
+            continue;
+        }
+        data[i] = regs_[addr];
+        if (addr == REG_STATUS && locked_) {
+            data[i] |= BIT_I2C_DISABLED;
+        }
+        if (addr == REG_CHANGE_SEQ) {
+            attention_ = false;
+        }
+    }
+
+    // The master NACKs the last byte, which resets the register pointer.
+    buffer_addr_ = 0xFF;
+}
+
+void MockSlave::stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer_addr_ = 0xFF;
+    // The relays never take time to settle here, and nothing is left to save.
+    if (boot_request_) {
+        boot_request_ = false;
+        bootloader_ = true;
+        boot_status_ = BOOT_STATUS_READY;
+    }
+}
+
+void MockSlave::set_button_override(bool active) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    publish(regs_[REG_AIR_IN], regs_[REG_AIR_OUT], active);
+}
+
+void MockSlave::set_modes_by_button(uint8_t air_in, uint8_t air_out) {
+    if (air_in >= NUM_AIR_IN_MODES || air_out >= NUM_AIR_OUT_MODES) {
+        throw std::invalid_argument("mode out of range");
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!locked_) {
+        throw std::logic_error("modes can only be changed by button while the override is active");
+    }
+    publish(air_in, air_out, true);
+}
+
+void MockSlave::reboot(bool by_watchdog) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    boot_request_ = false;
+    if (!firmware_valid()) {
+        bootloader_ = true;
+        boot_status_ = BOOT_STATUS_READY;
+        address_ = DEFAULT_ADDRESS;
+        return;
+    }
+    // Reset while sleeping in the main loop, like a real device would most likely be.
+    restart(by_watchdog ? RESET_WATCHDOG : RESET_EXTERNAL, CHECKPOINT_SLEEP, by_watchdog);
+}
+
+// Must be called with the mutex held.
+void MockSlave::restart(uint8_t reset_cause, uint8_t checkpoint, bool by_watchdog) {
+    uint8_t in = regs_[REG_AIR_IN];
+    uint8_t out = regs_[REG_AIR_OUT];
+    uint8_t address = regs_[REG_ADDRESS];
+    uint8_t groups = regs_[REG_GROUPS];
+    uint16_t relay_changes = regs_[REG_TELEMETRY + TELEMETRY_RELAY_CHANGE_COUNT];
+    uint16_t reboots = regs_[REG_DIAGNOSTICS + 3] | regs_[REG_DIAGNOSTICS + 4] << 8;
+
+    regs_.fill(0);
+    regs_[REG_AIR_IN] = in;
+    regs_[REG_AIR_OUT] = out;
+    regs_[REG_ADDRESS] = address;
+    regs_[REG_GROUPS] = groups;
+    address_ = address;
+    regs_[REG_STATUS] = by_watchdog ? 0 : BIT_WDT_RESET;
+    regs_[REG_PEC_READ_LENGTH] = 3;
+    regs_[REG_BUTTON_DEBOUNCE] = BUTTON_DEBOUNCE_DEFAULT;
+    regs_[REG_BUTTON_LONG_PRESS] = BUTTON_LONG_PRESS_DEFAULT;
+    regs_[REG_BUTTON_REPEAT] = BUTTON_REPEAT_DEFAULT;
+    regs_[REG_BRIGHTNESS] = 255;
+    regs_[REG_BRIGHTNESS + 1] = 255;
+    regs_[REG_DIAGNOSTICS] = reset_cause;
+    regs_[REG_DIAGNOSTICS + 1] = checkpoint;
+    reboots++;
+    regs_[REG_DIAGNOSTICS + 3] = static_cast<uint8_t>(reboots);
+    regs_[REG_DIAGNOSTICS + 4] = static_cast<uint8_t>(reboots >> 8);
+    for (size_t i = 0; i < TRACE_ENTRIES; i++) {
+        regs_[REG_TRACE + 1 + i * TRACE_ENTRY_SIZE] = TRACE_UNUSED;
+    }
+    // Telemetry restarts from zero, except that we keep counting relay changes so tests can check them.
+    regs_[REG_TELEMETRY + TELEMETRY_RELAY_CHANGE_COUNT] = static_cast<uint8_t>(relay_changes);
+    staging_.fill(0);
+    buffer_addr_ = 0xFF;
+    attention_ = false;
+    bootloader_ = false;
+}
+
+// Like handle_frame and run_command in the bootloader. Must be called with the mutex held.
+void MockSlave::boot_write(const uint8_t *data, size_t len) {
+    if (len == 0) {
+        return;
+    }
+
+    uint16_t arg = len >= 3 ? static_cast<uint16_t>(data[1] | data[2] << 8) : 0;
+    if (data[0] == BOOT_CMD_PAGE && len == BOOT_PAGE_HEADER_SIZE + MOCK_BOOT_PAGE_SIZE &&
+        arg % MOCK_BOOT_PAGE_SIZE == 0 && arg < MOCK_BOOT_START) {
+        // The first page invalidates the trailer.
+        trailer_length_ = 0;
+        std::copy(data + BOOT_PAGE_HEADER_SIZE, data + len, flash_.begin() + arg);
+        boot_status_ = BOOT_STATUS_READY;
+    } else if (data[0] == BOOT_CMD_COMMIT && len == BOOT_COMMIT_FRAME_SIZE) {
+        uint16_t crc = static_cast<uint16_t>(data[3] | data[4] << 8);
+        if (arg != 0 && arg <= MOCK_BOOT_START && crc16_xmodem(flash_.data(), arg) == crc) {
+            trailer_length_ = arg;
+            trailer_crc_ = crc;
+            boot_status_ = BOOT_STATUS_VERIFIED;
+        } else {
+            boot_status_ = BOOT_STATUS_BAD_IMAGE;
+        }
+    } else if (data[0] == BOOT_CMD_RUN && len == 1) {
+        if (firmware_valid()) {
+            // No reset, the relays keep their pattern.
+            restart(0, CHECKPOINT_EEPROM, false);
+        } else {
+            boot_status_ = BOOT_STATUS_BAD_IMAGE;
+        }
+    } else {
+        boot_status_ = BOOT_STATUS_BAD_COMMAND;
+    }
+}
+
+// Must be called with the mutex held.
+bool MockSlave::firmware_valid() const {
+    if (trailer_length_ == 0xFFFF) {
+        return flash_[0] != 0xFF || flash_[1] != 0xFF;
+    }
+    // The length is only saved after the CRC matched.
+    return trailer_length_ != 0;
+}
+
+uint8_t MockSlave::air_in() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return regs_[REG_AIR_IN];
+}
+
+uint8_t MockSlave::air_out() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return regs_[REG_AIR_OUT];
+}
+
+bool MockSlave::attention() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return attention_;
+}
+
+uint16_t MockSlave::relay_changes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<uint16_t>(regs_[REG_TELEMETRY + TELEMETRY_RELAY_CHANGE_COUNT] |
+                                 regs_[REG_TELEMETRY + TELEMETRY_RELAY_CHANGE_COUNT + 1] << 8);
+}
+
+bool MockSlave::in_bootloader() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bootloader_;
+}
+
+std::vector<uint8_t> MockSlave::firmware() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return flash_;
+}
+
+// Like commit_modes in TWI_vect, followed by the main program applying valid modes. Must be called with the mutex held.
+void MockSlave::commit(uint8_t air_in, uint8_t air_out) {
+    publish(air_in < NUM_AIR_IN_MODES ? air_in : regs_[REG_AIR_IN],
+            air_out < NUM_AIR_OUT_MODES ? air_out : regs_[REG_AIR_OUT], locked_);
+}
+
+// Like the changed branch of fan_control_loop. Must be called with the mutex held.
+void MockSlave::publish(uint8_t air_in, uint8_t air_out, bool locked) {
+    bool modes_changed = air_in != regs_[REG_AIR_IN] || air_out != regs_[REG_AIR_OUT];
+
+    if (modes_changed || locked != locked_) {
+        regs_[REG_CHANGE_SEQ]++;
+        attention_ = true;
+    }
+    if (modes_changed) {
+        uint8_t *count = &regs_[REG_TELEMETRY + TELEMETRY_RELAY_CHANGE_COUNT];
+        if (++count[0] == 0) {
+            count[1]++;
+        }
+    }
+
+    regs_[REG_AIR_IN] = air_in;
+    regs_[REG_AIR_OUT] = air_out;
+    locked_ = locked;
+}
+
+MockBus::MockBus(uint32_t scl_hz, bool realtime) : scl_hz_(scl_hz), realtime_(realtime) {}
+
+MockSlave &MockBus::add_slave(uint8_t address) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for (auto &slave : slaves_) {
+        if (slave->address() == address) {
+            throw std::invalid_argument("address already taken");
+        }
+    }
+    slaves_.push_back(std::make_unique<MockSlave>(address));
+    return *slaves_.back();
+}
+
+MockSlave *MockBus::slave(uint8_t address) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return find(address);
+}
+
+// Must be called with the mutex held.
+MockSlave *MockBus::find(uint8_t address) {
+    for (auto &slave : slaves_) {
+        if (slave->address() == address) {
+            return slave.get();
+        }
+    }
+    return nullptr;
+}
+
+void MockBus::transfer(Message *messages, size_t count) {
+    // The bus is held for the whole transaction.
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // START and STOP.
+    uint64_t bits = 2;
+    uint64_t bytes = 0;
+    MockSlave *last = nullptr;
+    int error = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const Message &msg = messages[i];
+
+        // (Repeated) START, address byte and ACK.
+        bits += (i > 0 ? 1 : 0) + 9;
+        bytes++;
+
+        if (msg.address == GENERAL_CALL_ADDRESS && !msg.read && !slaves_.empty()) {
+            // Everybody listens.
+            if (last) {
+                last->stop();
+                last = nullptr;
+            }
+            for (auto &slave : slaves_) {
+                slave->general_call(msg.data, msg.len);
+            }
+        } else {
+            MockSlave *slave = find(msg.address);
+            if (!slave) {
+                error = ENXIO;
+                stats_.nacks++;
+                break;
+            }
+            if (last && last != slave) {
+                last->stop();
+            }
+            last = slave;
+
+            if (msg.read) {
+                last->read(msg.data, msg.len);
+            } else {
+                last->write(msg.data, msg.len);
+            }
+        }
+        bits += 9 * msg.len;
+        bytes += msg.len;
+    }
+    if (last) {
+        last->stop();
+    }
+
+    stats_.transfers++;
+    stats_.messages += count;
+    stats_.bytes += bytes;
+    stats_.bits += bits;
+
+    if (realtime_) {
+        std::this_thread::sleep_for(std::chrono::microseconds(bits * 1000000 / scl_hz_));
+    }
+    if (error) {
+        throw std::system_error(error, std::generic_category(), "mock transfer");
+    }
+}
+
+MockBus::Stats MockBus::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void MockBus::reset_stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_ = Stats{};
+}
+
+double MockBus::wire_time_us() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<double>(stats_.bits) * 1e6 / scl_hz_;
+}
+
+} // namespace fan_control
@@ -0,0 +1,140 @@
+//
+// An in-process stand-in for the fan controller and the bus it sits on, to test and benchmark masters without hardware.
+//
+// MockSlave follows TWI_vect (src/twislave.c) transaction by transaction:
+// - The first byte of a write selects the register, the following ones are written from there on. Writes to read-only
+//   or reserved registers are ignored, anything beyond RX_SIZE data bytes is dropped.
+// - Writes are applied at the end of the write, i.e. on STOP or a repeated START.
+// - Writes to air in are staged, and only committed together with a write to air out. While the button override is
+//   active, both are ignored.
+// - A read continues where the preceding register-only write left off. A read without one, or after a write with
+//   data, starts at the status register. Reading beyond the register file returns 0xFF, as the slave NACKs.
+// - Reading the change sequence register releases the attention line.
+// - Group commits via general call are applied by every member of the addressed groups.
+// - Writes to the address register are stored, but like on the device only take effect on reboot().
+// The main program is folded in: Commits are applied right away, and every change of the modes or the lock increments
+// the change sequence register.
+// PEC is not implemented. The config registers store what is written, but transfers never carry a PEC byte.
+// Neither is the schedule, its registers read as 0 and ignore writes. The TWI trace can be enabled, but stays empty, and
+// the bus never hangs, so the TWI recovery count stays 0.
+// The bootloader is emulated as on an ATmega8, with MOCK_BOOT_PAGE_SIZE byte pages below MOCK_BOOT_START. The handover
+// happens at the end of the transaction that requests it, and pages are programmed right away. The firmware starts out
+// as if programmed by ISP, i.e. without a trailer.
+//
+
+#ifndef FAN_CONTROL_CLIENT_MOCK_BUS_HPP
+#define FAN_CONTROL_CLIENT_MOCK_BUS_HPP
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "bus.hpp"
+#include "registers.hpp"
+
+namespace fan_control {
+
+constexpr size_t MOCK_BOOT_PAGE_SIZE = 64;
+constexpr size_t MOCK_BOOT_START = 0x1800;
+
+class MockSlave {
+public:
+    explicit MockSlave(uint8_t address = DEFAULT_ADDRESS);
+
+    uint8_t address() const;
+    // The address stored in the address register, which the slave will have after a reboot.
+    uint8_t configured_address() const;
+
+    // Bus side. A transaction is a sequence of write() and read() calls, followed by stop().
+    void write(const uint8_t *data, size_t len);
+    // A write to the general call address.
+    void general_call(const uint8_t *data, size_t len);
+    void read(uint8_t *data, size_t len);
+    void stop();
+
+    // Device side, like the button and the main program.
+    // Long-pressing the button: true selects a digit and locks out I2C, false goes back to I2C control.
+    void set_button_override(bool active);
+    // Short-pressing the button while a digit is selected.
+    void set_modes_by_button(uint8_t air_in, uint8_t air_out);
+    // Restarts the firmware. Modes, the override and groups survive, as they do with the EEPROM. The slave moves to its
+    // configured address. If an update was interrupted, the bootloader stays instead, at DEFAULT_ADDRESS.
+    void reboot(bool by_watchdog);
+
+    uint8_t air_in() const;
+    uint8_t air_out() const;
+    bool attention() const;
+    // Number of times the relays switched.
+    uint16_t relay_changes() const;
+    bool in_bootloader() const;
+    // The flash below the bootloader.
+    std::vector<uint8_t> firmware() const;
+
+private:
+    void publish(uint8_t air_in, uint8_t air_out, bool locked);
+
+    // Restarts the firmware with the given diagnostics, keeping the modes.
+    void restart(uint8_t reset_cause, uint8_t checkpoint, bool by_watchdog);
+    void boot_write(const uint8_t *data, size_t len);
+    bool firmware_valid() const;
+
+    void commit(uint8_t air_in, uint8_t air_out);
+
+    uint8_t address_;
+    mutable std::mutex mutex_;
+    std::array<uint8_t, REGISTER_FILE_SIZE> regs_{};
+    std::array<uint8_t, 3> staging_{};
+    uint8_t buffer_addr_ = 0xFF;
+    bool locked_ = false;
+    bool attention_ = false;
+    bool boot_request_ = false;
+    bool bootloader_ = false;
+    uint8_t boot_status_ = BOOT_STATUS_READY;
+    std::vector<uint8_t> flash_;
+    // The bootloader's trailer in EEPROM, see src/bootloader.h.
+    uint16_t trailer_length_ = 0xFFFF;
+    uint16_t trailer_crc_ = 0xFFFF;
+};
+
+class MockBus : public Bus {
+public:
+    // If realtime is set, transfers take as long as they would on a real bus at the given clock.
+    explicit MockBus(uint32_t scl_hz = 100000, bool realtime = false);
+
+    // Creates a slave at the given address, which must be free.
+    MockSlave &add_slave(uint8_t address = DEFAULT_ADDRESS);
+    // The slave currently at the given address, if any.
+    MockSlave *slave(uint8_t address);
+
+    void transfer(Message *messages, size_t count) override;
+
+    struct Stats {
+        uint64_t transfers = 0;
+        uint64_t messages = 0;
+        // Bytes on the wire, including address bytes.
+        uint64_t bytes = 0;
+        // Bit times on the wire, including START, STOP and ACK bits.
+        uint64_t bits = 0;
+        uint64_t nacks = 0;
+    };
+
+    Stats stats() const;
+    void reset_stats();
+    // The time the transfers so far would have taken on a real bus, in microseconds.
+    double wire_time_us() const;
+
+private:
+    MockSlave *find(uint8_t address);
+
+    const uint32_t scl_hz_;
+    const bool realtime_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<MockSlave>> slaves_;
+    Stats stats_;
+};
+
+} // namespace fan_control
+
+#endif //FAN_CONTROL_CLIENT_MOCK_BUS_HPP
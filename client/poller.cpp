@@ -0,0 +1,242 @@
+#include "poller.hpp"
+
+#include <exception>
+
+namespace fan_control {
+
+using std::chrono::steady_clock;
+
+const char *to_string(PollEvent::Kind kind) {
+    switch (kind) {
+        case PollEvent::DISCOVERED:
+            return "discovered";
+        case PollEvent::OVERRIDE_STARTED:
+            return "override-started";
+        case PollEvent::OVERRIDE_ENDED:
+            return "override-ended";
+        case PollEvent::MODES_CHANGED_BY_BUTTON:
+            return "modes-changed-by-button";
+        case PollEvent::MODES_CHANGED:
+            return "modes-changed";
+        case PollEvent::WATCHDOG_RESET:
+            return "watchdog-reset";
+        case PollEvent::OFFLINE:
+            return "offline";
+        case PollEvent::ONLINE:
+            return "online";
+    }
+    return "unknown";
+}
+
+Poller::Poller(PollPolicy policy, EventSink sink) : policy_(policy), sink_(std::move(sink)) {}
+
+Poller::~Poller() {
+    stop();
+}
+
+size_t Poller::add_bus(std::string name, Bus &bus) {
+    buses_.push_back(BusWorker{std::move(name), &bus, std::thread()});
+    queues_.emplace_back();
+    return buses_.size() - 1;
+}
+
+void Poller::add_device(size_t bus, uint8_t address) {
+    auto device = std::make_unique<Device>();
+    device->bus = bus;
+    device->address = address;
+    device->client = std::make_unique<Client>(*buses_.at(bus).bus, address);
+    device->interval = policy_.min_interval;
+    devices_.push_back(std::move(device));
+}
+
+void Poller::start() {
+    {
+        std::lock_guard<std::mutex> lock(schedule_mutex_);
+        stopping_ = false;
+        auto now = steady_clock::now();
+        for (auto &device : devices_) {
+            device->due = now;
+            queues_[device->bus].emplace(now, device.get());
+        }
+    }
+
+    for (size_t i = 0; i < buses_.size(); i++) {
+        buses_[i].thread = std::thread(&Poller::run_worker, this, i);
+    }
+}
+
+void Poller::stop() {
+    {
+        std::lock_guard<std::mutex> lock(schedule_mutex_);
+        stopping_ = true;
+        for (auto &queue : queues_) {
+            queue = {};
+        }
+    }
+    schedule_cv_.notify_all();
+
+    for (auto &bus : buses_) {
+        if (bus.thread.joinable()) {
+            bus.thread.join();
+        }
+    }
+}
+
+// Blocks until a device on the given bus is due, and takes it off the schedule. Returns nullptr once stopping.
+Poller::Device *Poller::next_due(size_t bus) {
+    std::unique_lock<std::mutex> lock(schedule_mutex_);
+    auto &queue = queues_[bus];
+
+    while (!stopping_) {
+        if (queue.empty()) {
+            schedule_cv_.wait(lock);
+            continue;
+        }
+
+        Entry next = queue.top();
+        if (next.first <= steady_clock::now()) {
+            queue.pop();
+            return next.second;
+        }
+        schedule_cv_.wait_until(lock, next.first);
+    }
+    return nullptr;
+}
+
+void Poller::reschedule(Device *device, bool changed, bool failed) {
+    std::lock_guard<std::mutex> lock(schedule_mutex_);
+    if (stopping_) {
+        return;
+    }
+
+    if (changed && !failed) {
+        // Things are happening, keep a close eye on it.
+        device->interval = policy_.min_interval;
+    } else {
+        device->interval *= 2;
+        if (device->interval > policy_.max_interval) {
+            device->interval = policy_.max_interval;
+        }
+        if (device->interval < policy_.min_interval) {
+            device->interval = policy_.min_interval;
+        }
+    }
+
+    // Schedule relative to now, not to when the poll was due, so a slow bus doesn't accumulate a backlog.
+    device->due = steady_clock::now() + device->interval;
+    queues_[device->bus].emplace(device->due, device);
+}
+
+void Poller::run_worker(size_t bus) {
+    while (Device *device = next_due(bus)) {
+        poll(device);
+    }
+}
+
+void Poller::poll(Device *device) {
+    auto start = steady_clock::now();
+    std::optional<State> result;
+    bool failed = false;
+    try {
+        result = device->client->poll();
+    } catch (const std::exception &) {
+        failed = true;
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::now() - start).count();
+
+    std::optional<State> previous;
+    std::vector<PollEvent::Kind> events;
+    {
+        std::lock_guard<std::mutex> lock(device->mutex);
+        device->polls++;
+        device->latency.record(static_cast<uint32_t>(us));
+
+        if (failed) {
+            device->errors++;
+            device->failures++;
+            if (device->online && device->failures == policy_.offline_after) {
+                device->online = false;
+                events.push_back(PollEvent::OFFLINE);
+            }
+        } else {
+            device->failures = 0;
+            previous = device->state;
+
+            if (result) {
+                const State &state = *result;
+                if (!previous) {
+                    events.push_back(PollEvent::DISCOVERED);
+                } else {
+                    device->changes++;
+                    if (!device->online) {
+                        events.push_back(PollEvent::ONLINE);
+                    }
+                    if (state.status.i2c_disabled() && !previous->status.i2c_disabled()) {
+                        events.push_back(PollEvent::OVERRIDE_STARTED);
+                    }
+                    if (state.air_in != previous->air_in || state.air_out != previous->air_out) {
+                        events.push_back(state.status.i2c_disabled() ? PollEvent::MODES_CHANGED_BY_BUTTON
+                                                                     : PollEvent::MODES_CHANGED);
+                    }
+                    if (!state.status.i2c_disabled() && previous->status.i2c_disabled()) {
+                        events.push_back(PollEvent::OVERRIDE_ENDED);
+                    }
+                }
+                if (state.status.watchdog_reset() && (!previous || !previous->status.watchdog_reset())) {
+                    events.push_back(PollEvent::WATCHDOG_RESET);
+                }
+                device->state = result;
+            } else if (!device->online) {
+                events.push_back(PollEvent::ONLINE);
+            }
+            device->online = true;
+        }
+    }
+
+    for (auto kind : events) {
+        emit(kind, *device, previous);
+    }
+    reschedule(device, result.has_value(), failed);
+}
+
+void Poller::emit(PollEvent::Kind kind, const Device &device, const std::optional<State> &previous) {
+    if (!sink_) {
+        return;
+    }
+
+    PollEvent event{kind, buses_[device.bus].name, device.address, std::nullopt, previous};
+    if (kind != PollEvent::OFFLINE) {
+        std::lock_guard<std::mutex> lock(device.mutex);
+        event.state = device.state;
+    }
+    sink_(event);
+}
+
+std::vector<DeviceStats> Poller::stats() const {
+    std::vector<DeviceStats> result;
+    result.reserve(devices_.size());
+
+    for (auto &device : devices_) {
+        std::chrono::microseconds interval;
+        {
+            std::lock_guard<std::mutex> lock(schedule_mutex_);
+            interval = device->interval;
+        }
+
+        std::lock_guard<std::mutex> lock(device->mutex);
+        result.push_back(DeviceStats{buses_[device->bus].name, device->address, device->polls, device->changes,
+                                     device->errors, device->online, interval, device->latency});
+    }
+    return result;
+}
+
+uint64_t Poller::polls() const {
+    uint64_t total = 0;
+    for (auto &device : devices_) {
+        std::lock_guard<std::mutex> lock(device->mutex);
+        total += device->polls;
+    }
+    return total;
+}
+
+} // namespace fan_control
@@ -0,0 +1,157 @@
+//
+// Polls many fan controllers on many buses concurrently.
+//
+// Every bus gets one worker thread, since transactions on one bus are serialized anyway, and buses are independent.
+// A shared scheduler decides which device is due next on each bus. Poll intervals adapt per device: A device that
+// changed is polled again after the minimum interval, and every poll without a change doubles its interval, up to
+// the maximum. Failing devices back off the same way and are reported offline after a few failures.
+//
+// Polls use Client::poll, i.e. they read the change sequence register and only read the full state if it changed.
+// Differences between consecutive states are reported as events, from the bus worker threads. Mode changes while the
+// lock bit in the status register is set were made with the button.
+//
+
+#ifndef FAN_CONTROL_CLIENT_POLLER_HPP
+#define FAN_CONTROL_CLIENT_POLLER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bus.hpp"
+#include "client.hpp"
+#include "latency_histogram.hpp"
+
+namespace fan_control {
+
+struct PollPolicy {
+    std::chrono::microseconds min_interval = std::chrono::milliseconds(100);
+    std::chrono::microseconds max_interval = std::chrono::seconds(5);
+    // Consecutive failures before a device is reported offline.
+    unsigned offline_after = 3;
+};
+
+struct PollEvent {
+    enum Kind {
+        // First successful poll of a device.
+        DISCOVERED,
+        // The button override was activated, I2C writes are locked out.
+        OVERRIDE_STARTED,
+        // The button override was deactivated.
+        OVERRIDE_ENDED,
+        // The modes were changed with the button, while the override is active.
+        MODES_CHANGED_BY_BUTTON,
+        // The modes were changed via I2C, by us or another master.
+        MODES_CHANGED,
+        // The device reports a watchdog reset.
+        WATCHDOG_RESET,
+        OFFLINE,
+        ONLINE,
+    };
+
+    Kind kind;
+    std::string bus;
+    uint8_t address;
+    // The new state. Empty for OFFLINE.
+    std::optional<State> state;
+    // The previous state, if there was one.
+    std::optional<State> previous;
+};
+
+const char *to_string(PollEvent::Kind kind);
+
+struct DeviceStats {
+    std::string bus;
+    uint8_t address;
+    uint64_t polls;
+    uint64_t changes;
+    uint64_t errors;
+    bool online;
+    std::chrono::microseconds interval;
+    LatencyHistogram latency;
+};
+
+class Poller {
+public:
+    using EventSink = std::function<void(const PollEvent &)>;
+
+    explicit Poller(PollPolicy policy = {}, EventSink sink = nullptr);
+    ~Poller();
+
+    Poller(const Poller &) = delete;
+    Poller &operator=(const Poller &) = delete;
+
+    // Buses and devices must be added before start(). The bus must outlive the poller.
+    size_t add_bus(std::string name, Bus &bus);
+    void add_device(size_t bus, uint8_t address);
+
+    // Starts one worker per bus. All devices are due right away.
+    void start();
+    // Stops and joins the workers. Polls in progress are finished.
+    void stop();
+
+    std::vector<DeviceStats> stats() const;
+    // Total number of polls over all devices, successful or not.
+    uint64_t polls() const;
+
+private:
+    struct Device {
+        size_t bus;
+        uint8_t address;
+        std::unique_ptr<Client> client;
+
+        // Owned by the scheduler.
+        std::chrono::steady_clock::time_point due;
+        std::chrono::microseconds interval;
+
+        // Owned by the bus worker, read by stats().
+        mutable std::mutex mutex;
+        std::optional<State> state;
+        unsigned failures = 0;
+        bool online = false;
+        uint64_t polls = 0;
+        uint64_t changes = 0;
+        uint64_t errors = 0;
+        LatencyHistogram latency;
+    };
+
+    struct BusWorker {
+        std::string name;
+        Bus *bus;
+        std::thread thread;
+    };
+
+    // Scheduling, shared by all workers.
+    using Entry = std::pair<std::chrono::steady_clock::time_point, Device *>;
+    struct Later {
+        bool operator()(const Entry &a, const Entry &b) const { return a.first > b.first; }
+    };
+    Device *next_due(size_t bus);
+    void reschedule(Device *device, bool changed, bool failed);
+
+    void run_worker(size_t bus);
+    void poll(Device *device);
+    void emit(PollEvent::Kind kind, const Device &device, const std::optional<State> &previous);
+
+    const PollPolicy policy_;
+    const EventSink sink_;
+
+    std::vector<BusWorker> buses_;
+    std::vector<std::unique_ptr<Device>> devices_;
+
+    mutable std::mutex schedule_mutex_;
+    std::condition_variable schedule_cv_;
+    std::vector<std::priority_queue<Entry, std::vector<Entry>, Later>> queues_;
+    bool stopping_ = false;
+};
+
+} // namespace fan_control
+
+#endif //FAN_CONTROL_CLIENT_POLLER_HPP
@@ -0,0 +1,97 @@
+//
+// The register map of the fan controller, as seen from the I2C master.
+//
+// The map itself is src/registers.h, which the firmware and the simulator use as well. Its layout constants, e.g.
+// TELEMETRY_*, SCHEDULE_*, BUTTON_LOG_*, BOOT_* and NUM_AIR_IN_MODES, are used as they are. The register addresses
+// and flags get shorter names in this namespace.
+//
+
+#ifndef FAN_CONTROL_CLIENT_REGISTERS_HPP
+#define FAN_CONTROL_CLIENT_REGISTERS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "../src/registers.h"
+
+namespace fan_control {
+
+// 7-bit I2C address, unless configured otherwise.
+constexpr uint8_t DEFAULT_ADDRESS = I2C_SLAVE_ADDRESS;
+constexpr uint8_t GENERAL_CALL_ADDRESS = 0x00;
+constexpr uint8_t ADDRESS_MIN = DEVICE_CONFIG_ADDRESS_MIN;
+constexpr uint8_t ADDRESS_MAX = DEVICE_CONFIG_ADDRESS_MAX;
+
+constexpr uint8_t REG_STATUS = I2C_REG_STATUS;
+constexpr uint8_t REG_AIR_IN = I2C_REG_AIR_IN;
+constexpr uint8_t REG_AIR_OUT = I2C_REG_AIR_OUT;
+constexpr uint8_t REG_CHANGE_SEQ = I2C_REG_CHANGE_SEQ;
+constexpr uint8_t REG_CONFIG = I2C_REG_CONFIG;
+constexpr uint8_t REG_PEC_READ_LENGTH = I2C_REG_PEC_READ_LENGTH;
+constexpr uint8_t REG_ADDRESS = I2C_REG_ADDRESS;
+constexpr uint8_t REG_GROUPS = I2C_REG_GROUPS;
+constexpr uint8_t REG_SCHEDULE_CONTROL = I2C_REG_SCHEDULE_CONTROL;
+constexpr uint8_t REG_SCHEDULE_LENGTH = I2C_REG_SCHEDULE_LENGTH;
+constexpr uint8_t REG_SCHEDULE_ENTRY = I2C_REG_SCHEDULE_ENTRY;
+constexpr uint8_t REG_SCHEDULE_REMAINING = I2C_REG_SCHEDULE_REMAINING;
+constexpr uint8_t REG_BUTTON_DEBOUNCE = I2C_REG_BUTTON_DEBOUNCE;
+constexpr uint8_t REG_BUTTON_LONG_PRESS = I2C_REG_BUTTON_LONG_PRESS;
+constexpr uint8_t REG_BUTTON_REPEAT = I2C_REG_BUTTON_REPEAT;
+constexpr uint8_t REG_BOOT = I2C_REG_BOOT;
+constexpr uint8_t REG_TELEMETRY = I2C_REG_TELEMETRY;
+constexpr uint8_t REG_SCHEDULE = I2C_REG_SCHEDULE;
+constexpr uint8_t REG_RELAY_ACTUATIONS = I2C_REG_RELAY_ACTUATIONS;
+constexpr uint8_t REG_BUTTON_LOG = I2C_REG_BUTTON_LOG;
+constexpr uint8_t REG_BRIGHTNESS = I2C_REG_BRIGHTNESS;
+constexpr uint8_t REG_DIAGNOSTICS = I2C_REG_DIAGNOSTICS;
+constexpr uint8_t REG_STACK_MONITOR = I2C_REG_STACK_MONITOR;
+constexpr uint8_t REG_TRACE = I2C_REG_TRACE;
+constexpr uint8_t REG_TWI_RECOVERIES = I2C_REG_TWI_RECOVERIES;
+constexpr size_t TWI_RECOVERIES_SIZE = I2C_TWI_RECOVERIES_SIZE;
+constexpr size_t REGISTER_FILE_SIZE = i2c_buffer_size;
+
+constexpr size_t NUM_RELAYS = TELEMETRY_RELAYS;
+
+// Reset causes and main loop checkpoints in the diagnostics block.
+constexpr uint8_t RESET_POWER_ON = DIAGNOSTICS_RESET_POWER_ON;
+constexpr uint8_t RESET_EXTERNAL = DIAGNOSTICS_RESET_EXTERNAL;
+constexpr uint8_t RESET_BROWN_OUT = DIAGNOSTICS_RESET_BROWN_OUT;
+constexpr uint8_t RESET_WATCHDOG = DIAGNOSTICS_RESET_WATCHDOG;
+constexpr uint8_t CHECKPOINT_NONE = DIAGNOSTICS_CHECKPOINT_NONE;
+constexpr uint8_t CHECKPOINT_SETUP = DIAGNOSTICS_CHECKPOINT_SETUP;
+constexpr uint8_t CHECKPOINT_LOOP = DIAGNOSTICS_CHECKPOINT_LOOP;
+constexpr uint8_t CHECKPOINT_BUTTON = DIAGNOSTICS_CHECKPOINT_BUTTON;
+constexpr uint8_t CHECKPOINT_SCHEDULE = DIAGNOSTICS_CHECKPOINT_SCHEDULE;
+constexpr uint8_t CHECKPOINT_OUTPUTS = DIAGNOSTICS_CHECKPOINT_OUTPUTS;
+constexpr uint8_t CHECKPOINT_EEPROM = DIAGNOSTICS_CHECKPOINT_EEPROM;
+constexpr uint8_t CHECKPOINT_SLEEP = DIAGNOSTICS_CHECKPOINT_SLEEP;
+
+// The TWI trace, recorded while CONFIG_TRACE is set.
+constexpr size_t TRACE_ENTRIES = TWI_TRACE_ENTRIES;
+constexpr size_t TRACE_ENTRY_SIZE = TWI_TRACE_ENTRY_SIZE;
+constexpr size_t TRACE_SIZE = TWI_TRACE_SIZE;
+constexpr uint8_t TRACE_UNUSED = TWI_TRACE_UNUSED;
+
+// Set while the button override is active and writes to the modes are ignored.
+constexpr uint8_t BIT_I2C_DISABLED = I2C_BIT_I2C_DISABLED;
+// Cleared after a watchdog reset, until the master sets it again.
+constexpr uint8_t BIT_WDT_RESET = I2C_BIT_WDT_RESET;
+
+constexpr uint8_t CONFIG_PEC = I2C_CONFIG_PEC;
+constexpr uint8_t CONFIG_TRACE = I2C_CONFIG_TRACE;
+constexpr uint8_t CONFIG_MASK = I2C_CONFIG_MASK;
+
+// Group commit frame, sent to the general call address.
+constexpr size_t GCALL_FRAME_MASTER = I2C_GCALL_FRAME_MASTER;
+constexpr size_t GCALL_FRAME_GROUPS = I2C_GCALL_FRAME_GROUPS;
+constexpr size_t GCALL_FRAME_AIR_IN = I2C_GCALL_FRAME_AIR_IN;
+constexpr size_t GCALL_FRAME_AIR_OUT = I2C_GCALL_FRAME_AIR_OUT;
+constexpr size_t GCALL_FRAME_SIZE = I2C_GCALL_FRAME_SIZE;
+constexpr uint8_t DEFAULT_GROUPS = DEVICE_CONFIG_DEFAULT_GROUPS;
+
+// Maximum number of data bytes the slave accepts in one write.
+constexpr size_t RX_SIZE = I2C_RX_SIZE;
+
+} // namespace fan_control
+
+#endif //FAN_CONTROL_CLIENT_REGISTERS_HPP
@@ -0,0 +1,1228 @@
+/*
+ * fan_control_sim.c
+ *
+ * Benchmark and regression harness for the fan_control firmware.
+ * This runs the real fan_control ELF under simavr, with a scripted I2C master talking to the slave at 0x22 and a
+ * simulated button on PIND5.
+ *
+ * simavr does not model SCL, it hands each bus event to the TWI peripheral immediately. The master here therefore
+ * models the bus itself: Every event takes as many bit times as it would on the wire, and if the firmware has not
+ * cleared TWINT by then, the real hardware would have stretched the clock until it does. That difference is what we
+ * report as clock-stretch time. The same goes for the rest of the ISR after that: The next event has to wait for it.
+ * Since the peripheral doesn't drive the pins either, a bus hang is simulated by pulling PINC4 (SDA) low from outside.
+ *
+ * TWI_vect is also profiled per TWSR status code: the cycles from its vector to the store that clears TWINT, and to its
+ * RETI, and checked against the budgets in src/twislave.c. To compare two firmware versions, run this on both ELFs.
+ * The same goes for the functions in PROFILED_FUNCTIONS, which turn the modes into relay and display patterns: they are
+ * found by name in the ELF's symbol table and timed per call, from their first instruction until they return. They
+ * are profiled first, while all mode combinations are set, so this part also works for firmware versions from before
+ * the current register map, back to the first one. Given a baseline ELF, its functions are profiled the same way
+ * first, and both are reported side by side.
+ *
+ * The CPU is considered asleep whenever simavr reports it as sleeping. Power figures are estimates based on typical
+ * datasheet currents, see ACTIVE_MA and IDLE_MA.
+ *
+ * Given the bootloader ELF as well, it is loaded into the boot section and started on reset, like with the BOOTRST fuse
+ * programmed. The firmware then hands over to it over I2C and is flashed again, see src/bootloader.h.
+ *
+ * Usage: fan_control_sim [--baseline <old fan_control.elf>] <fan_control.elf> [<fan_control_boot.elf>]
+ * Exits non-zero if the firmware does not behave as expected.
+ */
+
+#include <fcntl.h>
+#include <gelf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "avr_eeprom.h"
+#include "avr_ioport.h"
+#include "avr_twi.h"
+
+// The register map and the bootloader protocol, shared with the firmware.
+#include "../src/registers.h"
+
+// The board the firmware was built for, passed in by CMake. See src/board.h.
+#ifdef SIM_MCU
+#define MCU SIM_MCU
+#define F_CPU SIM_F_CPU
+#else
+#define MCU "atmega8"
+#define F_CPU 8000000UL
+#endif
+// The boot section, see src/bootloader.h.
+#ifdef SIM_BOOT_START
+#define BOOT_START SIM_BOOT_START
+#define BOOT_PAGE_SIZE SIM_BOOT_PAGE_SIZE
+#else
+#define BOOT_START 0x1800
+#define BOOT_PAGE_SIZE 64
+#endif
+// The EEPROM size of the MCU.
+#ifdef SIM_EEPROM_SIZE
+#define EEPROM_SIZE SIM_EEPROM_SIZE
+#else
+#define EEPROM_SIZE 512
+#endif
+// Timer 1 runs with a prescaler of 8 on all boards we have, see src/timer.h.
+#define TIMER1_PRESCALER 8
+
+// Data space addresses of TWCR and TWSR on the ATmega8 and ATmega328P.
+#define ADDR_TWCR_ATMEGA8 0x56
+#define ADDR_TWCR_ATMEGA328P 0xBC
+#define ADDR_TWSR_ATMEGA8 0x21
+#define ADDR_TWSR_ATMEGA328P 0xB9
+#define TWINT 7
+#define TWEN 2
+#define TW_STATUS_MASK 0xF8
+#define TW_ST_SLA_ACK 0xA8
+// Flash byte addresses of the TWI vector, number 17 with 2 byte vectors on the ATmega8 and 24 with 4 byte vectors on
+// the ATmega328P.
+#define VECTOR_TWI_ATMEGA8 0x22
+#define VECTOR_TWI_ATMEGA328P 0x60
+#define OPCODE_RETI 0x9518
+
+// Time the firmware gets to boot before we start talking to it.
+#define BOOT_MS 50
+// The relays switch one at a time, this many ms apart. See RELAY_DEAD_TIME_TICKS in relay.h.
+#define RELAY_STEP_MS 50
+// Time until the relays have certainly reached any new pattern, one step for each of the eight relays.
+#define RELAY_SETTLE_MS (8 * RELAY_STEP_MS + 10)
+// If the firmware doesn't clear TWINT within this time, the bus is considered stuck.
+#define STUCK_MS 100
+
+// Bit times per bus event: 9 for a byte plus ACK, and roughly one for START and STOP.
+#define BITS_BYTE 9
+#define BITS_CONDITION 1
+
+// Number of back-to-back transactions used to measure throughput.
+#define THROUGHPUT_TRANSACTIONS 200
+
+// Cycle budget of TWI_vect until it clears TWINT, see src/twislave.c: The entry all states share (vector, register
+// saves, timestamp and table lookup), plus one bit time at 400 kHz for the state itself. A pure read stages its first
+// byte before sending it and gets a few bit times more.
+#define TWI_ENTRY_CYCLES 72
+#define TWI_STATE_CYCLES (F_CPU / 400000)
+#define TWI_PURE_READ_CYCLES (4 * F_CPU / 400000)
+// Number of each kind of transaction used to profile TWI_vect.
+#define TWI_PROFILE_TRANSACTIONS 50
+
+// Functions that look up relay and display patterns, profiled per call. Older firmware versions only have some of them,
+// and whatever is inlined has no symbol.
+static const char *const PROFILED_FUNCTIONS[] = {
+        "drive_relays", "portb_relay_pattern", "drive_display", "display_show", "drive_digit",
+};
+#define NUM_PROFILED_FUNCTIONS (sizeof(PROFILED_FUNCTIONS) / sizeof(PROFILED_FUNCTIONS[0]))
+// How long each mode combination is left running while profiling them.
+#define FUNCTION_PROFILE_MS 20
+
+// Supply current used for the power estimate, in mA.
+// These are rough typical values for an ATmega8 at 8 MHz and 5V, taken from the datasheet's characteristics plots.
+// They only cover the MCU, not the relays or the display.
+#define SUPPLY_VOLTAGE 5.0
+#define ACTIVE_MA 11.0
+#define IDLE_MA 4.5
+// Number of installed controllers to extrapolate the power estimate to.
+#define FLEET_SIZE 100
+
+// Rated EEPROM write endurance, the same on all boards.
+#define EEPROM_ENDURANCE 100000UL
+// Number of mode changes used to measure EEPROM wear. This should cover the mode store ring a few times.
+#define EEPROM_COMMITS 256
+// How long to wait for a save to reach EEPROM, a few byte writes of 8.5ms each.
+#define EEPROM_SAVE_MS 60
+
+// Number of transactions and button presses for the stack flood, and the stack space that must be left after it.
+#define STACK_FLOOD_TRANSACTIONS 400
+#define STACK_MARGIN_MIN 128
+// The firmware scans for the stack high-water mark once per second, so this covers at least one full scan.
+#define STACK_SCAN_MS 2100
+
+// SDA and SCL on PORTC, pulled up while nobody drives them.
+#define PIN_SDA 4
+#define PIN_SCL 5
+// The firmware resets the TWI 30 to 40 ms after the bus hangs, see TWI_HANG_TICKS in src/twislave.c.
+#define TWI_HANG_MS_MIN 30
+#define TWI_HANG_MS_MAX 40
+// How long to wait for the recovery before giving up.
+#define TWI_RECOVERY_WAIT_MS 200
+
+// Time until the firmware has handed over, waiting for the relays and the EEPROM.
+#define BOOT_ENTER_MS (RELAY_SETTLE_MS + EEPROM_SAVE_MS)
+
+typedef struct {
+    uint32_t scl_hz;
+    // Whether to use SMBus PEC, and whether to send a wrong one on writes.
+    int pec;
+    int corrupt_pec;
+    // Clock stretching observed so far, in cycles.
+    avr_cycle_count_t stretch_max;
+    avr_cycle_count_t stretch_total;
+    uint32_t stretch_count;
+} bus_t;
+
+// TWI_vect, profiled for one TWSR status code.
+typedef struct {
+    uint32_t count;
+    // From the event to the vector, i.e. waiting for other ISRs, interrupts being disabled or waking up.
+    avr_cycle_count_t latency_max;
+    // From the vector to TWINT cleared, and to the RETI.
+    avr_cycle_count_t release_max;
+    avr_cycle_count_t isr_max;
+    avr_cycle_count_t isr_total;
+} twi_profile_t;
+
+// One of PROFILED_FUNCTIONS.
+typedef struct {
+    avr_flashaddr_t entry;
+    // SP at the entry, while a call is in progress, or 0.
+    uint16_t sp;
+    avr_cycle_count_t started;
+    uint32_t calls;
+    avr_cycle_count_t min;
+    avr_cycle_count_t max;
+    avr_cycle_count_t total;
+} function_profile_t;
+
+static avr_t *avr;
+// The firmware under test and the bootloader, as loaded by start_firmware.
+static elf_firmware_t firmware;
+static elf_firmware_t bootloader;
+static uint16_t addr_twcr;
+static uint16_t addr_twsr;
+static avr_flashaddr_t vector_twi;
+static avr_irq_t *twi_input;
+static avr_irq_t *button;
+static avr_irq_t *sda;
+
+// The last byte the slave sent.
+static uint8_t twi_output_data;
+// The last value written to PORTB, and when.
+static uint8_t portb;
+static avr_cycle_count_t portb_changed_at;
+
+// Cycles the CPU spent sleeping so far.
+static avr_cycle_count_t sleep_cycles;
+
+// Where bus events are profiled, indexed by status code >> 3, or NULL.
+static twi_profile_t *twi_profile;
+
+// Profiles of PROFILED_FUNCTIONS, while profiling them.
+static function_profile_t function_profile[NUM_PROFILED_FUNCTIONS];
+static int functions_profiled;
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { fprintf(stderr, "FAIL: " __VA_ARGS__); fputc('\n', stderr); failures++; } } while (0)
+
+static avr_cycle_count_t ms_to_cycles(uint32_t ms) {
+    return (avr_cycle_count_t) ms * (F_CPU / 1000);
+}
+
+static double cycles_to_us(avr_cycle_count_t cycles) {
+    return (double) cycles * 1e6 / F_CPU;
+}
+
+static void twi_output_hook(struct avr_irq_t *irq, uint32_t value, void *param) {
+    avr_twi_msg_irq_t msg;
+    msg.u.v = value;
+
+    if (msg.u.twi.msg & TWI_COND_READ) {
+        twi_output_data = msg.u.twi.data;
+    }
+}
+
+static void portb_hook(struct avr_irq_t *irq, uint32_t value, void *param) {
+    if ((uint8_t) value != portb) {
+        portb = value;
+        portb_changed_at = avr->cycle;
+    }
+}
+
+static uint16_t stack_pointer(void) {
+    return avr->data[R_SPL] | avr->data[R_SPH] << 8;
+}
+
+// Times calls of the profiled functions. Call this after every instruction.
+// A call ends when its RET pops the return address, i.e. SP goes above where it was at the entry. Interrupts in the
+// middle of a call push and pop their own frames, so they don't end it, but their cycles are counted. The minimum is
+// the one to compare.
+static void profile_functions(void) {
+    uint16_t sp = stack_pointer();
+
+    for (size_t i = 0; i < NUM_PROFILED_FUNCTIONS; i++) {
+        function_profile_t *profile = &function_profile[i];
+        if (!profile->entry) {
+            continue;
+        }
+        if (!profile->sp) {
+            if (avr->pc == profile->entry) {
+                profile->sp = sp;
+                profile->started = avr->cycle;
+            }
+        } else if (sp > profile->sp) {
+            avr_cycle_count_t cycles = avr->cycle - profile->started;
+            profile->sp = 0;
+            profile->calls++;
+            profile->total += cycles;
+            if (!profile->min || cycles < profile->min) {
+                profile->min = cycles;
+            }
+            if (cycles > profile->max) {
+                profile->max = cycles;
+            }
+        }
+    }
+}
+
+// Runs the simulation for the given number of cycles.
+static void run_cycles(avr_cycle_count_t cycles) {
+    avr_cycle_count_t end = avr->cycle + cycles;
+
+    while (avr->cycle < end) {
+        avr_cycle_count_t before = avr->cycle;
+        int sleeping = avr->state == cpu_Sleeping;
+        int state = avr_run(avr);
+        if (sleeping) {
+            sleep_cycles += avr->cycle - before;
+        }
+        if (functions_profiled) {
+            profile_functions();
+        }
+        if (state == cpu_Done || state == cpu_Crashed) {
+            fprintf(stderr, "firmware stopped (state %d) at cycle %llu\n", state, (unsigned long long) avr->cycle);
+            exit(2);
+        }
+    }
+}
+
+// Bitwise CRC-8 for SMBus PEC, deliberately not the firmware's table.
+static uint8_t crc8(uint8_t crc, uint8_t data) {
+    crc ^= data;
+    for (int i = 0; i < 8; i++) {
+        crc = (crc & 0x80) ? (uint8_t) ((crc << 1) ^ 0x07) : (uint8_t) (crc << 1);
+    }
+    return crc;
+}
+
+// Returns the instruction at the program counter.
+static uint16_t next_opcode(void) {
+    return avr->flash[avr->pc] | avr->flash[avr->pc + 1] << 8;
+}
+
+// Puts one event on the bus and waits until it is over.
+// That is either after the given number of bit times, or when the firmware has handled the event, whichever is later.
+static void bus_event(bus_t *bus, uint8_t condition, uint8_t addr, uint8_t data, uint8_t bits) {
+    avr_cycle_count_t start = avr->cycle;
+    avr_cycle_count_t wire = (avr_cycle_count_t) bits * (F_CPU / bus->scl_hz);
+    avr_cycle_count_t entered = 0;
+
+    avr_raise_irq(twi_input, avr_twi_irq_msg(condition, addr, data));
+    uint8_t status = avr->data[addr_twsr] & TW_STATUS_MASK;
+
+    while (avr->data[addr_twcr] & (1 << TWINT)) {
+        if (avr->cycle - start > ms_to_cycles(STUCK_MS)) {
+            fprintf(stderr, "slave did not clear TWINT after condition 0x%02x\n", condition);
+            exit(2);
+        }
+        run_cycles(1);
+        if (!entered && avr->pc == vector_twi) {
+            entered = avr->cycle;
+        }
+    }
+    avr_cycle_count_t released = avr->cycle;
+
+    // Then run the rest of the ISR. ISRs don't nest, so the first RETI is its own.
+    if (entered) {
+        uint16_t opcode;
+        do {
+            opcode = next_opcode();
+            run_cycles(1);
+        } while (opcode != OPCODE_RETI);
+
+        if (twi_profile) {
+            twi_profile_t *profile = &twi_profile[status >> 3];
+            profile->count++;
+            if (entered - start > profile->latency_max) {
+                profile->latency_max = entered - start;
+            }
+            if (released - entered > profile->release_max) {
+                profile->release_max = released - entered;
+            }
+            if (avr->cycle - entered > profile->isr_max) {
+                profile->isr_max = avr->cycle - entered;
+            }
+            profile->isr_total += avr->cycle - entered;
+        }
+    }
+
+    avr_cycle_count_t handled = avr->cycle - start;
+    if (handled > wire) {
+        avr_cycle_count_t stretch = handled - wire;
+        bus->stretch_total += stretch;
+        bus->stretch_count++;
+        if (stretch > bus->stretch_max) {
+            bus->stretch_max = stretch;
+        }
+    } else {
+        run_cycles(wire - handled);
+    }
+}
+
+// Writes len bytes, starting at reg.
+static void i2c_write(bus_t *bus, uint8_t reg, const uint8_t *data, uint8_t len) {
+    uint8_t addr = I2C_SLAVE_ADDRESS << 1;
+    uint8_t crc = crc8(crc8(0, addr), reg);
+
+    bus_event(bus, TWI_COND_START | TWI_COND_ADDR, addr, 0, BITS_CONDITION + BITS_BYTE);
+    bus_event(bus, TWI_COND_WRITE, addr, reg, BITS_BYTE);
+    for (uint8_t i = 0; i < len; i++) {
+        bus_event(bus, TWI_COND_WRITE, addr, data[i], BITS_BYTE);
+        crc = crc8(crc, data[i]);
+    }
+    if (bus->pec) {
+        bus_event(bus, TWI_COND_WRITE, addr, bus->corrupt_pec ? crc ^ 0x01 : crc, BITS_BYTE);
+    }
+    bus_event(bus, TWI_COND_STOP, addr, 0, BITS_CONDITION);
+}
+
+// Sends the address byte of a read and reads len bytes, with crc covering everything before the data.
+static void read_bytes(bus_t *bus, uint8_t crc, uint8_t *data, uint8_t len) {
+    uint8_t addr = I2C_SLAVE_ADDRESS << 1;
+    uint8_t total = bus->pec ? len + 1 : len;
+
+    bus_event(bus, TWI_COND_START | TWI_COND_ADDR, addr | 1, 0, BITS_CONDITION + BITS_BYTE);
+    for (uint8_t i = 0; i < total; i++) {
+        // ACK every byte but the last.
+        uint8_t ack = (i + 1 < total) ? TWI_COND_ACK : 0;
+        bus_event(bus, TWI_COND_READ | ack, addr | 1, 0, BITS_BYTE);
+        if (i < len) {
+            data[i] = twi_output_data;
+            crc = crc8(crc, data[i]);
+        } else {
+            CHECK(twi_output_data == crc, "read PEC 0x%02x, expected 0x%02x", twi_output_data, crc);
+        }
+    }
+    bus_event(bus, TWI_COND_STOP, addr | 1, 0, BITS_CONDITION);
+}
+
+// Reads len bytes, starting at reg, using a write+read transaction with a repeated start.
+// With PEC, len must match the configured read length, and the PEC is checked.
+static void i2c_read(bus_t *bus, uint8_t reg, uint8_t *data, uint8_t len) {
+    uint8_t addr = I2C_SLAVE_ADDRESS << 1;
+
+    bus_event(bus, TWI_COND_START | TWI_COND_ADDR, addr, 0, BITS_CONDITION + BITS_BYTE);
+    bus_event(bus, TWI_COND_WRITE, addr, reg, BITS_BYTE);
+    read_bytes(bus, crc8(crc8(crc8(0, addr), reg), addr | 1), data, len);
+}
+
+// Reads len bytes from the start of the register file, without writing a register address first.
+static void i2c_read_pure(bus_t *bus, uint8_t *data, uint8_t len) {
+    read_bytes(bus, crc8(0, I2C_SLAVE_ADDRESS << 1 | 1), data, len);
+}
+
+static void set_modes(bus_t *bus, uint8_t air_in, uint8_t air_out) {
+    uint8_t data[2] = {air_in, air_out};
+    i2c_write(bus, I2C_REG_AIR_IN, data, sizeof(data));
+}
+
+static void press_button(uint32_t ms) {
+    avr_raise_irq(button, 0);
+    run_cycles(ms_to_cycles(ms));
+    avr_raise_irq(button, 1);
+}
+
+// Returns the flash byte address of the function called name in the ELF at path, or 0 if there is none.
+static avr_flashaddr_t elf_function(const char *path, const char *name) {
+    avr_flashaddr_t addr = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    elf_version(EV_CURRENT);
+    Elf *elf = elf_begin(fd, ELF_C_READ, NULL);
+    Elf_Scn *scn = NULL;
+    while (elf && !addr && (scn = elf_nextscn(elf, scn)) != NULL) {
+        GElf_Shdr shdr;
+        if (!gelf_getshdr(scn, &shdr) || shdr.sh_type != SHT_SYMTAB) {
+            continue;
+        }
+        Elf_Data *data = elf_getdata(scn, NULL);
+        for (size_t i = 0; data && i < shdr.sh_size / shdr.sh_entsize; i++) {
+            GElf_Sym sym;
+            if (gelf_getsym(data, (int) i, &sym) && GELF_ST_TYPE(sym.st_info) == STT_FUNC &&
+                strcmp(elf_strptr(elf, shdr.sh_link, sym.st_name), name) == 0) {
+                addr = (avr_flashaddr_t) sym.st_value;
+                break;
+            }
+        }
+    }
+    if (elf) {
+        elf_end(elf);
+    }
+    close(fd);
+    return addr;
+}
+
+// Profiles the functions that turn the modes into relay and display patterns, while going through all modes, with
+// the ones that are out of range. Only uses the modes registers, so this works on any firmware version.
+static void profile_lookups(const char *path) {
+    bus_t bus = {.scl_hz = 400000};
+
+    memset(function_profile, 0, sizeof(function_profile));
+    for (size_t i = 0; i < NUM_PROFILED_FUNCTIONS; i++) {
+        function_profile[i].entry = elf_function(path, PROFILED_FUNCTIONS[i]);
+    }
+    functions_profiled = 1;
+    for (uint8_t in = 0; in <= 7; in++) {
+        for (uint8_t out = 0; out <= 5; out++) {
+            set_modes(&bus, in, out);
+            run_cycles(ms_to_cycles(FUNCTION_PROFILE_MS));
+        }
+    }
+    functions_profiled = 0;
+}
+
+// Prints one column group of report_lookups, padded to full width if more follow.
+static void report_lookup(const function_profile_t *profile, int pad) {
+    if (profile->entry && profile->calls) {
+        printf("  %6lu %5llu %5llu %5llu", (unsigned long) profile->calls, (unsigned long long) profile->min,
+               (unsigned long long) (profile->total / profile->calls), (unsigned long long) profile->max);
+    } else {
+        printf("  %6s%s", profile->entry ? "0" : "-", pad ? "                  " : "");
+    }
+}
+
+// Prints the profiles of the pattern lookups, next to those of the baseline if given. A function without a symbol is
+// shown as -, e.g. because it is inlined or doesn't exist in that version.
+static void report_lookups(const function_profile_t *baseline) {
+    printf("--- pattern lookups ---\n");
+    if (baseline) {
+        printf("  %-20s  %-24s  %s\n", "", "baseline", "this version");
+        printf("  %-20s   calls   min   avg   max   calls   min   avg   max (cycles)\n", "function");
+    } else {
+        printf("  %-20s   calls   min   avg   max (cycles)\n", "function");
+    }
+    for (size_t i = 0; i < NUM_PROFILED_FUNCTIONS; i++) {
+        printf("  %-20s", PROFILED_FUNCTIONS[i]);
+        if (baseline) {
+            report_lookup(&baseline[i], 1);
+        }
+        report_lookup(&function_profile[i], 0);
+        printf("\n");
+    }
+}
+
+// Measures a single write and read transaction, the time until the relays follow a write, and throughput.
+static void bench_bus(uint32_t scl_hz) {
+    bus_t bus = {.scl_hz = scl_hz};
+    uint8_t status[3];
+
+    printf("--- I2C at %lu kHz ---\n", (unsigned long) (scl_hz / 1000));
+
+    // Latency of a single mode write, from the write to register 0x02 until PORTB starts changing, and until the last
+    // relay has switched.
+    uint8_t before = portb;
+    avr_cycle_count_t start = avr->cycle;
+    set_modes(&bus, 4, 3);
+    avr_cycle_count_t write_done = avr->cycle;
+    // The write to 0x02 is committed at the STOP condition, which is the last thing on the bus.
+    avr_cycle_count_t commit_at = write_done - BITS_CONDITION * (F_CPU / scl_hz);
+    run_cycles(ms_to_cycles(20));
+    CHECK(portb != before, "PORTB did not change after writing modes");
+    printf("write transaction:      %8.1f us\n", cycles_to_us(write_done - start));
+    printf("0x02 write -> PORTB:    %8.1f us\n", cycles_to_us(portb_changed_at - commit_at));
+    run_cycles(ms_to_cycles(RELAY_SETTLE_MS));
+    printf("0x02 write -> settled:  %8.1f us\n", cycles_to_us(portb_changed_at - commit_at));
+
+    // Latency of a read, and read-back of the modes we just set.
+    start = avr->cycle;
+    i2c_read(&bus, I2C_REG_STATUS, status, sizeof(status));
+    printf("read transaction:       %8.1f us\n", cycles_to_us(avr->cycle - start));
+    CHECK(status[1] == 4 && status[2] == 3, "read back modes %d/%d, expected 4/3", status[1], status[2]);
+
+    // Back-to-back transactions.
+    start = avr->cycle;
+    for (int i = 0; i < THROUGHPUT_TRANSACTIONS; i++) {
+        if (i % 2) {
+            set_modes(&bus, i % 7, i % 5);
+        } else {
+            i2c_read(&bus, I2C_REG_STATUS, status, sizeof(status));
+        }
+    }
+    double seconds = (double) (avr->cycle - start) / F_CPU;
+    printf("max transactions/s:     %8.0f\n", THROUGHPUT_TRANSACTIONS / seconds);
+
+    printf("clock stretch max:      %8.1f us\n", cycles_to_us(bus.stretch_max));
+    printf("clock stretch avg:      %8.1f us (%lu stretched events)\n",
+           bus.stretch_count ? cycles_to_us(bus.stretch_total / bus.stretch_count) : 0.0,
+           (unsigned long) bus.stretch_count);
+}
+
+// Prints the profile of TWI_vect per status code, and checks the time until it clears TWINT against the budget.
+static void report_twi_profile(const char *name, const twi_profile_t *profile, avr_cycle_count_t sla_r_budget) {
+    printf("%s\n", name);
+    printf("  status  events  latency max  to TWINT cleared  to RETI\n");
+    for (int i = 0; i < 32; i++) {
+        if (!profile[i].count) {
+            continue;
+        }
+        uint8_t status = i << 3;
+        avr_cycle_count_t budget = TWI_ENTRY_CYCLES + (status == TW_ST_SLA_ACK ? sla_r_budget : TWI_STATE_CYCLES);
+        printf("    0x%02x  %6lu  %11llu  %16llu  %7llu\n", status, (unsigned long) profile[i].count,
+               (unsigned long long) profile[i].latency_max, (unsigned long long) profile[i].release_max,
+               (unsigned long long) profile[i].isr_max);
+        CHECK(profile[i].release_max <= budget, "TWI_vect took %llu cycles to clear TWINT for status 0x%02x, budget %llu",
+              (unsigned long long) profile[i].release_max, status, (unsigned long long) budget);
+    }
+}
+
+// The states of TWI_vect, as in the cycle budget table in src/twislave.c, with the status codes they handle. The last
+// one, RESET, handles all others.
+static const struct {
+    const char *name;
+    const char *statuses;
+    uint8_t status[2];
+} TWI_STATES[] = {
+        {"SR_SLA", "0x60", {0x60, 0x60}},
+        {"SR_GCALL", "0x70", {0x70, 0x70}},
+        {"SR_DATA", "0x80, 0x90", {0x80, 0x90}},
+        {"SR_STOP", "0xA0", {0xA0, 0xA0}},
+        {"ST_SLA", "0xA8", {TW_ST_SLA_ACK, TW_ST_SLA_ACK}},
+        {"ST_DATA", "0xB8", {0xB8, 0xB8}},
+        {"RESET", "all others", {0, 0}},
+};
+#define NUM_TWI_STATES (sizeof(TWI_STATES) / sizeof(TWI_STATES[0]))
+
+static size_t twi_state(uint8_t status) {
+    for (size_t i = 0; i < NUM_TWI_STATES - 1; i++) {
+        if (status == TWI_STATES[i].status[0] || status == TWI_STATES[i].status[1]) {
+            return i;
+        }
+    }
+    return NUM_TWI_STATES - 1;
+}
+
+// Prints the maximum cycles per state of TWI_vect in the layout of the cycle budget table in src/twislave.c, so the
+// estimates there can be replaced with what was measured. Unlike that table, these include the entry all states share.
+// ST_SLA of a pure read has a budget of its own, so it gets a row of its own.
+static void report_twi_table(const twi_profile_t *combined, const twi_profile_t *pure) {
+    avr_cycle_count_t release_max[NUM_TWI_STATES] = {0}, isr_max[NUM_TWI_STATES] = {0};
+    uint32_t count[NUM_TWI_STATES] = {0};
+    for (int i = 0; i < 32; i++) {
+        uint8_t status = i << 3;
+        const twi_profile_t *profiles[] = {&combined[i], status == TW_ST_SLA_ACK ? NULL : &pure[i]};
+        for (size_t j = 0; j < 2; j++) {
+            if (profiles[j] && profiles[j]->count) {
+                size_t state = twi_state(status);
+                count[state] += profiles[j]->count;
+                if (profiles[j]->release_max > release_max[state]) {
+                    release_max[state] = profiles[j]->release_max;
+                }
+                if (profiles[j]->isr_max > isr_max[state]) {
+                    isr_max[state] = profiles[j]->isr_max;
+                }
+            }
+        }
+    }
+
+    printf("cycle budget table, measured from the vector:\n");
+    printf("  state     status       to TWINT cleared  to RETI\n");
+    for (size_t i = 0; i < NUM_TWI_STATES; i++) {
+        if (count[i]) {
+            printf("  %-9s %-12s %9llu cycles %7llu cycles\n", TWI_STATES[i].name, TWI_STATES[i].statuses,
+                   (unsigned long long) release_max[i], (unsigned long long) isr_max[i]);
+        } else {
+            printf("  %-9s %-12s         -\n", TWI_STATES[i].name, TWI_STATES[i].statuses);
+        }
+    }
+    const twi_profile_t *sla_r = &pure[TW_ST_SLA_ACK >> 3];
+    if (sla_r->count) {
+        printf("  ST_SLA    pure read    %9llu cycles %7llu cycles\n", (unsigned long long) sla_r->release_max,
+               (unsigned long long) sla_r->isr_max);
+    }
+}
+
+// Profiles TWI_vect at 400 kHz: writes, reads with a repeated START from a few places up to the whole register file,
+// and pure reads. All numbers are in cycles.
+static void bench_twi_profile(void) {
+    bus_t bus = {.scl_hz = 400000};
+    static twi_profile_t combined[32], pure[32];
+    uint8_t data[i2c_buffer_size];
+
+    printf("--- TWI_vect at 400 kHz ---\n");
+
+    twi_profile = combined;
+    for (int i = 0; i < TWI_PROFILE_TRANSACTIONS; i++) {
+        set_modes(&bus, i % 7, i % 5);
+        i2c_read(&bus, I2C_REG_STATUS, data, 3);
+        i2c_read(&bus, I2C_REG_TELEMETRY + TELEMETRY_TWI_ISR_TIME_MAX, data, 4);
+        i2c_read(&bus, I2C_REG_STATUS, data, sizeof(data));
+    }
+    twi_profile = pure;
+    for (int i = 0; i < TWI_PROFILE_TRANSACTIONS; i++) {
+        i2c_read_pure(&bus, data, 3);
+    }
+    twi_profile = NULL;
+
+    printf("budget to TWINT cleared: %d + %lu, one byte on the wire: %lu\n", TWI_ENTRY_CYCLES,
+           (unsigned long) TWI_STATE_CYCLES, (unsigned long) (BITS_BYTE * F_CPU / 400000));
+    report_twi_profile("writes and write+reads:", combined, TWI_STATE_CYCLES);
+    report_twi_profile("pure reads:", pure, TWI_PURE_READ_CYCLES);
+    report_twi_table(combined, pure);
+}
+
+// Returns the average cycles TWI_vect took per event for a mix of writes and reads.
+static avr_cycle_count_t twi_isr_average(bus_t *bus) {
+    static twi_profile_t profile[32];
+    uint8_t status[3];
+    avr_cycle_count_t total = 0;
+    uint32_t count = 0;
+
+    memset(profile, 0, sizeof(profile));
+    twi_profile = profile;
+    for (int i = 0; i < TWI_PROFILE_TRANSACTIONS; i++) {
+        set_modes(bus, i % 7, i % 5);
+        i2c_read(bus, I2C_REG_STATUS, status, sizeof(status));
+    }
+    twi_profile = NULL;
+
+    for (int i = 0; i < 32; i++) {
+        total += profile[i].isr_total;
+        count += profile[i].count;
+    }
+    return total / count;
+}
+
+// Checks that the TWI trace records a write as the firmware saw it, and measures what recording costs.
+static void bench_trace(void) {
+    bus_t bus = {.scl_hz = 400000};
+    uint8_t config = I2C_CONFIG_TRACE;
+    uint8_t modes[2] = {3, 2};
+    uint8_t trace[1 + TWI_TRACE_ENTRIES * 4];
+    // Newest first: the read of the trace (register address, SLA+W), then the write of the modes (STOP, two data
+    // bytes, register address, SLA+W).
+    static const uint8_t expected[][2] = {
+            {0x80, 0xFF}, {0x60, 0xFF}, {0xA0, I2C_REG_AIR_IN}, {0x80, I2C_REG_AIR_IN}, {0x80, I2C_REG_AIR_IN},
+            {0x80, 0xFF}, {0x60, 0xFF},
+    };
+
+    printf("--- TWI trace ---\n");
+
+    avr_cycle_count_t without = twi_isr_average(&bus);
+    i2c_write(&bus, I2C_REG_CONFIG, &config, 1);
+    avr_cycle_count_t with = twi_isr_average(&bus);
+    printf("TWI_vect average:       %8llu cycles without trace, %llu with\n", (unsigned long long) without,
+           (unsigned long long) with);
+
+    i2c_write(&bus, I2C_REG_AIR_IN, modes, sizeof(modes));
+    i2c_read(&bus, I2C_REG_TRACE, trace, sizeof(trace));
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+        const uint8_t *entry = &trace[1 + ((uint8_t) (trace[0] - 1 - i) % TWI_TRACE_ENTRIES) * 4];
+        CHECK(entry[0] == expected[i][0] && entry[1] == expected[i][1],
+              "trace entry %zu is status 0x%02x register 0x%02x, expected 0x%02x 0x%02x", i, entry[0], entry[1],
+              expected[i][0], expected[i][1]);
+    }
+
+    config = 0;
+    i2c_write(&bus, I2C_REG_CONFIG, &config, 1);
+}
+
+// A master that goes away in the middle of a read, while the firmware holds SDA low to send a zero bit.
+// Checks that the firmware resets its TWI in time, without rebooting or touching the relays, and counts it.
+static void bench_twi_recovery(void) {
+    bus_t bus = {.scl_hz = 100000};
+    uint8_t addr = I2C_SLAVE_ADDRESS << 1 | 1;
+    uint8_t status[3];
+    uint8_t recoveries[2];
+
+    printf("--- TWI recovery ---\n");
+
+    set_modes(&bus, 4, 3);
+    run_cycles(ms_to_cycles(RELAY_SETTLE_MS));
+    uint8_t relays = portb;
+    avr_cycle_count_t relays_changed_at = portb_changed_at;
+
+    // Take one byte and ACK it, so the firmware sends the next one, then stop clocking.
+    bus_event(&bus, TWI_COND_START | TWI_COND_ADDR, addr, 0, BITS_CONDITION + BITS_BYTE);
+    bus_event(&bus, TWI_COND_READ | TWI_COND_ACK, addr, 0, BITS_BYTE);
+    avr_raise_irq(sda, 0);
+    avr_cycle_count_t hung_at = avr->cycle;
+
+    // Disabling the TWI is the first thing the recovery does.
+    while (avr->data[addr_twcr] & (1 << TWEN)) {
+        if (avr->cycle - hung_at > ms_to_cycles(TWI_RECOVERY_WAIT_MS)) {
+            break;
+        }
+        run_cycles(1);
+    }
+    double recovered_ms = cycles_to_us(avr->cycle - hung_at) / 1000;
+    avr_raise_irq(sda, 1);
+    // Let init_twi_slave finish.
+    run_cycles(ms_to_cycles(1));
+
+    printf("hang -> TWI reset:      %8.1f ms\n", recovered_ms);
+    CHECK(recovered_ms >= TWI_HANG_MS_MIN && recovered_ms <= TWI_HANG_MS_MAX + 1,
+          "TWI reset %.1f ms after the hang, expected %d to %d", recovered_ms, TWI_HANG_MS_MIN, TWI_HANG_MS_MAX);
+
+    i2c_read(&bus, I2C_REG_TWI_RECOVERIES, recoveries, sizeof(recoveries));
+    CHECK((recoveries[0] | recoveries[1] << 8) == 1, "%u TWI recoveries counted, expected 1",
+          recoveries[0] | recoveries[1] << 8);
+    i2c_read(&bus, I2C_REG_STATUS, status, sizeof(status));
+    CHECK(status[1] == 4 && status[2] == 3, "modes are %d/%d after the recovery, expected 4/3", status[1], status[2]);
+    CHECK(portb == relays && portb_changed_at == relays_changed_at, "the relays switched during the recovery");
+}
+
+// Walks through the manual mode: long press selects the left digit, a short press changes air-in.
+static void bench_button(void) {
+    bus_t bus = {.scl_hz = 100000};
+    uint8_t status[3];
+
+    printf("--- Button ---\n");
+
+    set_modes(&bus, 0, 0);
+    run_cycles(ms_to_cycles(20));
+
+    press_button(600);
+    run_cycles(ms_to_cycles(20));
+    i2c_read(&bus, I2C_REG_STATUS, status, sizeof(status));
+    CHECK(status[0] & I2C_BIT_I2C_DISABLED, "long press did not disable I2C writes");
+
+    uint8_t before = portb;
+    press_button(100);
+    avr_cycle_count_t released = avr->cycle;
+    run_cycles(ms_to_cycles(50));
+    CHECK(portb != before, "short press did not change the relays");
+    printf("release -> PORTB:       %8.1f us\n", cycles_to_us(portb_changed_at - released));
+    i2c_read(&bus, I2C_REG_STATUS, status, sizeof(status));
+    CHECK(status[1] == 1, "short press set air-in to %d, expected 1", status[1]);
+
+    // Select the right digit, then back to I2C mode.
+    press_button(600);
+    run_cycles(ms_to_cycles(20));
+    press_button(600);
+    run_cycles(ms_to_cycles(20));
+    i2c_read(&bus, I2C_REG_STATUS, status, sizeof(status));
+    CHECK(!(status[0] & I2C_BIT_I2C_DISABLED), "I2C writes still disabled after cycling through digits");
+}
+
+// Prints the fraction of time spent asleep over the given window, and what that means for power.
+static void report_sleep(const char *name, avr_cycle_count_t start, avr_cycle_count_t slept) {
+    double asleep = (double) slept / (double) (avr->cycle - start);
+    double ma = asleep * IDLE_MA + (1.0 - asleep) * ACTIVE_MA;
+    double mw = ma * SUPPLY_VOLTAGE;
+
+    printf("%-22s  %5.1f%% asleep, ~%.1f mA, ~%.0f mW, ~%.1f kWh/year for %d controllers\n",
+           name, asleep * 100.0, ma, mw, mw * 24 * 365 / 1e6 * FLEET_SIZE, FLEET_SIZE);
+}
+
+// Measures how much time the firmware spends sleeping while idle, and while being polled as fast as the bus allows.
+static void bench_sleep(void) {
+    bus_t bus = {.scl_hz = 100000};
+    uint8_t status[3];
+
+    printf("--- Sleep ---\n");
+
+    avr_cycle_count_t start = avr->cycle;
+    avr_cycle_count_t slept = sleep_cycles;
+    run_cycles(ms_to_cycles(1000));
+    report_sleep("idle:", start, sleep_cycles - slept);
+
+    start = avr->cycle;
+    slept = sleep_cycles;
+    while (avr->cycle - start < ms_to_cycles(1000)) {
+        i2c_read(&bus, I2C_REG_STATUS, status, sizeof(status));
+    }
+    report_sleep("polled at 100 kHz:", start, sleep_cycles - slept);
+}
+
+static void read_eeprom(uint8_t *buf) {
+    avr_eeprom_desc_t desc = {.ee = buf, .offset = 0, .size = EEPROM_SIZE};
+    avr_ioctl(avr, AVR_IOCTL_EEPROM_GET, &desc);
+}
+
+// Measures how the mode store wears the EEPROM, and projects its lifetime for a few rates of mode changes.
+// Every byte that changed between two snapshots counts as one write. The mode store always changes the sequence
+// number and check byte, so this is exact for those and a lower bound otherwise.
+static void bench_eeprom(void) {
+    bus_t bus = {.scl_hz = 100000};
+    static const uint32_t changes_per_day[] = {10, 100, 1000, 10000};
+    static uint8_t before[EEPROM_SIZE], after[EEPROM_SIZE];
+    static uint32_t writes[EEPROM_SIZE];
+    uint32_t max_writes = 0;
+
+    printf("--- EEPROM ---\n");
+
+    read_eeprom(before);
+    for (int i = 0; i < EEPROM_COMMITS; i++) {
+        set_modes(&bus, 1 + i % 6, 1 + i % 4);
+        run_cycles(ms_to_cycles(EEPROM_SAVE_MS));
+
+        read_eeprom(after);
+        for (int addr = 0; addr < EEPROM_SIZE; addr++) {
+            if (after[addr] != before[addr]) {
+                writes[addr]++;
+                if (writes[addr] > max_writes) {
+                    max_writes = writes[addr];
+                }
+            }
+        }
+        memcpy(before, after, sizeof(before));
+    }
+    CHECK(max_writes > 0, "mode changes were not saved to EEPROM");
+    if (!max_writes) {
+        return;
+    }
+
+    double lifetime_changes = (double) EEPROM_ENDURANCE * EEPROM_COMMITS / max_writes;
+    printf("most-written cell:      %8lu writes for %d mode changes\n", (unsigned long) max_writes, EEPROM_COMMITS);
+    printf("projected lifetime:     %8.0f mode changes\n", lifetime_changes);
+    for (size_t i = 0; i < sizeof(changes_per_day) / sizeof(changes_per_day[0]); i++) {
+        printf("  at %5lu changes/day: %8.1f years\n",
+               (unsigned long) changes_per_day[i], lifetime_changes / changes_per_day[i] / 365);
+    }
+}
+
+// Floods the firmware with bus traffic and button bounces, and checks that the stack stays clear of the static data.
+// The firmware measures the stack high-water mark itself, see stack_monitor.h. This runs after all the other
+// benchmarks, so the mark covers them, too.
+static void bench_stack(void) {
+    bus_t bus = {.scl_hz = 400000};
+    uint8_t status[3];
+    uint8_t data[4];
+
+    printf("--- Stack ---\n");
+
+    for (int i = 0; i < STACK_FLOOD_TRANSACTIONS; i++) {
+        // A short press every few transactions, with the button bouncing on release.
+        if (i % 8 == 0) {
+            avr_raise_irq(button, 0);
+        } else if (i % 8 == 4 || i % 8 == 6) {
+            avr_raise_irq(button, 1);
+        } else if (i % 8 == 5) {
+            avr_raise_irq(button, 0);
+        }
+
+        if (i % 2) {
+            set_modes(&bus, i % 7, i % 5);
+        } else {
+            i2c_read(&bus, I2C_REG_STATUS, status, sizeof(status));
+        }
+    }
+    avr_raise_irq(button, 1);
+    run_cycles(ms_to_cycles(STACK_SCAN_MS));
+
+    i2c_read(&bus, I2C_REG_STACK_MONITOR + STACK_MONITOR_STACK_USED, data, sizeof(data));
+    uint16_t used = data[0] | data[1] << 8;
+    uint16_t unused = data[2] | data[3] << 8;
+    printf("stack used at most:     %8u bytes\n", used);
+    printf("stack never used:       %8u bytes\n", unused);
+    CHECK(used != 0, "the stack high-water mark was not published");
+    CHECK(unused >= STACK_MARGIN_MIN, "only %u bytes of stack left, expected at least %u", unused, STACK_MARGIN_MIN);
+}
+
+// Resets the MCU and checks that the modes are restored from EEPROM before the relays are driven.
+// The relays are driven straight to the pattern of the restored modes, without going through the sequencer.
+static void bench_reset(void) {
+    bus_t bus = {.scl_hz = 100000};
+    uint8_t status[3];
+
+    printf("--- Reset ---\n");
+
+    set_modes(&bus, 5, 2);
+    // This also covers EEPROM_SAVE_MS.
+    run_cycles(ms_to_cycles(RELAY_SETTLE_MS));
+    uint8_t expected = portb;
+
+    avr_reset(avr);
+    avr_cycle_count_t reset_at = avr->cycle;
+    run_cycles(ms_to_cycles(BOOT_MS + RELAY_SETTLE_MS));
+
+    CHECK(portb == expected, "relays are 0x%02x after reset, expected 0x%02x", portb, expected);
+    printf("reset -> relays:        %8.1f us\n", cycles_to_us(portb_changed_at - reset_at));
+    i2c_read(&bus, I2C_REG_STATUS, status, sizeof(status));
+    CHECK(status[1] == 5 && status[2] == 2, "modes are %d/%d after reset, expected 5/2", status[1], status[2]);
+}
+
+// Runs a mix of writes and reads, returning the average transaction time in cycles.
+static avr_cycle_count_t pec_mix(bus_t *bus) {
+    uint8_t status[I2C_PEC_READ_LENGTH_DEFAULT];
+    avr_cycle_count_t start = avr->cycle;
+
+    for (int i = 0; i < THROUGHPUT_TRANSACTIONS; i++) {
+        if (i % 2) {
+            set_modes(bus, i % 7, i % 5);
+        } else {
+            i2c_read(bus, I2C_REG_STATUS, status, sizeof(status));
+        }
+    }
+    return (avr->cycle - start) / THROUGHPUT_TRANSACTIONS;
+}
+
+// Measures the overhead of SMBus PEC and checks that corrupted writes are rejected.
+static void bench_pec(void) {
+    bus_t plain = {.scl_hz = 400000};
+    bus_t pec = {.scl_hz = 400000, .pec = 1};
+    uint8_t config = I2C_CONFIG_PEC;
+    uint8_t status[I2C_PEC_READ_LENGTH_DEFAULT];
+    uint8_t errors[I2C_PEC_READ_LENGTH_DEFAULT];
+
+    printf("--- PEC at 400 kHz ---\n");
+
+    avr_cycle_count_t without = pec_mix(&plain);
+    i2c_write(&plain, I2C_REG_CONFIG, &config, 1);
+    avr_cycle_count_t with = pec_mix(&pec);
+    printf("transaction without:    %8.1f us, stretch max %.1f us\n",
+           cycles_to_us(without), cycles_to_us(plain.stretch_max));
+    printf("transaction with PEC:   %8.1f us, stretch max %.1f us\n",
+           cycles_to_us(with), cycles_to_us(pec.stretch_max));
+
+    // A corrupted write must not change anything, but must be counted.
+    set_modes(&pec, 2, 2);
+    run_cycles(ms_to_cycles(20));
+    pec.corrupt_pec = 1;
+    set_modes(&pec, 6, 4);
+    pec.corrupt_pec = 0;
+    run_cycles(ms_to_cycles(20));
+    i2c_read(&pec, I2C_REG_STATUS, status, sizeof(status));
+    CHECK(status[1] == 2 && status[2] == 2, "corrupted write changed modes to %d/%d", status[1], status[2]);
+    i2c_read(&pec, I2C_REG_TELEMETRY + TELEMETRY_PEC_ERROR_COUNT, errors, sizeof(errors));
+    CHECK(errors[0] | errors[1] << 8, "corrupted write was not counted");
+
+    config = 0;
+    i2c_write(&pec, I2C_REG_CONFIG, &config, 1);
+}
+
+// CRC-16/XMODEM, as the bootloader computes it.
+static uint16_t crc16_xmodem(const uint8_t *data, uint32_t len) {
+    uint16_t crc = 0;
+
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= (uint16_t) (data[i] << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Sends one page to the bootloader. The bootloader holds the bus at the next SLA+W until it can take another page.
+static void boot_write_page(bus_t *bus, uint16_t addr, const uint8_t *page) {
+    uint8_t frame[2 + BOOT_PAGE_SIZE];
+
+    frame[0] = addr & 0xFF;
+    frame[1] = addr >> 8;
+    memcpy(&frame[2], page, BOOT_PAGE_SIZE);
+    // The command goes where the register address would.
+    i2c_write(bus, BOOT_CMD_PAGE, frame, sizeof(frame));
+}
+
+// Has the bootloader check the CRC, and returns its status afterwards. The read is held until the check is done.
+static uint8_t boot_commit(bus_t *bus, uint16_t length, uint16_t crc) {
+    uint8_t frame[4] = {length & 0xFF, length >> 8, crc & 0xFF, crc >> 8};
+    uint8_t info[BOOT_INFO_SIZE];
+
+    i2c_write(bus, BOOT_CMD_COMMIT, frame, sizeof(frame));
+    i2c_read_pure(bus, info, sizeof(info));
+    return info[1];
+}
+
+// Hands over to the bootloader, flashes the firmware again at 400 kHz and starts it. Checks that the relays keep their
+// pattern throughout, that a bad CRC is caught, and that the modes survive.
+static void bench_bootloader(const elf_firmware_t *firmware) {
+    bus_t bus = {.scl_hz = 400000};
+    uint8_t key = BOOT_ENTER_KEY;
+    uint8_t info[BOOT_INFO_SIZE];
+    uint8_t status[3];
+    uint8_t page[BOOT_PAGE_SIZE];
+
+    printf("--- Bootloader at 400 kHz ---\n");
+
+    set_modes(&bus, 2, 1);
+    run_cycles(ms_to_cycles(RELAY_SETTLE_MS + EEPROM_SAVE_MS));
+    uint8_t relays = portb;
+    avr_cycle_count_t relays_changed_at = portb_changed_at;
+
+    avr_cycle_count_t start = avr->cycle;
+    i2c_write(&bus, I2C_REG_BOOT, &key, 1);
+    while (avr->pc < BOOT_START && avr->cycle - start < ms_to_cycles(BOOT_ENTER_MS)) {
+        run_cycles(1);
+    }
+    CHECK(avr->pc >= BOOT_START, "the firmware did not hand over to the bootloader");
+    if (avr->pc < BOOT_START) {
+        return;
+    }
+    printf("handover:               %8.1f us\n", cycles_to_us(avr->cycle - start));
+
+    i2c_read_pure(&bus, info, sizeof(info));
+    CHECK(info[0] == BOOT_ID && info[1] == BOOT_STATUS_READY && info[2] == BOOT_PAGE_SIZE &&
+          info[3] == BOOT_START / BOOT_PAGE_SIZE, "bootloader info %02x %02x %02x %02x", info[0], info[1], info[2],
+          info[3]);
+
+    // A damaged first page must be written as sent, and caught by the CRC.
+    uint32_t length = firmware->flashsize;
+    uint16_t crc = crc16_xmodem(firmware->flash, length);
+    for (int i = 0; i < BOOT_PAGE_SIZE; i++) {
+        page[i] = firmware->flash[i] ^ 0xFF;
+    }
+    boot_write_page(&bus, 0, page);
+    CHECK(boot_commit(&bus, length, crc) == BOOT_STATUS_BAD_IMAGE, "a bad CRC was not caught");
+    CHECK(memcmp(avr->flash, page, BOOT_PAGE_SIZE) == 0, "the damaged page was not programmed");
+
+    avr_cycle_count_t flash_start = avr->cycle;
+    uint32_t pages = (length + BOOT_PAGE_SIZE - 1) / BOOT_PAGE_SIZE;
+    for (uint32_t p = 0; p < pages; p++) {
+        uint32_t offset = p * BOOT_PAGE_SIZE;
+        memset(page, 0xFF, sizeof(page));
+        memcpy(page, &firmware->flash[offset], length - offset < BOOT_PAGE_SIZE ? length - offset : BOOT_PAGE_SIZE);
+        boot_write_page(&bus, offset, page);
+    }
+    CHECK(boot_commit(&bus, length, crc) == BOOT_STATUS_VERIFIED, "the CRC of the new firmware did not match");
+    avr_cycle_count_t flashed = avr->cycle - flash_start;
+    CHECK(memcmp(avr->flash, firmware->flash, length) == 0, "the flash does not hold the new firmware");
+    printf("flash %4u pages:       %8.1f ms, %.1f us per page, stretch max %.1f us\n", pages,
+           cycles_to_us(flashed) / 1000, cycles_to_us(flashed) / pages, cycles_to_us(bus.stretch_max));
+
+    i2c_write(&bus, BOOT_CMD_RUN, NULL, 0);
+    run_cycles(ms_to_cycles(BOOT_MS));
+    printf("update total:           %8.1f ms\n", cycles_to_us(avr->cycle - start) / 1000);
+
+    CHECK(portb == relays && portb_changed_at == relays_changed_at, "the relays changed during the update");
+    i2c_read(&bus, I2C_REG_STATUS, status, sizeof(status));
+    CHECK(status[1] == 2 && status[2] == 1, "modes are %d/%d after the update, expected 2/1", status[1], status[2]);
+    i2c_read(&bus, I2C_REG_DIAGNOSTICS, status, 1);
+    CHECK(status[0] == 0, "reset cause 0x%02x after the update, expected none", status[0]);
+}
+
+// Reports the longest ISR runs the firmware measured itself, after all the other benchmarks exercised the button,
+// the relay sequencer and the bus. The firmware measures in TCNT1 ticks of TIMER1_PRESCALER cycles, i.e. 1us at 8 MHz,
+// and does not see its own prologue and epilogue.
+static void report_isr_times(void) {
+    bus_t bus = {.scl_hz = 100000};
+    uint8_t data[I2C_PEC_READ_LENGTH_DEFAULT];
+
+    printf("--- ISR worst case ---\n");
+
+    i2c_read(&bus, I2C_REG_TELEMETRY + TELEMETRY_TWI_ISR_TIME_MAX, data, 2);
+    uint16_t twi_max = data[0] | data[1] << 8;
+    i2c_read(&bus, I2C_REG_TELEMETRY + TELEMETRY_TIMER_ISR_TIME_MAX, data, 2);
+    uint16_t timer_max = data[0] | data[1] << 8;
+
+    printf("TWI_vect:               %8.1f us, ~%u cycles\n", cycles_to_us(twi_max * TIMER1_PRESCALER),
+           twi_max * TIMER1_PRESCALER);
+    printf("TIMER1_COMPA_vect:      %8.1f us, ~%u cycles\n", cycles_to_us(timer_max * TIMER1_PRESCALER),
+           timer_max * TIMER1_PRESCALER);
+}
+
+// Loads the firmware, and the bootloader if given, into a new simulated MCU and lets it boot. Exits on errors.
+static void start_firmware(const char *path, const char *boot_path) {
+    memset(&firmware, 0, sizeof(firmware));
+    if (elf_read_firmware(path, &firmware) != 0) {
+        fprintf(stderr, "could not read %s\n", path);
+        exit(1);
+    }
+    strcpy(firmware.mmcu, MCU);
+    firmware.frequency = F_CPU;
+    if (strcmp(MCU, "atmega328p") == 0) {
+        addr_twcr = ADDR_TWCR_ATMEGA328P;
+        addr_twsr = ADDR_TWSR_ATMEGA328P;
+        vector_twi = VECTOR_TWI_ATMEGA328P;
+    } else {
+        addr_twcr = ADDR_TWCR_ATMEGA8;
+        addr_twsr = ADDR_TWSR_ATMEGA8;
+        vector_twi = VECTOR_TWI_ATMEGA8;
+    }
+    if (avr) {
+        avr_terminate(avr);
+    }
+    portb = 0;
+    portb_changed_at = 0;
+    sleep_cycles = 0;
+    avr = avr_make_mcu_by_name(firmware.mmcu);
+    if (!avr) {
+        fprintf(stderr, "simavr does not know " MCU "\n");
+        exit(1);
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &firmware);
+    if (boot_path) {
+        memset(&bootloader, 0, sizeof(bootloader));
+        if (elf_read_firmware(boot_path, &bootloader) != 0 || bootloader.flashbase != BOOT_START) {
+            fprintf(stderr, "could not read %s, or it is not linked to 0x%x\n", boot_path, BOOT_START);
+            exit(1);
+        }
+        memcpy(avr->flash + bootloader.flashbase, bootloader.flash, bootloader.flashsize);
+        // Like the BOOTRST fuse.
+        avr->reset_pc = BOOT_START;
+        avr->pc = BOOT_START;
+    }
+
+    twi_input = avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT), twi_output_hook, NULL);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), IOPORT_IRQ_PIN_ALL), portb_hook, NULL);
+
+    // The button is HIGH while released.
+    button = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 5);
+    avr_raise_irq(button, 1);
+    // The bus is idle, both lines are pulled up.
+    sda = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), PIN_SDA);
+    avr_raise_irq(sda, 1);
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), PIN_SCL), 1);
+
+    run_cycles(ms_to_cycles(BOOT_MS));
+}
+
+int main(int argc, char *argv[]) {
+    const char *program = argv[0];
+    const char *baseline_path = NULL;
+    static function_profile_t baseline[NUM_PROFILED_FUNCTIONS];
+
+    if (argc > 2 && strcmp(argv[1], "--baseline") == 0) {
+        baseline_path = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: %s [--baseline <old fan_control.elf>] <fan_control.elf> [<fan_control_boot.elf>]\n",
+                program);
+        return 1;
+    }
+
+    printf("board: %s at %lu MHz\n", MCU, (unsigned long) (F_CPU / 1000000));
+    if (baseline_path) {
+        start_firmware(baseline_path, NULL);
+        profile_lookups(baseline_path);
+        memcpy(baseline, function_profile, sizeof(baseline));
+    }
+    start_firmware(argv[1], argc == 3 ? argv[2] : NULL);
+
+    profile_lookups(argv[1]);
+    report_lookups(baseline_path ? baseline : NULL);
+    bench_bus(100000);
+    bench_bus(400000);
+    bench_twi_profile();
+    bench_trace();
+    bench_twi_recovery();
+    bench_button();
+    bench_pec();
+    bench_sleep();
+    bench_eeprom();
+    bench_stack();
+    bench_reset();
+    report_isr_times();
+    // Last, since it restarts the firmware, which clears the telemetry.
+    if (argc == 3) {
+        bench_bootloader(&firmware);
+    }
+
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
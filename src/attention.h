@@ -0,0 +1,44 @@
+//
+// Optional open-drain "attention" line on the spare pin D7.
+//
+// The line is pulled LOW whenever the change sequence register (0x03) is bumped, and released once the master reads
+// that register. A master can thus wait on a GPIO instead of polling the bus.
+// D7 (see board.h) needs an external pullup, shared by all boards on the same line.
+//
+// This is only compiled in if ATTENTION_LINE is defined (see the FAN_CONTROL_ATTENTION_LINE CMake option), otherwise
+// all of these are no-ops and D7 is left alone.
+//
+
+#ifndef FAN_CONTROL_ATTENTION_H
+#define FAN_CONTROL_ATTENTION_H
+
+#include "hal.h"
+
+#ifdef ATTENTION_LINE
+
+// Sets up D7 as released, i.e. input without pullup.
+// To pull the line LOW, we only switch the direction to output, PORTD7 stays LOW all the time.
+static inline void attention_init(void) {
+    PORTD &= ~(1 << BOARD_ATTENTION_PIN);
+    DDRD &= ~(1 << BOARD_ATTENTION_PIN);
+}
+
+static inline void attention_assert(void) {
+    DDRD |= (1 << BOARD_ATTENTION_PIN);
+}
+
+static inline void attention_release(void) {
+    DDRD &= ~(1 << BOARD_ATTENTION_PIN);
+}
+
+#else
+
+static inline void attention_init(void) {}
+
+static inline void attention_assert(void) {}
+
+static inline void attention_release(void) {}
+
+#endif
+
+#endif //FAN_CONTROL_ATTENTION_H
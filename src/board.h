@@ -0,0 +1,120 @@
+//
+// Board profiles: MCU, clock and pin map.
+//
+// A board is selected with the FAN_CONTROL_BOARD CMake option, which defines one of the FAN_CONTROL_BOARD_* macros
+// below and passes the matching -mmcu and F_CPU. Without any, the original ATmega8 board at 8 MHz is assumed.
+// Everything else is derived from the profile at compile time: timer prescalers and compare values (see timer.h and
+// segment.h), the relay and segment pin masks, and the pattern tables built from them (see relay.h and segment.h).
+// None of it costs anything at runtime, the generated code is the same as if the values were written out by hand.
+//
+// A profile defines:
+// - BOARD_NAME, for humans.
+// - BOARD_MCU_ATMEGA8 or BOARD_MCU_ATMEGA328P, checked against the MCU the compiler was told to build for.
+// - BOARD_F_CPU, checked against F_CPU.
+// - The pin map, as bit numbers:
+//   - BOARD_RELAY_1_PIN to BOARD_RELAY_8_PIN on PORTB. All eight relays share PORTB, so it is written in one go.
+//   - BOARD_SEGMENT_*_PIN on PORTD (dot, top middle, top right, bottom right, bottom middle) and PORTC (top left,
+//     middle middle, bottom left), and the digit enable lines, left on PORTC and right on PORTD.
+//     The framebuffer holds one byte per port, so the segments have to stay on their ports, but can move within them.
+//   - BOARD_BUTTON_PIN and BOARD_ATTENTION_PIN on PORTD.
+//
+// The ATmega328P is pin-compatible with the ATmega8, so the boards we have share the same pin map. Its peripherals have
+// different register names in places, hal.h maps those.
+//
+
+#ifndef FAN_CONTROL_BOARD_H
+#define FAN_CONTROL_BOARD_H
+
+#if defined(FAN_CONTROL_BOARD_ATMEGA328P_8MHZ)
+
+#define BOARD_NAME "atmega328p-8mhz"
+#define BOARD_MCU_ATMEGA328P
+#define BOARD_F_CPU 8000000UL
+#define BOARD_PIN_MAP_DIP28
+
+#elif defined(FAN_CONTROL_BOARD_ATMEGA328P_16MHZ)
+
+#define BOARD_NAME "atmega328p-16mhz"
+#define BOARD_MCU_ATMEGA328P
+#define BOARD_F_CPU 16000000UL
+#define BOARD_PIN_MAP_DIP28
+
+#else
+
+// FAN_CONTROL_BOARD_ATMEGA8_8MHZ, the original board.
+#define BOARD_NAME "atmega8-8mhz"
+#define BOARD_MCU_ATMEGA8
+#define BOARD_F_CPU 8000000UL
+#define BOARD_PIN_MAP_DIP28
+
+#endif
+
+// The pin map of the original board, see relay.h and segment.h for what is connected where.
+#ifdef BOARD_PIN_MAP_DIP28
+
+// Relay 1 is hardwired to the second MCU with a pullup, so it has to be on B5.
+#define BOARD_RELAY_1_PIN 5
+#define BOARD_RELAY_2_PIN 1
+#define BOARD_RELAY_3_PIN 2
+#define BOARD_RELAY_4_PIN 3
+#define BOARD_RELAY_5_PIN 4
+#define BOARD_RELAY_6_PIN 0
+#define BOARD_RELAY_7_PIN 6
+#define BOARD_RELAY_8_PIN 7
+
+#define BOARD_SEGMENT_DOT_PIN 0
+#define BOARD_SEGMENT_TOP_MIDDLE_PIN 1
+#define BOARD_SEGMENT_TOP_RIGHT_PIN 2
+#define BOARD_SEGMENT_BOTTOM_RIGHT_PIN 3
+#define BOARD_SEGMENT_BOTTOM_MIDDLE_PIN 4
+#define BOARD_SEGMENT_RIGHT_ENABLE_PIN 6
+
+#define BOARD_SEGMENT_LEFT_ENABLE_PIN 0
+#define BOARD_SEGMENT_TOP_LEFT_PIN 1
+#define BOARD_SEGMENT_MIDDLE_MIDDLE_PIN 2
+#define BOARD_SEGMENT_BOTTOM_LEFT_PIN 3
+
+#define BOARD_BUTTON_PIN 5
+#define BOARD_ATTENTION_PIN 7
+
+#endif
+
+#ifndef F_CPU
+#define F_CPU BOARD_F_CPU
+#endif
+
+#if F_CPU != BOARD_F_CPU
+#error "F_CPU does not match the board, set FAN_CONTROL_BOARD instead of F_CPU"
+#endif
+
+#if !defined(FAN_CONTROL_HOST) && defined(BOARD_MCU_ATMEGA8) && !defined(__AVR_ATmega8__)
+#error "this board has an ATmega8, build with -mmcu=atmega8"
+#endif
+
+#if !defined(FAN_CONTROL_HOST) && defined(BOARD_MCU_ATMEGA328P) && !defined(__AVR_ATmega328P__)
+#error "this board has an ATmega328P, build with -mmcu=atmega328p"
+#endif
+
+// All PORTD pins in use.
+#define BOARD_PORTD_PINS ((1 << BOARD_SEGMENT_DOT_PIN) | (1 << BOARD_SEGMENT_TOP_MIDDLE_PIN) | \
+    (1 << BOARD_SEGMENT_TOP_RIGHT_PIN) | (1 << BOARD_SEGMENT_BOTTOM_RIGHT_PIN) | (1 << BOARD_SEGMENT_BOTTOM_MIDDLE_PIN) | \
+    (1 << BOARD_SEGMENT_RIGHT_ENABLE_PIN) | (1 << BOARD_BUTTON_PIN) | (1 << BOARD_ATTENTION_PIN))
+// All PORTC pins in use.
+#define BOARD_PORTC_PINS ((1 << BOARD_SEGMENT_LEFT_ENABLE_PIN) | (1 << BOARD_SEGMENT_TOP_LEFT_PIN) | \
+    (1 << BOARD_SEGMENT_MIDDLE_MIDDLE_PIN) | (1 << BOARD_SEGMENT_BOTTOM_LEFT_PIN))
+// SDA and SCL are fixed to PORTC on both MCUs.
+#define BOARD_TWI_SDA_PIN 4
+#define BOARD_TWI_SCL_PIN 5
+#define BOARD_TWI_PINS ((1 << BOARD_TWI_SDA_PIN) | (1 << BOARD_TWI_SCL_PIN))
+
+// A pin used twice shows up as fewer bits than pins.
+#define BOARD_BITS(x) (((x) & 1) + (((x) >> 1) & 1) + (((x) >> 2) & 1) + (((x) >> 3) & 1) + (((x) >> 4) & 1) + \
+    (((x) >> 5) & 1) + (((x) >> 6) & 1) + (((x) >> 7) & 1))
+
+_Static_assert(BOARD_BITS(BOARD_PORTD_PINS) == 8, "every PORTD pin can only be used once");
+_Static_assert(BOARD_BITS(BOARD_PORTC_PINS) == 4, "every PORTC pin can only be used once");
+_Static_assert((BOARD_PORTC_PINS & ~0x3F) == 0, "PORTC only has pins 0 to 5, and 6 is RESET");
+_Static_assert((BOARD_PORTC_PINS & BOARD_TWI_PINS) == 0, "the display can't use the TWI pins");
+// The relay pins are checked in relay.h, against the trees.
+
+#endif //FAN_CONTROL_BOARD_H
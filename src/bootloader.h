@@ -0,0 +1,85 @@
+//
+// Firmware updates over I2C.
+//
+// The bootloader (boot/fan_control_boot.c) sits in the boot section at BOOT_START, with the BOOTRST fuse programmed so
+// it runs on every reset. If the firmware is intact, i.e. the trailer the bootloader keeps at the end of the EEPROM
+// says its CRC matched, it starts the firmware right away. Otherwise, it stays and waits for a new one.
+//
+// Writing BOOT_ENTER_KEY to I2C_REG_BOOT hands over to the bootloader. The main loop waits until the relays have
+// reached their target and nothing is left to save to EEPROM, then disables interrupts, turns the display off and
+// jumps to BOOT_START. There is no reset, so PORTB keeps the last drive_relays pattern for the whole update: the
+// bootloader never touches it, and the firmware keeps it when it starts again, see relay_io_init.
+// The handover leaves BOOT_HANDOFF_KEY at the top of the stack, and no reset flags in MCUCSR (diagnostics_init clears
+// them), which is how the bootloader tells it apart from a reset.
+//
+// The bootloader answers at the address the firmware had, or at BOOT_DEFAULT_ADDRESS after a reset. It polls the TWI,
+// without interrupts, since the vectors belong to the firmware. Every write is one command:
+//   [BOOT_CMD_PAGE, address (16 bits little endian), BOOT_PAGE_SIZE bytes]   programs one page
+//   [BOOT_CMD_COMMIT, length (16 bits), CRC (16 bits)]                      checks the firmware, saves the trailer
+//   [BOOT_CMD_RUN]                                                          starts the firmware, if it is intact
+// and every read returns the info block, see BOOT_INFO_*. Its status tells how the last command went.
+//
+// A page is received into RAM while the previous one is being programmed, which takes up to 9 ms. If a write arrives
+// before the bootloader can take it, it holds SCL low after the address byte until it can, so a master can send pages
+// back to back, and the transfer of each page overlaps programming the one before. Reads are not held up by that.
+// The first page written invalidates the trailer, so an interrupted update stays in the bootloader after a reset
+// instead of starting half a firmware. The CRC is CRC-16/XMODEM (polynomial 0x1021, starting at 0) over the first
+// length bytes of flash. It is only checked on a commit, and the length only saved if it matched, so a nonzero length
+// means the firmware was verified, and a reset starts it right away, without reading the flash. The commit of a full
+// firmware takes about 25 ms on the ATmega8 and 110 ms on the ATmega328P at 8 MHz (about 30 cycles per byte, counted
+// from the instructions, not measured), during which writes are held.
+//
+// Boards programmed by ISP have no trailer. Then the firmware is started if its reset vector is programmed.
+//
+// Fuses: BOOTSZ for the largest boot section (1024 words on the ATmega8, 2048 on the ATmega328P), and BOOTRST. With
+// everything else at the defaults, that is a high fuse byte of 0xD8 on both.
+//
+
+#ifndef FAN_CONTROL_BOOTLOADER_H
+#define FAN_CONTROL_BOOTLOADER_H
+
+#include "hal.h"
+#include "registers.h"
+
+// Start of the boot section in bytes, and the flash page size. Everything below BOOT_START is the firmware.
+#if defined(BOARD_MCU_ATMEGA328P)
+#define BOOT_START 0x7000
+#define BOOT_PAGE_SIZE 128
+#else
+#define BOOT_START 0x1800
+#define BOOT_PAGE_SIZE 64
+#endif
+
+#if defined(SPM_PAGESIZE) && SPM_PAGESIZE != BOOT_PAGE_SIZE
+#error "BOOT_PAGE_SIZE does not match the MCU"
+#endif
+
+#if defined(BOOT_START_LINKED) && BOOT_START_LINKED != BOOT_START
+#error "the bootloader is linked to a different address than BOOT_START"
+#endif
+
+// The protocol, BOOT_ENTER_KEY, BOOT_CMD_*, BOOT_INFO_* and BOOT_STATUS_*, is in registers.h.
+// Left in BOOT_HANDOFF_WORD by the firmware when it hands over.
+#define BOOT_HANDOFF_KEY 0xB007
+// The top of the stack, i.e. RAMEND - 1 on the AVR, which the firmware is done with by then.
+#define BOOT_HANDOFF_WORD (*(volatile uint16_t *) (RAM_STACK_TOP - 1))
+#define BOOT_PAGE_FRAME_SIZE (BOOT_PAGE_HEADER_SIZE + BOOT_PAGE_SIZE)
+
+// The trailer: [length, CRC], 16 bits little endian each. A length of 0 marks an update in progress.
+#define BOOT_TRAILER_LENGTH 0
+#define BOOT_TRAILER_CRC 2
+#define BOOT_TRAILER_SIZE 4
+#define BOOT_TRAILER_ADDR (E2END + 1 - BOOT_TRAILER_SIZE)
+
+// Hands over to the bootloader, see above. Call this with interrupts disabled. Does not return, except on the host.
+static inline void bootloader_start(void) {
+    BOOT_HANDOFF_WORD = BOOT_HANDOFF_KEY;
+#ifdef FAN_CONTROL_HOST
+    hal_host_bootloader_starts++;
+#else
+    // Function pointers are word addresses.
+    __asm__ __volatile__ ("ijmp" :: "z" (BOOT_START / 2));
+#endif
+}
+
+#endif //FAN_CONTROL_BOOTLOADER_H
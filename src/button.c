@@ -0,0 +1,114 @@
+//
+// Button sampling and events, see button.h.
+//
+
+#include "button.h"
+#include "timer_wheel.h"
+
+volatile button_event_t button_queue[BUTTON_QUEUE_SIZE];
+volatile uint8_t button_queue_head = 0;
+volatile uint8_t button_queue_tail = 0;
+
+// Thresholds, written by the main loop, read by the timer interrupt. Each one is a single byte, so they're always
+// consistent on their own. A press that sees a mix of old and new thresholds is harmless.
+static volatile uint8_t debounce = BUTTON_DEBOUNCE_DEFAULT;
+static volatile uint8_t long_press = BUTTON_LONG_PRESS_DEFAULT;
+static volatile uint8_t repeat = BUTTON_REPEAT_DEFAULT;
+
+// The rest is only accessed by the timer interrupt.
+
+// The accepted level, and for how many samples in a row the pin has shown the other one.
+static uint8_t pressed = 0;
+static uint8_t bounce_samples = 0;
+// Whether the current press already was a long press.
+static uint8_t long_sent = 0;
+
+static void sample(void);
+static void long_press_expired(void);
+
+// Samples the button every tick.
+static timer_wheel_timer_t sample_timer = TIMER_WHEEL_TIMER(sample);
+// Started when a press is accepted, expires for the long press and then for every repeat.
+static timer_wheel_timer_t long_press_timer = TIMER_WHEEL_TIMER(long_press_expired);
+
+static void push(uint8_t type) {
+    uint8_t head = button_queue_head;
+    if ((uint8_t) (head - button_queue_tail) == BUTTON_QUEUE_SIZE) {
+        // Full, the main loop is not keeping up.
+        return;
+    }
+
+    volatile button_event_t *event = &button_queue[head & BUTTON_QUEUE_MASK];
+    event->type = type;
+    event->time = timer_wheel_ticks;
+    // Only now the main loop may read it.
+    button_queue_head = head + 1;
+}
+
+// Whether the pin currently reads as pressed.
+static uint8_t read_pin(void) {
+    // The button is connected to PIND5 (see board.h), but HIGH by default.
+    return !(PIND & (1 << BOARD_BUTTON_PIN));
+}
+
+static void long_press_expired(void) {
+    if (read_pin() == 0 || bounce_samples) {
+        // The button might be in the middle of being released. Wait until that is decided, sample cancels us if it is.
+        timer_wheel_start(&long_press_timer, 1, 0);
+        return;
+    }
+
+    if (!long_sent) {
+        long_sent = 1;
+        push(BUTTON_EVENT_LONG);
+        if (repeat) {
+            timer_wheel_start(&long_press_timer, repeat, repeat);
+        }
+        return;
+    }
+
+    push(BUTTON_EVENT_REPEAT);
+}
+
+static void sample(void) {
+    uint8_t is_pressed = read_pin();
+    if (is_pressed == pressed) {
+        bounce_samples = 0;
+        return;
+    }
+
+    bounce_samples++;
+    if (bounce_samples < debounce) {
+        return;
+    }
+    bounce_samples = 0;
+    pressed = is_pressed;
+
+    if (pressed) {
+        // The press started debounce - 1 ticks ago. It is long if the pin still reads as pressed on its long_press-th
+        // sample. A release that is being debounced right then still counts as a short press.
+        uint8_t delay = long_press > debounce ? long_press - debounce : 1;
+        long_sent = 0;
+        timer_wheel_start(&long_press_timer, delay, 0);
+        return;
+    }
+
+    timer_wheel_cancel(&long_press_timer);
+    if (!long_sent) {
+        push(BUTTON_EVENT_SHORT);
+    }
+}
+
+void button_init(void) {
+    timer_wheel_start(&sample_timer, 1, 1);
+}
+
+void button_set_thresholds(uint8_t new_debounce, uint8_t new_long_press, uint8_t new_repeat) {
+    if (new_debounce) {
+        debounce = new_debounce;
+    }
+    if (new_long_press) {
+        long_press = new_long_press;
+    }
+    repeat = new_repeat;
+}
@@ -0,0 +1,102 @@
+//
+// The button on PIND5: Sampling, debouncing and press detection in the timer interrupt, mode logic in the main loop.
+//
+// The timer interrupt samples the button every tick. A new level is accepted once it was seen on as many consecutive
+// samples as the debounce threshold says. From the accepted presses, it generates events:
+// - BUTTON_EVENT_SHORT when the button is released before the long press threshold,
+// - BUTTON_EVENT_LONG once it has been held for the long press threshold,
+// - BUTTON_EVENT_REPEAT every repeat interval after that, as long as it is held, unless the interval is 0.
+// All of these are in ticks, and the press is timed from its first sample.
+// Every event carries the value of timer_wheel_ticks when it happened.
+//
+// Events go into a lock-free single-producer/single-consumer queue: The timer interrupt only ever writes the head
+// index, the main loop only ever writes the tail index. Both are single bytes, so neither side ever needs to disable
+// interrupts. If the main loop does not keep up, new events are dropped.
+//
+// The last BUTTON_LOG_EVENTS events are also kept for auditing, and copied into the register file at the start of
+// every read transaction, like the telemetry. The log block is [count, then newest event first: type, time (16 bits
+// little endian)], where count is the number of events so far (wrapping), and unused entries have type 0.
+//
+// The thresholds can be changed via I2C at any time, see twislave.h. They are not saved and return to the defaults on
+// reset.
+//
+
+#ifndef FAN_CONTROL_BUTTON_H
+#define FAN_CONTROL_BUTTON_H
+
+#include "hal.h"
+#include "registers.h"
+
+// The events, the defaults for the thresholds and the layout of the log, BUTTON_EVENT_*, BUTTON_*_DEFAULT and
+// BUTTON_LOG_*, are in registers.h.
+
+// Queue size, must be a power of two.
+#define BUTTON_QUEUE_SIZE 8
+#define BUTTON_QUEUE_MASK (BUTTON_QUEUE_SIZE - 1)
+
+#if (BUTTON_QUEUE_SIZE & BUTTON_QUEUE_MASK) != 0
+#error "BUTTON_QUEUE_SIZE must be a power of two"
+#endif
+
+#if BUTTON_LOG_EVENTS > BUTTON_QUEUE_SIZE
+#error "the button log is kept in the queue, it can't be longer than that"
+#endif
+
+typedef struct {
+    uint8_t type;
+    uint16_t time;
+} button_event_t;
+
+// The queue. Only button.c and the inline functions below touch these.
+// The entries are volatile too, so the compiler can't move accessing them past updating the indices.
+extern volatile button_event_t button_queue[BUTTON_QUEUE_SIZE];
+// Number of events produced, wrapping. Only written by the timer interrupt.
+extern volatile uint8_t button_queue_head;
+// Number of events consumed, wrapping. Only written by the main loop.
+extern volatile uint8_t button_queue_tail;
+
+// Starts sampling the button. Call this with interrupts disabled.
+void button_init(void);
+
+// Sets the thresholds, in ticks. Zero debounce or long press values are ignored.
+// Only call this from the main loop.
+void button_set_thresholds(uint8_t debounce, uint8_t long_press, uint8_t repeat);
+
+// Whether there are events for the main loop.
+static inline uint8_t button_events_pending(void) {
+    return button_queue_head != button_queue_tail;
+}
+
+// Takes the oldest event from the queue. Returns 0 if there is none.
+// Only call this from the main loop.
+static inline uint8_t button_take_event(button_event_t *event) {
+    uint8_t tail = button_queue_tail;
+    if (button_queue_head == tail) {
+        return 0;
+    }
+
+    volatile button_event_t *entry = &button_queue[tail & BUTTON_QUEUE_MASK];
+    event->type = entry->type;
+    event->time = entry->time;
+    // Only now the slot may be reused.
+    button_queue_tail = tail + 1;
+    return 1;
+}
+
+// Copies the audit log to dst, which must be BUTTON_LOG_SIZE bytes long.
+// Only call this from within TWI_vect.
+static inline void button_snapshot(volatile uint8_t *dst) {
+    uint8_t head = button_queue_head;
+
+    dst[BUTTON_LOG_COUNT] = head;
+    for (uint8_t i = 0; i < BUTTON_LOG_EVENTS; i++) {
+        volatile button_event_t *event = &button_queue[(uint8_t) (head - 1 - i) & BUTTON_QUEUE_MASK];
+        volatile uint8_t *entry = dst + BUTTON_LOG_FIRST + i * BUTTON_LOG_EVENT_SIZE;
+
+        entry[0] = event->type;
+        entry[1] = event->time & 0xFF;
+        entry[2] = event->time >> 8;
+    }
+}
+
+#endif //FAN_CONTROL_BUTTON_H
@@ -0,0 +1,20 @@
+//
+// CRC-8 as used for SMBus Packet Error Checking (PEC).
+// Polynomial x^8 + x^2 + x + 1 (0x07), initial value 0, not reflected, no final XOR.
+//
+// This is table-driven, so updating the CRC for one byte is a single flash load.
+// A nice property of this CRC: Running it over a message followed by its own CRC yields 0.
+//
+
+#ifndef FAN_CONTROL_CRC8_H
+#define FAN_CONTROL_CRC8_H
+
+#include "hal.h"
+
+extern const uint8_t crc8_table[256] PROGMEM;
+
+static inline uint8_t crc8_update(uint8_t crc, uint8_t data) {
+    return pgm_read_byte(&crc8_table[crc ^ data]);
+}
+
+#endif //FAN_CONTROL_CRC8_H
@@ -0,0 +1,66 @@
+//
+// Device config records in EEPROM, see device_config.h.
+//
+
+#include "device_config.h"
+
+#define RECORD_ADDRESS 0
+#define RECORD_GROUPS 1
+
+static eeprom_ring_t ring = EEPROM_RING(DEVICE_CONFIG_ADDR, DEVICE_CONFIG_SLOTS, DEVICE_CONFIG_DATA_SIZE);
+// The config that was saved last, or is being saved right now.
+static device_config_t saved;
+// Whether saved differs from what's in EEPROM.
+static uint8_t save_pending = 0;
+// The data of the record currently being written.
+static uint8_t record[DEVICE_CONFIG_DATA_SIZE];
+
+static uint8_t record_valid(const uint8_t *data) {
+    uint8_t address = eeprom_read_byte(data + RECORD_ADDRESS);
+    return address >= DEVICE_CONFIG_ADDRESS_MIN && address <= DEVICE_CONFIG_ADDRESS_MAX;
+}
+
+static uint8_t record_data(uint8_t i) {
+    return record[i];
+}
+
+void device_config_load(device_config_t *config, uint8_t default_address) {
+    const uint8_t *data = eeprom_ring_load(&ring, record_valid);
+
+    if (data) {
+        saved.i2c_address = eeprom_read_byte(data + RECORD_ADDRESS);
+        saved.groups = eeprom_read_byte(data + RECORD_GROUPS);
+    } else {
+        // Not saved yet, the first change will write a record.
+        saved.i2c_address = default_address;
+        saved.groups = DEVICE_CONFIG_DEFAULT_GROUPS;
+    }
+
+    *config = saved;
+}
+
+void device_config_save(const device_config_t *config) {
+    if (config->i2c_address == saved.i2c_address && config->groups == saved.groups) {
+        return;
+    }
+
+    // If a record is being written right now, this will be picked up once it's done.
+    saved = *config;
+    save_pending = 1;
+}
+
+void device_config_poll(void) {
+    if (save_pending && !eeprom_ring_busy(&ring)) {
+        // Start the next record, overwriting the older one.
+        save_pending = 0;
+        record[RECORD_ADDRESS] = saved.i2c_address;
+        record[RECORD_GROUPS] = saved.groups;
+        eeprom_ring_save(&ring);
+    }
+
+    eeprom_ring_poll(&ring, record_data);
+}
+
+uint8_t device_config_busy(void) {
+    return save_pending || eeprom_ring_busy(&ring);
+}
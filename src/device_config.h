@@ -0,0 +1,52 @@
+//
+// Per-device settings in EEPROM: The I2C address, and which broadcast groups the device belongs to.
+//
+// Both can be changed via I2C, see twislave.h. They are stored right after the mode store, in an eeprom_ring of two
+// records of [seq, address, groups, check]. Saves alternate between them, and the valid one with the newer sequence
+// number wins, so a save interrupted by a reset falls back to the previous config instead of the defaults. Settings
+// rarely change, so there's no need for more wear leveling than that.
+// Like mode_store, saving only queues the record, and device_config_poll writes one byte at a time.
+//
+
+#ifndef FAN_CONTROL_DEVICE_CONFIG_H
+#define FAN_CONTROL_DEVICE_CONFIG_H
+
+#include "hal.h"
+#include "eeprom_ring.h"
+#include "mode_store.h"
+#include "registers.h"
+
+#define DEVICE_CONFIG_ADDR MODE_STORE_END
+#define DEVICE_CONFIG_SLOTS 2
+// The address and the groups.
+#define DEVICE_CONFIG_DATA_SIZE 2
+#define DEVICE_CONFIG_END (DEVICE_CONFIG_ADDR + EEPROM_RING_SIZE(DEVICE_CONFIG_SLOTS, DEVICE_CONFIG_DATA_SIZE))
+
+#if DEVICE_CONFIG_END > E2END + 1
+#error "device config does not fit in EEPROM"
+#endif
+
+// The valid addresses and the default groups, DEVICE_CONFIG_ADDRESS_* and DEVICE_CONFIG_DEFAULT_GROUPS, are in
+// registers.h.
+
+typedef struct {
+    // 7-bit I2C address.
+    uint8_t i2c_address;
+    // Bit n set means the device is a member of group n.
+    uint8_t groups;
+} device_config_t;
+
+// Loads the stored config, or the defaults (I2C_SLAVE_ADDRESS, DEVICE_CONFIG_DEFAULT_GROUPS) if there is none.
+void device_config_load(device_config_t *config, uint8_t default_address);
+
+// Queues the given config to be saved, unless it is the same as what was saved last.
+void device_config_save(const device_config_t *config);
+
+// Writes the next byte of a queued save, if the EEPROM is ready. Never blocks.
+// Call this on every main loop pass.
+void device_config_poll(void);
+
+// Whether a save is queued or still being written.
+uint8_t device_config_busy(void);
+
+#endif //FAN_CONTROL_DEVICE_CONFIG_H
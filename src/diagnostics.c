@@ -0,0 +1,38 @@
+//
+// Reset diagnostics, see diagnostics.h.
+//
+
+#include "diagnostics.h"
+
+// Marks a valid record. Anything else is what RAM happened to contain after power-on.
+#define DIAGNOSTICS_MAGIC 0xD1A6
+
+volatile diagnostics_record_t diagnostics NOINIT;
+
+uint8_t diagnostics_init(volatile uint8_t *dst) {
+    uint8_t cause = MCUCSR & DIAGNOSTICS_RESET_FLAGS;
+    // The flags accumulate until cleared, so clear them all, or the next reset would look like this one.
+    MCUCSR &= ~DIAGNOSTICS_RESET_FLAGS;
+
+    uint16_t check = ~diagnostics.reboots;
+    if ((cause & (1 << PORF)) || diagnostics.magic != DIAGNOSTICS_MAGIC || diagnostics.reboots_check != check) {
+        diagnostics.magic = DIAGNOSTICS_MAGIC;
+        diagnostics.reboots = 0;
+        diagnostics.checkpoint = DIAGNOSTICS_CHECKPOINT_NONE;
+        diagnostics.twi_status = 0;
+    } else {
+        diagnostics.reboots++;
+    }
+    diagnostics.reboots_check = ~diagnostics.reboots;
+
+    dst[DIAGNOSTICS_RESET_CAUSE] = cause;
+    dst[DIAGNOSTICS_CHECKPOINT] = diagnostics.checkpoint;
+    dst[DIAGNOSTICS_TWI_STATUS] = diagnostics.twi_status;
+    dst[DIAGNOSTICS_REBOOTS] = diagnostics.reboots & 0xFF;
+    dst[DIAGNOSTICS_REBOOTS + 1] = diagnostics.reboots >> 8;
+
+    // Start this run's record.
+    diagnostics.twi_status = 0;
+    diagnostics_checkpoint(DIAGNOSTICS_CHECKPOINT_SETUP);
+    return cause;
+}
@@ -0,0 +1,68 @@
+//
+// Reset diagnostics, readable via I2C.
+//
+// A small record is kept in .noinit RAM, which is not cleared on startup, so it survives watchdog, brown-out and
+// external resets. While running, the main loop stores a checkpoint ID at each of its stages, and TWI_vect stores the
+// TWI status code it handles. Both are single byte stores.
+// On boot, diagnostics_init takes what the previous run left there, together with the reset cause from MCUCSR, and
+// puts it into the register file:
+//
+//   [reset cause (MCUCSR flags), checkpoint, TWI status, reboots (16 bits little endian)]
+//
+// where checkpoint and TWI status are the last ones stored before the reset, and reboots is the number of resets since
+// power-on. After a power-on reset, or if the record doesn't look valid, the record starts over and the checkpoint
+// and TWI status read as 0. A reset cause of 0 means there was no reset: the bootloader started the firmware after an
+// update, see bootloader.h.
+// The block is read-only and does not change until the next reset.
+//
+
+#ifndef FAN_CONTROL_DIAGNOSTICS_H
+#define FAN_CONTROL_DIAGNOSTICS_H
+
+#include "hal.h"
+#include "registers.h"
+
+// The layout of the diagnostics block, the reset causes and the checkpoints, DIAGNOSTICS_*, are in registers.h.
+
+// All reset flags in MCUCSR.
+#define DIAGNOSTICS_RESET_FLAGS ((1 << PORF) | (1 << EXTRF) | (1 << BORF) | (1 << WDRF))
+
+#if DIAGNOSTICS_RESET_FLAGS != (DIAGNOSTICS_RESET_POWER_ON | DIAGNOSTICS_RESET_EXTERNAL | DIAGNOSTICS_RESET_BROWN_OUT | \
+        DIAGNOSTICS_RESET_WATCHDOG)
+#error "the reset flags in MCUCSR don't match DIAGNOSTICS_RESET_*"
+#endif
+
+typedef struct {
+    // DIAGNOSTICS_MAGIC if the record is valid.
+    uint16_t magic;
+    uint16_t reboots;
+    // The complement of reboots, as a second check.
+    uint16_t reboots_check;
+    uint8_t checkpoint;
+    uint8_t twi_status;
+} diagnostics_record_t;
+
+// The record of the current run. Only diagnostics.c and the inline functions below touch this.
+extern volatile diagnostics_record_t diagnostics;
+
+// Reads and clears the reset flags, starts a new record and copies the previous one to dst, which must be
+// DIAGNOSTICS_SIZE bytes long. Returns the reset flags.
+// Call this early in setup, with interrupts disabled.
+uint8_t diagnostics_init(volatile uint8_t *dst);
+
+// Records that the main program reached the given checkpoint.
+static inline void diagnostics_checkpoint(uint8_t checkpoint) {
+    diagnostics.checkpoint = checkpoint;
+#ifdef FAN_CONTROL_HOST
+    if (hal_host_checkpoint_hook) {
+        hal_host_checkpoint_hook(checkpoint);
+    }
+#endif
+}
+
+// Records the TWI status code being handled. Only call this from within TWI_vect.
+static inline void diagnostics_twi_status(uint8_t status) {
+    diagnostics.twi_status = status;
+}
+
+#endif //FAN_CONTROL_DIAGNOSTICS_H
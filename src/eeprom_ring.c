@@ -0,0 +1,93 @@
+//
+// Records in an EEPROM ring, see eeprom_ring.h.
+//
+
+#include "eeprom_ring.h"
+#include "crc8.h"
+
+#define RECORD_SEQ 0
+#define RECORD_DATA 1
+
+// Erased EEPROM reads as 0xFF, so no record ever uses this sequence number.
+#define SEQ_ERASED 0xFF
+
+static uint8_t *slot_addr(const eeprom_ring_t *ring, uint8_t slot) {
+    return (uint8_t *) (uintptr_t) (ring->addr + slot * ring->size);
+}
+
+const uint8_t *eeprom_ring_load(eeprom_ring_t *ring, uint8_t (*valid)(const uint8_t *data)) {
+    uint8_t found = 0;
+
+    for (uint8_t slot = 0; slot < ring->slots; slot++) {
+        uint8_t *addr = slot_addr(ring, slot);
+        uint8_t seq = eeprom_read_byte(addr + RECORD_SEQ);
+        uint8_t check = 0;
+        for (uint8_t i = 0; i < ring->size - 1; i++) {
+            check = crc8_update(check, eeprom_read_byte(addr + i));
+        }
+
+        if (seq == SEQ_ERASED || eeprom_read_byte(addr + ring->size - 1) != check) {
+            continue;
+        }
+        // All sequence numbers in the ring are within slots of each other, so comparing them as a signed difference
+        // works across the wrap-around.
+        if (found && (int8_t) (seq - ring->newest_seq) <= 0) {
+            continue;
+        }
+        if (valid && !valid(addr + RECORD_DATA)) {
+            continue;
+        }
+
+        found = 1;
+        ring->newest_slot = slot;
+        ring->newest_seq = seq;
+    }
+
+    return found ? slot_addr(ring, ring->newest_slot) + RECORD_DATA : NULL;
+}
+
+void eeprom_ring_save(eeprom_ring_t *ring) {
+    if (ring->written == ring->size) {
+        ring->newest_slot = (ring->newest_slot + 1) % ring->slots;
+        ring->newest_seq++;
+        if (ring->newest_seq == SEQ_ERASED) {
+            ring->newest_seq = 0;
+        }
+    }
+
+    ring->written = 0;
+    ring->check = crc8_update(0, ring->newest_seq);
+}
+
+void eeprom_ring_poll(eeprom_ring_t *ring, uint8_t (*data)(uint8_t i)) {
+    if (ring->written == ring->size) {
+        return;
+    }
+    // Another EEPROM user might have just started a write, in which case we try again on the next pass.
+    if (!eeprom_is_ready()) {
+        return;
+    }
+
+    // The data goes first, then the check byte, and the sequence number last, see eeprom_ring.h.
+    uint8_t i = (ring->written + 1) % ring->size;
+    uint8_t value;
+    if (i == RECORD_SEQ) {
+        value = ring->newest_seq;
+    } else if (i == ring->size - 1) {
+        value = ring->check;
+    } else {
+        value = data(i - RECORD_DATA);
+        ring->check = crc8_update(ring->check, value);
+    }
+
+    uint8_t *addr = slot_addr(ring, ring->newest_slot) + i;
+    if (eeprom_read_byte(addr) != value) {
+        // The EEPROM is ready, so eeprom_write_byte doesn't wait.
+        eeprom_write_byte(addr, value);
+    }
+    ring->written++;
+}
+
+uint8_t eeprom_ring_busy(const eeprom_ring_t *ring) {
+    return ring->written != ring->size;
+}
@@ -0,0 +1,67 @@
+//
+// A ring of fixed-size records in EEPROM, of which the newest valid one holds the current state.
+//
+// Each record is [seq, data..., check]. Every save goes into the slot after the newest one, so the wear is spread
+// evenly over the ring, and a ring of two slots keeps the previous record around while the next one is written.
+// The newest record is the valid one with the highest sequence number (modulo 256, 0xFF is never used). A record is
+// valid if its check byte, a CRC-8 over the sequence number and the data, matches.
+//
+// A save interrupted by a reset never wins over the previous record, because the sequence number is written last:
+// Until then, the slot still has the sequence number of the record being overwritten, which is older than every other
+// record in the ring, or 0xFF if it was erased. If the reset hits while the sequence number itself is being written,
+// the record differs from a valid one in that single byte, and CRC-8 detects every single-byte error.
+//
+// Writing one EEPROM byte takes about 8.5ms. To not block the main loop, eeprom_ring_save only starts the record, and
+// eeprom_ring_poll writes one byte at a time whenever the EEPROM is ready. Bytes that already hold the right value are
+// skipped.
+//
+
+#ifndef FAN_CONTROL_EEPROM_RING_H
+#define FAN_CONTROL_EEPROM_RING_H
+
+#include <stddef.h>
+
+#include "hal.h"
+
+// The sequence number and the check byte.
+#define EEPROM_RING_OVERHEAD 2
+
+typedef struct {
+    // Where the ring starts in EEPROM, how many records it holds, and how long each one is, including the overhead.
+    uint16_t addr;
+    uint8_t slots;
+    uint8_t size;
+    // The slot and sequence number of the newest record, or of the one being written.
+    uint8_t newest_slot;
+    uint8_t newest_seq;
+    // How many bytes of the record being written are done, size if there is none.
+    uint8_t written;
+    // The CRC-8 over what was written so far.
+    uint8_t check;
+} eeprom_ring_t;
+
+// A ring of slots records with size bytes of data each, starting at addr. Sequence numbers are compared as a signed
+// difference, so there can be at most 127 slots.
+#define EEPROM_RING(addr, slots, size) {(addr), (slots), (size) + EEPROM_RING_OVERHEAD, (slots) - 1, 0xFF, \
+                                        (size) + EEPROM_RING_OVERHEAD, 0}
+
+// How many bytes of EEPROM a ring takes.
+#define EEPROM_RING_SIZE(slots, size) ((slots) * ((size) + EEPROM_RING_OVERHEAD))
+
+// Finds the newest record, for which valid, if given, returns nonzero when passed the EEPROM address of its data.
+// Returns the EEPROM address of that data, or NULL if there is no such record.
+const uint8_t *eeprom_ring_load(eeprom_ring_t *ring, uint8_t (*valid)(const uint8_t *data));
+
+// Starts writing the next record. If one is being written right now, it starts over in the same slot instead, which
+// is fine, because its sequence number is written last.
+void eeprom_ring_save(eeprom_ring_t *ring);
+
+// Writes the next byte of the record, if the EEPROM is ready. Never blocks.
+// data returns the i-th data byte of the record, and has to return the same values until the record is done or
+// started over.
+void eeprom_ring_poll(eeprom_ring_t *ring, uint8_t (*data)(uint8_t i));
+
+// Whether a record is being written.
+uint8_t eeprom_ring_busy(const eeprom_ring_t *ring);
+
+#endif //FAN_CONTROL_EEPROM_RING_H
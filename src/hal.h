@@ -0,0 +1,79 @@
+//
+// Hardware abstraction layer.
+//
+// All firmware sources include this instead of the avr-libc headers directly.
+// On the AVR, this is nothing but the usual avr-libc includes, so register accesses compile to the exact same
+// instructions as before.
+// When building for the host (FAN_CONTROL_HOST is defined), the registers, ISR() and friends are instead mapped to
+// simulated registers in host/hal_host.h, which allows running drive_relays, drive_display and both ISRs on a dev box.
+
+#ifndef FAN_CONTROL_HAL_H
+#define FAN_CONTROL_HAL_H
+
+// Defines F_CPU, unless the build did, see board.h.
+#include "board.h"
+
+#ifdef FAN_CONTROL_HOST
+
+#include "host/hal_host.h"
+
+#else
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <util/delay.h>
+#include <util/twi.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+#include <avr/boot.h>
+
+// Variables in .noinit are not cleared on startup, so they keep their values across resets (but not power cycles).
+#define NOINIT __attribute__((section(".noinit")))
+
+// RAM layout, from the linker script: .data, .bss and .noinit, and then the heap and stack share the rest. We don't use
+// the heap, so the stack may grow down all the way to the end of .noinit.
+extern uint8_t __data_start, __data_end, __bss_start, __heap_start;
+#define RAM_DATA_SIZE ((uint16_t) (&__data_end - &__data_start))
+// Includes .noinit.
+#define RAM_BSS_SIZE ((uint16_t) (&__heap_start - &__bss_start))
+#define RAM_STACK_LIMIT (&__heap_start)
+#define RAM_STACK_TOP ((uint8_t *) RAMEND)
+#define RAM_STACK_POINTER() ((uint8_t *) SP)
+
+// Reads flash at an absolute byte address, like the bootloader does. pgm_read_byte is for PROGMEM variables, which are
+// plain variables on the host, while flash addresses are not.
+#define FLASH_READ_BYTE(addr) pgm_read_byte(addr)
+#define FLASH_READ_WORD(addr) pgm_read_word(addr)
+
+#endif
+
+// The ATmega8 register names are used throughout. On the ATmega328P, the same peripherals are spread over more
+// registers, so the few that differ are mapped here. The host simulates an ATmega8, whatever the board.
+#if defined(BOARD_MCU_ATMEGA328P) && !defined(FAN_CONTROL_HOST)
+
+#define MCUCSR MCUSR
+#define OCR2 OCR2A
+#define OCIE2 OCIE2A
+#define TIMER2_COMP_vect TIMER2_COMPA_vect
+// Interrupt masks of timer 1 and 2, and the timer 2 waveform and clock select bits.
+#define TIMER1_TIMSK TIMSK1
+#define TIMER2_TIMSK TIMSK2
+#define TIMER2_TCCRA TCCR2A
+#define TIMER2_TCCRB TCCR2B
+
+#else
+
+#define TIMER1_TIMSK TIMSK
+#define TIMER2_TIMSK TIMSK
+#define TIMER2_TCCRA TCCR2
+#define TIMER2_TCCRB TCCR2
+
+#endif
+
+#include <stdint.h>
+
+#endif //FAN_CONTROL_HAL_H
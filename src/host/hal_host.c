@@ -0,0 +1,176 @@
+//
+// Storage for the simulated registers declared in hal_host.h.
+//
+
+// Via hal.h, for the board, which sets the flash page size.
+#include "hal.h"
+
+volatile uint8_t hal_host_PORTB;
+volatile uint8_t hal_host_DDRB;
+volatile uint8_t hal_host_PINB;
+volatile uint8_t hal_host_PORTC;
+volatile uint8_t hal_host_DDRC;
+volatile uint8_t hal_host_PINC;
+volatile uint8_t hal_host_PORTD;
+volatile uint8_t hal_host_DDRD;
+volatile uint8_t hal_host_PIND;
+
+volatile uint8_t hal_host_MCUCSR;
+
+volatile uint8_t hal_host_TCCR1A;
+volatile uint8_t hal_host_TCCR1B;
+volatile uint16_t hal_host_TCNT1;
+volatile uint16_t hal_host_OCR1A;
+volatile uint8_t hal_host_TIMSK;
+
+volatile uint8_t hal_host_TCCR2;
+volatile uint8_t hal_host_TCNT2;
+volatile uint8_t hal_host_OCR2;
+
+volatile uint8_t hal_host_TWAR;
+volatile uint8_t hal_host_TWCR;
+volatile uint8_t hal_host_TWDR;
+volatile uint8_t hal_host_TWSR;
+
+volatile uint8_t hal_host_interrupts_enabled;
+void (*hal_host_checkpoint_hook)(uint8_t checkpoint);
+
+volatile uint32_t hal_host_sleeps;
+
+uint8_t hal_host_eeprom[E2END + 1] = {[0 ... E2END] = 0xFF};
+volatile uint32_t hal_host_eeprom_writes;
+uint32_t hal_host_eeprom_cell_writes[E2END + 1];
+
+volatile uint8_t hal_host_wdt_timeout;
+volatile uint32_t hal_host_wdt_resets;
+volatile uint32_t hal_host_delay_us;
+volatile uint32_t hal_host_bootloader_starts;
+volatile uint32_t hal_host_firmware_starts;
+
+uint8_t hal_host_flash[HAL_HOST_FLASH_SIZE] = {[0 ... HAL_HOST_FLASH_SIZE - 1] = 0xFF};
+uint8_t hal_host_spm_polls = 3;
+volatile uint8_t hal_host_rww_busy;
+volatile uint32_t hal_host_page_erases;
+volatile uint32_t hal_host_page_writes;
+volatile uint32_t hal_host_flash_reads;
+volatile uint32_t hal_host_spm_errors;
+
+// The temporary page buffer, and how many more polls the current SPM operation takes.
+static uint8_t page_buffer[SPM_PAGESIZE] = {[0 ... SPM_PAGESIZE - 1] = 0xFF};
+static uint8_t spm_busy_polls;
+
+// Aligned, since the bootloader handover leaves a 16 bit key at the top.
+uint8_t hal_host_stack[HAL_HOST_STACK_SIZE] __attribute__((aligned(2)));
+uint8_t *hal_host_SP;
+
+void hal_host_reset(void) {
+    hal_host_PORTB = 0;
+    hal_host_DDRB = 0;
+    hal_host_PINB = 0;
+    hal_host_PORTC = 0;
+    hal_host_DDRC = 0;
+    hal_host_PINC = 0;
+    hal_host_PORTD = 0;
+    hal_host_DDRD = 0;
+    // The button on PIND5 has a pullup, i.e. it reads HIGH while released.
+    hal_host_PIND = 0xFF;
+
+    hal_host_MCUCSR = 0;
+
+    hal_host_TCCR1A = 0;
+    hal_host_TCCR1B = 0;
+    hal_host_TCNT1 = 0;
+    hal_host_OCR1A = 0;
+    hal_host_TIMSK = 0;
+
+    hal_host_TCCR2 = 0;
+    hal_host_TCNT2 = 0;
+    hal_host_OCR2 = 0;
+
+    hal_host_TWAR = 0xFE;
+    hal_host_TWCR = 0;
+    hal_host_TWDR = 0xFF;
+    hal_host_TWSR = 0xF8;
+
+    hal_host_interrupts_enabled = 0;
+    hal_host_sleeps = 0;
+
+    hal_host_wdt_timeout = 0xFF;
+    hal_host_wdt_resets = 0;
+    hal_host_delay_us = 0;
+    hal_host_bootloader_starts = 0;
+    hal_host_firmware_starts = 0;
+
+    // A reset cancels whatever SPM was doing, and clears the page buffer.
+    hal_host_rww_busy = 0;
+    hal_host_page_erases = 0;
+    hal_host_page_writes = 0;
+    hal_host_flash_reads = 0;
+    hal_host_spm_errors = 0;
+    spm_busy_polls = 0;
+    for (uint16_t i = 0; i < SPM_PAGESIZE; i++) {
+        page_buffer[i] = 0xFF;
+    }
+
+    hal_host_SP = RAM_STACK_TOP;
+}
+
+// Starts an SPM operation. The real thing ignores it while the last one is still busy, but it is easier to find the
+// bug if the flash changes anyway, so this only counts it.
+static void spm_start(void) {
+    if (spm_busy_polls) {
+        hal_host_spm_errors++;
+    }
+}
+
+void hal_host_page_fill(uint16_t addr, uint16_t word) {
+    spm_start();
+    page_buffer[addr % SPM_PAGESIZE] = (uint8_t) word;
+    page_buffer[(addr + 1) % SPM_PAGESIZE] = (uint8_t) (word >> 8);
+}
+
+void hal_host_page_erase(uint16_t addr) {
+    spm_start();
+    uint16_t page = addr - addr % SPM_PAGESIZE;
+    for (uint16_t i = 0; i < SPM_PAGESIZE; i++) {
+        hal_host_flash[(page + i) % HAL_HOST_FLASH_SIZE] = 0xFF;
+    }
+    hal_host_page_erases++;
+    hal_host_rww_busy = 1;
+    spm_busy_polls = hal_host_spm_polls;
+}
+
+void hal_host_page_write(uint16_t addr) {
+    spm_start();
+    // Programming can only clear bits, so a page that wasn't erased comes out wrong.
+    uint16_t page = addr - addr % SPM_PAGESIZE;
+    for (uint16_t i = 0; i < SPM_PAGESIZE; i++) {
+        hal_host_flash[(page + i) % HAL_HOST_FLASH_SIZE] &= page_buffer[i];
+        page_buffer[i] = 0xFF;
+    }
+    hal_host_page_writes++;
+    hal_host_rww_busy = 1;
+    spm_busy_polls = hal_host_spm_polls;
+}
+
+uint8_t hal_host_spm_busy(void) {
+    if (spm_busy_polls) {
+        spm_busy_polls--;
+        return 1;
+    }
+    return 0;
+}
+
+void hal_host_spm_wait(void) {
+    spm_busy_polls = 0;
+}
+
+void hal_host_rww_enable(void) {
+    spm_start();
+    hal_host_rww_busy = 0;
+}
+
+uint8_t hal_host_flash_read_byte(uint16_t addr) {
+    hal_host_flash_reads++;
+    return hal_host_rww_busy ? 0xFF : hal_host_flash[addr % HAL_HOST_FLASH_SIZE];
+}
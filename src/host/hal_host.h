@@ -0,0 +1,361 @@
+//
+// Simulated ATmega8 registers for host builds.
+//
+// Every register the firmware touches is a plain global here, see hal_host.c.
+// Bit positions and status codes are copied from the ATmega8 datasheet / avr-libc, so the firmware sources compile
+// unmodified.
+// Interrupt vectors become ordinary functions, which means a test or benchmark can simply call TWI_vect() or
+// TIMER1_COMPA_vect() after setting up the simulated registers accordingly.
+// Nothing in here is thread-safe, and it doesn't need to be: There's only one core on the real thing, too.
+
+#ifndef FAN_CONTROL_HAL_HOST_H
+#define FAN_CONTROL_HAL_HOST_H
+
+#include <stdint.h>
+
+// ==============================
+// Registers
+// ==============================
+
+extern volatile uint8_t hal_host_PORTB;
+extern volatile uint8_t hal_host_DDRB;
+extern volatile uint8_t hal_host_PINB;
+extern volatile uint8_t hal_host_PORTC;
+extern volatile uint8_t hal_host_DDRC;
+extern volatile uint8_t hal_host_PINC;
+extern volatile uint8_t hal_host_PORTD;
+extern volatile uint8_t hal_host_DDRD;
+extern volatile uint8_t hal_host_PIND;
+
+extern volatile uint8_t hal_host_MCUCSR;
+
+extern volatile uint8_t hal_host_TCCR1A;
+extern volatile uint8_t hal_host_TCCR1B;
+extern volatile uint16_t hal_host_TCNT1;
+extern volatile uint16_t hal_host_OCR1A;
+extern volatile uint8_t hal_host_TIMSK;
+
+extern volatile uint8_t hal_host_TCCR2;
+extern volatile uint8_t hal_host_TCNT2;
+extern volatile uint8_t hal_host_OCR2;
+
+extern volatile uint8_t hal_host_TWAR;
+extern volatile uint8_t hal_host_TWCR;
+extern volatile uint8_t hal_host_TWDR;
+extern volatile uint8_t hal_host_TWSR;
+
+#define PORTB hal_host_PORTB
+#define DDRB hal_host_DDRB
+#define PINB hal_host_PINB
+#define PORTC hal_host_PORTC
+#define DDRC hal_host_DDRC
+#define PINC hal_host_PINC
+#define PORTD hal_host_PORTD
+#define DDRD hal_host_DDRD
+#define PIND hal_host_PIND
+
+#define MCUCSR hal_host_MCUCSR
+
+#define TCCR1A hal_host_TCCR1A
+#define TCCR1B hal_host_TCCR1B
+#define TCNT1 hal_host_TCNT1
+#define OCR1A hal_host_OCR1A
+#define TIMSK hal_host_TIMSK
+
+#define TCCR2 hal_host_TCCR2
+#define TCNT2 hal_host_TCNT2
+#define OCR2 hal_host_OCR2
+
+#define TWAR hal_host_TWAR
+#define TWCR hal_host_TWCR
+#define TWDR hal_host_TWDR
+#define TWSR hal_host_TWSR
+
+// ==============================
+// Bit positions
+// ==============================
+
+#define PORTB0 0
+#define PORTB1 1
+#define PORTB2 2
+#define PORTB3 3
+#define PORTB4 4
+#define PORTB5 5
+#define PORTB6 6
+#define PORTB7 7
+
+#define PORTC0 0
+#define PORTC1 1
+#define PORTC2 2
+#define PORTC3 3
+#define PORTC4 4
+#define PORTC5 5
+
+#define PORTD0 0
+#define PORTD1 1
+#define PORTD2 2
+#define PORTD3 3
+#define PORTD4 4
+#define PORTD5 5
+#define PORTD6 6
+#define PORTD7 7
+
+#define DDD5 5
+#define DDD7 7
+#define PIND5 5
+
+// MCUCSR
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+
+// TCCR1B
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define WGM13 4
+
+// TCCR2
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM21 3
+#define COM20 4
+#define COM21 5
+#define WGM20 6
+
+// TIMSK
+#define TOIE0 0
+#define TOIE1 2
+#define OCIE1B 3
+#define OCIE1A 4
+#define TICIE1 5
+#define TOIE2 6
+#define OCIE2 7
+
+// TWCR
+#define TWIE 0
+#define TWEN 2
+#define TWWC 3
+#define TWSTO 4
+#define TWSTA 5
+#define TWEA 6
+#define TWINT 7
+
+// TWAR
+#define TWGCE 0
+
+// ==============================
+// TWI status codes, see util/twi.h
+// ==============================
+
+#define TW_STATUS_MASK 0xF8
+#define TW_STATUS (TWSR & TW_STATUS_MASK)
+
+#define TW_ST_SLA_ACK 0xA8
+#define TW_ST_ARB_LOST_SLA_ACK 0xB0
+#define TW_ST_DATA_ACK 0xB8
+#define TW_ST_DATA_NACK 0xC0
+#define TW_ST_LAST_DATA 0xC8
+#define TW_SR_SLA_ACK 0x60
+#define TW_SR_ARB_LOST_SLA_ACK 0x68
+#define TW_SR_GCALL_ACK 0x70
+#define TW_SR_ARB_LOST_GCALL_ACK 0x78
+#define TW_SR_DATA_ACK 0x80
+#define TW_SR_DATA_NACK 0x88
+#define TW_SR_GCALL_DATA_ACK 0x90
+#define TW_SR_GCALL_DATA_NACK 0x98
+#define TW_SR_STOP 0xA0
+#define TW_NO_INFO 0xF8
+#define TW_BUS_ERROR 0x00
+
+// ==============================
+// Interrupts
+// ==============================
+
+// Mirrors the I bit in SREG.
+extern volatile uint8_t hal_host_interrupts_enabled;
+
+#define sei() (hal_host_interrupts_enabled = 1)
+#define cli() (hal_host_interrupts_enabled = 0)
+
+#define ISR(vector) void vector(void)
+
+// See util/atomic.h. There are no concurrent interrupts on the host, so this only has to run the block once.
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type) for (uint8_t hal_host_atomic_once = 1; hal_host_atomic_once; hal_host_atomic_once = 0)
+
+// All vectors the firmware implements, so they can be called from the host.
+void TWI_vect(void);
+void TIMER1_COMPA_vect(void);
+void TIMER2_COMP_vect(void);
+
+// Firmware entry points, see main.c.
+// On the AVR, main() calls fan_control_setup() once and then fan_control_loop() forever.
+void fan_control_setup(void);
+void fan_control_loop(void);
+
+// Called at every diagnostics_checkpoint of the firmware, if set. A test can use this to run an ISR at a specific point
+// of the main loop.
+extern void (*hal_host_checkpoint_hook)(uint8_t checkpoint);
+
+// ==============================
+// Sleep
+// ==============================
+
+#define SLEEP_MODE_IDLE 0
+
+// Incremented on every sleep_cpu. There's nothing to wait for on the host, so sleeping returns immediately.
+extern volatile uint32_t hal_host_sleeps;
+
+#define set_sleep_mode(mode) ((void) (mode))
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu() (hal_host_sleeps++)
+
+// ==============================
+// Program memory
+// ==============================
+
+// There's only one address space on the host.
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *) (addr))
+
+// ==============================
+// Flash
+// ==============================
+
+// The flash as the bootloader sees it, by absolute address, see hal.h. Big enough for every board, starts out erased,
+// and is not touched by hal_host_reset.
+#define HAL_HOST_FLASH_SIZE 0x8000
+extern uint8_t hal_host_flash[HAL_HOST_FLASH_SIZE];
+
+#if defined(BOARD_MCU_ATMEGA328P)
+#define SPM_PAGESIZE 128
+#else
+#define SPM_PAGESIZE 64
+#endif
+
+// How many times boot_spm_busy reports busy after a page erase or write. Set it before starting the operation.
+extern uint8_t hal_host_spm_polls;
+// Set by a page erase or write, and cleared by boot_rww_enable. In between, the RWW section (everything below the
+// bootloader) reads as 0xFF, like on the real thing.
+extern volatile uint8_t hal_host_rww_busy;
+// Incremented on every page erase and write, respectively.
+extern volatile uint32_t hal_host_page_erases;
+extern volatile uint32_t hal_host_page_writes;
+// Incremented on every FLASH_READ_BYTE and FLASH_READ_WORD, to tell whether the bootloader computed a CRC.
+extern volatile uint32_t hal_host_flash_reads;
+// Incremented whenever an SPM instruction is issued while the one before is still busy, which the real thing ignores.
+// The _safe variants wait, so they never count.
+extern volatile uint32_t hal_host_spm_errors;
+
+void hal_host_page_fill(uint16_t addr, uint16_t word);
+void hal_host_page_erase(uint16_t addr);
+void hal_host_page_write(uint16_t addr);
+uint8_t hal_host_spm_busy(void);
+void hal_host_spm_wait(void);
+void hal_host_rww_enable(void);
+uint8_t hal_host_flash_read_byte(uint16_t addr);
+
+// See avr/boot.h.
+#define boot_page_fill_safe(addr, word) (hal_host_spm_wait(), hal_host_page_fill(addr, word))
+#define boot_page_erase_safe(addr) (hal_host_spm_wait(), hal_host_page_erase(addr))
+#define boot_page_write(addr) hal_host_page_write(addr)
+#define boot_spm_busy() hal_host_spm_busy()
+#define boot_rww_enable() hal_host_rww_enable()
+#define boot_rww_enable_safe() (hal_host_spm_wait(), hal_host_rww_enable())
+
+#define FLASH_READ_BYTE(addr) hal_host_flash_read_byte(addr)
+#define FLASH_READ_WORD(addr) ((uint16_t) (hal_host_flash_read_byte(addr) | hal_host_flash_read_byte((addr) + 1) << 8))
+
+// See util/crc16.h.
+static inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data) {
+    crc ^= (uint16_t) (data << 8);
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = crc & 0x8000 ? (uint16_t) (crc << 1 ^ 0x1021) : (uint16_t) (crc << 1);
+    }
+    return crc;
+}
+
+// ==============================
+// RAM
+// ==============================
+
+// hal_host_reset only resets the registers, so all variables keep their values across simulated resets anyway.
+// Set MCUCSR to (1 << PORF) before the next fan_control_setup to simulate a power-on reset.
+#define NOINIT
+
+// There's no linker script to ask for the RAM layout, so there's no static data as far as the firmware is concerned,
+// and the stack is simulated: It's hal_host_stack, SP points into it, and nothing uses it unless a test writes to it.
+#define HAL_HOST_STACK_SIZE 768
+extern uint8_t hal_host_stack[HAL_HOST_STACK_SIZE];
+extern uint8_t *hal_host_SP;
+
+#define RAM_DATA_SIZE 0
+#define RAM_BSS_SIZE 0
+#define RAM_STACK_LIMIT (&hal_host_stack[0])
+#define RAM_STACK_TOP (&hal_host_stack[HAL_HOST_STACK_SIZE - 1])
+#define RAM_STACK_POINTER() (hal_host_SP)
+
+// ==============================
+// EEPROM
+// ==============================
+
+#define E2END 0x1FF
+
+// Simulated EEPROM contents. Starts out erased, and is not touched by hal_host_reset, just like the real thing.
+extern uint8_t hal_host_eeprom[E2END + 1];
+// Incremented on every eeprom_write_byte.
+extern volatile uint32_t hal_host_eeprom_writes;
+// The same, per cell, to check the wear leveling.
+extern uint32_t hal_host_eeprom_cell_writes[E2END + 1];
+
+#define eeprom_is_ready() 1
+#define eeprom_read_byte(addr) (hal_host_eeprom[(uintptr_t) (addr)])
+#define eeprom_write_byte(addr, value) (hal_host_eeprom[(uintptr_t) (addr)] = (value), \
+                                        hal_host_eeprom_cell_writes[(uintptr_t) (addr)]++, hal_host_eeprom_writes++)
+#define eeprom_read_word(addr) ((uint16_t) (eeprom_read_byte(addr) | eeprom_read_byte((uintptr_t) (addr) + 1) << 8))
+#define eeprom_write_word(addr, value) (eeprom_write_byte(addr, (uint8_t) (value)), \
+                                        eeprom_write_byte((uintptr_t) (addr) + 1, (uint8_t) ((value) >> 8)))
+
+// ==============================
+// Watchdog and delays
+// ==============================
+
+#define WDTO_2S 7
+
+// The timeout passed to the last wdt_enable, or 0xFF if the watchdog was never enabled.
+extern volatile uint8_t hal_host_wdt_timeout;
+// Incremented on every wdt_reset.
+extern volatile uint32_t hal_host_wdt_resets;
+// Accumulated time spent in _delay_ms, in microseconds.
+extern volatile uint32_t hal_host_delay_us;
+
+#define wdt_enable(timeout) (hal_host_wdt_timeout = (timeout))
+#define wdt_reset() (hal_host_wdt_resets++)
+
+#define _delay_ms(ms) (hal_host_delay_us += (uint32_t) ((ms) * 1000))
+
+// ==============================
+// Bootloader
+// ==============================
+
+// Incremented whenever the firmware hands over to the bootloader, see bootloader.h. The handover returns right away on
+// the host, and leaves the key at the top of hal_host_stack, so a test can go on with fan_control_boot_setup.
+extern volatile uint32_t hal_host_bootloader_starts;
+// Incremented whenever the bootloader starts the firmware, which returns right away as well. A test goes on with
+// fan_control_setup then, with MCUCSR left as it was.
+extern volatile uint32_t hal_host_firmware_starts;
+
+// Bootloader entry points, see boot/fan_control_boot.c. These are only there if a test compiles it in.
+// On the AVR, main() calls fan_control_boot_setup() once and then fan_control_boot_loop() forever.
+void fan_control_boot_setup(void);
+void fan_control_boot_loop(void);
+
+// Resets all simulated registers to their power-on values.
+void hal_host_reset(void);
+
+#endif //FAN_CONTROL_HAL_HOST_H
@@ -12,139 +12,253 @@ Mode of operation:
   - The selected digit is blinking.
   - If no digit is selected, values can be set via I2C.
   - If _any_ digit is selected, _no_ values will be accepted via I2C.
+  - The timer interrupt only debounces the button and queues press events, the main loop acts on them. See button.h.
 - The I2C register file contains three registers:
   - 0x00 is a status byte. The rightmost bit indicates whether writing via I2C is currently _disabled_. The next bit indicates whether _no_ watchdog reset has occurred.
   - 0x01 is the air-intake mode. If manual mode is active, this can be read to get the currently selected mode. Otherwise, it can be written to set a mode.
   - 0x02 is the air-out mode, same as above.
   - Only after register 0x02 is written are the changes to registers 0x01 and 0x02 processed!
+  - Reading 0x01 and 0x02 always returns the currently active modes, not what was last written.
+  - 0x03 is a read-only change sequence number. It is incremented whenever the modes or the lock (bit 1 of 0x00)
+    change, be it via I2C or the button. A master can poll just this byte instead of the full state.
+    Optionally, an open-drain attention line on D7 is pulled LOW on every change, until 0x03 is read. See attention.h.
+  - 0x04 holds configuration flags. Bit 0 enables SMBus Packet Error Checking, see twislave.c.
+  - 0x05 is the number of data bytes a read returns before the PEC, if enabled.
+  - 0x06 is the I2C address of this device, and 0x07 the broadcast groups it is a member of. Both are saved in
+    EEPROM (see device_config.h). A new address takes effect after the next reset.
+  - A general call can set the modes of all members of a group at once, see twislave.c.
+  - 0x08 to 0x0B control the on-device schedule, and the schedule table is staged at 0x24. See schedule.h.
+  - 0x10 and onwards hold read-only performance counters, see telemetry.h.
+    They are captured when a read reaches them, so one burst read returns a consistent snapshot.
+  - The relay actuation counts follow the schedule table, see telemetry.h.
+  - 0x0C to 0x0E set the button thresholds, and a log of the last button events follows the relay actuation counts.
+    See button.h.
+  - Writing 0xB0 to 0x0F starts the bootloader, for a firmware update over I2C. See bootloader.h.
+  - The brightness of the left and right digit follow the button log.
+  - Read-only reset diagnostics follow the brightness: the reset cause, what the firmware was doing when it was reset,
+    and the number of resets since power-on. See diagnostics.h.
+  - The static RAM usage and the stack high-water mark follow the diagnostics, see stack_monitor.h.
+  - Then a trace of the last TWI events, recorded while bit 1 of 0x04 is set. See twi_trace.h.
+  - Last is the number of times the TWI was reset because the bus hung, see twislave.c.
 - The relays controlled by this form two binary trees. See the relay.h source for more information on that.
+  They are switched one at a time from the timer interrupt, in an order that never puts more voltage on a fan than
+  before or after the change.
 - A seven-segment display is attached, which is controlled by segment.h.
+  It is multiplexed from a timer interrupt, so the main loop never blocks. Each digit can be dimmed via I2C.
+  It shows the modes, or for a moment a status code: "Er" after a watchdog reset, "L" if a master tried to set the
+  modes while they're locked by the button. The right dot stays lit until the master acknowledges a watchdog reset.
+- The modes and the manual mode selection are saved in EEPROM (see mode_store.h) and restored on boot, before the
+  relays are driven for the first time.
+- The main loop sleeps (idle mode) whenever there is nothing to do, and is woken up by the interrupts.
 */
 
-#ifndef F_CPU
-# define F_CPU 8000000UL
-#endif
-
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <avr/wdt.h>
-#include <util/delay.h>
+#include "hal.h"
 #include "twislave.h"
 #include "segment.h"
 #include "relay.h"
+#include "timer.h"
+#include "timer_wheel.h"
+#include "telemetry.h"
+#include "mode_store.h"
+#include "device_config.h"
+#include "schedule.h"
+#include "button.h"
+#include "diagnostics.h"
+#include "stack_monitor.h"
+#include "twi_trace.h"
+#include "bootloader.h"
 
 // The currently active air-intake mode.
-// This is volatile since it is being changed from within the timer interrupt on button presses.
-volatile uint8_t air_mode_in = 0;
+uint8_t air_mode_in = 0;
 // The currently active air-out mode.
-// This is volatile since it is being changed from within the timer interrupt on button presses.
-volatile uint8_t air_mode_out = 0;
+uint8_t air_mode_out = 0;
+// The current mode for manual control. 0=i2c, 1=left digit, 2=right digit.
+// This is volatile since the blinking in the timer interrupt reads it.
+volatile uint8_t selected_digit = 0;
+// The I2C commit sequence number we last processed, see i2c_read_commit.
+static uint8_t last_commit_seq = 0;
+// The state last published via I2C, to detect changes for the change sequence register.
+static mode_state_t published;
+// The address and groups as saved in EEPROM. TWI_vect updates the registers, we save them.
+static device_config_t config;
+// The value of telemetry_seconds the schedule was last advanced to.
+static uint8_t schedule_seconds;
+// The sequence numbers of the schedule requests we last processed, see i2c_read_request.
+static uint8_t last_schedule_length_seq = 0;
+static uint8_t last_schedule_jump_seq = 0;
+static uint8_t last_schedule_remaining_seq = 0;
 // Whether the left digit should be displayed.
-// This is volatile since it is being changed from within the timer interrupt on button presses.
+// This is volatile since it is being changed from within the timer interrupt for blinking.
 volatile uint8_t left_digit_on = 1;
 // Whether the right digit should be displayed.
-// This is volatile since it is being changed from within the timer interrupt on button presses.
+// This is volatile since it is being changed from within the timer interrupt for blinking.
 volatile uint8_t right_digit_on = 1;
+// Set by the timer interrupt whenever one of the above changed, cleared by the main loop.
+volatile uint8_t ui_changed = 1;
+
+// Whether the master wrote any schedule requests we didn't process yet.
+static uint8_t schedule_requests_pending(void) {
+    return i2c_schedule_length_seq != last_schedule_length_seq || i2c_schedule_jump_seq != last_schedule_jump_seq ||
+           i2c_schedule_remaining_seq != last_schedule_remaining_seq;
+}
 
 // Initialize outputs.
 static void io_init() {
-    relay_io_init();
+    relay_io_init(air_mode_in, air_mode_out);
 
     segment_io_init();
 
-    // The button is connected to PIND5.
-    DDRD &= ~(1 << DDD5);
+    // The button is an input, see board.h.
+    DDRD &= ~(1 << BOARD_BUTTON_PIN);
+
+    attention_init();
 }
 
 // Initialize the timer.
 // This sets up timer 1 to fire at 100 Hz, i.e. every 10ms.
 // Timer interrupts have higher priority than I2C, but I don't know if that could cause problems irl...
 void init_timer() {
-    // See http://www.8bit-era.cz/arduino-timer-interrupts-calculator.html
-    // Or https://www.arduinoslovakia.eu/application/timer-calculator
-
     TCCR1A = 0; // set entire TCCR1A register to 0
     TCCR1B = 0; // same for TCCR1B
     TCNT1 = 0; // initialize counter value to 0
-    // set compare match register for 100 Hz increments
-    OCR1A = 9999; // = 8000000 / (8 * 100) - 1 (must be <65536)
+    // set compare match register for 100 Hz increments, derived from F_CPU in timer.h
+    OCR1A = TIMER1_TOP; // = 8000000 / (8 * 100) - 1 = 9999 on the original board
     // turn on CTC mode
     TCCR1B |= (1 << WGM12);
-    // Set CS12, CS11 and CS10 bits for 8 prescaler
-    TCCR1B |= (0 << CS12) | (1 << CS11) | (0 << CS10);
+    // Set the prescaler, also derived in timer.h
+    TCCR1B |= TIMER1_CLOCK_SELECT;
     // enable timer compare interrupt
-    TIMSK |= (1 << OCIE1A);
+    TIMER1_TIMSK |= (1 << OCIE1A);
 }
 
-// The number of digits on the segment.
-#define NUM_DIGITS 2
-// The blinking duration to show a digit is selected, in multiples of 10ms.
-#define TIMER_CNT_THRESH 30
+// The blinking duration to show a digit is selected, in ticks.
+#define BLINK_TICKS 30
 
-ISR(TIMER1_COMPA_vect) // every 10ms
-{
-    // The current mode for manual control. 0=i2c, 1=left digit, 2=right digit.
-    static uint8_t selected_digit = 0;
-    static uint8_t down_for_cycles = 0;
-    static uint8_t timer_cnt = 0;
-
-    // The button is connected to PIND5, but HIGH by default.
-    uint8_t is_pressed = !(PIND & (1 << PIND5));
-    if (is_pressed) {
-        // Button down
-        down_for_cycles++;
-
-        if (down_for_cycles == 50) {
-            // Long press
-            selected_digit = (selected_digit + 1) % (NUM_DIGITS + 1);
-            // Set the blink counter to trigger immediately.
-            timer_cnt = TIMER_CNT_THRESH - 1;
-            if (selected_digit == 0) {
-                i2c_write_disabled = 0;
-            } else {
-                i2c_write_disabled = 1;
-            }
-        }
-        if (down_for_cycles > 250) {
-            // This will overflow soon, so we reset it to something low now.
-            // We reset to 51 to not trigger a long press.
-            down_for_cycles = 51;
-        }
-    } else {
-        // Button up
-        if (down_for_cycles > 1 && down_for_cycles < 50) {
-            // Short press
-            if (selected_digit == 1) {
-                air_mode_in = (air_mode_in + 1) % NUM_AIR_IN_MODES;
-            } else if (selected_digit == 2) {
-                air_mode_out = (air_mode_out + 1) % NUM_AIR_OUT_MODES;
-            }
-        }
-        down_for_cycles = 0;
+static void blink(void);
+
+// Toggles the selected digit while one is selected.
+static timer_wheel_timer_t blink_timer = TIMER_WHEEL_TIMER(blink);
+
+// How long a status code is shown instead of the modes, in ticks.
+#define DISPLAY_CODE_TICKS 250
+
+static void code_expired(void);
+
+// Whether a status code is shown instead of the modes, see show_code.
+// This is volatile since it is being cleared from within the timer interrupt.
+static volatile uint8_t code_shown = 0;
+static uint8_t code_left_glyph;
+static uint8_t code_right_glyph;
+// Whether the dot for an unacknowledged watchdog reset is shown.
+static uint8_t wdt_dot_shown = 0;
+static timer_wheel_timer_t code_timer = TIMER_WHEEL_TIMER(code_expired);
+
+static void code_expired(void) {
+    code_shown = 0;
+    ui_changed = 1;
+}
+
+// Shows a status code instead of the modes for DISPLAY_CODE_TICKS, e.g. "Er" after a watchdog reset.
+static void show_code(uint8_t left_glyph, uint8_t right_glyph) {
+    code_left_glyph = left_glyph;
+    code_right_glyph = right_glyph;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        code_shown = 1;
+        timer_wheel_start(&code_timer, DISPLAY_CODE_TICKS, 0);
     }
+}
 
-    // Make selected digit blink.
+// Updates the display framebuffer.
+// Normally, this shows the modes, with the selected digit blinking. The right dot is lit until the master acknowledges
+// a watchdog reset.
+static void update_display(void) {
+    if (code_shown) {
+        display_show(code_left_glyph, code_right_glyph, 1, 1);
+        return;
+    }
+
+    uint8_t right_glyph = air_mode_out;
+    if (wdt_dot_shown) {
+        right_glyph |= GLYPH_DOT;
+    }
+    display_show(air_mode_in, right_glyph, left_digit_on, right_digit_on);
+}
+
+// Starts blinking the selected digit, or stops blinking if none is selected.
+static void blink_update(void) {
     if (selected_digit == 0) {
-        // No digit selected, no blinking.
-        timer_cnt = 0;
+        timer_wheel_cancel(&blink_timer);
         left_digit_on = 1;
         right_digit_on = 1;
     } else {
-        timer_cnt++;
-        if (timer_cnt == TIMER_CNT_THRESH) {
-            timer_cnt = 0;
-            if (selected_digit == 1) {
-                right_digit_on = 1;
-                left_digit_on = !left_digit_on;
-            } else {
-                left_digit_on = 1;
-                right_digit_on = !right_digit_on;
-            }
-        }
+        // Blink right away, so the selection is visible immediately.
+        timer_wheel_start(&blink_timer, 1, BLINK_TICKS);
     }
 }
 
-int main(void) {
+static void blink(void) {
+    if (selected_digit == 1) {
+        right_digit_on = 1;
+        left_digit_on = !left_digit_on;
+    } else {
+        left_digit_on = 1;
+        right_digit_on = !right_digit_on;
+    }
+    ui_changed = 1;
+}
+
+// A long press selects the next digit, or goes back to I2C mode after the last one.
+static void handle_long_press(void) {
+    selected_digit = (selected_digit + 1) % (NUM_DIGITS + 1);
+    i2c_write_disabled = (selected_digit != 0);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        blink_update();
+    }
+}
+
+// Hands over to the bootloader, see bootloader.h. The relays keep their pattern, everything else stops.
+static void start_bootloader(void) {
+    cli();
+    TIMER1_TIMSK &= ~(1 << OCIE1A);
+    display_off();
+    TWCR = 0;
+    wdt_reset();
+    // Only matters on the host, where this returns.
+    i2c_boot_request = 0;
+    bootloader_start();
+}
+
+// A short press changes the mode of the selected digit.
+static void handle_short_press(void) {
+    if (selected_digit == 1) {
+        air_mode_in = (air_mode_in + 1) % NUM_AIR_IN_MODES;
+    } else if (selected_digit == 2) {
+        air_mode_out = (air_mode_out + 1) % NUM_AIR_OUT_MODES;
+    }
+}
+
+// The system tick. Everything periodic runs from the timer wheel, see timer_wheel.h.
+ISR(TIMER1_COMPA_vect) // every 10ms
+{
+    uint16_t isr_start = timer1_now_isr();
+
+    timer_wheel_tick();
+
+    telemetry_timer_isr_end(isr_start);
+}
+
+// Sets up all peripherals and enables interrupts.
+// This is split from main() so host builds can run the firmware logic step by step.
+void fan_control_setup(void) {
+    // Restore the last state, so the relays come up the way they were before the reset.
+    mode_state_t state;
+    if (mode_store_load(&state) && state.air_mode_in < NUM_AIR_IN_MODES && state.air_mode_out < NUM_AIR_OUT_MODES &&
+        state.selected_digit <= NUM_DIGITS) {
+        air_mode_in = state.air_mode_in;
+        air_mode_out = state.air_mode_out;
+        selected_digit = state.selected_digit;
+    }
+
     // Set inputs/outputs.
     io_init();
 
@@ -152,59 +266,241 @@ int main(void) {
     for (int i = 0; i < i2c_buffer_size; i++) {
         i2cdata[i] = 0;
     }
-    i2cdata[1] = air_mode_in;
-    i2cdata[2] = air_mode_out;
+    // Find out why we were reset, and what we were doing at the time.
+    uint8_t reset_cause = diagnostics_init(&i2cdata[I2C_REG_DIAGNOSTICS]);
+    // From here on, we can tell how deep the stack gets.
+    stack_monitor_init(&i2cdata[I2C_REG_STACK_MONITOR]);
+    twi_trace_init(&i2cdata[I2C_REG_TRACE]);
+    i2cdata[I2C_REG_AIR_IN] = air_mode_in;
+    i2cdata[I2C_REG_AIR_OUT] = air_mode_out;
+    i2cdata[I2C_REG_PEC_READ_LENGTH] = I2C_PEC_READ_LENGTH_DEFAULT;
+    i2cdata[I2C_REG_BUTTON_DEBOUNCE] = BUTTON_DEBOUNCE_DEFAULT;
+    i2cdata[I2C_REG_BUTTON_LONG_PRESS] = BUTTON_LONG_PRESS_DEFAULT;
+    i2cdata[I2C_REG_BUTTON_REPEAT] = BUTTON_REPEAT_DEFAULT;
+    i2cdata[I2C_REG_BRIGHTNESS] = 255;
+    i2cdata[I2C_REG_BRIGHTNESS + 1] = 255;
+    device_config_load(&config, I2C_SLAVE_ADDRESS);
+    i2cdata[I2C_REG_ADDRESS] = config.i2c_address;
+    i2cdata[I2C_REG_GROUPS] = config.groups;
+    i2cdata[I2C_REG_SCHEDULE_CONTROL] = schedule_load(&i2cdata[I2C_REG_SCHEDULE]);
+    schedule_seconds = telemetry_seconds;
+    published.air_mode_in = air_mode_in;
+    published.air_mode_out = air_mode_out;
+    published.selected_digit = selected_digit;
 
     // Mark watchdog reset in status byte.
-    if (MCUCSR & (1 << WDRF)) {
+    if (reset_cause & (1 << WDRF)) {
         // A reset by the watchdog has occurred.
         // Signal this by clearing bit 2 in status byte.
-        i2cdata[0] &= ~(I2C_BIT_WDT_RESET);
-        // Clear flag for next time.
-        MCUCSR &= ~(1 << WDRF);
+        i2cdata[I2C_REG_STATUS] &= ~(I2C_BIT_WDT_RESET);
+        // And on the display, for whoever is standing in front of it.
+        show_code(GLYPH_E, GLYPH_R);
     } else {
         // 1 means no WDT reset occurred.
-        i2cdata[0] |= I2C_BIT_WDT_RESET;
+        i2cdata[I2C_REG_STATUS] |= I2C_BIT_WDT_RESET;
     }
 
     // Enable watchdog to restart if we didn't reset it for 2 seconds.
     wdt_enable(WDTO_2S);
     // Enable I2C.
-    init_twi_slave(I2C_SLAVE_ADDRESS);
+    init_twi_slave(config.i2c_address);
+    // Manual mode survives resets, too.
+    i2c_write_disabled = (selected_digit != 0);
+    // Start the software timers. The relays already have theirs, see relay_io_init.
+    button_init();
+    twi_supervisor_init();
+    blink_update();
+    telemetry_init();
     // Enable timer.
     init_timer();
+    // Enable display scan-out.
+    init_display_timer();
+
+    // The main loop sleeps in idle mode, which keeps the timers and TWI running.
+    set_sleep_mode(SLEEP_MODE_IDLE);
 
     // Enable Interrupts.
     sei();
+}
 
-    while (1) {
-        // Reset watchdog timer.
-        wdt_reset();
-
-        // If we got new values via I2C...
-        {
-            cli();
-            if (i2c_write_disabled) {
-                i2cdata[0] |= I2C_BIT_I2C_DISABLED;
-                i2cdata[1] = air_mode_in;
-                i2cdata[2] = air_mode_out;
-            } else {
-                i2cdata[0] &= ~I2C_BIT_I2C_DISABLED;
-                if (i2c_fully_written) {
-                    if (i2cdata[1] < NUM_AIR_IN_MODES)
-                        air_mode_in = i2cdata[1];
-                    if (i2cdata[2] < NUM_AIR_OUT_MODES)
-                        air_mode_out = i2cdata[2];
-                }
-            }
-            i2c_fully_written = 0;
-            sei();
+// One pass of the main loop.
+// The main loop is event-driven: It handles whatever happened since the last pass and then puts the CPU to sleep until
+// the next interrupt. Relays and display are only touched if something changed.
+void fan_control_loop(void) {
+    uint16_t loop_start = timer1_now();
+    uint8_t changed = 0;
+
+    diagnostics_checkpoint(DIAGNOSTICS_CHECKPOINT_LOOP);
+
+    // Reset watchdog timer.
+    // The timer interrupts wake us up at least every 10ms, so this happens often enough.
+    wdt_reset();
+
+    // If we got new values via I2C...
+    if (i2c_commit_seq != last_commit_seq) {
+        uint8_t new_air_in, new_air_out;
+        last_commit_seq = i2c_read_commit(&new_air_in, &new_air_out);
+
+        // TWI_vect only commits while writing is enabled, but the button might have been long-pressed since.
+        if (!i2c_write_disabled) {
+            if (new_air_in < NUM_AIR_IN_MODES)
+                air_mode_in = new_air_in;
+            if (new_air_out < NUM_AIR_OUT_MODES)
+                air_mode_out = new_air_out;
         }
+        changed = 1;
+    }
+
+    diagnostics_checkpoint(DIAGNOSTICS_CHECKPOINT_BUTTON);
+
+    // Button presses. Repeat events are only logged, holding the button does not cycle through the digits.
+    button_set_thresholds(i2cdata[I2C_REG_BUTTON_DEBOUNCE], i2cdata[I2C_REG_BUTTON_LONG_PRESS],
+                          i2cdata[I2C_REG_BUTTON_REPEAT]);
+    button_event_t event;
+    while (button_take_event(&event)) {
+        if (event.type == BUTTON_EVENT_LONG) {
+            handle_long_press();
+            changed = 1;
+        } else if (event.type == BUTTON_EVENT_SHORT) {
+            handle_short_press();
+            changed = 1;
+        }
+    }
+
+    // Let whoever is at the panel know that a master tried to change the modes while they're locked.
+    if (i2c_write_rejected) {
+        i2c_write_rejected = 0;
+        show_code(GLYPH_L, GLYPH_BLANK);
+        changed = 1;
+    }
+
+    // The watchdog reset dot goes away once the master acknowledged the reset.
+    uint8_t wdt_dot = !(i2cdata[I2C_REG_STATUS] & I2C_BIT_WDT_RESET);
+    if (wdt_dot != wdt_dot_shown) {
+        wdt_dot_shown = wdt_dot;
+        changed = 1;
+    }
+
+    // Dimming is done by the display timer, this only passes the values on.
+    display_set_brightness(i2cdata[I2C_REG_BRIGHTNESS], i2cdata[I2C_REG_BRIGHTNESS + 1]);
+
+    diagnostics_checkpoint(DIAGNOSTICS_CHECKPOINT_SCHEDULE);
+
+    // Schedule changes via I2C, in the order they'd be written in one transaction.
+    uint8_t request;
+    if (i2c_schedule_length_seq != last_schedule_length_seq) {
+        last_schedule_length_seq = i2c_read_request(&i2c_schedule_length_request, &i2c_schedule_length_seq, &request);
+        schedule_commit(&i2cdata[I2C_REG_SCHEDULE], request);
+    }
+    if (i2c_schedule_jump_seq != last_schedule_jump_seq) {
+        last_schedule_jump_seq = i2c_read_request(&i2c_schedule_jump_request, &i2c_schedule_jump_seq, &request);
+        schedule_jump(request);
+    }
+    if (i2c_schedule_remaining_seq != last_schedule_remaining_seq) {
+        last_schedule_remaining_seq = i2c_read_request(&i2c_schedule_remaining_request, &i2c_schedule_remaining_seq,
+                                                       &request);
+        schedule_set_remaining(request);
+    }
+
+    // Run the schedule.
+    uint8_t now = telemetry_seconds;
+    if (now != schedule_seconds) {
+        schedule_advance(now - schedule_seconds);
+        schedule_seconds = now;
+    }
+    schedule_set_enabled(i2cdata[I2C_REG_SCHEDULE_CONTROL] & SCHEDULE_CONTROL_ENABLED);
+    uint8_t schedule_air_in, schedule_air_out;
+    if (schedule_take_modes(selected_digit != 0, &schedule_air_in, &schedule_air_out)) {
+        air_mode_in = schedule_air_in;
+        air_mode_out = schedule_air_out;
+        changed = 1;
+    }
+    i2cdata[I2C_REG_SCHEDULE_LENGTH] = schedule_length();
+    i2cdata[I2C_REG_SCHEDULE_ENTRY] = schedule_entry();
+    i2cdata[I2C_REG_SCHEDULE_REMAINING] = schedule_remaining();
+
+    // If the button was used or a digit is blinking...
+    if (ui_changed) {
+        // Clear before reading the state, so we don't miss changes made while we're at it.
+        ui_changed = 0;
+        changed = 1;
+    }
+
+    diagnostics_checkpoint(DIAGNOSTICS_CHECKPOINT_OUTPUTS);
+
+    if (changed) {
+        mode_state_t state = {air_mode_in, air_mode_out, selected_digit};
+
+        // Publish the currently active modes for reading via I2C. TWI_vect might have committed newer ones since we
+        // read the last commit, and it keeps showing those until i2c_published_seq catches up.
+        i2cdata[I2C_REG_AIR_IN] = state.air_mode_in;
+        i2cdata[I2C_REG_AIR_OUT] = state.air_mode_out;
+        i2c_published_seq = last_commit_seq;
+        if (state.air_mode_in != published.air_mode_in || state.air_mode_out != published.air_mode_out ||
+            (state.selected_digit != 0) != (published.selected_digit != 0)) {
+            i2cdata[I2C_REG_CHANGE_SEQ]++;
+            attention_assert();
+        }
+        published = state;
 
         // Set relays.
-        drive_relays(air_mode_in, air_mode_out);
+        if (drive_relays(air_mode_in, air_mode_out)) {
+            telemetry_relay_changed();
+        }
+
+        // Update display framebuffer.
+        update_display();
+
+        // Remember the state across resets.
+        mode_store_save(&state);
+    }
+
+    diagnostics_checkpoint(DIAGNOSTICS_CHECKPOINT_EEPROM);
+
+    // Save address and group changes made via I2C.
+    if (i2cdata[I2C_REG_ADDRESS] != config.i2c_address || i2cdata[I2C_REG_GROUPS] != config.groups) {
+        config.i2c_address = i2cdata[I2C_REG_ADDRESS];
+        config.groups = i2cdata[I2C_REG_GROUPS];
+        device_config_save(&config);
+    }
+
+    // Continue saving, if necessary.
+    mode_store_poll();
+    device_config_poll();
+    schedule_poll();
+
+    // Look for the stack high-water mark, a few bytes at a time.
+    stack_monitor_poll(&i2cdata[I2C_REG_STACK_MONITOR]);
+
+    telemetry_loop_end(loop_start);
 
-        // Set display.
-        drive_display(air_mode_in, air_mode_out, left_digit_on, right_digit_on);
+    // Only once the relays are where they should be and the EEPROM is consistent, the update may take a while.
+    if (i2c_boot_request && relays_settled() && !mode_store_busy() && !device_config_busy() && !schedule_busy()) {
+        start_bootloader();
     }
-}
\ No newline at end of file
+
+    diagnostics_checkpoint(DIAGNOSTICS_CHECKPOINT_SLEEP);
+
+    // Sleep until the next interrupt, unless something happened in the meantime.
+    // Interrupts are disabled for the check, and sei() always executes the next instruction before any interrupt, so
+    // we can't miss a wakeup between the check and going to sleep.
+    cli();
+    if (!ui_changed && i2c_commit_seq == last_commit_seq && !schedule_requests_pending() &&
+        !button_events_pending() && !i2c_write_rejected) {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    sei();
+}
+
+#ifndef FAN_CONTROL_HOST
+int main(void) {
+    fan_control_setup();
+
+    while (1) {
+        fan_control_loop();
+    }
+}
+#endif
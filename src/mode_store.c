@@ -0,0 +1,64 @@
+//
+// Wear-leveled EEPROM ring for the mode state, see mode_store.h.
+//
+
+#include "mode_store.h"
+#include "eeprom_ring.h"
+
+#define RECORD_MODES 0
+#define RECORD_SELECTED_DIGIT 1
+
+static eeprom_ring_t ring = EEPROM_RING(MODE_STORE_ADDR, MODE_STORE_SLOTS, MODE_STORE_DATA_SIZE);
+// The state that was saved last, or is being saved right now.
+static mode_state_t saved;
+// Whether saved differs from what's in EEPROM.
+static uint8_t save_pending = 0;
+// The data of the record currently being written.
+static uint8_t record[MODE_STORE_DATA_SIZE];
+
+static uint8_t record_data(uint8_t i) {
+    return record[i];
+}
+
+uint8_t mode_store_load(mode_state_t *state) {
+    const uint8_t *data = eeprom_ring_load(&ring, NULL);
+    if (!data) {
+        return 0;
+    }
+
+    uint8_t modes = eeprom_read_byte(data + RECORD_MODES);
+    saved.air_mode_in = modes & 0x0F;
+    saved.air_mode_out = modes >> 4;
+    saved.selected_digit = eeprom_read_byte(data + RECORD_SELECTED_DIGIT);
+    *state = saved;
+    return 1;
+}
+
+void mode_store_save(const mode_state_t *state) {
+    if (state->air_mode_in == saved.air_mode_in &&
+        state->air_mode_out == saved.air_mode_out &&
+        state->selected_digit == saved.selected_digit) {
+        return;
+    }
+
+    // If a record is being written right now, this will be picked up once it's done.
+    saved = *state;
+    save_pending = 1;
+}
+
+void mode_store_poll(void) {
+    if (save_pending && !eeprom_ring_busy(&ring)) {
+        // Start the next record. Waiting for the previous one instead of starting it over means rapid changes still
+        // go around the ring, rather than wearing out a single slot.
+        save_pending = 0;
+        record[RECORD_MODES] = saved.air_mode_in | (saved.air_mode_out << 4);
+        record[RECORD_SELECTED_DIGIT] = saved.selected_digit;
+        eeprom_ring_save(&ring);
+    }
+
+    eeprom_ring_poll(&ring, record_data);
+}
+
+uint8_t mode_store_busy(void) {
+    return save_pending || eeprom_ring_busy(&ring);
+}
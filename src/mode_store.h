@@ -0,0 +1,54 @@
+//
+// Persists the mode state in EEPROM, so it survives resets and power cycles.
+//
+// The state is stored in an eeprom_ring of MODE_STORE_SLOTS records of four bytes each: [seq, modes, selected digit,
+// check]. Every save goes into the slot after the newest one, so the wear is spread evenly over the whole ring, and a
+// save interrupted by a reset falls back to the previous record, see eeprom_ring.h.
+//
+// EEPROM cells are good for about 100000 writes. Every save writes each byte of one slot at most once, so the ring
+// lasts for 100000 * MODE_STORE_SLOTS = 6.4 million saves. Even at one mode change per minute, that's more than 12
+// years.
+//
+// Saving only queues the record, and mode_store_poll writes one byte at a time whenever the EEPROM is ready.
+//
+
+#ifndef FAN_CONTROL_MODE_STORE_H
+#define FAN_CONTROL_MODE_STORE_H
+
+#include "hal.h"
+#include "eeprom_ring.h"
+
+// EEPROM area used for the ring. The rest of the EEPROM is free for other uses.
+#define MODE_STORE_ADDR 0x000
+#define MODE_STORE_SLOTS 64
+// Packed modes and the selected digit.
+#define MODE_STORE_DATA_SIZE 2
+#define MODE_STORE_RECORD_SIZE (MODE_STORE_DATA_SIZE + EEPROM_RING_OVERHEAD)
+#define MODE_STORE_END (MODE_STORE_ADDR + EEPROM_RING_SIZE(MODE_STORE_SLOTS, MODE_STORE_DATA_SIZE))
+
+#if MODE_STORE_END > E2END + 1
+#error "mode store does not fit in EEPROM"
+#endif
+
+typedef struct {
+    uint8_t air_mode_in;
+    uint8_t air_mode_out;
+    // The selected digit of the manual mode, 0 if the modes are set via I2C.
+    uint8_t selected_digit;
+} mode_state_t;
+
+// Loads the last saved state into state.
+// Returns 0 and leaves state untouched if there is none.
+uint8_t mode_store_load(mode_state_t *state);
+
+// Queues the given state to be saved, unless it is the same as what was saved last.
+void mode_store_save(const mode_state_t *state);
+
+// Writes the next byte of a queued save, if the EEPROM is ready. Never blocks.
+// Call this on every main loop pass.
+void mode_store_poll(void);
+
+// Whether a save is queued or still being written.
+uint8_t mode_store_busy(void);
+
+#endif //FAN_CONTROL_MODE_STORE_H
@@ -0,0 +1,12 @@
+//
+// The ventilation modes, as shared between the relay driver and the I2C slave.
+// See relay.h for what the modes actually do.
+//
+
+#ifndef FAN_CONTROL_MODES_H
+#define FAN_CONTROL_MODES_H
+
+#define NUM_AIR_IN_MODES 7
+#define NUM_AIR_OUT_MODES 5
+
+#endif //FAN_CONTROL_MODES_H
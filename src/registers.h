@@ -0,0 +1,238 @@
+//
+// The I2C register map, as seen by the master.
+//
+// This is the one definition of the register map, shared by the firmware, the client library (client/registers.hpp)
+// and the simulator (sim/fan_control_sim.c). It only has plain #defines and no includes besides modes.h, so it works
+// for C and C++, on the AVR and on the host. What the registers do is described where they are implemented, see the
+// headers referenced below.
+//
+
+#ifndef FAN_CONTROL_REGISTERS_H
+#define FAN_CONTROL_REGISTERS_H
+
+#include "modes.h"
+
+// Default I2C slave address, if none is configured. See device_config.h.
+#define I2C_SLAVE_ADDRESS 0x22
+
+// Valid 7-bit addresses for I2C_REG_ADDRESS, i.e. anything not reserved by the I2C spec.
+#define DEVICE_CONFIG_ADDRESS_MIN 0x08
+#define DEVICE_CONFIG_ADDRESS_MAX 0x77
+// Without a stored config, a device is a member of group 0 only.
+#define DEVICE_CONFIG_DEFAULT_GROUPS 0x01
+
+// Layout of the telemetry block, see telemetry.h.
+// All values are little-endian uint16_t. Counts wrap around.
+#define TELEMETRY_LOOPS_PER_SECOND 0x00
+#define TELEMETRY_LOOP_TIME_MAX 0x02
+#define TELEMETRY_LOOP_TIME_AVG 0x04
+#define TELEMETRY_TWI_ISR_COUNT 0x06
+#define TELEMETRY_TIMER_ISR_COUNT 0x08
+#define TELEMETRY_TWI_ISR_TIME_MAX 0x0A
+#define TELEMETRY_TIMER_ISR_TIME_MAX 0x0C
+#define TELEMETRY_TWI_NACK_COUNT 0x0E
+#define TELEMETRY_RELAY_CHANGE_COUNT 0x10
+#define TELEMETRY_PEC_ERROR_COUNT 0x12
+#define TELEMETRY_SIZE 0x14
+// Number of relays with an actuation count.
+#define TELEMETRY_RELAYS 8
+
+// Layout of the schedule table, see schedule.h.
+#define SCHEDULE_MAX_ENTRIES 16
+#define SCHEDULE_ENTRY_SIZE 2
+#define SCHEDULE_ENTRY_DURATION 0
+#define SCHEDULE_ENTRY_MODES 1
+#define SCHEDULE_TABLE_SIZE (SCHEDULE_MAX_ENTRIES * SCHEDULE_ENTRY_SIZE)
+
+// Bits of the schedule control register.
+// Whether the schedule is enabled. Saved to EEPROM.
+#define SCHEDULE_CONTROL_ENABLED 0x01
+// Read-only: The schedule is enabled, not empty, and not overridden by the button.
+#define SCHEDULE_CONTROL_RUNNING 0x02
+#define SCHEDULE_CONTROL_MASK (SCHEDULE_CONTROL_ENABLED)
+
+// Button events, see button.h.
+#define BUTTON_EVENT_NONE 0
+#define BUTTON_EVENT_SHORT 1
+#define BUTTON_EVENT_LONG 2
+#define BUTTON_EVENT_REPEAT 3
+
+// Defaults for the button thresholds, in ticks.
+#define BUTTON_DEBOUNCE_DEFAULT 2
+#define BUTTON_LONG_PRESS_DEFAULT 50
+#define BUTTON_REPEAT_DEFAULT 100
+
+// Layout of the button log.
+#define BUTTON_LOG_EVENTS 4
+#define BUTTON_LOG_COUNT 0
+#define BUTTON_LOG_FIRST 1
+#define BUTTON_LOG_EVENT_SIZE 3
+#define BUTTON_LOG_SIZE (BUTTON_LOG_FIRST + BUTTON_LOG_EVENTS * BUTTON_LOG_EVENT_SIZE)
+
+// Layout of the reset diagnostics block, see diagnostics.h.
+#define DIAGNOSTICS_RESET_CAUSE 0
+#define DIAGNOSTICS_CHECKPOINT 1
+#define DIAGNOSTICS_TWI_STATUS 2
+#define DIAGNOSTICS_REBOOTS 3
+#define DIAGNOSTICS_SIZE 5
+
+// Reset causes, the flags of MCUCSR (MCUSR on the ATmega328P), which are the same on all boards.
+#define DIAGNOSTICS_RESET_POWER_ON 0x01
+#define DIAGNOSTICS_RESET_EXTERNAL 0x02
+#define DIAGNOSTICS_RESET_BROWN_OUT 0x04
+#define DIAGNOSTICS_RESET_WATCHDOG 0x08
+
+// Checkpoints, in the order fan_control_setup and fan_control_loop pass them.
+#define DIAGNOSTICS_CHECKPOINT_NONE 0
+#define DIAGNOSTICS_CHECKPOINT_SETUP 1
+// Start of a main loop pass, handling I2C commits.
+#define DIAGNOSTICS_CHECKPOINT_LOOP 2
+#define DIAGNOSTICS_CHECKPOINT_BUTTON 3
+#define DIAGNOSTICS_CHECKPOINT_SCHEDULE 4
+// Publishing the state, driving relays and display.
+#define DIAGNOSTICS_CHECKPOINT_OUTPUTS 5
+#define DIAGNOSTICS_CHECKPOINT_EEPROM 6
+// About to sleep, or asleep.
+#define DIAGNOSTICS_CHECKPOINT_SLEEP 7
+
+// Layout of the stack monitor block, see stack_monitor.h.
+#define STACK_MONITOR_DATA_SIZE 0x00
+#define STACK_MONITOR_BSS_SIZE 0x02
+#define STACK_MONITOR_STACK_USED 0x04
+#define STACK_MONITOR_STACK_FREE 0x06
+#define STACK_MONITOR_SIZE 0x08
+
+// Layout of the TWI trace block, see twi_trace.h. The number of entries must be a power of two.
+#define TWI_TRACE_ENTRIES 16
+#define TWI_TRACE_COUNT 0
+#define TWI_TRACE_FIRST 1
+#define TWI_TRACE_ENTRY_SIZE 4
+#define TWI_TRACE_SIZE (TWI_TRACE_FIRST + TWI_TRACE_ENTRIES * TWI_TRACE_ENTRY_SIZE)
+
+// Layout of an entry.
+#define TWI_TRACE_STATUS 0
+#define TWI_TRACE_REGISTER 1
+#define TWI_TRACE_TIME 2
+// The status of unused entries, TW_NO_INFO.
+#define TWI_TRACE_UNUSED 0xF8
+
+// Register addresses.
+#define I2C_REG_STATUS 0x00
+#define I2C_REG_AIR_IN 0x01
+#define I2C_REG_AIR_OUT 0x02
+// Read-only, incremented every time the modes or the I2C lock change, for whatever reason.
+// Reading this releases the attention line, see attention.h.
+#define I2C_REG_CHANGE_SEQ 0x03
+// Configuration flags, see I2C_CONFIG_*.
+#define I2C_REG_CONFIG 0x04
+// With PEC enabled, the number of data bytes returned by a read before the PEC.
+#define I2C_REG_PEC_READ_LENGTH 0x05
+// The I2C address of this device. Writes are saved to EEPROM and take effect after the next reset.
+// Invalid addresses (reserved by the I2C spec) are ignored.
+#define I2C_REG_ADDRESS 0x06
+// Broadcast groups this device is a member of, bit n for group n. Saved to EEPROM, takes effect immediately.
+#define I2C_REG_GROUPS 0x07
+// Schedule control, see SCHEDULE_CONTROL_*.
+#define I2C_REG_SCHEDULE_CONTROL 0x08
+// Number of entries in the schedule. Writing this commits the table staged at I2C_REG_SCHEDULE with that many entries
+// and starts it from the first entry. Invalid tables are ignored, so read this back.
+#define I2C_REG_SCHEDULE_LENGTH 0x09
+// The current schedule entry. Writing this starts the given entry right away.
+#define I2C_REG_SCHEDULE_ENTRY 0x0A
+// The minutes left of the current schedule entry, rounded up. Writing this sets them, to align the schedule.
+#define I2C_REG_SCHEDULE_REMAINING 0x0B
+// Button thresholds in ticks of 10ms, see button.h. Zero is ignored for the first two, and disables repeat events.
+// These are not saved, and return to the defaults on reset.
+#define I2C_REG_BUTTON_DEBOUNCE 0x0C
+#define I2C_REG_BUTTON_LONG_PRESS 0x0D
+#define I2C_REG_BUTTON_REPEAT 0x0E
+// Writing BOOT_ENTER_KEY hands over to the bootloader for a firmware update, see bootloader.h. Reads as 0.
+#define I2C_REG_BOOT 0x0F
+// Start of the read-only telemetry block.
+#define I2C_REG_TELEMETRY 0x10
+// Staging area for the schedule table. Holds the current table after a reset.
+#define I2C_REG_SCHEDULE (I2C_REG_TELEMETRY + TELEMETRY_SIZE)
+// Read-only actuation counts of relays 1 to 8, 16 bits little endian each. See telemetry.h.
+#define I2C_REG_RELAY_ACTUATIONS (I2C_REG_SCHEDULE + SCHEDULE_TABLE_SIZE)
+// Read-only log of the last button events.
+#define I2C_REG_BUTTON_LOG (I2C_REG_RELAY_ACTUATIONS + 2 * TELEMETRY_RELAYS)
+// Brightness of the left and right digit, 0 (off) to 255 (default). Not saved, see segment.h.
+#define I2C_REG_BRIGHTNESS (I2C_REG_BUTTON_LOG + BUTTON_LOG_SIZE)
+#define I2C_BRIGHTNESS_SIZE 2
+// Read-only reset diagnostics.
+#define I2C_REG_DIAGNOSTICS (I2C_REG_BRIGHTNESS + I2C_BRIGHTNESS_SIZE)
+// Read-only RAM usage.
+#define I2C_REG_STACK_MONITOR (I2C_REG_DIAGNOSTICS + DIAGNOSTICS_SIZE)
+// Read-only trace of the last TWI events.
+#define I2C_REG_TRACE (I2C_REG_STACK_MONITOR + STACK_MONITOR_SIZE)
+// Read-only number of times the TWI was reset because the bus hung, 16 bits little endian. See twislave.c.
+#define I2C_REG_TWI_RECOVERIES (I2C_REG_TRACE + TWI_TRACE_SIZE)
+#define I2C_TWI_RECOVERIES_SIZE 2
+
+// I2C register file size.
+// Control registers (status, air in and air out mode, ...), followed by the telemetry block, the schedule table, the
+// relay actuation counts, the button log, the display brightness, the reset diagnostics, the RAM usage, the TWI trace,
+// and the TWI recovery count.
+#define i2c_buffer_size (I2C_REG_TWI_RECOVERIES + I2C_TWI_RECOVERIES_SIZE)
+
+#define I2C_BIT_I2C_DISABLED 0x01
+#define I2C_BIT_WDT_RESET 0x02
+
+// Enables SMBus Packet Error Checking, see twislave.c.
+#define I2C_CONFIG_PEC 0x01
+// Enables the TWI trace, see twi_trace.h.
+#define I2C_CONFIG_TRACE 0x02
+// All writable config bits.
+#define I2C_CONFIG_MASK (I2C_CONFIG_PEC | I2C_CONFIG_TRACE)
+
+// Default for I2C_REG_PEC_READ_LENGTH: status, air in and air out.
+#define I2C_PEC_READ_LENGTH_DEFAULT 3
+
+// Maximum number of data bytes in one write transaction. Anything after that is dropped.
+#define I2C_RX_SIZE 16
+
+// Group commit via general call, see twislave.c.
+// The frame is [master address << 1 | 1, groups, air in, air out], optionally followed by a PEC.
+#define I2C_GCALL_FRAME_MASTER 0
+#define I2C_GCALL_FRAME_GROUPS 1
+#define I2C_GCALL_FRAME_AIR_IN 2
+#define I2C_GCALL_FRAME_AIR_OUT 3
+#define I2C_GCALL_FRAME_SIZE 4
+
+// The bootloader protocol, see bootloader.h. The page size and the number of pages depend on the board, and are in
+// the info block.
+// The value to write to I2C_REG_BOOT.
+#define BOOT_ENTER_KEY 0xB0
+// The address the bootloader answers at after a reset.
+#define BOOT_DEFAULT_ADDRESS I2C_SLAVE_ADDRESS
+
+// Commands, the first byte of every write.
+#define BOOT_CMD_PAGE 0x01
+#define BOOT_CMD_COMMIT 0x02
+#define BOOT_CMD_RUN 0x03
+// The command and the address in front of a page.
+#define BOOT_PAGE_HEADER_SIZE 3
+#define BOOT_COMMIT_FRAME_SIZE 5
+
+// Layout of the info block returned by reads. Reading past it returns 0xFF.
+#define BOOT_INFO_ID 0
+#define BOOT_INFO_STATUS 1
+#define BOOT_INFO_PAGE_SIZE 2
+// The number of pages below BOOT_START.
+#define BOOT_INFO_PAGES 3
+#define BOOT_INFO_SIZE 4
+
+// At BOOT_INFO_ID. The status register of the firmware never reads as this, so a master can tell who answers.
+#define BOOT_ID 0xB1
+
+// Status, at BOOT_INFO_STATUS.
+// Nothing went wrong so far.
+#define BOOT_STATUS_READY 0
+// The last write was not a valid command, e.g. a page at an address that's not page aligned. It was ignored.
+#define BOOT_STATUS_BAD_COMMAND 1
+// The CRC did not match the firmware, or the length was out of range. The firmware will not be started.
+#define BOOT_STATUS_BAD_IMAGE 2
+// The last commit matched, the firmware can be started.
+#define BOOT_STATUS_VERIFIED 3
+
+#endif //FAN_CONTROL_REGISTERS_H
@@ -18,7 +18,7 @@
 // - 230V (active)
 //
 // Relay 2 sits above that to multiplex. It has relay 1 selected by default.
-// Relay 3 demuxes the output of relay 2 to the two fan modes:
+// Relay 4 demuxes the output of relay 2 to the two fan modes:
 // - Intake air fan mode 1 (default)
 // - Intake air fan mode 2 (active)
 //
@@ -53,107 +53,264 @@
 // - 230V (active)
 // Relay 6 multiplexes between relays 5 and 7.
 //
-// We thus end up with 4 air-out modes, plus off.
-
+// We thus end up with 4 air-out modes, plus off:
+// - off: all relays in default position
+// - mode 1: 80V
+// - mode 2: 120V
+// - mode 3: 150V
+// - mode 4: 230V
+//
+// ==============================
+// PATTERN TABLE
+// ==============================
+//
+// The PORTB pattern for every combination of (air-in, air-out) mode is precomputed at compile time and stored in flash,
+// so driving the relays is a single table lookup.
+// The table is built from the AIR_IN_PATTERN_x and AIR_OUT_PATTERN_x macros below. These are checked against a model
+// of the relay trees above using static asserts, so a typo in a pattern breaks the build instead of the ventilation.
+//
+// ==============================
+// TRANSITIONS
+// ==============================
+//
+// The relays are never switched all at once. drive_relays only sets the target pattern, and the timer interrupt walks
+// towards it one relay at a time, with RELAY_DEAD_TIME_TICKS between two steps, so every relay has settled before the
+// next one moves. Only relays that differ between the current and the target pattern are switched, each one once.
+// The order is chosen greedily using the model of the trees: The next relay is the one that leaves the least voltage
+// on the fans. A step that would put more voltage on either fan than both the current and the target state is only
+// taken if there is no other choice, which the tree structure never requires.
+// In practice, this means that power sources are disconnected before others are connected, and that relays not
+// selected by their multiplexer are switched while they carry no load. For example, intake mode 4 to 5 first drops
+// relay 3 (230V to 190V) and then moves relay 4 to fan mode 2, instead of passing through 230V on fan mode 2.
+// Turning air intake off drops relay 2 first (down to 100V), then relay 1 (heater off, no voltage), and only then
+// relay 3, without load.
+// The one exception is the boot: The relays float in their default position until relay_io_init runs, and it drives
+// the pattern of the restored modes right away, so the ventilation is back as soon as possible.
+// After a firmware update, they keep the pattern they had before it instead, see bootloader.h.
+// The target can change at any time, the sequencer simply continues from wherever it is.
 #ifndef FAN_CONTROL_RELAY_H
 #define FAN_CONTROL_RELAY_H
 
-#include <avr/io.h>
+#include "hal.h"
+#include "modes.h"
+#include "telemetry.h"
+#include "timer_wheel.h"
 
-// Relay 1 is hardwired to the second MCU with a pullup, so it has to be on B5.
+// The PORTB pins of the relays come from the board profile, see board.h. On the original board, relay 1 is hardwired
+// to the second MCU with a pullup, so it has to be on B5.
 // Also, we have to keep that ON whenever air is coming in, even if the "path" is unused.
 // Also, our relays are HIGH by default, i.e., all of this is actually inverted.
-#define RELAY_1 (1 << PORTB5)
-#define RELAY_2 (1 << PORTB1)
-#define RELAY_3 (1 << PORTB2)
-#define RELAY_4 (1 << PORTB3)
-#define RELAY_5 (1 << PORTB4)
-#define RELAY_6 (1 << PORTB0)
-#define RELAY_7 (1 << PORTB6)
-#define RELAY_8 (1 << PORTB7)
+#define RELAY_1 (1 << BOARD_RELAY_1_PIN)
+#define RELAY_2 (1 << BOARD_RELAY_2_PIN)
+#define RELAY_3 (1 << BOARD_RELAY_3_PIN)
+#define RELAY_4 (1 << BOARD_RELAY_4_PIN)
+#define RELAY_5 (1 << BOARD_RELAY_5_PIN)
+#define RELAY_6 (1 << BOARD_RELAY_6_PIN)
+#define RELAY_7 (1 << BOARD_RELAY_7_PIN)
+#define RELAY_8 (1 << BOARD_RELAY_8_PIN)
+
+#define NUM_RELAYS 8
 
 #define AIR_IN_MASK (RELAY_1 | RELAY_2 | RELAY_3 | RELAY_4)
 #define AIR_OUT_MASK (RELAY_5 | RELAY_6 | RELAY_7 | RELAY_8)
 
-#define NUM_AIR_IN_MODES 7
-#define NUM_AIR_OUT_MODES 5
-
-// Do not use this.
-static uint8_t relay_pattern_air_in_inverted(uint8_t level) {
-    switch (level) {
-        case 0:
-            return 0;
-        case 1:
-            return RELAY_1;
-        case 2:
-            return RELAY_1 | RELAY_4;
-        case 3:
-            return RELAY_1 | RELAY_2;
-        case 4:
-            return RELAY_1 | RELAY_3 | RELAY_2;
-        case 5:
-            return RELAY_1 | RELAY_2 | RELAY_4;
-        case 6:
-            return RELAY_1 | RELAY_2 | RELAY_3 | RELAY_4;
-        default:
-            return 0;
-    }
+// The relays to activate (i.e. drive LOW) for each air intake mode.
+#define AIR_IN_PATTERN_0 0
+#define AIR_IN_PATTERN_1 (RELAY_1)
+#define AIR_IN_PATTERN_2 (RELAY_1 | RELAY_4)
+#define AIR_IN_PATTERN_3 (RELAY_1 | RELAY_2)
+#define AIR_IN_PATTERN_4 (RELAY_1 | RELAY_2 | RELAY_3)
+#define AIR_IN_PATTERN_5 (RELAY_1 | RELAY_2 | RELAY_4)
+#define AIR_IN_PATTERN_6 (RELAY_1 | RELAY_2 | RELAY_3 | RELAY_4)
+
+// The relays to activate (i.e. drive LOW) for each air out mode.
+#define AIR_OUT_PATTERN_0 0
+#define AIR_OUT_PATTERN_1 (RELAY_5)
+#define AIR_OUT_PATTERN_2 (RELAY_6)
+#define AIR_OUT_PATTERN_3 (RELAY_6 | RELAY_7)
+#define AIR_OUT_PATTERN_4 (RELAY_8)
+
+// Model of the air intake tree: The voltage that reaches the fan for a given set of active relays.
+// Relay 2 selects between relay 1 (100V or nothing) and relay 3 (190V or 230V).
+#define AIR_IN_VOLTAGE(p) (((p) & RELAY_2) ? (((p) & RELAY_3) ? 230 : 190) : (((p) & RELAY_1) ? 100 : 0))
+// Model of the air intake tree: The fan mode selected by relay 4.
+#define AIR_IN_FAN_MODE(p) (((p) & RELAY_4) ? 2 : 1)
+// Model of the air out tree: The voltage that reaches the fan for a given set of active relays.
+// Relay 8 overrides everything with 230V, otherwise relay 6 selects between relay 5 (80V or nothing) and relay 7
+// (120V or 150V).
+#define AIR_OUT_VOLTAGE(p) (((p) & RELAY_8) ? 230 : ((p) & RELAY_6) ? (((p) & RELAY_7) ? 150 : 120) : (((p) & RELAY_5) ? 80 : 0))
+
+_Static_assert((AIR_IN_MASK | AIR_OUT_MASK) == 0xFF && (AIR_IN_MASK & AIR_OUT_MASK) == 0,
+               "every relay must be on its own pin of PORTB");
+
+_Static_assert(AIR_IN_VOLTAGE(AIR_IN_PATTERN_0) == 0, "air intake off must not connect any power");
+_Static_assert(AIR_IN_PATTERN_0 == 0, "air intake off must leave all relays in their default position");
+_Static_assert(AIR_IN_VOLTAGE(AIR_IN_PATTERN_1) == 100 && AIR_IN_FAN_MODE(AIR_IN_PATTERN_1) == 1,
+               "air intake mode 1 must be 100V + fan mode 1");
+_Static_assert(AIR_IN_VOLTAGE(AIR_IN_PATTERN_2) == 100 && AIR_IN_FAN_MODE(AIR_IN_PATTERN_2) == 2,
+               "air intake mode 2 must be 100V + fan mode 2");
+_Static_assert(AIR_IN_VOLTAGE(AIR_IN_PATTERN_3) == 190 && AIR_IN_FAN_MODE(AIR_IN_PATTERN_3) == 1,
+               "air intake mode 3 must be 190V + fan mode 1");
+_Static_assert(AIR_IN_VOLTAGE(AIR_IN_PATTERN_4) == 230 && AIR_IN_FAN_MODE(AIR_IN_PATTERN_4) == 1,
+               "air intake mode 4 must be 230V + fan mode 1");
+_Static_assert(AIR_IN_VOLTAGE(AIR_IN_PATTERN_5) == 190 && AIR_IN_FAN_MODE(AIR_IN_PATTERN_5) == 2,
+               "air intake mode 5 must be 190V + fan mode 2");
+_Static_assert(AIR_IN_VOLTAGE(AIR_IN_PATTERN_6) == 230 && AIR_IN_FAN_MODE(AIR_IN_PATTERN_6) == 2,
+               "air intake mode 6 must be 230V + fan mode 2");
+// The heater only runs while relay 1 is active, so every mode that moves air in has to activate it.
+_Static_assert((AIR_IN_PATTERN_1 & AIR_IN_PATTERN_2 & AIR_IN_PATTERN_3 & AIR_IN_PATTERN_4 & AIR_IN_PATTERN_5 &
+                AIR_IN_PATTERN_6 & RELAY_1) == RELAY_1, "all air intake modes must activate relay 1");
+
+_Static_assert(AIR_OUT_PATTERN_0 == 0, "air out off must leave all relays in their default position");
+_Static_assert(AIR_OUT_VOLTAGE(AIR_OUT_PATTERN_1) == 80, "air out mode 1 must be 80V");
+_Static_assert(AIR_OUT_VOLTAGE(AIR_OUT_PATTERN_2) == 120, "air out mode 2 must be 120V");
+_Static_assert(AIR_OUT_VOLTAGE(AIR_OUT_PATTERN_3) == 150, "air out mode 3 must be 150V");
+_Static_assert(AIR_OUT_VOLTAGE(AIR_OUT_PATTERN_4) == 230, "air out mode 4 must be 230V");
+
+// Computes the PORTB pattern for the given air in and air out relay patterns.
+// Our relays are in their default position when HIGH, which means we need to invert everything.
+#define PORTB_PATTERN(in, out) ((~(in) & AIR_IN_MASK) | (~(out) & AIR_OUT_MASK))
+
+#define PORTB_PATTERN_ROW(in) { \
+    PORTB_PATTERN(in, AIR_OUT_PATTERN_0), \
+    PORTB_PATTERN(in, AIR_OUT_PATTERN_1), \
+    PORTB_PATTERN(in, AIR_OUT_PATTERN_2), \
+    PORTB_PATTERN(in, AIR_OUT_PATTERN_3), \
+    PORTB_PATTERN(in, AIR_OUT_PATTERN_4), \
+}
+
+// PORTB patterns, indexed by [air_mode_in][air_mode_out].
+static const uint8_t portb_relay_patterns[NUM_AIR_IN_MODES][NUM_AIR_OUT_MODES] PROGMEM = {
+        PORTB_PATTERN_ROW(AIR_IN_PATTERN_0),
+        PORTB_PATTERN_ROW(AIR_IN_PATTERN_1),
+        PORTB_PATTERN_ROW(AIR_IN_PATTERN_2),
+        PORTB_PATTERN_ROW(AIR_IN_PATTERN_3),
+        PORTB_PATTERN_ROW(AIR_IN_PATTERN_4),
+        PORTB_PATTERN_ROW(AIR_IN_PATTERN_5),
+        PORTB_PATTERN_ROW(AIR_IN_PATTERN_6),
+};
+
+// The pins of all relays, in order of their numbers, i.e. RELAY_1 first.
+static const uint8_t relay_pins[NUM_RELAYS] PROGMEM = {
+        RELAY_1, RELAY_2, RELAY_3, RELAY_4, RELAY_5, RELAY_6, RELAY_7, RELAY_8,
+};
+
+// Time between two relay switching steps, in timer ticks.
+// Our relays take up to 10ms to operate or release, plus bouncing.
+#define RELAY_DEAD_TIME_TICKS 5
+
+// The PORTB pattern the sequencer works towards.
+// Written by the main program, read by the timer interrupt, which owns PORTB.
+volatile uint8_t relay_target;
+
+static void relay_sequencer_step(void);
+
+// Runs the sequencer every tick while idle, and RELAY_DEAD_TIME_TICKS after every step.
+static timer_wheel_timer_t relay_timer = TIMER_WHEEL_TIMER(relay_sequencer_step);
+
+// The total voltage on both fans, for the given active relays.
+static uint16_t relay_load(uint8_t active) {
+    return AIR_IN_VOLTAGE(active) + AIR_OUT_VOLTAGE(active);
 }
 
-// Computes a masked pattern for PORTB for the given air intake level.
-static uint8_t relay_pattern_air_in(uint8_t level) {
-    // Our relays are in their default position when HIGH, which means we need to invert some stuff.
-    return (~relay_pattern_air_in_inverted(level) & AIR_IN_MASK);
+// Whether going to next puts more voltage on a fan than both active and target do.
+static uint8_t relay_overshoots(uint8_t next, uint8_t active, uint8_t target) {
+    uint16_t in = AIR_IN_VOLTAGE(next);
+    uint16_t out = AIR_OUT_VOLTAGE(next);
+
+    return (in > AIR_IN_VOLTAGE(active) && in > AIR_IN_VOLTAGE(target)) ||
+           (out > AIR_OUT_VOLTAGE(active) && out > AIR_OUT_VOLTAGE(target));
 }
 
-// Do not use this.
-static uint8_t relay_pattern_air_out_inverted(uint8_t level) {
-    switch (level) {
-        case 0:
-            return 0;
-        case 1:
-            return RELAY_5;
-        case 2:
-            return RELAY_6;
-        case 3:
-            return RELAY_6 | RELAY_7;
-        case 4:
-            return RELAY_8;
-        default:
-            return 0;
+// Switches at most one relay towards relay_target. Runs from relay_timer.
+static void relay_sequencer_step(void) {
+    // Work with active relays, not pin levels.
+    uint8_t active = ~PORTB;
+    uint8_t target = ~relay_target;
+    if (active == target) {
+        return;
+    }
+
+    uint8_t best = 0;
+    uint8_t best_relay = 0;
+    uint16_t best_cost = 0xFFFF;
+    for (uint8_t relay = 0; relay < NUM_RELAYS; relay++) {
+        uint8_t pin = pgm_read_byte(&relay_pins[relay]);
+        if (!((active ^ target) & pin)) {
+            continue;
+        }
+
+        uint8_t next = active ^ pin;
+        uint16_t cost = relay_load(next);
+        if (relay_overshoots(next, active, target)) {
+            // Anything else is better.
+            cost += 0x8000;
+        }
+        if (cost < best_cost) {
+            best = pin;
+            best_relay = relay;
+            best_cost = cost;
+        }
     }
-}
 
-// Computes a masked pattern for PORTB for the given air out level.
-static uint8_t relay_pattern_air_out(uint8_t level) {
-    return (~relay_pattern_air_out_inverted(level) & AIR_OUT_MASK);
+    PORTB = ~(active ^ best);
+    telemetry_relay_actuations[best_relay]++;
+    timer_wheel_start(&relay_timer, RELAY_DEAD_TIME_TICKS, 1);
 }
 
+// Looks up the pattern for PORTB for the given modes.
+// Invalid modes are treated as off.
 static uint8_t portb_relay_pattern(uint8_t air_mode_in, uint8_t air_mode_out) {
-    uint8_t relay_pattern = 0;
-
-    relay_pattern |= relay_pattern_air_in(air_mode_in);
-    relay_pattern |= relay_pattern_air_out(air_mode_out);
+    if (air_mode_in >= NUM_AIR_IN_MODES) {
+        air_mode_in = 0;
+    }
+    if (air_mode_out >= NUM_AIR_OUT_MODES) {
+        air_mode_out = 0;
+    }
 
-    return relay_pattern;
+    return pgm_read_byte(&portb_relay_patterns[air_mode_in][air_mode_out]);
 }
 
-// Computes and sets the outputs for the relays according to the given modes.
-void drive_relays(uint8_t air_mode_in, uint8_t air_mode_out) {
-    // Compute relay pattern.
+// Sets the target for the relays according to the given modes. The timer interrupt then switches them over.
+// Returns whether the target changed.
+uint8_t drive_relays(uint8_t air_mode_in, uint8_t air_mode_out) {
+    // Look up relay pattern.
     uint8_t relay_pattern = portb_relay_pattern(air_mode_in, air_mode_out);
 
-    // Set relays
-    PORTB = relay_pattern;
+    if (relay_target == relay_pattern) {
+        return 0;
+    }
+
+    relay_target = relay_pattern;
+    return 1;
 }
 
 
+// Whether the relays have reached relay_target.
+static inline uint8_t relays_settled(void) {
+    return PORTB == relay_target;
+}
+
 // Initializes outputs used for the relays.
-// Sets bank B to outputs and writes the default pattern for (in,out) modes (0,0).
-void relay_io_init() {
-    PORTB = portb_relay_pattern(0, 0);
+// After a reset, sets bank B to outputs with the pattern for the given modes, i.e. the ones restored from EEPROM.
+// If bank B already is an output, the bootloader started us without a reset, and the relays still hold the pattern
+// from before the update. That stays, and the sequencer continues from there.
+// Call this with interrupts disabled.
+void relay_io_init(uint8_t air_mode_in, uint8_t air_mode_out) {
+    relay_target = portb_relay_pattern(air_mode_in, air_mode_out);
+
+    if (DDRB != 0xFF) {
+        PORTB = relay_target;
+        for (uint8_t relay = 0; relay < NUM_RELAYS; relay++) {
+            if (!(relay_target & pgm_read_byte(&relay_pins[relay]))) {
+                telemetry_relay_actuations[relay]++;
+            }
+        }
+    }
 
     DDRB |= 0xFF;
+
+    timer_wheel_start(&relay_timer, 1, 1);
 }
 
 #endif //FAN_CONTROL_RELAY_H
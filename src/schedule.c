@@ -0,0 +1,219 @@
+//
+// Mode schedule, see schedule.h.
+//
+
+#include "schedule.h"
+#include "modes.h"
+#include "eeprom_ring.h"
+
+#define RECORD_LENGTH 0
+#define RECORD_CONTROL 1
+#define RECORD_TABLE 2
+
+volatile uint8_t schedule_running = 0;
+
+static uint8_t table[SCHEDULE_TABLE_SIZE];
+static uint8_t length = 0;
+static uint8_t enabled = 0;
+
+// The current entry, and how much of it is left.
+static uint8_t entry = 0;
+static uint8_t remaining_minutes = 0;
+static uint8_t remaining_seconds = 0;
+
+// Whether the modes of the current entry should be applied.
+static uint8_t due = 0;
+// Whether the button override was active last time we looked.
+static uint8_t was_locked = 0;
+
+static eeprom_ring_t ring = EEPROM_RING(SCHEDULE_ADDR, SCHEDULE_SLOTS, SCHEDULE_DATA_SIZE);
+
+// The data of the record being written, computed from the current schedule.
+static uint8_t record_data(uint8_t i) {
+    if (i == RECORD_LENGTH) {
+        return length;
+    }
+    if (i == RECORD_CONTROL) {
+        return enabled ? SCHEDULE_CONTROL_ENABLED : 0;
+    }
+    return table[i - RECORD_TABLE];
+}
+
+static uint8_t entry_valid(const volatile uint8_t *e) {
+    uint8_t modes = e[SCHEDULE_ENTRY_MODES];
+    return e[SCHEDULE_ENTRY_DURATION] != 0 && (modes & 0x0F) < NUM_AIR_IN_MODES && (modes >> 4) < NUM_AIR_OUT_MODES;
+}
+
+static void start_entry(uint8_t i) {
+    entry = i;
+    remaining_minutes = table[i * SCHEDULE_ENTRY_SIZE + SCHEDULE_ENTRY_DURATION];
+    remaining_seconds = 0;
+    due = 1;
+}
+
+static void restart(void) {
+    if (length) {
+        start_entry(0);
+    } else {
+        entry = 0;
+        remaining_minutes = 0;
+        remaining_seconds = 0;
+    }
+}
+
+// Whether the record with the given data holds a valid schedule.
+static uint8_t record_valid(const uint8_t *addr) {
+    uint8_t n = eeprom_read_byte(addr + RECORD_LENGTH);
+    if (n > SCHEDULE_MAX_ENTRIES) {
+        return 0;
+    }
+    for (uint8_t i = 0; i < n; i++) {
+        uint8_t e[SCHEDULE_ENTRY_SIZE];
+        e[SCHEDULE_ENTRY_DURATION] = eeprom_read_byte(addr + RECORD_TABLE + i * SCHEDULE_ENTRY_SIZE);
+        e[SCHEDULE_ENTRY_MODES] = eeprom_read_byte(addr + RECORD_TABLE + i * SCHEDULE_ENTRY_SIZE + 1);
+        if (!entry_valid(e)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+uint8_t schedule_load(volatile uint8_t *entries) {
+    const uint8_t *addr = eeprom_ring_load(&ring, record_valid);
+
+    if (addr) {
+        length = eeprom_read_byte(addr + RECORD_LENGTH);
+        enabled = eeprom_read_byte(addr + RECORD_CONTROL) & SCHEDULE_CONTROL_ENABLED;
+        for (uint8_t i = 0; i < SCHEDULE_TABLE_SIZE; i++) {
+            table[i] = eeprom_read_byte(addr + RECORD_TABLE + i);
+        }
+    } else {
+        // Nothing saved yet, or garbage.
+        length = 0;
+        enabled = 0;
+        for (uint8_t i = 0; i < SCHEDULE_TABLE_SIZE; i++) {
+            table[i] = 0;
+        }
+    }
+
+    for (uint8_t i = 0; i < SCHEDULE_TABLE_SIZE; i++) {
+        entries[i] = table[i];
+    }
+    restart();
+    // The modes restored by mode_store win after a reset, the schedule takes over with the next entry.
+    due = 0;
+
+    return enabled ? SCHEDULE_CONTROL_ENABLED : 0;
+}
+
+uint8_t schedule_commit(const volatile uint8_t *entries, uint8_t new_length) {
+    if (new_length > SCHEDULE_MAX_ENTRIES) {
+        return 0;
+    }
+    for (uint8_t i = 0; i < new_length; i++) {
+        if (!entry_valid(&entries[i * SCHEDULE_ENTRY_SIZE])) {
+            return 0;
+        }
+    }
+
+    for (uint8_t i = 0; i < SCHEDULE_TABLE_SIZE; i++) {
+        table[i] = i < new_length * SCHEDULE_ENTRY_SIZE ? entries[i] : 0;
+    }
+    length = new_length;
+    restart();
+    // If a record is being written right now, it starts over in the same slot.
+    eeprom_ring_save(&ring);
+
+    return 1;
+}
+
+void schedule_set_enabled(uint8_t enable) {
+    enable = enable ? 1 : 0;
+    if (enable == enabled) {
+        return;
+    }
+
+    enabled = enable;
+    due = enabled;
+    eeprom_ring_save(&ring);
+}
+
+void schedule_jump(uint8_t i) {
+    if (i < length) {
+        start_entry(i);
+    }
+}
+
+void schedule_set_remaining(uint8_t minutes) {
+    if (length && minutes) {
+        remaining_minutes = minutes;
+        remaining_seconds = 0;
+    }
+}
+
+void schedule_advance(uint8_t seconds) {
+    if (!length) {
+        return;
+    }
+
+    while (seconds--) {
+        if (remaining_seconds == 0) {
+            if (remaining_minutes == 0) {
+                // Not reached, entries are at least one minute long.
+                start_entry(0);
+                continue;
+            }
+            remaining_minutes--;
+            remaining_seconds = 60;
+        }
+        remaining_seconds--;
+
+        if (remaining_minutes == 0 && remaining_seconds == 0) {
+            start_entry((entry + 1) % length);
+        }
+    }
+}
+
+uint8_t schedule_take_modes(uint8_t locked, uint8_t *air_in, uint8_t *air_out) {
+    if (was_locked && !locked) {
+        // The button override just ended, go back to the schedule.
+        due = 1;
+    }
+    was_locked = locked;
+
+    schedule_running = enabled && length && !locked;
+    if (!due || !schedule_running) {
+        // Anything due stays due until the override ends.
+        if (!enabled || !length) {
+            due = 0;
+        }
+        return 0;
+    }
+
+    due = 0;
+    uint8_t modes = table[entry * SCHEDULE_ENTRY_SIZE + SCHEDULE_ENTRY_MODES];
+    *air_in = modes & 0x0F;
+    *air_out = modes >> 4;
+    return 1;
+}
+
+uint8_t schedule_length(void) {
+    return length;
+}
+
+uint8_t schedule_entry(void) {
+    return entry;
+}
+
+uint8_t schedule_remaining(void) {
+    // Round up, so this reads 1 during the last minute.
+    return remaining_minutes + (remaining_seconds ? 1 : 0);
+}
+
+void schedule_poll(void) {
+    eeprom_ring_poll(&ring, record_data);
+}
+
+uint8_t schedule_busy(void) {
+    return eeprom_ring_busy(&ring);
+}
@@ -0,0 +1,90 @@
+//
+// On-device mode schedule, so the ventilation follows a routine without a master.
+//
+// The schedule is a cyclic list of up to SCHEDULE_MAX_ENTRIES entries of [duration in minutes, modes], with the modes
+// packed like in mode_store (air in in the low nibble, air out in the high nibble). Each entry's modes are applied
+// when it starts, and after the last entry the schedule starts over. There is no clock, so a day-long cycle is aligned
+// to the time of day by the master, by jumping to an entry and setting the remaining minutes of it (see twislave.h).
+// The system tick runs from the internal oscillator, which can be off by a few percent, so the master should do that
+// every now and then.
+//
+// Overrides take precedence:
+// - While the button override is active, the schedule keeps time but doesn't touch the modes. When it ends, the
+//   current entry is applied again.
+// - Modes written via I2C (or by a group commit) stay until the next entry starts.
+//
+// The table and whether the schedule is enabled are kept in EEPROM right after the device config, in an eeprom_ring of
+// two records of [seq, length, control, entries..., check]. They are only written when the master commits a new table
+// or toggles the schedule, and bytes that didn't change are skipped. Like the device config, saves alternate between
+// the two, so a save interrupted by a reset falls back to the previous schedule. If the schedule changes while a save
+// is in progress, that record starts over in the same slot.
+// The position within the schedule is not saved, the schedule starts with entry 0 after a reset.
+//
+// This is all run from the main loop, using the seconds counted by the timer interrupt.
+//
+
+#ifndef FAN_CONTROL_SCHEDULE_H
+#define FAN_CONTROL_SCHEDULE_H
+
+#include "hal.h"
+#include "eeprom_ring.h"
+#include "device_config.h"
+#include "bootloader.h"
+#include "registers.h"
+
+// The layout of the table and the bits of the schedule control register, SCHEDULE_*, are in registers.h.
+
+#define SCHEDULE_ADDR DEVICE_CONFIG_END
+#define SCHEDULE_SLOTS 2
+// Length, control and the table.
+#define SCHEDULE_DATA_SIZE (2 + SCHEDULE_TABLE_SIZE)
+#define SCHEDULE_RECORD_SIZE (SCHEDULE_DATA_SIZE + EEPROM_RING_OVERHEAD)
+#define SCHEDULE_END (SCHEDULE_ADDR + EEPROM_RING_SIZE(SCHEDULE_SLOTS, SCHEDULE_DATA_SIZE))
+
+// The end of the EEPROM holds the bootloader's trailer, see bootloader.h.
+#if SCHEDULE_END > BOOT_TRAILER_ADDR
+#error "schedule does not fit in EEPROM"
+#endif
+
+// Whether the schedule currently drives the modes, see SCHEDULE_CONTROL_RUNNING.
+// Written by the main program, read by TWI_vect.
+extern volatile uint8_t schedule_running;
+
+// Loads the schedule from EEPROM and starts it at entry 0.
+// Copies the table to entries and returns the control byte, so they can be published via I2C.
+uint8_t schedule_load(volatile uint8_t *entries);
+
+// Replaces the table with the given one of length entries, and starts it at entry 0.
+// Returns 0 and leaves the schedule untouched if any entry is invalid, i.e. has a duration of 0 or invalid modes.
+uint8_t schedule_commit(const volatile uint8_t *entries, uint8_t length);
+
+// Enables or disables the schedule. Enabling applies the current entry.
+void schedule_set_enabled(uint8_t enabled);
+
+// Starts the given entry right away. Ignored if there is no such entry.
+void schedule_jump(uint8_t entry);
+
+// Sets how many minutes of the current entry are left, to align the schedule. Ignored if 0.
+void schedule_set_remaining(uint8_t minutes);
+
+// Advances the schedule by the given number of seconds.
+void schedule_advance(uint8_t seconds);
+
+// Returns 1 and the modes of the current entry, if they should be applied now, i.e. an entry just started, or the
+// schedule was just enabled, changed or resumed. Returns 0 otherwise.
+// locked is whether the button override is active. Nothing is applied while it is, but the current entry is once it
+// ends.
+uint8_t schedule_take_modes(uint8_t locked, uint8_t *air_in, uint8_t *air_out);
+
+uint8_t schedule_length(void);
+uint8_t schedule_entry(void);
+uint8_t schedule_remaining(void);
+
+// Writes the next byte of a queued save, if the EEPROM is ready. Never blocks.
+// Call this on every main loop pass.
+void schedule_poll(void);
+
+// Whether a save is queued or still being written.
+uint8_t schedule_busy(void);
+
+#endif //FAN_CONTROL_SCHEDULE_H
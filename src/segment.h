@@ -2,124 +2,290 @@
 // Created by leo on 28/05/22.
 //
 // This drives a two-digit seven-segment display.
-// The display is connected to pins D0,D1,D2,D3,D4,D6 and C0,C1,C2,C3.
+// The display is connected to pins D0,D1,D2,D3,D4,D6 and C0,C1,C2,C3 on the original board, see board.h.
 // This file manages those pins. All write operations are masked accordingly.
 //
 // Displaying digits on the display works by sequentially going over each digit and displaying that.
 // The segment pins are shared between both digits, but each digit has its own enable line.
+// This is done by timer 2 in the background: display_show only fills a small framebuffer, which the timer interrupt
+// then scans out, one digit at a time. Besides digits, the display can show a few letters and the decimal point, and
+// each digit can be dimmed by only lighting it for part of its time slot.
 
 #ifndef FAN_CONTROL_SEGMENT_H
 #define FAN_CONTROL_SEGMENT_H
 
-#include <avr/io.h>
-
-#define PORTD_SEGMENT_MASK ((1 << PORTD0) | (1 << PORTD1) | (1 << PORTD2) | (1 << PORTD3) | (1 << PORTD4) | (1 << PORTD6))
-#define PORTC_SEGMENT_MASK ((1 << PORTC0) | (1 << PORTC1) | (1 << PORTC2) | (1 << PORTC3))
-
-#define PORTD_SEGMENT_MASK_NO_ENABLE  ((1 << PORTD0) | (1 << PORTD1) | (1 << PORTD2) | (1 << PORTD3) | (1 << PORTD4))
-#define PORTC_SEGMENT_MASK_NO_ENABLE  ((1 << PORTC1) | (1 << PORTC2) | (1 << PORTC3))
-
-#define SEGMENT_RIGHT_ENABLE (1 << PORTD6)
-#define SEGMENT_LEFT_ENABLE (1 << PORTC0)
-
-#define SEGMENT_DOT (1 << PORTD0)
-#define SEGMENT_TOP_MIDDLE (1 << PORTD1)
-#define SEGMENT_TOP_RIGHT (1 << PORTD2)
-#define SEGMENT_BOTTOM_RIGHT (1 << PORTD3)
-#define SEGMENT_BOTTOM_MIDDLE (1 << PORTD4)
-
-#define SEGMENT_TOP_LEFT (1 << PORTC1)
-#define SEGMENT_MIDDLE_MIDDLE (1 << PORTC2)
-#define SEGMENT_BOTTOM_LEFT (1 << PORTC3)
-
-static uint8_t portd_segment_pattern(uint8_t num) {
-    switch (num) {
-        case 0:
-            return SEGMENT_BOTTOM_RIGHT | SEGMENT_BOTTOM_MIDDLE | SEGMENT_TOP_RIGHT | SEGMENT_TOP_MIDDLE;
-        case 1:
-            return SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_RIGHT;
-        case 2:
-            return SEGMENT_TOP_MIDDLE | SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_MIDDLE;
-        case 3:
-            return SEGMENT_TOP_MIDDLE | SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_RIGHT | SEGMENT_BOTTOM_MIDDLE;
-        case 4:
-            return SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_RIGHT;
-        case 5:
-            return SEGMENT_TOP_MIDDLE | SEGMENT_BOTTOM_RIGHT | SEGMENT_BOTTOM_MIDDLE;
-        case 6:
-            return SEGMENT_TOP_MIDDLE | SEGMENT_BOTTOM_MIDDLE | SEGMENT_BOTTOM_RIGHT;
-        case 7:
-            return SEGMENT_TOP_MIDDLE | SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_RIGHT;
-        case 8:
-            return SEGMENT_BOTTOM_RIGHT | SEGMENT_BOTTOM_MIDDLE | SEGMENT_TOP_RIGHT | SEGMENT_TOP_MIDDLE;
-        case 9:
-            return SEGMENT_TOP_MIDDLE | SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_RIGHT | SEGMENT_BOTTOM_MIDDLE;
-        default:
-            return 0;
+#include "hal.h"
+
+#define SEGMENT_RIGHT_ENABLE (1 << BOARD_SEGMENT_RIGHT_ENABLE_PIN)
+#define SEGMENT_LEFT_ENABLE (1 << BOARD_SEGMENT_LEFT_ENABLE_PIN)
+
+// On PORTD.
+#define SEGMENT_DOT (1 << BOARD_SEGMENT_DOT_PIN)
+#define SEGMENT_TOP_MIDDLE (1 << BOARD_SEGMENT_TOP_MIDDLE_PIN)
+#define SEGMENT_TOP_RIGHT (1 << BOARD_SEGMENT_TOP_RIGHT_PIN)
+#define SEGMENT_BOTTOM_RIGHT (1 << BOARD_SEGMENT_BOTTOM_RIGHT_PIN)
+#define SEGMENT_BOTTOM_MIDDLE (1 << BOARD_SEGMENT_BOTTOM_MIDDLE_PIN)
+
+// On PORTC.
+#define SEGMENT_TOP_LEFT (1 << BOARD_SEGMENT_TOP_LEFT_PIN)
+#define SEGMENT_MIDDLE_MIDDLE (1 << BOARD_SEGMENT_MIDDLE_MIDDLE_PIN)
+#define SEGMENT_BOTTOM_LEFT (1 << BOARD_SEGMENT_BOTTOM_LEFT_PIN)
+
+#define PORTD_SEGMENT_MASK_NO_ENABLE \
+    (SEGMENT_DOT | SEGMENT_TOP_MIDDLE | SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_RIGHT | SEGMENT_BOTTOM_MIDDLE)
+#define PORTC_SEGMENT_MASK_NO_ENABLE (SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT)
+
+#define PORTD_SEGMENT_MASK (PORTD_SEGMENT_MASK_NO_ENABLE | SEGMENT_RIGHT_ENABLE)
+#define PORTC_SEGMENT_MASK (PORTC_SEGMENT_MASK_NO_ENABLE | SEGMENT_LEFT_ENABLE)
+
+// Glyphs the display can show. Digits are their own glyphs, so a number below 10 can be shown directly.
+#define GLYPH_A 10
+#define GLYPH_B 11
+#define GLYPH_C 12
+#define GLYPH_D 13
+#define GLYPH_E 14
+#define GLYPH_F 15
+#define GLYPH_H 16
+#define GLYPH_L 17
+#define GLYPH_N 18
+#define GLYPH_O 19
+#define GLYPH_P 20
+#define GLYPH_R 21
+#define GLYPH_T 22
+#define GLYPH_U 23
+#define GLYPH_MINUS 24
+#define GLYPH_BLANK 25
+#define NUM_GLYPHS 26
+// Flag to light the decimal point along with a glyph.
+#define GLYPH_DOT 0x80
+
+// The segments to light for each glyph, as {PORTD, PORTC} pairs.
+// Stored in flash and indexed by glyph. Letters are upper or lower case, whichever is readable on seven segments.
+static const uint8_t segment_patterns[NUM_GLYPHS][2] PROGMEM = {
+        // 0
+        {SEGMENT_BOTTOM_RIGHT | SEGMENT_BOTTOM_MIDDLE | SEGMENT_TOP_RIGHT | SEGMENT_TOP_MIDDLE,
+                SEGMENT_TOP_LEFT | SEGMENT_BOTTOM_LEFT},
+        // 1
+        {SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_RIGHT,
+                0},
+        // 2
+        {SEGMENT_TOP_MIDDLE | SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_MIDDLE,
+                SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT},
+        // 3
+        {SEGMENT_TOP_MIDDLE | SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_RIGHT | SEGMENT_BOTTOM_MIDDLE,
+                SEGMENT_MIDDLE_MIDDLE},
+        // 4
+        {SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_RIGHT,
+                SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE},
+        // 5
+        {SEGMENT_TOP_MIDDLE | SEGMENT_BOTTOM_RIGHT | SEGMENT_BOTTOM_MIDDLE,
+                SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE},
+        // 6
+        {SEGMENT_TOP_MIDDLE | SEGMENT_BOTTOM_MIDDLE | SEGMENT_BOTTOM_RIGHT,
+                SEGMENT_TOP_LEFT | SEGMENT_BOTTOM_LEFT | SEGMENT_MIDDLE_MIDDLE},
+        // 7
+        {SEGMENT_TOP_MIDDLE | SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_RIGHT,
+                0},
+        // 8
+        {SEGMENT_BOTTOM_RIGHT | SEGMENT_BOTTOM_MIDDLE | SEGMENT_TOP_RIGHT | SEGMENT_TOP_MIDDLE,
+                SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT},
+        // 9
+        {SEGMENT_TOP_MIDDLE | SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_RIGHT | SEGMENT_BOTTOM_MIDDLE,
+                SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE},
+        // A
+        {SEGMENT_TOP_MIDDLE | SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_RIGHT,
+                SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT},
+        // b
+        {SEGMENT_BOTTOM_RIGHT | SEGMENT_BOTTOM_MIDDLE,
+                SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT},
+        // C
+        {SEGMENT_TOP_MIDDLE | SEGMENT_BOTTOM_MIDDLE,
+                SEGMENT_TOP_LEFT | SEGMENT_BOTTOM_LEFT},
+        // d
+        {SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_RIGHT | SEGMENT_BOTTOM_MIDDLE,
+                SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT},
+        // E
+        {SEGMENT_TOP_MIDDLE | SEGMENT_BOTTOM_MIDDLE,
+                SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT},
+        // F
+        {SEGMENT_TOP_MIDDLE,
+                SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT},
+        // H
+        {SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_RIGHT,
+                SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT},
+        // L
+        {SEGMENT_BOTTOM_MIDDLE,
+                SEGMENT_TOP_LEFT | SEGMENT_BOTTOM_LEFT},
+        // n
+        {SEGMENT_BOTTOM_RIGHT,
+                SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT},
+        // o
+        {SEGMENT_BOTTOM_RIGHT | SEGMENT_BOTTOM_MIDDLE,
+                SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT},
+        // P
+        {SEGMENT_TOP_MIDDLE | SEGMENT_TOP_RIGHT,
+                SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT},
+        // r
+        {0,
+                SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT},
+        // t
+        {SEGMENT_BOTTOM_MIDDLE,
+                SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT},
+        // U
+        {SEGMENT_TOP_RIGHT | SEGMENT_BOTTOM_RIGHT | SEGMENT_BOTTOM_MIDDLE,
+                SEGMENT_TOP_LEFT | SEGMENT_BOTTOM_LEFT},
+        // -
+        {0,
+                SEGMENT_MIDDLE_MIDDLE},
+        // blank
+        {0,
+                0},
+};
+
+// The number of digits on the display.
+#define NUM_DIGITS 2
+
+// Display refresh rate, i.e. how often the scan-out moves on to the next digit.
+// 200 Hz gives every digit 5ms per 10ms frame, which is what the old delay-based loop did.
+#define DISPLAY_SCAN_HZ 200
+// Timer 2 runs with the smallest prescaler that fits a slot, the time one digit gets, into its 8 bits. That's 256 at
+// 8 MHz and 1024 at 16 MHz. DISPLAY_SLOT_TICKS is also the resolution of the brightness control.
+#if F_CPU / (64UL * DISPLAY_SCAN_HZ) <= 255
+#define DISPLAY_PRESCALER 64
+#define DISPLAY_CLOCK_SELECT (1 << CS22)
+#elif F_CPU / (128UL * DISPLAY_SCAN_HZ) <= 255
+#define DISPLAY_PRESCALER 128
+#define DISPLAY_CLOCK_SELECT ((1 << CS22) | (1 << CS20))
+#elif F_CPU / (256UL * DISPLAY_SCAN_HZ) <= 255
+#define DISPLAY_PRESCALER 256
+#define DISPLAY_CLOCK_SELECT ((1 << CS22) | (1 << CS21))
+#else
+#define DISPLAY_PRESCALER 1024
+#define DISPLAY_CLOCK_SELECT ((1 << CS22) | (1 << CS21) | (1 << CS20))
+#endif
+
+#define DISPLAY_SLOT_TICKS (F_CPU / DISPLAY_PRESCALER / DISPLAY_SCAN_HZ)
+
+#if DISPLAY_SLOT_TICKS > 255 || DISPLAY_SLOT_TICKS < 16
+#error "DISPLAY_SCAN_HZ cannot be reached with timer 2 at this F_CPU"
+#endif
+
+// The display framebuffer, index 0 is the left digit.
+// Each entry holds the complete pin pattern for PORTD and PORTC (within the segment masks) for that digit, including
+// its enable line. A disabled digit is all zeros, which is also what the scan-out writes between digits.
+// These are volatile since they are read from within the display timer interrupt.
+volatile uint8_t display_fb_portd[NUM_DIGITS];
+volatile uint8_t display_fb_portc[NUM_DIGITS];
+
+// Brightness of each digit, 0 (off) to 255 (lit for its whole slot). Read by the display timer interrupt.
+volatile uint8_t display_brightness[NUM_DIGITS] = {255, 255};
+
+// Computes the framebuffer entry for a single digit.
+static void framebuffer_digit(uint8_t index, uint8_t glyph, uint8_t enabled, uint8_t enable_portd, uint8_t enable_portc) {
+    if (!enabled) {
+        display_fb_portd[index] = 0;
+        display_fb_portc[index] = 0;
+        return;
     }
-}
 
-static uint8_t portc_segment_pattern(uint8_t num) {
-    switch (num) {
-        case 0:
-            return SEGMENT_TOP_LEFT | SEGMENT_BOTTOM_LEFT;
-        case 1:
-            return 0;
-        case 2:
-            return SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT;
-        case 3:
-            return SEGMENT_MIDDLE_MIDDLE;
-        case 4:
-            return SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE;
-        case 5:
-            return SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE;
-        case 6:
-            return SEGMENT_TOP_LEFT | SEGMENT_BOTTOM_LEFT | SEGMENT_MIDDLE_MIDDLE;
-        case 7:
-            return 0;
-        case 8:
-            return SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE | SEGMENT_BOTTOM_LEFT;
-        case 9:
-            return SEGMENT_TOP_LEFT | SEGMENT_MIDDLE_MIDDLE;
-        default:
-            return 0;
+    uint8_t portd_digit_pins = 0;
+    uint8_t portc_digit_pins = 0;
+    if (glyph & GLYPH_DOT) {
+        portd_digit_pins = SEGMENT_DOT;
+        glyph &= ~GLYPH_DOT;
     }
+    if (glyph < NUM_GLYPHS) {
+        portd_digit_pins |= pgm_read_byte(&segment_patterns[glyph][0]);
+        portc_digit_pins = pgm_read_byte(&segment_patterns[glyph][1]);
+    }
+
+    // Segments are lit while LOW, so we drive every segment _not_ in the pattern HIGH.
+    display_fb_portd[index] = (PORTD_SEGMENT_MASK_NO_ENABLE & ~portd_digit_pins) | enable_portd;
+    display_fb_portc[index] = (PORTC_SEGMENT_MASK_NO_ENABLE & ~portc_digit_pins) | enable_portc;
 }
 
-void clear_segment_pins() {
-    PORTD &= ~PORTD_SEGMENT_MASK;
-    PORTC &= ~PORTC_SEGMENT_MASK;
+// Sets what the display shows, as glyphs: GLYPH_x or a digit, optionally with GLYPH_DOT. Unknown glyphs are blank.
+// The enabled flags can be used to turn off the left or right digit, respectively.
+// This only updates the framebuffer, the actual multiplexing happens in the display timer interrupt.
+// Even if a digit is disabled, it still gets its time slot in the scan-out. Otherwise, the other digit would get 100%
+// PWM, which makes it brighter while this digit is disabled.
+void display_show(uint8_t left_glyph, uint8_t right_glyph, uint8_t left_enabled, uint8_t right_enabled) {
+    framebuffer_digit(0, left_glyph, left_enabled, 0, SEGMENT_LEFT_ENABLE);
+    framebuffer_digit(1, right_glyph, right_enabled, SEGMENT_RIGHT_ENABLE, 0);
 }
 
-void drive_digit(uint8_t digit) {
-    uint8_t portd_digit_pins = portd_segment_pattern(digit);
-    uint8_t portc_digit_pins = portc_segment_pattern(digit);
+// Shows two digits, see display_show.
+void drive_display(uint8_t left_digit, uint8_t right_digit, uint8_t left_digit_enabled, uint8_t right_digit_enabled) {
+    display_show(left_digit, right_digit, left_digit_enabled, right_digit_enabled);
+}
 
-    PORTD |= (PORTD_SEGMENT_MASK_NO_ENABLE & ~portd_digit_pins);
-    PORTC |= (PORTC_SEGMENT_MASK_NO_ENABLE & ~portc_digit_pins);
+// Sets the brightness of both digits, 0 to 255. Takes effect with the next slot of each digit.
+void display_set_brightness(uint8_t left, uint8_t right) {
+    display_brightness[0] = left;
+    display_brightness[1] = right;
 }
 
-// Drives the display with the given digits.
-// The enabled flags can be used to turn off the left or right digit, respectively.
-// Internally, this displays the left and right digit for 5ms each, sequentially.
-void drive_display(uint8_t left_digit, uint8_t right_digit, uint8_t left_digit_enabled, uint8_t right_digit_enabled) {
-    // This might seem wrong, but it's on purpose:
-    // Even if the digit is disabled, we still clear the side and wait for 5ms.
-    // Otherwise, the other digit gets 100% PWM, which makes it brighter while this digit is disabled.
-
-    clear_segment_pins();
-    if (left_digit_enabled) {
-        drive_digit(left_digit);
-        PORTC |= SEGMENT_LEFT_ENABLE;
+// Display scan-out.
+// Every digit gets a slot of 5ms. At its start, the digit is shown from the framebuffer, and if it is not at full
+// brightness, the next compare match ends the lit part early and the digit stays dark for the rest of its slot.
+// The timer does this by itself, so dimming costs two interrupts per slot and no time in the main loop.
+ISR(TIMER2_COMP_vect) {
+    static uint8_t scan_digit = NUM_DIGITS - 1;
+    // Timer ticks left in the current slot once its lit part is over, or 0 if it is lit for the whole slot.
+    static uint8_t dark_ticks = 0;
+
+    // Clear all segment pins first, otherwise we get ghosting between updating PORTD and PORTC.
+    PORTD &= ~PORTD_SEGMENT_MASK;
+    PORTC &= ~PORTC_SEGMENT_MASK;
+
+    if (dark_ticks) {
+        // End of the lit part, stay dark for the rest of the slot.
+        // In CTC mode, OCR2 is not buffered, but TCNT2 has just been cleared, so this is the length of the next period.
+        OCR2 = dark_ticks - 1;
+        dark_ticks = 0;
+        return;
     }
-    _delay_ms(5);
 
-    clear_segment_pins();
-    if (right_digit_enabled) {
-        drive_digit(right_digit);
-        PORTD |= SEGMENT_RIGHT_ENABLE;
+    // Start of the next slot.
+    scan_digit++;
+    if (scan_digit == NUM_DIGITS) {
+        scan_digit = 0;
     }
-    _delay_ms(5);
+
+    // 8x8 bit multiplication, a couple of cycles on the AVR.
+    uint8_t lit_ticks = ((uint16_t) (display_brightness[scan_digit] + 1) * DISPLAY_SLOT_TICKS) >> 8;
+    if (lit_ticks == 0) {
+        OCR2 = DISPLAY_SLOT_TICKS - 1;
+        return;
+    }
+
+    PORTD |= display_fb_portd[scan_digit];
+    PORTC |= display_fb_portc[scan_digit];
+
+    OCR2 = lit_ticks - 1;
+    dark_ticks = DISPLAY_SLOT_TICKS - lit_ticks;
+}
+
+// Initialize timer 2 for the display scan-out.
+// This runs in CTC mode with DISPLAY_PRESCALER, interrupting at least every 5ms.
+void init_display_timer() {
+    // Stopped, and on the ATmega8, both of these are TCCR2. See hal.h.
+    TIMER2_TCCRA = 0;
+    TIMER2_TCCRB = 0;
+    TCNT2 = 0;
+    OCR2 = DISPLAY_SLOT_TICKS - 1; // = 8000000 / (256 * 200) - 1 = 155 on the original board
+    // CTC mode, then start with the prescaler.
+    TIMER2_TCCRA = (1 << WGM21);
+    TIMER2_TCCRB |= DISPLAY_CLOCK_SELECT;
+    // enable timer compare interrupt
+    TIMER2_TIMSK |= (1 << OCIE2);
+}
+
+// Stops the scan-out and turns all segments off, before handing over to the bootloader.
+void display_off() {
+    TIMER2_TIMSK &= ~(1 << OCIE2);
+    PORTD &= ~PORTD_SEGMENT_MASK;
+    PORTC &= ~PORTC_SEGMENT_MASK;
 }
 
 // Sets up outputs for the segment display.
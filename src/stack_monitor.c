@@ -0,0 +1,52 @@
+//
+// Stack usage, see stack_monitor.h.
+//
+
+#include <stddef.h>
+
+#include "stack_monitor.h"
+#include "telemetry.h"
+
+// The next byte to look at, or NULL between scans.
+static uint8_t *scan = NULL;
+// The value of telemetry_seconds the last scan was started at.
+static uint8_t scan_seconds;
+
+void stack_monitor_init(volatile uint8_t *dst) {
+    // Everything below the stack pointer is free. Nothing is called while painting, so our own frame is above it.
+    uint8_t *end = RAM_STACK_POINTER();
+    for (uint8_t *p = RAM_STACK_LIMIT; p < end; p++) {
+        *p = STACK_MONITOR_CANARY;
+    }
+
+    telemetry_put16(dst + STACK_MONITOR_DATA_SIZE, RAM_DATA_SIZE);
+    telemetry_put16(dst + STACK_MONITOR_BSS_SIZE, RAM_BSS_SIZE);
+    scan_seconds = telemetry_seconds;
+}
+
+void stack_monitor_poll(volatile uint8_t *dst) {
+    if (scan == NULL) {
+        uint8_t now = telemetry_seconds;
+        if (now == scan_seconds) {
+            return;
+        }
+        scan_seconds = now;
+        scan = RAM_STACK_LIMIT;
+    }
+
+    for (uint8_t i = 0; i < STACK_MONITOR_CHUNK; i++) {
+        // The stack only grows down, so once we are past the canaries, they can't come back. Stop at the top, in case
+        // the stack pointer was set somewhere else.
+        if (*scan != STACK_MONITOR_CANARY || scan == RAM_STACK_TOP) {
+            uint16_t free = scan - RAM_STACK_LIMIT;
+            uint16_t used = RAM_STACK_TOP - scan + 1;
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                telemetry_put16(dst + STACK_MONITOR_STACK_USED, used);
+                telemetry_put16(dst + STACK_MONITOR_STACK_FREE, free);
+            }
+            scan = NULL;
+            return;
+        }
+        scan++;
+    }
+}
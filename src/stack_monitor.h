@@ -0,0 +1,37 @@
+//
+// Stack usage, readable via I2C.
+//
+// The ATmega8 has 1 KB of SRAM. Static data (.data, .bss, .noinit) sits at the bottom, the stack grows down from the
+// top, and with both ISRs running on top of whatever the main loop is doing, nothing but luck keeps the two apart.
+// So we measure it:
+// - stack_monitor_init paints all free stack space with STACK_MONITOR_CANARY.
+// - Once per second, the main loop scans the painted area from the bottom up, STACK_MONITOR_CHUNK bytes per pass so it
+//   never delays anything. The first byte that isn't the canary anymore is the deepest the stack has ever been.
+// The result is copied to the register file after every scan:
+//
+//   [.data size, .bss size (including .noinit), stack used at most, stack never used], all 16 bits little endian,
+//
+// in bytes. The last one is the margin left before the stack runs into static data. The stack might have used a byte
+// or two more than reported, if it happened to leave the canary value there.
+//
+
+#ifndef FAN_CONTROL_STACK_MONITOR_H
+#define FAN_CONTROL_STACK_MONITOR_H
+
+#include "hal.h"
+#include "registers.h"
+
+// The layout of the stack monitor block in the I2C register file, STACK_MONITOR_*, is in registers.h.
+
+#define STACK_MONITOR_CANARY 0xC5
+// Bytes scanned per main loop pass.
+#define STACK_MONITOR_CHUNK 32
+
+// Paints the free stack and fills dst, which must be STACK_MONITOR_SIZE bytes long, with the static sizes.
+// Call this first thing in setup, with interrupts disabled.
+void stack_monitor_init(volatile uint8_t *dst);
+
+// Continues the scan, and copies the result to dst once it is complete. Only call this from the main loop.
+void stack_monitor_poll(volatile uint8_t *dst);
+
+#endif //FAN_CONTROL_STACK_MONITOR_H
@@ -0,0 +1,76 @@
+//
+// Performance counters, see telemetry.h.
+//
+
+#include "telemetry.h"
+#include "timer_wheel.h"
+
+#if TIMER1_TICK_HZ > 255
+#error "one second does not fit in a timer wheel period"
+#endif
+
+loop_stats_t telemetry_loop_stats[2];
+volatile uint8_t telemetry_loop_stats_index;
+
+uint16_t telemetry_twi_isr_count;
+uint16_t telemetry_twi_isr_time_max;
+uint16_t telemetry_twi_nack_count;
+uint16_t telemetry_pec_error_count;
+
+uint16_t telemetry_timer_isr_count;
+uint16_t telemetry_timer_isr_time_max;
+uint16_t telemetry_relay_actuations[TELEMETRY_RELAYS];
+volatile uint8_t telemetry_seconds;
+
+// The current aggregation window of the main loop.
+static uint8_t window_seconds = 0;
+static uint32_t window_loops = 0;
+static uint32_t window_time_sum = 0;
+static uint16_t window_time_max = 0;
+static uint16_t relay_changes = 0;
+
+static void count_second(void) {
+    telemetry_seconds++;
+}
+
+static timer_wheel_timer_t second_timer = TIMER_WHEEL_TIMER(count_second);
+
+void telemetry_init(void) {
+    timer_wheel_start(&second_timer, TIMER1_TICK_HZ, TIMER1_TICK_HZ);
+}
+
+void telemetry_relay_changed(void) {
+    relay_changes++;
+}
+
+void telemetry_loop_end(uint16_t start) {
+    uint16_t duration = timer1_elapsed(start, timer1_now());
+
+    window_loops++;
+    window_time_sum += duration;
+    if (duration > window_time_max) {
+        window_time_max = duration;
+    }
+
+    uint8_t seconds = telemetry_seconds;
+    if (seconds == window_seconds) {
+        return;
+    }
+
+    // Publish into the inactive buffer, then flip.
+    // If the main loop was stuck for more than a second, this averages over the whole time.
+    uint8_t elapsed = seconds - window_seconds;
+    uint32_t loops_per_second = window_loops / elapsed;
+    loop_stats_t *next = &telemetry_loop_stats[telemetry_loop_stats_index ^ 1];
+
+    next->loops_per_second = loops_per_second > 0xFFFF ? 0xFFFF : loops_per_second;
+    next->loop_time_max = window_time_max;
+    next->loop_time_avg = window_time_sum / window_loops;
+    next->relay_changes = relay_changes;
+    telemetry_loop_stats_index ^= 1;
+
+    window_seconds = seconds;
+    window_loops = 0;
+    window_time_sum = 0;
+    window_time_max = 0;
+}
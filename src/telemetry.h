@@ -0,0 +1,110 @@
+//
+// Performance counters, readable via I2C.
+//
+// Counters are kept in two places, depending on who updates them:
+// - Counters updated from ISRs are plain variables. ISRs don't nest, so TWI_vect can read them consistently.
+// - Counters updated by the main loop are aggregated over one second and then published into one of two buffers.
+//   The main loop only ever writes the inactive buffer and then flips telemetry_loop_stats_index, which is a single
+//   byte store. TWI_vect always reads the active buffer.
+// TWI_vect copies everything into the I2C register file when a read reaches the block, so a burst read returns one
+// consistent snapshot.
+//
+// All times are in timer 1 ticks, i.e. microseconds at 8 MHz.
+//
+
+#ifndef FAN_CONTROL_TELEMETRY_H
+#define FAN_CONTROL_TELEMETRY_H
+
+#include "hal.h"
+#include "timer.h"
+#include "registers.h"
+
+// The layout of the telemetry block in the I2C register file, TELEMETRY_*, is in registers.h.
+
+// Statistics from the main loop, published once per second.
+typedef struct {
+    uint16_t loops_per_second;
+    uint16_t loop_time_max;
+    uint16_t loop_time_avg;
+    uint16_t relay_changes;
+} loop_stats_t;
+
+extern loop_stats_t telemetry_loop_stats[2];
+extern volatile uint8_t telemetry_loop_stats_index;
+
+// Owned by TWI_vect.
+extern uint16_t telemetry_twi_isr_count;
+extern uint16_t telemetry_twi_isr_time_max;
+extern uint16_t telemetry_twi_nack_count;
+extern uint16_t telemetry_pec_error_count;
+
+// Owned by TIMER1_COMPA_vect.
+extern uint16_t telemetry_timer_isr_count;
+extern uint16_t telemetry_timer_isr_time_max;
+// How often each relay switched since boot, indexed by relay number - 1. See relay.h.
+// These wrap around and start from zero after every reset, a master has to accumulate them if it wants totals.
+extern uint16_t telemetry_relay_actuations[TELEMETRY_RELAYS];
+// Incremented once per second.
+extern volatile uint8_t telemetry_seconds;
+
+// Call at the end of TWI_vect, with the TCNT1 value from when it started.
+static inline void telemetry_twi_isr_end(uint16_t start) {
+    uint16_t duration = timer1_elapsed(start, timer1_now_isr());
+
+    telemetry_twi_isr_count++;
+    if (duration > telemetry_twi_isr_time_max) {
+        telemetry_twi_isr_time_max = duration;
+    }
+}
+
+// Call at the end of TIMER1_COMPA_vect, with the TCNT1 value from when it started.
+static inline void telemetry_timer_isr_end(uint16_t start) {
+    uint16_t duration = timer1_elapsed(start, timer1_now_isr());
+
+    telemetry_timer_isr_count++;
+    if (duration > telemetry_timer_isr_time_max) {
+        telemetry_timer_isr_time_max = duration;
+    }
+}
+
+static inline void telemetry_put16(volatile uint8_t *dst, uint16_t value) {
+    dst[0] = value & 0xFF;
+    dst[1] = value >> 8;
+}
+
+// Copies all counters to dst, which must be TELEMETRY_SIZE bytes long.
+// Only call this from within TWI_vect.
+static inline void telemetry_snapshot(volatile uint8_t *dst) {
+    const loop_stats_t *loop_stats = &telemetry_loop_stats[telemetry_loop_stats_index];
+
+    telemetry_put16(dst + TELEMETRY_LOOPS_PER_SECOND, loop_stats->loops_per_second);
+    telemetry_put16(dst + TELEMETRY_LOOP_TIME_MAX, loop_stats->loop_time_max);
+    telemetry_put16(dst + TELEMETRY_LOOP_TIME_AVG, loop_stats->loop_time_avg);
+    telemetry_put16(dst + TELEMETRY_TWI_ISR_COUNT, telemetry_twi_isr_count);
+    telemetry_put16(dst + TELEMETRY_TIMER_ISR_COUNT, telemetry_timer_isr_count);
+    telemetry_put16(dst + TELEMETRY_TWI_ISR_TIME_MAX, telemetry_twi_isr_time_max);
+    telemetry_put16(dst + TELEMETRY_TIMER_ISR_TIME_MAX, telemetry_timer_isr_time_max);
+    telemetry_put16(dst + TELEMETRY_TWI_NACK_COUNT, telemetry_twi_nack_count);
+    telemetry_put16(dst + TELEMETRY_RELAY_CHANGE_COUNT, loop_stats->relay_changes);
+    telemetry_put16(dst + TELEMETRY_PEC_ERROR_COUNT, telemetry_pec_error_count);
+}
+
+// Copies the relay actuation counts to dst, which must be 2 * TELEMETRY_RELAYS bytes long.
+// Only call this from within TWI_vect.
+static inline void telemetry_snapshot_relays(volatile uint8_t *dst) {
+    for (uint8_t i = 0; i < TELEMETRY_RELAYS; i++) {
+        telemetry_put16(dst + 2 * i, telemetry_relay_actuations[i]);
+    }
+}
+
+// Starts counting telemetry_seconds. Call this with interrupts disabled.
+void telemetry_init(void);
+
+// Counts a change of the relay target. Only call this from the main loop.
+void telemetry_relay_changed(void);
+
+// Call at the end of every main loop pass, with the timer1_now value from the start of the pass.
+// Publishes the main loop statistics once per second.
+void telemetry_loop_end(uint16_t start);
+
+#endif //FAN_CONTROL_TELEMETRY_H
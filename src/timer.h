@@ -0,0 +1,65 @@
+//
+// Timer 1 runs the 100 Hz system tick, see init_timer in main.c.
+// This file holds the constants derived from that and helpers to use TCNT1 as a timestamp.
+// The prescaler is the smallest one that lets TCNT1 count a whole tick, so timestamps are as fine as they can be.
+// One timer tick is 1us at 8 MHz (prescaler 8), 0.5us at 16 MHz (also 8), and TCNT1 wraps around every 10ms.
+//
+
+#ifndef FAN_CONTROL_TIMER_H
+#define FAN_CONTROL_TIMER_H
+
+#include "hal.h"
+
+// System tick frequency.
+#define TIMER1_TICK_HZ 100
+
+// Timer 1 prescaler, and the matching clock select bits for TCCR1B.
+#if F_CPU / TIMER1_TICK_HZ <= 65536UL
+#define TIMER1_PRESCALER 1
+#define TIMER1_CLOCK_SELECT (1 << CS10)
+#elif F_CPU / (8UL * TIMER1_TICK_HZ) <= 65536UL
+#define TIMER1_PRESCALER 8
+#define TIMER1_CLOCK_SELECT (1 << CS11)
+#elif F_CPU / (64UL * TIMER1_TICK_HZ) <= 65536UL
+#define TIMER1_PRESCALER 64
+#define TIMER1_CLOCK_SELECT ((1 << CS11) | (1 << CS10))
+#elif F_CPU / (256UL * TIMER1_TICK_HZ) <= 65536UL
+#define TIMER1_PRESCALER 256
+#define TIMER1_CLOCK_SELECT (1 << CS12)
+#else
+#error "TIMER1_TICK_HZ cannot be reached with timer 1 at this F_CPU"
+#endif
+
+// Compare value for CTC mode.
+#define TIMER1_TOP ((F_CPU / (TIMER1_PRESCALER * TIMER1_TICK_HZ)) - 1)
+
+#if F_CPU % (TIMER1_PRESCALER * TIMER1_TICK_HZ) != 0
+#error "F_CPU is not a multiple of the timer 1 period, the system tick would drift"
+#endif
+
+// Reads TCNT1 from within an ISR.
+static inline uint16_t timer1_now_isr(void) {
+    return TCNT1;
+}
+
+// Reads TCNT1 from the main program.
+// 16 bit registers share a single TEMP register, and the ISRs read TCNT1 too, so the two byte reads must not be
+// interrupted. Interrupts are only disabled for those two instructions.
+static inline uint16_t timer1_now(void) {
+    uint16_t now;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        now = TCNT1;
+    }
+    return now;
+}
+
+// Computes the number of timer ticks between two timestamps.
+// This is only correct if less than one full tick period (10ms) passed in between.
+static inline uint16_t timer1_elapsed(uint16_t start, uint16_t end) {
+    if (end >= start) {
+        return end - start;
+    }
+    return end + (TIMER1_TOP + 1) - start;
+}
+
+#endif //FAN_CONTROL_TIMER_H
@@ -0,0 +1,94 @@
+//
+// Software timers, see timer_wheel.h.
+//
+
+#include "timer_wheel.h"
+
+volatile uint16_t timer_wheel_ticks = 0;
+
+static timer_wheel_timer_t *slots[TIMER_WHEEL_SLOTS];
+
+// The timer whose callback is running. Cleared if the callback restarts or cancels it, so it is not re-armed.
+static timer_wheel_timer_t *firing = NULL;
+
+static void list_add(timer_wheel_timer_t **head, timer_wheel_timer_t *timer) {
+    timer->next = *head;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+}
+
+static void list_del(timer_wheel_timer_t *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+// Links the timer into the slot delay ticks ahead. The current slot has already been handled, so a delay of
+// TIMER_WHEEL_SLOTS lands in it with zero rounds and expires exactly one turn later.
+static void insert(timer_wheel_timer_t *timer, uint8_t delay) {
+    if (delay == 0) {
+        delay = 1;
+    }
+    timer->rounds = (delay - 1) / TIMER_WHEEL_SLOTS;
+    list_add(&slots[(uint8_t) (timer_wheel_ticks + delay) & TIMER_WHEEL_MASK], timer);
+}
+
+void timer_wheel_start(timer_wheel_timer_t *timer, uint8_t delay, uint8_t period) {
+    if (timer_wheel_pending(timer)) {
+        list_del(timer);
+    }
+    if (timer == firing) {
+        firing = NULL;
+    }
+
+    timer->period = period;
+    insert(timer, delay);
+}
+
+void timer_wheel_cancel(timer_wheel_timer_t *timer) {
+    if (timer_wheel_pending(timer)) {
+        list_del(timer);
+    }
+    if (timer == firing) {
+        firing = NULL;
+    }
+}
+
+void timer_wheel_tick(void) {
+    uint16_t now = timer_wheel_ticks + 1;
+    timer_wheel_ticks = now;
+
+    // Move the slot to a list of its own first. Callbacks may then start and cancel timers, including the ones still
+    // waiting in here, and timers they start for a full turn from now go back into the (now empty) slot.
+    timer_wheel_timer_t **slot = &slots[now & TIMER_WHEEL_MASK];
+    timer_wheel_timer_t *expiring = NULL;
+    if (*slot) {
+        expiring = *slot;
+        expiring->pprev = &expiring;
+        *slot = NULL;
+    }
+
+    while (expiring) {
+        timer_wheel_timer_t *timer = expiring;
+        list_del(timer);
+
+        if (timer->rounds) {
+            timer->rounds--;
+            list_add(slot, timer);
+            continue;
+        }
+
+        firing = timer;
+        timer->callback();
+        if (firing == timer && timer->period) {
+            insert(timer, timer->period);
+        }
+        firing = NULL;
+    }
+}
@@ -0,0 +1,73 @@
+//
+// Software timers driven by the 100 Hz system tick, see timer.h.
+//
+// Everything that has to happen some number of ticks from now (debouncing the button, blinking the selected digit,
+// stepping the relays, counting seconds) registers a timer here, instead of keeping its own counter in
+// TIMER1_COMPA_vect. The ISR only calls timer_wheel_tick.
+// The display scan-out is the exception, it needs 200 Hz and keeps timer 2 to itself, see segment.h.
+//
+// This is a hashed timer wheel with TIMER_WHEEL_SLOTS slots, one per tick. A timer due in d ticks goes into the slot
+// d ticks ahead of the current one, with the number of full turns of the wheel it has to wait for. Every tick looks
+// at one slot only. Slots are intrusive doubly linked lists, so starting and cancelling a timer is O(1), and a tick
+// costs O(timers in that slot), independent of how many timers are pending elsewhere.
+// There is no allocation: Timers are statically allocated by whoever owns them, so the capacity is fixed at compile
+// time by the number of timers in the firmware.
+//
+// Callbacks run from within TIMER1_COMPA_vect and must be short. They may start or cancel any timer, including their
+// own. Periodic timers are re-armed after their callback returns, unless the callback restarted or cancelled them.
+//
+// All functions may only be called from TIMER1_COMPA_vect (i.e. from callbacks), or with interrupts disabled.
+//
+
+#ifndef FAN_CONTROL_TIMER_WHEEL_H
+#define FAN_CONTROL_TIMER_WHEEL_H
+
+#include <stddef.h>
+
+#include "hal.h"
+
+// Number of slots, must be a power of two.
+// Timers due within this many ticks never wait for a full turn. Most of ours are.
+#define TIMER_WHEEL_SLOTS 16
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+
+#if (TIMER_WHEEL_SLOTS & TIMER_WHEEL_MASK) != 0
+#error "TIMER_WHEEL_SLOTS must be a power of two"
+#endif
+
+typedef void (*timer_wheel_callback_t)(void);
+
+typedef struct timer_wheel_timer {
+    struct timer_wheel_timer *next;
+    // The pointer pointing to this timer, i.e. the slot head or next of the previous timer. NULL while not pending.
+    struct timer_wheel_timer **pprev;
+    timer_wheel_callback_t callback;
+    // Ticks between two expiries, or 0 for a one-shot timer.
+    uint8_t period;
+    // Full turns of the wheel left before expiry.
+    uint8_t rounds;
+} timer_wheel_timer_t;
+
+// Static initializer for a timer that calls the given function.
+#define TIMER_WHEEL_TIMER(cb) {NULL, NULL, (cb), 0, 0}
+
+// Ticks since boot, wrapping around. Only written by timer_wheel_tick.
+extern volatile uint16_t timer_wheel_ticks;
+
+// Starts timer to expire delay ticks from now (at least 1), and then every period ticks, unless period is 0.
+// If the timer was pending, it is restarted.
+void timer_wheel_start(timer_wheel_timer_t *timer, uint8_t delay, uint8_t period);
+
+// Stops the timer. Does nothing if it is not pending.
+void timer_wheel_cancel(timer_wheel_timer_t *timer);
+
+// Whether the timer is pending.
+static inline uint8_t timer_wheel_pending(const timer_wheel_timer_t *timer) {
+    return timer->pprev != NULL;
+}
+
+// Advances the wheel by one tick and runs the callbacks of all timers that expire.
+// Call this from TIMER1_COMPA_vect.
+void timer_wheel_tick(void);
+
+#endif //FAN_CONTROL_TIMER_WHEEL_H
@@ -0,0 +1,54 @@
+//
+// A trace of the last TWI events, readable via I2C, to debug the bus in the field without a logic analyzer.
+//
+// While I2C_CONFIG_TRACE is set in the config register, TWI_vect records every event it handles: the TWSR status code,
+// the register address, and TCNT1 when the ISR started (wrapping every 10 ms, see timer.h). The register address is
+// the one selected when the event arrived, or for transmitted bytes, the one the byte came from. At the end of a read,
+// it is the register of the next byte, which the master did not take. 0xFF means none, e.g. for SLA+W or the PEC.
+// Entries are written straight into the register file after TWINT has been cleared, so tracing never stretches the
+// clock. It costs about 20 cycles per event while enabled, and a test of the config register while not.
+//
+// The trace block is [count, then TWI_TRACE_ENTRIES entries: status, register, time (16 bits little endian)], where
+// count is the number of events so far (wrapping), and the newest entry is at (count - 1) % TWI_TRACE_ENTRIES. The
+// entries are not reordered to save the copy; unused ones have status TW_NO_INFO, which TWI_vect never sees.
+// Once a read reaches the block, recording pauses until the next transaction, so the read is consistent and does not
+// trace itself. Only its SLA+W and register address are recorded.
+//
+
+#ifndef FAN_CONTROL_TWI_TRACE_H
+#define FAN_CONTROL_TWI_TRACE_H
+
+#include "hal.h"
+#include "registers.h"
+
+// The layout of the trace block in the I2C register file, TWI_TRACE_*, is in registers.h.
+#define TWI_TRACE_MASK (TWI_TRACE_ENTRIES - 1)
+
+#if (TWI_TRACE_ENTRIES & TWI_TRACE_MASK) != 0
+#error "TWI_TRACE_ENTRIES must be a power of two"
+#endif
+
+#if TWI_TRACE_UNUSED != TW_NO_INFO
+#error "TWI_TRACE_UNUSED must be TW_NO_INFO, which TWI_vect never sees"
+#endif
+
+// Marks all entries of the trace block at dst as unused. Call this once in setup, after clearing the register file.
+static inline void twi_trace_init(volatile uint8_t *dst) {
+    for (uint8_t i = 0; i < TWI_TRACE_ENTRIES; i++) {
+        dst[TWI_TRACE_FIRST + i * TWI_TRACE_ENTRY_SIZE + TWI_TRACE_STATUS] = TWI_TRACE_UNUSED;
+    }
+}
+
+// Records one event into the trace block at dst. Only call this from within TWI_vect.
+static inline void twi_trace_record(volatile uint8_t *dst, uint8_t status, uint8_t reg, uint16_t time) {
+    uint8_t count = dst[TWI_TRACE_COUNT];
+    volatile uint8_t *entry = dst + TWI_TRACE_FIRST + (count & TWI_TRACE_MASK) * TWI_TRACE_ENTRY_SIZE;
+
+    entry[TWI_TRACE_STATUS] = status;
+    entry[TWI_TRACE_REGISTER] = reg;
+    entry[TWI_TRACE_TIME] = time & 0xFF;
+    entry[TWI_TRACE_TIME + 1] = time >> 8;
+    dst[TWI_TRACE_COUNT] = count + 1;
+}
+
+#endif //FAN_CONTROL_TWI_TRACE_H
@@ -8,102 +8,569 @@
 * We support all three types of I2C transactions:
 * - Pure write: One byte can be written to address 0x0.
 *	This is the status register. Consult main.c for an explanation.
-* - Pure read: 3 bytes can be read, starting from address 0x0.
-*    The data consists of one status byte (at 0x0) followed by 2 bytes for the air-intake and air-out ventilation modes.
+* - Pure read: Up to i2c_buffer_size bytes can be read, starting from address 0x0.
+*    The data consists of one status byte (at 0x0) followed by 2 bytes for the air-intake and air-out ventilation modes,
+*    the change sequence number, more control registers, the telemetry block (see telemetry.h), and the schedule
+*    table (see schedule.h).
 * - Write+read: This is actually just a read from some given address (the one byte written).
+*
+* Written bytes are buffered and only applied once the write transaction is complete, i.e. at the STOP or repeated
+* START. Writes to the air mode registers then go to a staging buffer.
+* Only once register 0x02 is written are both modes published to i2c_committed_air_in/out, by incrementing
+* i2c_commit_seq. This lets the main program pick them up without ever disabling interrupts.
+* The main program might publish the modes of an older commit to i2cdata after that, so until it has caught up
+* (i2c_published_seq), reads of the air mode registers return the committed modes.
+*
+* Optionally, SMBus Packet Error Checking can be enabled via bit 0 of register 0x04. Then:
+* - Every write must end with a PEC byte, computed over the address byte, the register address and the data.
+*   Writes with a wrong or missing PEC are dropped completely and counted in the telemetry.
+* - Every read returns as many data bytes as configured in register 0x05, followed by the PEC. The PEC is computed
+*   over the address byte and register address of the write (if any), the address byte of the read, and the data.
+*   Use a repeated START between the two, as SMBus does.
+*
+* Group commit: General call reception is enabled, so a master can set the modes of many devices at once.
+* A general call frame has the layout of a "hardware general call" from the I2C spec: The first byte is the address of
+* the master, shifted left, with bit 0 set. It is followed by a bitmask of groups, and the air in and out modes.
+* Every device that is a member of at least one of the groups (see register 0x07) commits the modes at the STOP, just
+* like a write to register 0x02, so they all switch at the same time. Devices with the button override active ignore
+* the frame. If the frame ends with a fifth byte, that's a PEC and it is checked. Devices with PEC enabled ignore frames
+* without one.
+* Other general calls, e.g. the reset command (0x06) from the spec, are ignored.
+*
+* Bus hangs: If a master goes away in the middle of a transaction, e.g. because it was reset while we were sending a
+* zero bit, the TWI keeps SDA low and waits for clocks that never come, and the bus is stuck for everyone. The same
+* happens if SCL is held low forever. So the bus supervisor checks once per timer tick whether a transaction is in
+* progress, TWI_vect has not run since the last tick, and SDA or SCL is low. If that stays the case for TWI_HANG_TICKS
+* ticks in a row, it disables the TWI, which releases both lines, and runs init_twi_slave again. Nothing else is reset,
+* in particular not the relays or the modes. Each recovery is counted at I2C_REG_TWI_RECOVERIES.
+* A transaction that ends normally, even a read the master NACKs or breaks off with a STOP, never trips this.
+*
+* Tracing: While bit 1 of register 0x04 is set, every event is recorded into the trace block, see twi_trace.h.
+*
+* Timing: The TWI holds SCL low from setting TWINT until TWI_vect clears it, so everything the ISR does before that
+* stretches the clock. TWI_vect therefore maps the status code to one of a few states via twi_states, and every state
+* clears TWINT as early as it can: Received bytes are read from TWDR and acknowledged right away, and the next byte of
+* a read is staged while the previous one is on the wire, so sending it takes two loads and two stores. Everything
+* else (the PEC, buffering, applying writes, snapshots) happens after TWINT is cleared, while the next byte is on the
+* wire. The read-only blocks (telemetry, relay actuations, button log) are copied when the read reaches them, so each
+* of them is consistent in itself.
+*
+* Cycle budget per state, on top of the entry that all states share (vector, register saves, the telemetry timestamp
+* and the table lookup). One bit at 400 kHz is 20 cycles at 8 MHz:
+*   state     status       before clearing TWINT       after, within one byte on the wire (180 cycles at 8 MHz)
+*   SR_SLA    0x60         -             ~3 cycles     reset the transaction, PEC over SLA+W
+*   SR_GCALL  0x70         -             ~3 cycles     reset the transaction
+*   SR_DATA   0x80, 0x90   read TWDR     ~5 cycles     PEC, register address or buffer
+*   SR_STOP   0xA0         -             ~3 cycles     apply the write, or stage the first byte of the read to come
+*   ST_SLA    0xA8         send staged   ~10 cycles    stage the next byte
+*   ST_DATA   0xB8         send staged   ~8 cycles     stage the next byte, snapshot at the start of a block
+*   RESET     all others   -             ~5 cycles     count
+* A pure read (no register address written before) has nothing staged, so ST_SLA stages the status byte before sending
+* it, which takes a few bit times longer. Snapshots and applying a write can take longer than a byte, then the next
+* event waits for them.
+* Tracing, if enabled, happens at the end, after all of the above.
+* The cycle counts are estimates from reading the code, not measurements. fan_control_sim measures the actual cycles
+* per status code, checks them against the budget, and prints them in the layout of this table, from the vector and
+* so including the entry. Run it on the ELF of this version and of the one before to compare them.
+*
+* Staging: The first byte of a read is staged at the end of the register address, which only pays off with a repeated
+* START. The TWI reports a STOP the same way, and then the read may come much later. So the bus supervisor drops the
+* staged byte once a whole timer tick passed without any TWI event and the bus is idle, and the read stages it again
+* when it comes. A master stalling before the read with SCL low is a hang, as above.
+*
+* Invalid addresses: A register address past the end of the register file discards the rest of the write, and a read
+* from it returns 0xFF and NACKs.
 */
 
-#include <util/twi.h>
-#include <avr/interrupt.h>
-#include <stdint.h>
+#include "hal.h"
 #include "twislave.h"
+#include "crc8.h"
+#include "modes.h"
+#include "device_config.h"
+#include "timer_wheel.h"
+#include "bootloader.h"
+
+#if BOOT_DEFAULT_ADDRESS != I2C_SLAVE_ADDRESS
+#error "the bootloader should answer at the default address"
+#endif
+
+// Number of timer ticks the bus has to be stuck before the supervisor resets the TWI.
+// The first tick after the last event only notes the ISR count, so the hang is detected 30 to 40 ms after it started,
+// just above the SMBus timeout of 25 to 35 ms, and SMBus masters give up on the transaction first.
+#define TWI_HANG_TICKS 3
+
+volatile uint8_t i2c_write_disabled;
+volatile uint8_t i2c_write_rejected;
+volatile uint8_t i2c_boot_request;
+volatile uint8_t i2cdata[i2c_buffer_size];
+volatile uint8_t i2c_committed_air_in;
+volatile uint8_t i2c_committed_air_out;
+volatile uint8_t i2c_commit_seq;
+volatile uint8_t i2c_published_seq;
+volatile uint8_t i2c_schedule_length_request;
+volatile uint8_t i2c_schedule_length_seq;
+volatile uint8_t i2c_schedule_jump_request;
+volatile uint8_t i2c_schedule_jump_seq;
+volatile uint8_t i2c_schedule_remaining_request;
+volatile uint8_t i2c_schedule_remaining_seq;
+
+// Written values, before they are committed.
+// Only ever accessed from within TWI_vect.
+static uint8_t i2c_staging[I2C_REG_AIR_OUT + 1];
+
+// Everything below is only ever accessed from within TWI_vect.
 
-// The currently selected register address (within i2cdata) to be read from/written to.
-volatile uint8_t buffer_addr;
+// The currently selected register address (within i2cdata) to be read from/written to, 0xFF if none, or
+// BUFFER_ADDR_INVALID if the master wrote one past the end of i2cdata.
+// During a read, this is the address of the byte after the staged one.
+static uint8_t buffer_addr;
+#define BUFFER_ADDR_INVALID 0xFE
+
+// Data bytes of the current write transaction, after the register address.
+static uint8_t rx_buf[I2C_RX_SIZE];
+// Number of data bytes received in the current write transaction. This keeps counting past I2C_RX_SIZE.
+static uint8_t rx_len;
+// Number of data bytes sent in the current read transaction.
+static uint8_t tx_count;
+// Running CRC-8 over the current transaction, for SMBus PEC.
+static uint8_t pec;
+// Whether the current write was addressed to the general call address.
+static uint8_t gcall;
+// The next byte of the current read, and the TWCR value to send it with.
+static uint8_t tx_data;
+static uint8_t tx_twcr;
+// The register tx_data was read from, or 0xFF for the PEC.
+static uint8_t tx_addr;
+// Whether tx_data already holds the first byte of the next read, staged at the end of a register address write.
+static uint8_t tx_staged;
+// buffer_addr and pec from before the staging, to drop the staged byte and stage it again.
+static uint8_t unstaged_addr;
+static uint8_t unstaged_pec;
+// Whether recording into the trace is paused, because a read of it is in progress.
+static uint8_t trace_paused;
+
+// Whether we are addressed, i.e. between SLA+R/W and the STOP or the end of the read.
+// Set by TWI_vect and read by the bus supervisor, which runs in the timer ISR. ISRs don't nest.
+static uint8_t twi_active;
+// Only accessed by the bus supervisor: the ISR count at the last tick, and the number of ticks the bus was stuck.
+static uint16_t supervisor_isr_count;
+static uint8_t supervisor_stuck_ticks;
+
+// States of TWI_vect, see above.
+#define TWI_STATE_RESET 0
+#define TWI_STATE_SR_SLA 1
+#define TWI_STATE_SR_GCALL 2
+#define TWI_STATE_SR_DATA 3
+#define TWI_STATE_SR_STOP 4
+#define TWI_STATE_ST_SLA 5
+#define TWI_STATE_ST_DATA 6
+
+// Maps TW_STATUS >> 3 to the state handling it. Everything not listed is an error, or not expected of a slave, and
+// resets the TWI.
+// The states are dense, so the switch in TWI_vect doesn't have to go through all the status codes.
+static const uint8_t twi_states[32] PROGMEM = {
+        [TW_SR_SLA_ACK >> 3] = TWI_STATE_SR_SLA,
+        [TW_SR_GCALL_ACK >> 3] = TWI_STATE_SR_GCALL,
+        [TW_SR_DATA_ACK >> 3] = TWI_STATE_SR_DATA,
+        [TW_SR_GCALL_DATA_ACK >> 3] = TWI_STATE_SR_DATA,
+        [TW_SR_STOP >> 3] = TWI_STATE_SR_STOP,
+        [TW_ST_SLA_ACK >> 3] = TWI_STATE_ST_SLA,
+        [TW_ST_DATA_ACK >> 3] = TWI_STATE_ST_DATA,
+};
 
 void init_twi_slave(uint8_t addr) {
     // I2C addresses are 7 bits! We have to shift.
-    TWAR = (addr << 1);
+    TWAR = (addr << 1) | (1 << TWGCE);
     TWCR &= ~((1 << TWSTA) | (1 << TWSTO));
     TWCR |= (1 << TWEA) | (1 << TWEN) | (1 << TWIE);
     buffer_addr = 0xFF;
-    i2c_fully_written = 0;
-    i2c_write_disabled = 0;
+    rx_len = 0;
+    gcall = 0;
+    tx_staged = 0;
+    trace_paused = 0;
+    twi_active = 0;
+}
+
+// Runs every timer tick, see "Bus hangs" and "Staging" above.
+static void twi_supervise(void) {
+    uint16_t isr_count = telemetry_twi_isr_count;
+    uint8_t lines = PINC & BOARD_TWI_PINS;
+
+    if (tx_staged && isr_count == supervisor_isr_count && lines == BOARD_TWI_PINS) {
+        // The register address ended with a STOP, and the read is yet to come, if at all.
+        buffer_addr = unstaged_addr;
+        pec = unstaged_pec;
+        tx_staged = 0;
+        trace_paused = 0;
+        twi_active = 0;
+    }
+
+    if (!twi_active || isr_count != supervisor_isr_count || lines == BOARD_TWI_PINS) {
+        supervisor_isr_count = isr_count;
+        supervisor_stuck_ticks = 0;
+        return;
+    }
+
+    if (++supervisor_stuck_ticks < TWI_HANG_TICKS) {
+        return;
+    }
+    supervisor_stuck_ticks = 0;
+
+    // Disabling the TWI releases SDA and SCL and drops whatever it was doing.
+    TWCR = 0;
+    init_twi_slave(TWAR >> 1);
+
+    uint16_t recoveries = i2cdata[I2C_REG_TWI_RECOVERIES] | (i2cdata[I2C_REG_TWI_RECOVERIES + 1] << 8);
+    if (recoveries != 0xFFFF) {
+        recoveries++;
+    }
+    i2cdata[I2C_REG_TWI_RECOVERIES] = recoveries & 0xFF;
+    i2cdata[I2C_REG_TWI_RECOVERIES + 1] = recoveries >> 8;
+}
+
+static timer_wheel_timer_t supervisor_timer = TIMER_WHEEL_TIMER(twi_supervise);
+
+void twi_supervisor_init(void) {
+    timer_wheel_start(&supervisor_timer, 1, 1);
 }
 
 // Macros for TWI control register bitmasks
 
 // ACK nach empfangenen Daten senden/ ACK nach gesendeten Daten erwarten
-#define TWCR_ACK TWCR = (1<<TWEN)|(1<<TWIE)|(1<<TWINT)|(1<<TWEA)|(0<<TWSTA)|(0<<TWSTO)|(0<<TWWC);
+#define TWCR_ACK_BITS ((1<<TWEN)|(1<<TWIE)|(1<<TWINT)|(1<<TWEA)|(0<<TWSTA)|(0<<TWSTO)|(0<<TWWC))
+#define TWCR_ACK TWCR = TWCR_ACK_BITS;
 
 // NACK nach empfangenen Daten senden/ NACK nach gesendeten Daten erwarten
-#define TWCR_NACK TWCR = (1<<TWEN)|(1<<TWIE)|(1<<TWINT)|(0<<TWEA)|(0<<TWSTA)|(0<<TWSTO)|(0<<TWWC);
+#define TWCR_NACK_BITS ((1<<TWEN)|(1<<TWIE)|(1<<TWINT)|(0<<TWEA)|(0<<TWSTA)|(0<<TWSTO)|(0<<TWWC))
 
 // Switch to the non-addressed slave mode...
 #define TWCR_RESET TWCR = (1<<TWEN)|(1<<TWIE)|(1<<TWINT)|(1<<TWEA)|(0<<TWSTA)|(1<<TWSTO)|(0<<TWWC); buffer_addr=0xFF;
 
+// Applies the data bytes of a completed write transaction, starting at register buffer_addr.
+// This runs at the STOP (or repeated START), after the PEC has been checked if enabled.
+// Publishes the staged modes. The main program picks them up once it sees the new sequence number.
+static inline void commit_modes(void) {
+    i2c_committed_air_in = i2c_staging[I2C_REG_AIR_IN];
+    i2c_committed_air_out = i2c_staging[I2C_REG_AIR_OUT];
+    i2c_commit_seq++;
+
+    // The main program will apply valid modes. Show them right away, so a write+read with a repeated START reads back
+    // what was just set, not what the main program has not processed yet.
+    if (i2c_committed_air_in < NUM_AIR_IN_MODES) {
+        i2cdata[I2C_REG_AIR_IN] = i2c_committed_air_in;
+    }
+    if (i2c_committed_air_out < NUM_AIR_OUT_MODES) {
+        i2cdata[I2C_REG_AIR_OUT] = i2c_committed_air_out;
+    }
+}
+
+// Applies a general call frame of len bytes in rx_buf, PEC included, see above.
+static inline void apply_group_commit(uint8_t len) {
+    if (len == I2C_GCALL_FRAME_SIZE + 1) {
+        if (pec != 0) {
+            telemetry_pec_error_count++;
+            return;
+        }
+    } else if (len != I2C_GCALL_FRAME_SIZE || (i2cdata[I2C_REG_CONFIG] & I2C_CONFIG_PEC)) {
+        return;
+    }
+
+    if (!(rx_buf[I2C_GCALL_FRAME_MASTER] & 0x01) || !(rx_buf[I2C_GCALL_FRAME_GROUPS] & i2cdata[I2C_REG_GROUPS])) {
+        // Not a group commit, or not for us.
+        return;
+    }
+
+    if (!i2c_write_disabled) {
+        i2c_staging[I2C_REG_AIR_IN] = rx_buf[I2C_GCALL_FRAME_AIR_IN];
+        i2c_staging[I2C_REG_AIR_OUT] = rx_buf[I2C_GCALL_FRAME_AIR_OUT];
+        commit_modes();
+    } else {
+        i2c_write_rejected = 1;
+    }
+}
+
+static inline void apply_write(uint8_t len) {
+    uint8_t addr = buffer_addr;
+
+    for (uint8_t i = 0; i < len; i++, addr++) {
+        uint8_t data = rx_buf[i];
+
+        switch (addr) {
+            case I2C_REG_STATUS:
+                // Bit 2 low = WDT reset occurred -> allow setting only (cleared by mc)
+                // Discard read-only bits.
+                i2cdata[I2C_REG_STATUS] |= data & I2C_BIT_WDT_RESET;
+                break;
+            case I2C_REG_AIR_IN:
+                if (!i2c_write_disabled) {
+                    i2c_staging[I2C_REG_AIR_IN] = data;
+                }
+                break;
+            case I2C_REG_AIR_OUT:
+                if (!i2c_write_disabled) {
+                    i2c_staging[I2C_REG_AIR_OUT] = data;
+                    commit_modes();
+                } else {
+                    i2c_write_rejected = 1;
+                }
+                break;
+            case I2C_REG_CONFIG:
+                i2cdata[I2C_REG_CONFIG] = data & I2C_CONFIG_MASK;
+                break;
+            case I2C_REG_PEC_READ_LENGTH:
+                i2cdata[I2C_REG_PEC_READ_LENGTH] = data;
+                break;
+            case I2C_REG_ADDRESS:
+                if (data >= DEVICE_CONFIG_ADDRESS_MIN && data <= DEVICE_CONFIG_ADDRESS_MAX) {
+                    i2cdata[I2C_REG_ADDRESS] = data;
+                }
+                break;
+            case I2C_REG_GROUPS:
+                i2cdata[I2C_REG_GROUPS] = data;
+                break;
+            case I2C_REG_SCHEDULE_CONTROL:
+                i2cdata[I2C_REG_SCHEDULE_CONTROL] = data & SCHEDULE_CONTROL_MASK;
+                break;
+            case I2C_REG_SCHEDULE_LENGTH:
+                i2c_schedule_length_request = data;
+                i2c_schedule_length_seq++;
+                break;
+            case I2C_REG_SCHEDULE_ENTRY:
+                i2c_schedule_jump_request = data;
+                i2c_schedule_jump_seq++;
+                break;
+            case I2C_REG_SCHEDULE_REMAINING:
+                i2c_schedule_remaining_request = data;
+                i2c_schedule_remaining_seq++;
+                break;
+            case I2C_REG_BUTTON_DEBOUNCE:
+            case I2C_REG_BUTTON_LONG_PRESS:
+                if (data) {
+                    i2cdata[addr] = data;
+                }
+                break;
+            case I2C_REG_BUTTON_REPEAT:
+                i2cdata[I2C_REG_BUTTON_REPEAT] = data;
+                break;
+            case I2C_REG_BOOT:
+                if (data == BOOT_ENTER_KEY) {
+                    i2c_boot_request = 1;
+                }
+                break;
+            default:
+                if (addr >= I2C_REG_BRIGHTNESS && addr < I2C_REG_BRIGHTNESS + I2C_BRIGHTNESS_SIZE) {
+                    i2cdata[addr] = data;
+                }
+                if (addr >= I2C_REG_SCHEDULE && addr < I2C_REG_SCHEDULE + SCHEDULE_TABLE_SIZE) {
+                    // Staged until the length is written.
+                    i2cdata[addr] = data;
+                }
+                // Everything else is read-only.
+                break;
+        }
+    }
+}
+
+// Copies the read-only block at addr into i2cdata, if the read is about to enter it: at its first byte, or anywhere in
+// it if this is the first byte of the read.
+// The trace is not copied, recording pauses instead.
+static inline void snapshot_block(uint8_t addr, uint8_t first) {
+    if (addr == I2C_REG_TELEMETRY ||
+        (first && addr > I2C_REG_TELEMETRY && addr < I2C_REG_TELEMETRY + TELEMETRY_SIZE)) {
+        telemetry_snapshot(&i2cdata[I2C_REG_TELEMETRY]);
+    } else if (addr == I2C_REG_RELAY_ACTUATIONS ||
+               (first && addr > I2C_REG_RELAY_ACTUATIONS && addr < I2C_REG_RELAY_ACTUATIONS + 2 * TELEMETRY_RELAYS)) {
+        telemetry_snapshot_relays(&i2cdata[I2C_REG_RELAY_ACTUATIONS]);
+    } else if (addr == I2C_REG_BUTTON_LOG ||
+               (first && addr > I2C_REG_BUTTON_LOG && addr < I2C_REG_BUTTON_LOG + BUTTON_LOG_SIZE)) {
+        button_snapshot(&i2cdata[I2C_REG_BUTTON_LOG]);
+    } else if (addr == I2C_REG_TRACE || (first && addr > I2C_REG_TRACE)) {
+        trace_paused = 1;
+    }
+}
+
+// Stages the next byte of a read: the one at buffer_addr, or the PEC once all data has been staged.
+static inline void stage_tx(uint8_t first) {
+    uint8_t config = i2cdata[I2C_REG_CONFIG];
+
+    if ((config & I2C_CONFIG_PEC) && tx_count >= i2cdata[I2C_REG_PEC_READ_LENGTH]) {
+        // All data has been staged, the PEC goes last.
+        // Anything read after that is 0xFF, since TWEA is cleared.
+        tx_data = pec;
+        tx_addr = 0xFF;
+        tx_twcr = TWCR_NACK_BITS;
+        return;
+    }
+
+    uint8_t addr = buffer_addr;
+    if (addr == BUFFER_ADDR_INVALID) {
+        tx_data = 0xFF;
+        tx_addr = 0xFF;
+        tx_twcr = TWCR_NACK_BITS;
+        return;
+    }
+    if (addr >= i2c_buffer_size) {
+        // This is either a pure read transaction (no Write+Read, buffer_addr=0xFF set via previous TWCR_RESET)
+        // or something else went wrong.
+        // We'll just assume they want to read everything...
+        addr = 0x00;
+    }
+    snapshot_block(addr, first);
+
+    uint8_t data = i2cdata[addr];
+    if (addr == I2C_REG_STATUS && i2c_write_disabled) {
+        data |= I2C_BIT_I2C_DISABLED;
+    }
+    if (i2c_commit_seq != i2c_published_seq) {
+        // Only valid modes are shown, just like in commit_modes.
+        if (addr == I2C_REG_AIR_IN && i2c_committed_air_in < NUM_AIR_IN_MODES) {
+            data = i2c_committed_air_in;
+        } else if (addr == I2C_REG_AIR_OUT && i2c_committed_air_out < NUM_AIR_OUT_MODES) {
+            data = i2c_committed_air_out;
+        }
+    }
+    if (addr == I2C_REG_SCHEDULE_CONTROL && schedule_running) {
+        data |= SCHEDULE_CONTROL_RUNNING;
+    }
+    tx_data = data;
+    tx_addr = addr;
+    pec = crc8_update(pec, data);
+    tx_count++;
+
+    if (addr == (i2c_buffer_size - 1) && !(config & I2C_CONFIG_PEC)) {
+        // Indicate that this is the last byte available, i.e. expect a NACK after we transmitted it.
+        tx_twcr = TWCR_NACK_BITS;
+    } else {
+        tx_twcr = TWCR_ACK_BITS;
+    }
+
+    // Auto increment address
+    buffer_addr = addr + 1;
+}
+
+// Starts a read and stages its first byte.
+static inline void begin_read(void) {
+    // For a write+read, the PEC covers the register address written before the repeated start.
+    if (buffer_addr == 0xFF) {
+        pec = 0;
+    }
+    pec = crc8_update(pec, (TWAR & 0xFE) | 1);
+    tx_count = 0;
+    stage_tx(1);
+}
+
 // TWI interrupt service routine
 ISR (TWI_vect) {
-    uint8_t data = 0;
+    uint16_t isr_start = timer1_now_isr();
 
-    // Check TWI status register
-    switch (TW_STATUS) {
+    uint8_t status = TW_STATUS;
+    // For the trace, see twi_trace.h.
+    uint8_t reg;
+
+    diagnostics_twi_status(status);
+
+    switch (pgm_read_byte(&twi_states[status >> 3])) {
         /*
          * Slave Receiver
          */
 
         // 0x60 SLA+W received, ACK returned
-        case TW_SR_SLA_ACK:
+        case TWI_STATE_SR_SLA:
             // Receive next byte of data, send ACK afterwards
             TWCR_ACK;
             // Set "register address" to undefined
             buffer_addr = 0xFF;
+            reg = 0xFF;
+            rx_len = 0;
+            gcall = 0;
+            tx_staged = 0;
+            trace_paused = 0;
+            twi_active = 1;
+            pec = crc8_update(0, TWAR & 0xFE);
+            break;
+
+            // 0x70 general call received, ACK returned
+        case TWI_STATE_SR_GCALL:
+            TWCR_ACK;
+            buffer_addr = 0xFF;
+            reg = 0xFF;
+            rx_len = 0;
+            gcall = 1;
+            tx_staged = 0;
+            trace_paused = 0;
+            twi_active = 1;
+            // The address byte of a general call is 0x00.
+            pec = 0;
             break;
 
             // 0x80 data received, ACK returned
-        case TW_SR_DATA_ACK:
-            // Read received data
-            data = TWDR;
+            // 0x90 general call data received, ACK returned
+        case TWI_STATE_SR_DATA: {
+            // Read received data, then receive next byte, ACK afterwards to request next byte
+            uint8_t data = TWDR;
+            TWCR_ACK;
+            reg = buffer_addr;
+            pec = crc8_update(pec, data);
 
             // First access of this transaction, set register address
-            if (buffer_addr == 0xFF) {
+            // General calls have no register address, everything goes into rx_buf.
+            if (buffer_addr == 0xFF && !gcall) {
                 // First byte of this transaction
                 // This specifies the register address, usually.
-                if (data < i2c_buffer_size) {
-                    buffer_addr = data;
-                }
-
-                // Receive next byte, ACK afterwards to request next byte
-                TWCR_ACK;
-            } else {
+                buffer_addr = data < i2c_buffer_size ? data : BUFFER_ADDR_INVALID;
+            } else if (buffer_addr != BUFFER_ADDR_INVALID) {
                 // Subsequent byte(s) of this transaction
-                // We can now receive data and use it.
-
-                if (buffer_addr == 0x0) {
-                    // Bit 2 low = WDT reset occurred -> allow setting only (cleared by mc)
-
-                    // Discard read-only bits.
-                    data &= 0b00000010;
-                    i2cdata[buffer_addr] |= data;
-                } else if (buffer_addr < i2c_buffer_size && !i2c_write_disabled) {
-                    i2cdata[buffer_addr] = data;
-
-                    if (buffer_addr == i2c_buffer_size - 1) {
-                        i2c_fully_written = 1;
-                    }
+                // These are only buffered here and applied once the transaction is complete.
+                uint8_t len = rx_len;
+                if (len < I2C_RX_SIZE) {
+                    rx_buf[len] = data;
+                }
+                if (len < 0xFF) {
+                    rx_len = len + 1;
                 }
-
-                // Increase address for subsequent writes.
-                buffer_addr++;
-
-                // Receive next byte, ACK afterwards to request next byte
-                TWCR_ACK;
             }
             break;
+        }
 
             // 0xA0 stop or repeated start condition received while selected
-        case TW_SR_STOP:
+        case TWI_STATE_SR_STOP:
             TWCR_ACK;
+            reg = buffer_addr;
+
+            if (gcall) {
+                apply_group_commit(rx_len);
+                gcall = 0;
+                rx_len = 0;
+            } else if (rx_len) {
+                // This was a write, not the first half of a write+read.
+                uint8_t len = rx_len;
+                if (i2cdata[I2C_REG_CONFIG] & I2C_CONFIG_PEC) {
+                    // The last byte is the PEC. Running the CRC over it yields 0 if everything arrived intact.
+                    if (len < 2 || pec != 0) {
+                        telemetry_pec_error_count++;
+                        len = 0;
+                    } else {
+                        len--;
+                    }
+                }
+                if (len > I2C_RX_SIZE) {
+                    len = I2C_RX_SIZE;
+                }
+                apply_write(len);
+
+                // A following pure read should start at the beginning again.
+                buffer_addr = 0xFF;
+                rx_len = 0;
+            } else if (buffer_addr != 0xFF) {
+                // Only a register address, so a read follows. Stage its first byte while the address byte of the read
+                // is on the wire.
+                unstaged_addr = buffer_addr;
+                unstaged_pec = pec;
+                begin_read();
+                tx_staged = 1;
+            }
+            // Still addressed if the read is yet to come.
+            twi_active = tx_staged;
             break;
 
             /*
@@ -111,45 +578,52 @@ ISR (TWI_vect) {
              */
 
             //0xA8 SLA+R received, ACK returned
-        case TW_ST_SLA_ACK:
+        case TWI_STATE_ST_SLA:
+            if (!tx_staged) {
+                trace_paused = 0;
+                twi_active = 1;
+                begin_read();
+            }
+            tx_staged = 0;
             // fallthrough
 
             // 0xB8 data transmitted, ACK received
-        case TW_ST_DATA_ACK:
-            if (buffer_addr >= i2c_buffer_size) {
-                // This is either a pure read transaction (no Write+Read, buffer_addr=0xFF set via previous TWCR_RESET)
-                // or something else went wrong.
-                // We'll just assume they want to read everything...
-                buffer_addr = 0x00;
-            }
-
-            if (buffer_addr < i2c_buffer_size) {
-                // Send one byte of data
-                TWDR = i2cdata[buffer_addr];
-
-                if (buffer_addr == (i2c_buffer_size - 1)) {
-                    // Indicate that this is the last byte available, i.e. expect a NACK after we transmitted it.
-                    TWCR_NACK
-                    break;
-                }
-
-                // Auto increment address
-                buffer_addr++;
-            } else {
-                // Invalid address/read too many bytes/... -- we send 0xFE as an error
-                TWDR = 0xFE;
+        case TWI_STATE_ST_DATA:
+            // Send the staged byte
+            TWDR = tx_data;
+            TWCR = tx_twcr;
+            reg = tx_addr;
+#ifdef ATTENTION_LINE
+            if (tx_addr == I2C_REG_CHANGE_SEQ) {
+                // The master has seen the latest change.
+                attention_release();
             }
-            TWCR_ACK;
+#endif
+            stage_tx(0);
             break;
 
             /*
              * Error states
+             * 0xC0 data transmitted, NACK received. No further data requested.
+             * 0x88 data received, NACK returned
+             * 0xC8 last data byte (TWEA=0) transmitted, ACK received
              */
-        case TW_ST_DATA_NACK: // 0xC0 data transmitted, NACK received. No further data requested.
-        case TW_SR_DATA_NACK: // 0x88 data received, NACK returned
-        case TW_ST_LAST_DATA: // 0xC8 last data byte (TWEA=0) transmitted, ACK received
         default:
-        TWCR_RESET;
+            reg = buffer_addr;
+            TWCR_RESET;
+            if (status >= TW_ST_SLA_ACK) {
+                // The end of a read. buffer_addr is already past the staged byte, which the master did not take.
+                reg = tx_addr;
+            }
+            tx_staged = 0;
+            twi_active = 0;
+            telemetry_twi_nack_count++;
             break;
     }
-}
\ No newline at end of file
+
+    if ((i2cdata[I2C_REG_CONFIG] & I2C_CONFIG_TRACE) && !trace_paused) {
+        twi_trace_record(&i2cdata[I2C_REG_TRACE], status, reg, isr_start);
+    }
+
+    telemetry_twi_isr_end(isr_start);
+}
@@ -9,32 +9,96 @@
 #ifndef TWISLAVE_H_
 #define TWISLAVE_H_
 
-#include <util/twi.h>
-#include <avr/interrupt.h>
-#include <stdint.h>
+#include "hal.h"
+#include "registers.h"
+#include "telemetry.h"
+#include "attention.h"
+#include "schedule.h"
+#include "button.h"
+#include "diagnostics.h"
+#include "stack_monitor.h"
+#include "twi_trace.h"
 
-// I2C register file size.
-// One byte status register plus two bytes for air in and air out mode, respectively.
-#define i2c_buffer_size 3
+// The register map, I2C_REG_* and everything a master needs to talk to the device, is in registers.h.
 
-// I2C slave address.
-#define I2C_SLAVE_ADDRESS 0x22
+// Set by TWI_vect when a master tried to set the modes while writing them is disabled, cleared by the main program.
+extern volatile uint8_t i2c_write_rejected;
 
-#define I2C_BIT_I2C_DISABLED 0x01
-#define I2C_BIT_WDT_RESET 0x02
+// Set by TWI_vect when BOOT_ENTER_KEY was written to I2C_REG_BOOT. The main loop then hands over to the bootloader.
+extern volatile uint8_t i2c_boot_request;
 
-volatile uint8_t i2c_fully_written;
-volatile uint8_t i2c_write_disabled;
-volatile uint8_t i2cdata[i2c_buffer_size];
+// Whether writing the air modes via I2C is currently disabled.
+// Written by the button handling in the main loop, read by TWI_vect.
+extern volatile uint8_t i2c_write_disabled;
 
-// Initializes TWI with the given address.
+// The register file as seen by the master when reading.
+// The main program publishes the current air modes and the change sequence here. TWI_vect owns the WDT bit in the
+// status register and the config, address and groups registers, and also writes freshly committed air modes, so they
+// can be read back immediately.
+// The I2C disabled bit of the status register is not stored here, TWI_vect adds it when transmitting.
+extern volatile uint8_t i2cdata[i2c_buffer_size];
+
+// The air modes committed by the last write to register 0x02.
+// These are only valid together with i2c_commit_seq, see i2c_read_commit.
+extern volatile uint8_t i2c_committed_air_in;
+extern volatile uint8_t i2c_committed_air_out;
+// Incremented by TWI_vect every time new air modes have been committed.
+extern volatile uint8_t i2c_commit_seq;
+// The i2c_commit_seq the main program last published the air modes for. Until it catches up, TWI_vect transmits the
+// committed modes instead of i2cdata, which the main program may have overwritten with older ones.
+extern volatile uint8_t i2c_published_seq;
+
+// Schedule changes written via I2C, for the main program to pick up. Like the modes, each one is published by
+// incrementing its sequence number, see i2c_read_request. If the master writes one twice before the main program gets
+// to it, the second value wins.
+extern volatile uint8_t i2c_schedule_length_request;
+extern volatile uint8_t i2c_schedule_length_seq;
+extern volatile uint8_t i2c_schedule_jump_request;
+extern volatile uint8_t i2c_schedule_jump_seq;
+extern volatile uint8_t i2c_schedule_remaining_request;
+extern volatile uint8_t i2c_schedule_remaining_seq;
+
+// Initializes TWI with the given address, and enables general call reception for group commits.
 // I2C addresses are 7 bytes, init_twi_slave will shift the given address by one bit.
+// This also resets any transaction in progress, so the bus supervisor can run it again to recover the TWI.
 void init_twi_slave(uint8_t addr);
 
+// Starts the bus supervisor, which resets the TWI if the bus hangs. See twislave.c.
+// Call this once in setup, after init_twi_slave.
+void twi_supervisor_init(void);
+
+// Reads the most recently committed air modes without disabling interrupts.
+// Returns the commit sequence number the modes belong to.
+// This works like a seqlock: TWI_vect always runs to completion, so if the sequence number didn't change while we
+// were reading, the two modes belong together.
+static inline uint8_t i2c_read_commit(uint8_t *air_in, uint8_t *air_out) {
+    uint8_t seq;
+    do {
+        seq = i2c_commit_seq;
+        *air_in = i2c_committed_air_in;
+        *air_out = i2c_committed_air_out;
+    } while (seq != i2c_commit_seq);
+
+    return seq;
+}
+
+// Reads one of the schedule requests above without disabling interrupts, just like i2c_read_commit.
+// Returns the sequence number the value belongs to.
+static inline uint8_t i2c_read_request(const volatile uint8_t *request, const volatile uint8_t *request_seq,
+                                       uint8_t *value) {
+    uint8_t seq;
+    do {
+        seq = *request_seq;
+        *value = *request;
+    } while (seq != *request_seq);
+
+    return seq;
+}
+
 // Don't change below here
 
 // Old versions of AVR-GCC do interrupt stuff differently.
-#if (__GNUC__ * 100 + __GNUC_MINOR__) < 304
+#if !defined(FAN_CONTROL_HOST) && (__GNUC__ * 100 + __GNUC_MINOR__) < 304
     #error "This library requires AVR-GCC 3.4.5 or later, update to newer AVR-GCC compiler"
 #endif
 
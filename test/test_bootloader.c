@@ -0,0 +1,237 @@
+//
+// The bootloader, see bootloader.h, running against the simulated flash, with the firmware handing over to it and being
+// started by it again.
+//
+// The bootloader polls the TWI, so the helpers here raise TWINT with a status code and run its loop until it has
+// written TWCR, which is when the TWI would clear TWINT and release SCL.
+//
+
+#include <string.h>
+
+#include "test_host.h"
+#include "bootloader.h"
+
+// The image to flash, ending in a partial page.
+#define PAGES 4
+#define IMAGE_SIZE ((PAGES - 1) * BOOT_PAGE_SIZE + 10)
+
+// What TWCR holds while TWINT is set, until the bootloader writes it.
+#define TWCR_WAITING ((1 << TWINT) | (1 << TWEN))
+
+static uint8_t image[PAGES * BOOT_PAGE_SIZE];
+static uint16_t image_crc;
+
+// Raises TWINT with the given status and runs the loop until the bootloader takes the event. Returns the number of
+// passes that took, more than one if it held SCL.
+static int boot_twi(uint8_t status) {
+    TWSR = status;
+    TWCR = TWCR_WAITING;
+    int passes = 0;
+    while (TWCR == TWCR_WAITING && passes < 1000) {
+        fan_control_boot_loop();
+        passes++;
+    }
+    TWCR &= ~(1 << TWINT);
+    return passes;
+}
+
+// A write transaction. Returns the passes it took to take the address byte.
+static int boot_write(const uint8_t *data, int len) {
+    int passes = boot_twi(TW_SR_SLA_ACK);
+    for (int i = 0; i < len; i++) {
+        TWDR = data[i];
+        boot_twi(TW_SR_DATA_ACK);
+    }
+    boot_twi(TW_SR_STOP);
+    return passes;
+}
+
+static int boot_page(uint16_t addr, const uint8_t *page) {
+    uint8_t frame[BOOT_PAGE_FRAME_SIZE] = {BOOT_CMD_PAGE, (uint8_t) addr, (uint8_t) (addr >> 8)};
+    memcpy(&frame[3], page, BOOT_PAGE_SIZE);
+    return boot_write(frame, sizeof(frame));
+}
+
+static void boot_commit(uint16_t length, uint16_t crc) {
+    uint8_t frame[] = {BOOT_CMD_COMMIT, (uint8_t) length, (uint8_t) (length >> 8), (uint8_t) crc, (uint8_t) (crc >> 8)};
+    boot_write(frame, sizeof(frame));
+}
+
+// Followed by the pass of the loop that runs it.
+static void boot_run(void) {
+    uint8_t frame[] = {BOOT_CMD_RUN};
+    boot_write(frame, sizeof(frame));
+    fan_control_boot_loop();
+}
+
+static void boot_info(uint8_t *info) {
+    boot_twi(TW_ST_SLA_ACK);
+    for (int i = 0; i < BOOT_INFO_SIZE; i++) {
+        info[i] = TWDR;
+        boot_twi(i == BOOT_INFO_SIZE - 1 ? TW_ST_DATA_NACK : TW_ST_DATA_ACK);
+    }
+}
+
+// Polls the status until it's no longer READY, like the flasher does after a commit.
+static uint8_t boot_wait(void) {
+    uint8_t info[BOOT_INFO_SIZE];
+    for (int i = 0; i < 100; i++) {
+        boot_info(info);
+        if (info[BOOT_INFO_STATUS] != BOOT_STATUS_READY) {
+            break;
+        }
+    }
+    return info[BOOT_INFO_STATUS];
+}
+
+// Sends the image back to back, with the page at corrupt_page damaged, or none if that's out of range, and commits it.
+// Returns the status after the commit.
+static uint8_t boot_flash(int corrupt_page) {
+    for (int page = 0; page < PAGES; page++) {
+        uint8_t data[BOOT_PAGE_SIZE];
+        memcpy(data, &image[page * BOOT_PAGE_SIZE], BOOT_PAGE_SIZE);
+        if (page == corrupt_page) {
+            data[1] ^= 0x10;
+        }
+        int passes = boot_page(page * BOOT_PAGE_SIZE, data);
+        // The first page is taken right away, and the second one while the first is being programmed.
+        CHECK(page < 2 || passes > 1, "page %d was not held", page);
+    }
+
+    boot_commit(IMAGE_SIZE, image_crc);
+    // So the CRC would come out wrong if the bootloader read the flash before re-enabling the RWW section.
+    CHECK(hal_host_rww_busy, "the last page was already programmed when the commit arrived");
+    return boot_wait();
+}
+
+// A reset with the given MCUCSR flags. The bootloader either starts the firmware or stays.
+static void boot_reset(uint8_t reset_cause) {
+    hal_host_reset();
+    MCUCSR = reset_cause;
+    fan_control_boot_setup();
+    TWCR &= ~(1 << TWINT);
+}
+
+// Has the firmware hand over, and goes on in the bootloader.
+static void hand_over(void) {
+    test_write_reg(I2C_REG_BOOT, BOOT_ENTER_KEY);
+    for (int i = 0; i < 200 && !hal_host_bootloader_starts; i++) {
+        test_ticks(1);
+    }
+    CHECK(hal_host_bootloader_starts == 1, "did not hand over");
+    hal_host_bootloader_starts = 0;
+    fan_control_boot_setup();
+    TWCR &= ~(1 << TWINT);
+    CHECK(hal_host_firmware_starts == 0, "started the firmware after a handover");
+}
+
+static uint16_t trailer(uint8_t offset) {
+    return eeprom_read_word(BOOT_TRAILER_ADDR + offset);
+}
+
+int main(void) {
+    uint16_t crc = 0;
+    for (const char *c = "123456789"; *c; c++) {
+        crc = _crc_xmodem_update(crc, *c);
+    }
+    CHECK(crc == 0x31C3, "CRC-16/XMODEM check value %04x", crc);
+
+    uint32_t random = 1;
+    for (int i = 0; i < (int) sizeof(image); i++) {
+        random = random * 1103515245 + 12345;
+        image[i] = i < IMAGE_SIZE ? (uint8_t) (random >> 16) : 0xFF;
+    }
+    for (int i = 0; i < IMAGE_SIZE; i++) {
+        image_crc = _crc_xmodem_update(image_crc, image[i]);
+    }
+    // Programming a page takes longer than receiving the next one, even at 400 kHz.
+    hal_host_spm_polls = 2 * BOOT_PAGE_FRAME_SIZE;
+
+    // Programmed by ISP, i.e. some reset vector and no trailer.
+    hal_host_flash[0] = 0x12;
+    hal_host_flash[1] = 0xC0;
+    boot_reset(1 << PORF);
+    CHECK(hal_host_firmware_starts == 1, "the ISP firmware was not started");
+
+    test_boot(1 << PORF);
+    uint8_t modes[] = {I2C_REG_AIR_IN, 3, 2};
+    test_write(modes, sizeof(modes));
+    test_ticks(100);
+    uint8_t relays = PORTB;
+
+    hand_over();
+    CHECK(TWAR == I2C_SLAVE_ADDRESS << 1, "TWAR %02x after a handover", TWAR);
+    uint8_t info[BOOT_INFO_SIZE];
+    boot_info(info);
+    CHECK(info[BOOT_INFO_ID] == BOOT_ID && info[BOOT_INFO_STATUS] == BOOT_STATUS_READY &&
+          info[BOOT_INFO_PAGE_SIZE] == BOOT_PAGE_SIZE && info[BOOT_INFO_PAGES] == BOOT_START / BOOT_PAGE_SIZE,
+          "info %02x %02x %02x %02x", info[0], info[1], info[2], info[3]);
+
+    // Pages that are not aligned or would overwrite the bootloader are rejected, and leave the trailer alone.
+    boot_page(BOOT_PAGE_SIZE / 2, image);
+    CHECK(boot_wait() == BOOT_STATUS_BAD_COMMAND, "took an unaligned page");
+    boot_page(BOOT_START, image);
+    CHECK(boot_wait() == BOOT_STATUS_BAD_COMMAND, "took a page in the boot section");
+    CHECK(hal_host_page_erases == 0 && trailer(BOOT_TRAILER_LENGTH) == 0xFFFF, "a rejected page was programmed");
+
+    // An update.
+    CHECK(boot_flash(PAGES) == BOOT_STATUS_VERIFIED, "the commit failed");
+    CHECK(memcmp(hal_host_flash, image, sizeof(image)) == 0, "the flash does not match the image");
+    CHECK(hal_host_page_erases == PAGES && hal_host_page_writes == PAGES, "%u erases, %u writes",
+          hal_host_page_erases, hal_host_page_writes);
+    CHECK(hal_host_spm_errors == 0, "%u SPM instructions while busy", hal_host_spm_errors);
+    CHECK(trailer(BOOT_TRAILER_LENGTH) == IMAGE_SIZE && trailer(BOOT_TRAILER_CRC) == image_crc, "trailer %04x %04x",
+          trailer(BOOT_TRAILER_LENGTH), trailer(BOOT_TRAILER_CRC));
+    CHECK(PORTB == relays, "the bootloader touched the relays");
+
+    // Running it is not a reset, so the firmware keeps the relays.
+    boot_run();
+    CHECK(hal_host_firmware_starts == 1 && TWCR == 0, "the firmware was not started");
+    fan_control_setup();
+    fan_control_loop();
+    CHECK(PORTB == relays, "relays changed to %02x from %02x", PORTB, relays);
+
+    // After a reset, the verified firmware is started without reading the flash.
+    boot_reset(1 << EXTRF);
+    CHECK(hal_host_firmware_starts == 1, "the verified firmware was not started");
+    CHECK(hal_host_flash_reads == 0, "read the flash %u times at reset", hal_host_flash_reads);
+
+    // A page that came out wrong fails the CRC. The bootloader refuses to run that, and stays after a reset, at its
+    // default address.
+    test_boot(1 << EXTRF);
+    test_ticks(100);
+    hand_over();
+    CHECK(boot_flash(1) == BOOT_STATUS_BAD_IMAGE, "the commit of a broken image passed");
+    CHECK(trailer(BOOT_TRAILER_LENGTH) == 0, "the trailer is valid after a failed commit");
+    boot_run();
+    CHECK(hal_host_firmware_starts == 0 && boot_wait() == BOOT_STATUS_BAD_IMAGE, "ran the broken image");
+    boot_reset(1 << EXTRF);
+    CHECK(hal_host_firmware_starts == 0, "started the broken image after a reset");
+    CHECK(TWAR == BOOT_DEFAULT_ADDRESS << 1 && TWCR == ((1 << TWEA) | (1 << TWEN)),
+          "TWAR %02x, TWCR %02x after a reset", TWAR, TWCR);
+
+    // From there, an update goes through.
+    CHECK(boot_flash(PAGES) == BOOT_STATUS_VERIFIED, "the commit failed after a failed one");
+    boot_run();
+    CHECK(hal_host_firmware_starts == 1, "the firmware was not started after a failed update");
+
+    // An update interrupted after the first page stays in the bootloader too.
+    test_boot(1 << EXTRF);
+    test_ticks(100);
+    hand_over();
+    boot_page(0, image);
+    for (int i = 0; i < 10 * hal_host_spm_polls; i++) {
+        fan_control_boot_loop();
+    }
+    CHECK(hal_host_page_writes == 1 && trailer(BOOT_TRAILER_LENGTH) == 0, "the first page was not programmed");
+    boot_reset(1 << EXTRF);
+    CHECK(hal_host_firmware_starts == 0, "started an interrupted update");
+    boot_info(info);
+    CHECK(info[BOOT_INFO_ID] == BOOT_ID && info[BOOT_INFO_STATUS] == BOOT_STATUS_READY,
+          "no bootloader after an interrupted update");
+    CHECK(boot_flash(PAGES) == BOOT_STATUS_VERIFIED, "the commit failed after an interrupted update");
+    boot_reset(1 << EXTRF);
+    CHECK(hal_host_firmware_starts == 1 && hal_host_flash_reads == 0, "the firmware was not started");
+
+    return test_result();
+}
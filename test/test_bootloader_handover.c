@@ -0,0 +1,48 @@
+//
+// Handing over to the bootloader, see bootloader.h. There is no bootloader on the host, so this only checks the
+// firmware's side.
+//
+
+#include "test_host.h"
+#include "bootloader.h"
+#include "mode_store.h"
+
+int main(void) {
+    test_boot(1 << PORF);
+    test_ticks(100);
+
+    // Only the key hands over.
+    test_write_reg(I2C_REG_BOOT, BOOT_ENTER_KEY ^ 0xFF);
+    test_ticks(1);
+    CHECK(hal_host_bootloader_starts == 0, "wrong key handed over");
+
+    // Not before the relays have settled and the modes are saved.
+    uint8_t modes[] = {I2C_REG_AIR_IN, 3, 2};
+    test_write(modes, sizeof(modes));
+    test_write_reg(I2C_REG_BOOT, BOOT_ENTER_KEY);
+    CHECK(test_read_reg(I2C_REG_BOOT) == 0, "the boot register reads back");
+    int ticks = 0;
+    while (!hal_host_bootloader_starts && ticks < 200) {
+        fan_control_loop();
+        TIMER1_COMPA_vect();
+        ticks++;
+    }
+    CHECK(hal_host_bootloader_starts == 1, "did not hand over");
+    CHECK(!mode_store_busy(), "handed over while saving");
+    CHECK(!(TIMER1_TIMSK & (1 << OCIE1A)) && TWCR == 0, "timer or TWI still running");
+    uint8_t relays = PORTB;
+
+    // The bootloader starts the firmware without a reset, so the relays keep their pattern.
+    MCUCSR = 0;
+    fan_control_setup();
+    fan_control_loop();
+    CHECK(PORTB == relays, "relays changed to %02x from %02x", PORTB, relays);
+    CHECK(i2cdata[I2C_REG_DIAGNOSTICS + DIAGNOSTICS_RESET_CAUSE] == 0, "reset cause after the update");
+
+    // That was the pattern for the new modes, i.e. the relays had settled before the handover.
+    test_boot(1 << PORF);
+    test_ticks(100);
+    CHECK(PORTB == relays, "relays %02x had not settled, expected %02x", relays, PORTB);
+
+    return test_result();
+}
@@ -0,0 +1,92 @@
+//
+// Button events and the manual mode, see button.h.
+//
+
+#include "test_host.h"
+#include "modes.h"
+
+// See main.c.
+extern volatile uint8_t selected_digit, left_digit_on, right_digit_on;
+
+static uint8_t air_in(void) {
+    return test_read_reg(I2C_REG_AIR_IN);
+}
+
+// Checks the newest event in the log, and returns the number of events so far.
+static uint8_t check_log(uint8_t type, const char *what) {
+    uint8_t log[BUTTON_LOG_SIZE];
+    test_read(I2C_REG_BUTTON_LOG, log, sizeof(log));
+    CHECK(log[BUTTON_LOG_FIRST] == type, "%s: newest event %d, expected %d", what, log[BUTTON_LOG_FIRST], type);
+    return log[BUTTON_LOG_COUNT];
+}
+
+int main(void) {
+    test_boot(1 << PORF);
+    test_ticks(10);
+
+    // A bounce is no press at all, a long press selects the left digit.
+    test_press(1);
+    CHECK(selected_digit == 0, "bounce selected a digit");
+    test_press(60);
+    CHECK(selected_digit == 1, "long press selected %d", selected_digit);
+    CHECK(test_read_reg(I2C_REG_STATUS) & I2C_BIT_I2C_DISABLED, "not locked");
+    check_log(BUTTON_EVENT_LONG, "long press");
+
+    // Short presses change the selected mode.
+    test_press(1);
+    CHECK(air_in() == 0, "bounce changed the mode");
+    test_press(2);
+    CHECK(air_in() == 1, "short press -> %d", air_in());
+    check_log(BUTTON_EVENT_SHORT, "short press");
+    test_press(BUTTON_LONG_PRESS_DEFAULT - 1);
+    CHECK(air_in() == 2 && selected_digit == 1, "press just below the long press threshold -> %d %d", air_in(),
+          selected_digit);
+    test_press(BUTTON_LONG_PRESS_DEFAULT);
+    CHECK(selected_digit == 2 && air_in() == 2, "press at the long press threshold -> %d", selected_digit);
+
+    // The long press ends the override and stops blinking. Holding the button on logs repeats, which the manual mode
+    // ignores.
+    uint8_t count = check_log(BUTTON_EVENT_LONG, "before repeat");
+    test_press(BUTTON_LONG_PRESS_DEFAULT + BUTTON_REPEAT_DEFAULT + 10);
+    CHECK(selected_digit == 0, "repeat -> %d", selected_digit);
+    CHECK(left_digit_on && right_digit_on, "digits still blinking");
+    CHECK(!(test_read_reg(I2C_REG_STATUS) & I2C_BIT_I2C_DISABLED), "still locked");
+    CHECK((uint8_t) (check_log(BUTTON_EVENT_REPEAT, "repeat") - count) == 2, "long press and repeat not logged");
+
+    // Thresholds.
+    uint8_t thresholds[] = {I2C_REG_BUTTON_DEBOUNCE, 1, 20, 0};
+    test_write(thresholds, sizeof(thresholds));
+    test_ticks(1);
+    test_press(1);
+    CHECK(selected_digit == 0, "one tick with debounce 1 is a short press");
+    check_log(BUTTON_EVENT_SHORT, "debounce 1");
+    test_press(25);
+    CHECK(selected_digit == 1, "25 ticks with long press 20 -> %d", selected_digit);
+    test_press(300);
+    CHECK(selected_digit == 2, "no repeat with interval 0 -> %d", selected_digit);
+
+    uint8_t zero[] = {I2C_REG_BUTTON_DEBOUNCE, 0, 0};
+    test_write(zero, sizeof(zero));
+    test_ticks(1);
+    uint8_t regs[3];
+    test_read(I2C_REG_BUTTON_DEBOUNCE, regs, 3);
+    CHECK(regs[0] == 1 && regs[1] == 20 && regs[2] == 0, "zero thresholds accepted: %d %d %d", regs[0], regs[1],
+          regs[2]);
+
+    // Presses the main loop doesn't get to are queued, up to BUTTON_QUEUE_SIZE, the rest are dropped.
+    uint8_t out = test_read_reg(I2C_REG_AIR_OUT);
+    for (int i = 0; i < BUTTON_QUEUE_SIZE + 4; i++) {
+        PIND &= ~(1 << PIND5);
+        TIMER1_COMPA_vect();
+        TIMER1_COMPA_vect();
+        PIND |= (1 << PIND5);
+        TIMER1_COMPA_vect();
+        TIMER1_COMPA_vect();
+    }
+    fan_control_loop();
+    uint8_t expected = (out + BUTTON_QUEUE_SIZE) % NUM_AIR_OUT_MODES;
+    CHECK(test_read_reg(I2C_REG_AIR_OUT) == expected, "queued presses: %d, expected %d", test_read_reg(I2C_REG_AIR_OUT),
+          expected);
+
+    return test_result();
+}
@@ -0,0 +1,192 @@
+//
+// Tests of the client library against MockBus: the client, the mock device and the flasher.
+//
+// The access patterns are compared in client/fan_control_bench.cpp, which only checks what it measures.
+//
+
+#include <algorithm>
+#include <future>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include "client.hpp"
+#include "flasher.hpp"
+#include "mock_bus.hpp"
+#include "test_client.hpp"
+
+using namespace fan_control;
+
+// Reads, writes, polling, the button override and watchdog resets, against one device.
+static void check_semantics() {
+    MockBus bus;
+    MockSlave &slave = bus.add_slave();
+    Client client(bus);
+
+    State state = client.read_state();
+    CHECK(!state.status.i2c_disabled());
+    CHECK(!state.status.watchdog_reset());
+    CHECK(state.air_in == 0 && state.air_out == 0);
+
+    // Set and read back in one go.
+    state = client.set_modes(3, 2);
+    CHECK(state.air_in == 3 && state.air_out == 2);
+    CHECK(slave.air_in() == 3 && slave.air_out() == 2);
+    CHECK(bus.stats().transfers == 2);
+
+    // Nothing changed, so polling is one short transaction.
+    CHECK(!client.poll());
+    CHECK(bus.stats().transfers == 3);
+
+    // Button override: Writes are ignored, and the read-back says so.
+    slave.set_button_override(true);
+    slave.set_modes_by_button(5, 4);
+    auto polled = client.poll();
+    CHECK(polled && polled->status.i2c_disabled() && polled->air_in == 5);
+    state = client.set_modes(1, 1);
+    CHECK(state.status.i2c_disabled());
+    CHECK(state.air_in == 5 && state.air_out == 4);
+    CHECK(client.status().i2c_disabled());
+    slave.set_button_override(false);
+    CHECK(client.poll());
+    CHECK(!client.status().i2c_disabled());
+
+    // Watchdog resets show up until acknowledged.
+    slave.reboot(true);
+    state = client.read_state();
+    CHECK(state.status.watchdog_reset());
+    CHECK(state.air_in == 5 && state.air_out == 4);
+    client.acknowledge_watchdog_reset();
+    CHECK(!client.read_state().status.watchdog_reset());
+
+    CHECK(client.read_telemetry().relay_change_count == 2);
+
+    // Async operations on one client complete in order.
+    std::vector<std::future<State>> results;
+    for (uint8_t i = 0; i < NUM_AIR_IN_MODES; i++) {
+        results.push_back(client.set_modes_async(i, i % NUM_AIR_OUT_MODES));
+    }
+    for (uint8_t i = 0; i < NUM_AIR_IN_MODES; i++) {
+        CHECK(results[i].get().air_in == i);
+    }
+
+    // No device, no ACK.
+    Client missing(bus, 0x23);
+    bool threw = false;
+    try {
+        missing.read_state();
+    } catch (const std::system_error &e) {
+        threw = e.code().value() == ENXIO;
+    }
+    CHECK(threw);
+}
+
+// Group commits, and address changes taking effect after a reset.
+static void check_groups() {
+    MockBus bus;
+    MockSlave &a = bus.add_slave(0x20);
+    MockSlave &b = bus.add_slave(0x21);
+    MockSlave &c = bus.add_slave(0x22);
+
+    // a is in group 0 only (the default), b in groups 0 and 1, c in group 2.
+    Client(bus, 0x21).set_groups(0x03);
+    Client(bus, 0x22).set_groups(0x04);
+    CHECK(Client(bus, 0x22).read_groups() == 0x04);
+
+    group_set_modes(bus, 0x01, 3, 3);
+    CHECK(a.air_in() == 3 && b.air_in() == 3 && c.air_in() == 0);
+    group_set_modes(bus, 0x06, 4, 4);
+    CHECK(a.air_in() == 3 && b.air_in() == 4 && c.air_in() == 4);
+
+    // The button override wins.
+    a.set_button_override(true);
+    group_set_modes(bus, 0xFF, 1, 1);
+    CHECK(a.air_in() == 3 && b.air_in() == 1 && c.air_in() == 1);
+
+    // Address changes take effect after a reset.
+    Client(bus, 0x22).set_address(0x30);
+    CHECK(bus.slave(0x22) == &c && c.configured_address() == 0x30);
+    c.reboot(false);
+    CHECK(bus.slave(0x22) == nullptr && bus.slave(0x30) == &c);
+    CHECK(Client(bus, 0x30).read_groups() == 0x04);
+}
+
+// An update of a device at a non-default address, interrupted by a reset, leaves the bootloader at DEFAULT_ADDRESS.
+// Flashing the device by its own address again finds it there, and the firmware comes back at its address.
+static void check_flash_recovery() {
+    MockBus bus;
+    MockSlave &slave = bus.add_slave(0x30);
+    MockSlave &other = bus.add_slave(0x31);
+    std::vector<uint8_t> image(3 * MOCK_BOOT_PAGE_SIZE, 0x5A);
+
+    Flasher flasher(bus, 0x30);
+    flasher.enter();
+    flasher.write_page(0, image.data(), MOCK_BOOT_PAGE_SIZE);
+    slave.reboot(false);
+    CHECK(slave.in_bootloader() && slave.address() == DEFAULT_ADDRESS);
+
+    // Another device's firmware doesn't count as the bootloader.
+    CHECK(!Flasher(bus, 0x31).read_info());
+
+    Flasher recovery(bus, 0x30);
+    auto info = recovery.read_info();
+    CHECK(info && recovery.boot_address() == DEFAULT_ADDRESS);
+    recovery.flash(image);
+    CHECK(!slave.in_bootloader() && slave.address() == 0x30 && recovery.boot_address() == 0x30);
+    std::vector<uint8_t> firmware = slave.firmware();
+    CHECK(std::equal(image.begin(), image.end(), firmware.begin()));
+    CHECK(!other.in_bootloader());
+
+    // Nobody at the address, and no bootloader at DEFAULT_ADDRESS either.
+    bool threw = false;
+    try {
+        Flasher(bus, 0x40).read_info();
+    } catch (const std::system_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+// A broken transfer is caught by the CRC and keeps the device in the bootloader, even across a reset. Flashing it again
+// goes through without touching the relays, and the firmware starts without a reset.
+static void check_flash() {
+    MockBus bus;
+    MockSlave &slave = bus.add_slave();
+    Client(bus).set_modes(2, 1);
+    uint16_t relay_changes = slave.relay_changes();
+    std::vector<uint8_t> image(3 * MOCK_BOOT_PAGE_SIZE + 10);
+    for (size_t i = 0; i < image.size(); i++) {
+        image[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    Flasher flasher(bus);
+    BootInfo info = flasher.enter();
+    CHECK(slave.in_bootloader());
+    CHECK(info.page_size == MOCK_BOOT_PAGE_SIZE && info.max_image_size == MOCK_BOOT_START);
+    flasher.write_page(0, image.data(), info.page_size);
+    bool threw = false;
+    try {
+        flasher.commit(static_cast<uint16_t>(image.size()), crc16_xmodem(image.data(), image.size()));
+    } catch (const std::runtime_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+    slave.reboot(false);
+    CHECK(slave.in_bootloader());
+
+    Flasher::Result result = flasher.flash(image);
+    CHECK(result.pages == 4);
+    CHECK(!slave.in_bootloader());
+    std::vector<uint8_t> firmware = slave.firmware();
+    CHECK(std::equal(image.begin(), image.end(), firmware.begin()));
+    CHECK(slave.air_in() == 2 && slave.air_out() == 1 && slave.relay_changes() == relay_changes);
+    CHECK(Client(bus).read_diagnostics().reset_cause == 0);
+}
+
+int main() {
+    check_semantics();
+    check_groups();
+    check_flash();
+    check_flash_recovery();
+    return test_result();
+}
@@ -0,0 +1,32 @@
+//
+// Helpers for the tests of the client library, see CMakeLists.txt.
+//
+// These run against MockBus, so they need no hardware. Like the host tests in test_host.h, a failed check is reported
+// and the test carries on, and the exit code says whether all of them passed.
+//
+
+#ifndef FAN_CONTROL_TEST_CLIENT_HPP
+#define FAN_CONTROL_TEST_CLIENT_HPP
+
+#include <cstdio>
+
+static int test_failures;
+
+// Records a failure and carries on.
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+// The exit code of a test.
+static inline int test_result() {
+    if (test_failures) {
+        std::printf("%d checks failed\n", test_failures);
+        return 1;
+    }
+    return 0;
+}
+
+#endif //FAN_CONTROL_TEST_CLIENT_HPP
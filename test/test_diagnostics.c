@@ -0,0 +1,47 @@
+//
+// Reset diagnostics, see diagnostics.h.
+//
+
+#include "test_host.h"
+
+static void check(uint8_t cause, uint8_t checkpoint, uint8_t twi_status, uint16_t reboots, const char *what) {
+    uint8_t block[DIAGNOSTICS_SIZE];
+    test_read(I2C_REG_DIAGNOSTICS, block, sizeof(block));
+    uint16_t read_reboots = block[DIAGNOSTICS_REBOOTS] | block[DIAGNOSTICS_REBOOTS + 1] << 8;
+    CHECK(block[DIAGNOSTICS_RESET_CAUSE] == cause && block[DIAGNOSTICS_CHECKPOINT] == checkpoint &&
+          block[DIAGNOSTICS_TWI_STATUS] == twi_status && read_reboots == reboots,
+          "%s: cause %02x checkpoint %d TWI %02x reboots %u", what, block[DIAGNOSTICS_RESET_CAUSE],
+          block[DIAGNOSTICS_CHECKPOINT], block[DIAGNOSTICS_TWI_STATUS], read_reboots);
+    CHECK(MCUCSR == 0, "%s: MCUCSR not cleared", what);
+}
+
+int main(void) {
+    test_boot(1 << PORF);
+    check(1 << PORF, DIAGNOSTICS_CHECKPOINT_NONE, 0, 0, "power-on");
+    // The WDT bit is cleared by a watchdog reset only.
+    CHECK(test_read_reg(I2C_REG_STATUS) & I2C_BIT_WDT_RESET, "WDT bit cleared after power-on");
+
+    // The watchdog bites in the middle of a write, while the main loop sleeps.
+    test_twi(TW_SR_SLA_ACK);
+    TWDR = I2C_REG_AIR_IN;
+    test_twi(TW_SR_DATA_ACK);
+    test_boot(1 << WDRF);
+    check(1 << WDRF, DIAGNOSTICS_CHECKPOINT_SLEEP, TW_SR_DATA_ACK, 1, "watchdog");
+    CHECK(!(test_read_reg(I2C_REG_STATUS) & I2C_BIT_WDT_RESET), "WDT bit not cleared");
+
+    // The master acknowledges it by setting the bit again.
+    test_write_reg(I2C_REG_STATUS, I2C_BIT_WDT_RESET);
+    test_ticks(1);
+    CHECK(test_read_reg(I2C_REG_STATUS) & I2C_BIT_WDT_RESET, "WDT bit not set");
+
+    // The last event before this reset is the end of that read.
+
+    test_boot(1 << EXTRF);
+    check(1 << EXTRF, DIAGNOSTICS_CHECKPOINT_SLEEP, TW_ST_DATA_NACK, 2, "external");
+
+    // A power-on starts over, whatever else is set.
+    test_boot(1 << PORF | 1 << EXTRF);
+    check(1 << PORF | 1 << EXTRF, DIAGNOSTICS_CHECKPOINT_NONE, 0, 0, "power-on with external");
+
+    return test_result();
+}
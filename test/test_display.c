@@ -0,0 +1,76 @@
+//
+// The display: status codes, the watchdog dot and dimming, see segment.h.
+//
+
+#include "test_host.h"
+
+// See segment.h.
+extern volatile uint8_t display_fb_portd[2], display_fb_portc[2];
+
+static int frame_is(uint8_t left_d, uint8_t left_c, uint8_t right_d, uint8_t right_c) {
+    return display_fb_portd[0] == left_d && display_fb_portc[0] == left_c && display_fb_portd[1] == right_d &&
+           display_fb_portc[1] == right_c;
+}
+
+#define CHECK_FRAME(what, ld, lc, rd, rc) CHECK(frame_is(ld, lc, rd, rc), "%s: %02x/%02x %02x/%02x", what, \
+        display_fb_portd[0], display_fb_portc[0], display_fb_portd[1], display_fb_portc[1])
+
+// Runs the multiplexing interrupt for a few rounds and counts the timer 2 ticks each digit is lit for.
+static void measure(int *left, int *right, int *total) {
+    *left = *right = *total = 0;
+    for (int i = 0; i < 8; i++) {
+        TIMER2_COMP_vect();
+        int slot = OCR2 + 1;
+        *total += slot;
+        if (PORTC & (1 << BOARD_SEGMENT_LEFT_ENABLE_PIN)) {
+            *left += slot;
+        }
+        if (PORTD & (1 << BOARD_SEGMENT_RIGHT_ENABLE_PIN)) {
+            *right += slot;
+        }
+    }
+}
+
+int main(void) {
+    test_boot(1 << WDRF);
+    CHECK_FRAME("Er after a watchdog reset", 0x0d, 0x01, 0x5f, 0x02);
+    test_ticks(260);
+    CHECK_FRAME("0 0 with the dot", 0x01, 0x05, 0x40, 0x04);
+    test_write_reg(I2C_REG_STATUS, I2C_BIT_WDT_RESET);
+    test_ticks(1);
+    CHECK_FRAME("acknowledged", 0x01, 0x05, 0x41, 0x04);
+
+    uint8_t modes[] = {I2C_REG_AIR_IN, 3, 4};
+    test_write(modes, sizeof(modes));
+    test_ticks(1);
+    CHECK_FRAME("3 4", 0x01, 0x0b, 0x53, 0x08);
+
+    // L when a master writes modes while the button locks them.
+    PIND &= ~(1 << PIND5);
+    test_ticks(55);
+    PIND |= (1 << PIND5);
+    test_ticks(5);
+    test_write(modes, sizeof(modes));
+    test_ticks(1);
+    CHECK_FRAME("L", 0x0f, 0x05, 0x5f, 0x0e);
+    test_ticks(260);
+    CHECK_FRAME("3 4 again", 0x01, 0x0b, 0x53, 0x08);
+
+    int left, right, total;
+    measure(&left, &right, &total);
+    CHECK(left == total / 2 && right == total / 2, "full brightness: %d %d of %d", left, right, total);
+
+    uint8_t dim[] = {I2C_REG_BRIGHTNESS, 128, 0};
+    test_write(dim, sizeof(dim));
+    test_ticks(1);
+    measure(&left, &right, &total);
+    CHECK(left > 0 && left < total / 2 && right == 0, "128/0: %d %d of %d", left, right, total);
+
+    uint8_t dim2[] = {I2C_REG_BRIGHTNESS, 10, 254};
+    test_write(dim2, sizeof(dim2));
+    test_ticks(1);
+    measure(&left, &right, &total);
+    CHECK(left > 0 && left < right / 10, "10/254: %d %d of %d", left, right, total);
+
+    return test_result();
+}
@@ -0,0 +1,88 @@
+//
+// General call group commits and the EEPROM-stored address and groups, see twislave.c and device_config.h.
+//
+
+#include "test_host.h"
+#include "crc8.h"
+
+static void general_call(const uint8_t *data, int len) {
+    test_twi(TW_SR_GCALL_ACK);
+    for (int i = 0; i < len; i++) {
+        TWDR = data[i];
+        test_twi(TW_SR_GCALL_DATA_ACK);
+    }
+    test_twi(TW_SR_STOP);
+}
+
+static void check_modes(uint8_t in, uint8_t out, const char *what) {
+    uint8_t modes[2];
+    test_read(I2C_REG_AIR_IN, modes, 2);
+    CHECK(modes[0] == in && modes[1] == out, "%s: modes %d %d, expected %d %d", what, modes[0], modes[1], in, out);
+}
+
+int main(void) {
+    test_boot(1 << PORF);
+
+    CHECK(TWAR == (I2C_SLAVE_ADDRESS << 1 | 1 << TWGCE), "TWAR %02x", TWAR);
+    CHECK(test_read_reg(I2C_REG_ADDRESS) == I2C_SLAVE_ADDRESS, "default address");
+    CHECK(test_read_reg(I2C_REG_GROUPS) == 0x01, "default groups");
+
+    uint8_t group0[] = {0x03, 0x01, 4, 3};
+    general_call(group0, sizeof(group0));
+    test_ticks(1);
+    check_modes(4, 3, "group 0");
+
+    uint8_t group1[] = {0x03, 0x02, 1, 1};
+    general_call(group1, sizeof(group1));
+    test_ticks(1);
+    check_modes(4, 3, "group 1, not a member");
+
+    uint8_t reset[] = {0x06, 0x01, 1, 1};
+    general_call(reset, sizeof(reset));
+    test_ticks(1);
+    check_modes(4, 3, "reset command");
+
+    uint8_t config[] = {I2C_REG_ADDRESS, 0x30, 0x06};
+    test_write(config, sizeof(config));
+    test_ticks(10);
+    CHECK(test_read_reg(I2C_REG_ADDRESS) == 0x30, "address not written");
+    CHECK(TWAR == (I2C_SLAVE_ADDRESS << 1 | 1 << TWGCE), "new address must wait for a reset");
+
+    // Groups take effect right away. With a PEC, it is checked.
+    uint8_t group2[] = {0x03, 0x04, 2, 2, 0};
+    uint8_t crc = crc8_update(0, 0);
+    for (int i = 0; i < I2C_GCALL_FRAME_SIZE; i++) {
+        crc = crc8_update(crc, group2[i]);
+    }
+    group2[I2C_GCALL_FRAME_SIZE] = crc;
+    general_call(group2, sizeof(group2));
+    test_ticks(1);
+    check_modes(2, 2, "group 2 with PEC");
+
+    group2[I2C_GCALL_FRAME_AIR_IN] = 5;
+    general_call(group2, sizeof(group2));
+    test_ticks(1);
+    check_modes(2, 2, "bad PEC");
+
+    // Devices locked by the button ignore group commits.
+    PIND &= ~(1 << PIND5);
+    test_ticks(60);
+    PIND |= (1 << PIND5);
+    test_ticks(3);
+    CHECK(test_read_reg(I2C_REG_STATUS) & I2C_BIT_I2C_DISABLED, "button did not lock");
+    uint8_t locked[] = {0x03, 0x04, 0, 0};
+    general_call(locked, sizeof(locked));
+    test_ticks(1);
+    check_modes(2, 2, "locked");
+
+    test_boot(1 << EXTRF);
+    CHECK(TWAR == (0x30 << 1 | 1 << TWGCE), "address after reset, TWAR %02x", TWAR);
+    CHECK(test_read_reg(I2C_REG_GROUPS) == 0x06, "groups after reset");
+
+    // Reserved addresses are ignored.
+    test_write_reg(I2C_REG_ADDRESS, 0x78);
+    test_ticks(10);
+    CHECK(test_read_reg(I2C_REG_ADDRESS) == 0x30, "reserved address accepted");
+
+    return test_result();
+}
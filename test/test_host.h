@@ -0,0 +1,114 @@
+//
+// Helpers for the host tests, see CMakeLists.txt.
+//
+// Every test is its own executable linked against fan_control_host, so each one starts with a fresh firmware and
+// EEPROM. The helpers play the I2C master by feeding TWI_vect the status codes the TWI would report, and advance time
+// in timer ticks of 10ms, running the main loop after each, just like it wakes up on the real thing.
+//
+
+#ifndef FAN_CONTROL_TEST_HOST_H
+#define FAN_CONTROL_TEST_HOST_H
+
+#include <stdio.h>
+
+#include "hal.h"
+#include "twislave.h"
+
+static int test_failures;
+
+// Records a failure, with a printf-style message, and carries on.
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s: ", __FILE__, __LINE__, #cond); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            test_failures++; \
+        } \
+    } while (0)
+
+// The exit code of a test.
+static inline int test_result(void) {
+    if (test_failures) {
+        printf("%d checks failed\n", test_failures);
+        return 1;
+    }
+    return 0;
+}
+
+// Simulates a reset with the given MCUCSR flags, with the button released, and runs the firmware up to its first sleep.
+static inline void test_boot(uint8_t reset_cause) {
+    hal_host_reset();
+    MCUCSR = reset_cause;
+    PIND |= (1 << PIND5);
+    fan_control_setup();
+    fan_control_loop();
+}
+
+// One timer tick, followed by the main loop.
+static inline void test_ticks(int n) {
+    for (int i = 0; i < n; i++) {
+        TIMER1_COMPA_vect();
+        fan_control_loop();
+    }
+}
+
+static inline void test_twi(uint8_t status) {
+    TWSR = status;
+    TWI_vect();
+}
+
+// A write transaction of the given bytes, the first one being the register address.
+static inline void test_write(const uint8_t *data, int len) {
+    test_twi(TW_SR_SLA_ACK);
+    for (int i = 0; i < len; i++) {
+        TWDR = data[i];
+        test_twi(TW_SR_DATA_ACK);
+    }
+    test_twi(TW_SR_STOP);
+}
+
+static inline void test_write_reg(uint8_t reg, uint8_t value) {
+    uint8_t data[] = {reg, value};
+    test_write(data, sizeof(data));
+}
+
+// Reads len bytes without a register address, from wherever the last transaction left off.
+static inline void test_read_more(uint8_t *data, int len) {
+    test_twi(TW_ST_SLA_ACK);
+    for (int i = 0; i < len; i++) {
+        data[i] = TWDR;
+        test_twi(i == len - 1 ? TW_ST_DATA_NACK : TW_ST_DATA_ACK);
+    }
+}
+
+// A combined transaction: the register address, a repeated start and len bytes read from there.
+// The TWI reports a repeated start as TW_SR_STOP as well.
+static inline void test_read(uint8_t reg, uint8_t *data, int len) {
+    test_twi(TW_SR_SLA_ACK);
+    TWDR = reg;
+    test_twi(TW_SR_DATA_ACK);
+    test_twi(TW_SR_STOP);
+    test_read_more(data, len);
+}
+
+static inline uint8_t test_read_reg(uint8_t reg) {
+    uint8_t value;
+    test_read(reg, &value, 1);
+    return value;
+}
+
+static inline uint16_t test_read_reg16(uint8_t reg) {
+    uint8_t value[2];
+    test_read(reg, value, 2);
+    return value[0] | value[1] << 8;
+}
+
+// Holds the button for the given number of ticks, then releases it for a few more, so the release is seen.
+static inline void test_press(int ticks) {
+    PIND &= ~(1 << PIND5);
+    test_ticks(ticks);
+    PIND |= (1 << PIND5);
+    test_ticks(3);
+}
+
+#endif //FAN_CONTROL_TEST_HOST_H
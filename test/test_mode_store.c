@@ -0,0 +1,142 @@
+//
+// The mode state in EEPROM, see mode_store.h.
+//
+
+#include <string.h>
+
+#include "test_host.h"
+#include "mode_store.h"
+
+static void set_modes(uint8_t in, uint8_t out) {
+    uint8_t modes[] = {I2C_REG_AIR_IN, in, out};
+    test_write(modes, sizeof(modes));
+    test_ticks(1);
+}
+
+static void check_modes(uint8_t in, uint8_t out, const char *what) {
+    uint8_t modes[2];
+    test_read(I2C_REG_AIR_IN, modes, 2);
+    CHECK(modes[0] == in && modes[1] == out, "%s: modes %d %d, expected %d %d", what, modes[0], modes[1], in, out);
+}
+
+// Ten times around the ring.
+#define SAVES (10 * MODE_STORE_SLOTS)
+
+// Runs the main loop until the save is written.
+static void settle(void) {
+    for (int i = 0; i < 100 && mode_store_busy(); i++) {
+        test_ticks(1);
+    }
+    CHECK(!mode_store_busy(), "save never finished");
+}
+
+// Interrupts the save of the given modes after every byte, with every possible value in the byte being written, and
+// checks that the firmware comes back with either the previous modes or, once the record is complete, the new ones.
+static void check_torn_save(uint8_t in, uint8_t out, uint8_t prev_in, uint8_t prev_out) {
+    static uint8_t images[MODE_STORE_RECORD_SIZE + 1][E2END + 1];
+    int addrs[MODE_STORE_RECORD_SIZE];
+
+    memcpy(images[0], hal_host_eeprom, sizeof(hal_host_eeprom));
+    mode_state_t state = {in, out, 0};
+    mode_store_save(&state);
+    for (int i = 0; i < MODE_STORE_RECORD_SIZE; i++) {
+        uint32_t cell_writes[E2END + 1];
+        memcpy(cell_writes, hal_host_eeprom_cell_writes, sizeof(cell_writes));
+        mode_store_poll();
+        // Bytes that already hold the right value are skipped, and can't be torn.
+        addrs[i] = -1;
+        for (int addr = 0; addr <= E2END; addr++) {
+            if (hal_host_eeprom_cell_writes[addr] != cell_writes[addr]) {
+                addrs[i] = addr;
+            }
+        }
+        memcpy(images[i + 1], hal_host_eeprom, sizeof(hal_host_eeprom));
+    }
+    CHECK(!mode_store_busy(), "record not written after %d bytes", MODE_STORE_RECORD_SIZE);
+
+    CHECK(addrs[MODE_STORE_RECORD_SIZE - 1] >= 0, "sequence number not written last");
+    for (int i = 0; i < MODE_STORE_RECORD_SIZE; i++) {
+        if (addrs[i] < 0) {
+            continue;
+        }
+        uint8_t written = images[i + 1][addrs[i]];
+        for (int value = 0; value <= 0xFF; value++) {
+            memcpy(hal_host_eeprom, images[i], sizeof(hal_host_eeprom));
+            hal_host_eeprom[addrs[i]] = value;
+            test_boot(1 << PORF);
+
+            char what[64];
+            snprintf(what, sizeof(what), "torn after %d bytes, 0x%02x instead of 0x%02x", i, value, written);
+            if (i == MODE_STORE_RECORD_SIZE - 1 && value == written) {
+                check_modes(in, out, what);
+            } else {
+                check_modes(prev_in, prev_out, what);
+            }
+        }
+    }
+
+    memcpy(hal_host_eeprom, images[MODE_STORE_RECORD_SIZE], sizeof(hal_host_eeprom));
+    test_boot(1 << PORF);
+    check_modes(in, out, "after the torn saves");
+}
+
+int main(void) {
+    test_boot(1 << PORF);
+    check_modes(0, 0, "erased EEPROM");
+
+    set_modes(5, 2);
+    settle();
+    test_boot(1 << PORF);
+    check_modes(5, 2, "after power cycle");
+
+    // Into an erased slot.
+    check_torn_save(3, 1, 5, 2);
+
+    // Every save writes at most one record, and nothing is written while the modes stay the same.
+    uint32_t writes = hal_host_eeprom_writes;
+    static uint32_t cell_writes[E2END + 1];
+    memcpy(cell_writes, hal_host_eeprom_cell_writes, sizeof(cell_writes));
+    for (int i = 0; i < SAVES; i++) {
+        set_modes(i % 7, (i / 7) % 5);
+        settle();
+    }
+    CHECK(hal_host_eeprom_writes - writes <= SAVES * MODE_STORE_RECORD_SIZE, "%u writes for %d saves",
+          (unsigned) (hal_host_eeprom_writes - writes), SAVES);
+    writes = hal_host_eeprom_writes;
+    test_ticks(100);
+    CHECK(hal_host_eeprom_writes == writes, "%u writes without a change", (unsigned) (hal_host_eeprom_writes - writes));
+
+    // The wear is spread over the whole ring, so the most worn cell sets the lifetime. At 100000 writes per cell and
+    // one mode change per minute, it should last the 12 years promised in mode_store.h.
+    uint32_t max_cell_writes = 0;
+    for (int addr = 0; addr <= E2END; addr++) {
+        if (hal_host_eeprom_cell_writes[addr] - cell_writes[addr] > max_cell_writes) {
+            max_cell_writes = hal_host_eeprom_cell_writes[addr] - cell_writes[addr];
+        }
+    }
+    double lifetime_saves = 100000.0 * SAVES / max_cell_writes;
+    double lifetime_years = lifetime_saves / (60 * 24 * 365);
+    printf("%d saves, at most %u writes per cell: %.1f million saves, %.1f years at one per minute\n",
+           SAVES, (unsigned) max_cell_writes, lifetime_saves / 1e6, lifetime_years);
+    CHECK(lifetime_years > 12, "projected lifetime of %.1f years", lifetime_years);
+
+    // The sequence numbers wrapped around several times by now.
+    set_modes(4, 3);
+    settle();
+    test_boot(1 << EXTRF);
+    check_modes(4, 3, "after wrap-around");
+
+    // Into a slot with an old record.
+    check_torn_save(6, 4, 4, 3);
+
+    // The button override is restored as well.
+    PIND &= ~(1 << PIND5);
+    test_ticks(60);
+    PIND |= (1 << PIND5);
+    test_ticks(3);
+    settle();
+    test_boot(1 << PORF);
+    CHECK(test_read_reg(I2C_REG_STATUS) & I2C_BIT_I2C_DISABLED, "button override not restored");
+
+    return test_result();
+}
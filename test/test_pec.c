@@ -0,0 +1,65 @@
+//
+// SMBus Packet Error Checking, see twislave.c.
+//
+
+#include "test_host.h"
+#include "crc8.h"
+
+#define SLA_W (I2C_SLAVE_ADDRESS << 1)
+#define SLA_R (I2C_SLAVE_ADDRESS << 1 | 1)
+
+// Writes data to reg with a PEC, XORed with corrupt.
+static void write_pec(uint8_t reg, const uint8_t *data, int len, uint8_t corrupt) {
+    uint8_t frame[I2C_RX_SIZE + 2];
+    uint8_t crc = crc8_update(0, SLA_W);
+
+    frame[0] = reg;
+    crc = crc8_update(crc, reg);
+    for (int i = 0; i < len; i++) {
+        frame[1 + i] = data[i];
+        crc = crc8_update(crc, data[i]);
+    }
+    frame[1 + len] = crc ^ corrupt;
+    test_write(frame, len + 2);
+}
+
+int main(void) {
+    test_boot(1 << PORF);
+
+    test_write_reg(I2C_REG_CONFIG, I2C_CONFIG_PEC);
+    test_ticks(1);
+
+    uint8_t modes[] = {3, 2};
+    write_pec(I2C_REG_AIR_IN, modes, 2, 0);
+    test_ticks(1);
+    uint8_t other[] = {6, 4};
+    write_pec(I2C_REG_AIR_IN, other, 2, 1);
+    test_ticks(1);
+    uint8_t no_pec[] = {I2C_REG_AIR_IN, 6, 4};
+    test_write(no_pec, sizeof(no_pec));
+    test_ticks(1);
+
+    // Reads return I2C_PEC_READ_LENGTH_DEFAULT bytes and the PEC over everything, including the register address.
+    uint8_t data[I2C_PEC_READ_LENGTH_DEFAULT + 1];
+    test_read(I2C_REG_STATUS, data, sizeof(data));
+    CHECK(data[1] == 3 && data[2] == 2, "modes %d %d, only the valid write should apply", data[1], data[2]);
+    uint8_t crc = crc8_update(crc8_update(crc8_update(0, SLA_W), I2C_REG_STATUS), SLA_R);
+    for (int i = 0; i < I2C_PEC_READ_LENGTH_DEFAULT; i++) {
+        crc = crc8_update(crc, data[i]);
+    }
+    CHECK(data[I2C_PEC_READ_LENGTH_DEFAULT] == crc, "read PEC %02x, expected %02x", data[I2C_PEC_READ_LENGTH_DEFAULT],
+          crc);
+
+    // The corrupt PEC, the missing one, and this write without a PEC are counted.
+    uint8_t telemetry[TELEMETRY_SIZE];
+    test_write_reg(I2C_REG_PEC_READ_LENGTH, TELEMETRY_SIZE);
+    test_ticks(1);
+    uint8_t length[] = {TELEMETRY_SIZE};
+    write_pec(I2C_REG_PEC_READ_LENGTH, length, 1, 0);
+    test_ticks(1);
+    test_read(I2C_REG_TELEMETRY, telemetry, sizeof(telemetry));
+    uint16_t errors = telemetry[TELEMETRY_PEC_ERROR_COUNT] | telemetry[TELEMETRY_PEC_ERROR_COUNT + 1] << 8;
+    CHECK(errors == 3, "%u PEC errors", errors);
+
+    return test_result();
+}
@@ -0,0 +1,127 @@
+//
+// Tests of the poller against MockBus: which events it reports, for which device, and when it reports none.
+//
+// The poller runs its own threads, so the test waits for each event, up to a few seconds. The polling intervals are
+// short, and the mock bus doesn't take real time, so that's plenty. Throughput is measured in
+// client/fan_control_poller_bench.cpp.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "client.hpp"
+#include "mock_bus.hpp"
+#include "poller.hpp"
+#include "test_client.hpp"
+
+using namespace fan_control;
+using namespace std::chrono_literals;
+
+static constexpr auto WAIT_MAX = 5s;
+
+// Collects the events the poller reports.
+struct Events {
+    std::mutex mutex;
+    std::vector<PollEvent> events;
+
+    void add(const PollEvent &event) {
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back(event);
+    }
+
+    size_t count(PollEvent::Kind kind, uint8_t address) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::count_if(events.begin(), events.end(), [&](const PollEvent &event) {
+            return event.kind == kind && event.address == address;
+        });
+    }
+
+    // Waits until there are that many events of the kind for the device. Returns the last one, or nothing on timeout.
+    std::optional<PollEvent> wait(PollEvent::Kind kind, uint8_t address, size_t n = 1) {
+        auto start = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - start < WAIT_MAX) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                size_t seen = 0;
+                for (const PollEvent &event : events) {
+                    if (event.kind == kind && event.address == address && ++seen == n) {
+                        return event;
+                    }
+                }
+            }
+            std::this_thread::sleep_for(1ms);
+        }
+        return std::nullopt;
+    }
+};
+
+int main() {
+    MockBus bus;
+    MockSlave &a = bus.add_slave(0x20);
+    MockSlave &b = bus.add_slave(0x21);
+
+    PollPolicy policy;
+    policy.min_interval = 1ms;
+    policy.max_interval = 10ms;
+    Events events;
+    Poller poller(policy, [&events](const PollEvent &event) { events.add(event); });
+    size_t index = poller.add_bus("bus", bus);
+    poller.add_device(index, 0x20);
+    poller.add_device(index, 0x21);
+    // Nobody there yet.
+    poller.add_device(index, 0x22);
+    poller.start();
+
+    CHECK(events.wait(PollEvent::DISCOVERED, 0x20));
+    CHECK(events.wait(PollEvent::DISCOVERED, 0x21));
+
+    // A change via I2C, for that device only.
+    Client(bus, 0x20).set_modes(3, 2);
+    auto changed = events.wait(PollEvent::MODES_CHANGED, 0x20);
+    CHECK(changed && changed->state->air_in == 3 && changed->state->air_out == 2);
+    CHECK(changed && changed->previous && changed->previous->air_in == 0);
+    CHECK(events.count(PollEvent::MODES_CHANGED, 0x21) == 0);
+
+    // The button override, and changes made with the button while it's active.
+    b.set_button_override(true);
+    CHECK(events.wait(PollEvent::OVERRIDE_STARTED, 0x21));
+    b.set_modes_by_button(4, 1);
+    auto by_button = events.wait(PollEvent::MODES_CHANGED_BY_BUTTON, 0x21);
+    CHECK(by_button && by_button->state->air_in == 4 && by_button->state->air_out == 1);
+    b.set_button_override(false);
+    CHECK(events.wait(PollEvent::OVERRIDE_ENDED, 0x21));
+    CHECK(events.count(PollEvent::MODES_CHANGED, 0x21) == 0);
+
+    // A watchdog reset.
+    a.reboot(true);
+    auto reset = events.wait(PollEvent::WATCHDOG_RESET, 0x20);
+    CHECK(reset && reset->state->status.watchdog_reset());
+
+    // A device that was never seen is not reported offline, but shows up once it answers.
+    CHECK(events.count(PollEvent::OFFLINE, 0x22) == 0);
+    bus.add_slave(0x22);
+    CHECK(events.wait(PollEvent::DISCOVERED, 0x22));
+
+    // A device that moves away goes offline.
+    Client(bus, 0x20).set_address(0x23);
+    a.reboot(false);
+    auto offline = events.wait(PollEvent::OFFLINE, 0x20);
+    CHECK(offline && !offline->state);
+
+    // Quiet devices report nothing, however often they're polled.
+    std::this_thread::sleep_for(50ms);
+    poller.stop();
+    CHECK(events.count(PollEvent::MODES_CHANGED, 0x20) == 1);
+    CHECK(events.count(PollEvent::DISCOVERED, 0x20) == 1 && events.count(PollEvent::DISCOVERED, 0x21) == 1);
+    CHECK(events.count(PollEvent::OFFLINE, 0x20) == 1 && events.count(PollEvent::OFFLINE, 0x21) == 0);
+    for (const DeviceStats &device : poller.stats()) {
+        CHECK(device.online == (device.address != 0x20));
+        CHECK((device.errors > 0) == (device.address == 0x20 || device.address == 0x22));
+    }
+
+    return test_result();
+}
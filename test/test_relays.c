@@ -0,0 +1,105 @@
+//
+// The relay sequencer, see relay.h.
+//
+
+#include "test_host.h"
+
+#define RELAY(n) (1 << BOARD_RELAY_##n##_PIN)
+
+static const uint8_t relay_pins[] = {
+        RELAY(1), RELAY(2), RELAY(3), RELAY(4), RELAY(5), RELAY(6), RELAY(7), RELAY(8),
+};
+
+static int tick;
+static int switches[8];
+
+// Sets the modes and runs the sequencer until it is done, checking that it switches one relay at a time, at least
+// five ticks apart, and ends up at the expected relays. Returns the order in which the relays switched, as a bitmask
+// per step.
+static int change_modes(uint8_t in, uint8_t out, uint8_t expected, uint8_t *steps) {
+    uint8_t modes[] = {I2C_REG_AIR_IN, in, out};
+    test_write(modes, sizeof(modes));
+    fan_control_loop();
+
+    int count = 0;
+    int last = -100;
+    for (int i = 0; i < 100; i++) {
+        uint8_t before = PORTB;
+        test_ticks(1);
+        tick++;
+        uint8_t changed = before ^ PORTB;
+        if (!changed) {
+            continue;
+        }
+        CHECK((changed & (changed - 1)) == 0, "%d/%d: several relays at once: %02x", in, out, changed);
+        CHECK(tick - last >= 5, "%d/%d: only %d ticks between steps", in, out, tick - last);
+        last = tick;
+        for (int r = 0; r < 8; r++) {
+            if (changed & relay_pins[r]) {
+                switches[r]++;
+            }
+        }
+        if (steps && count < 8) {
+            steps[count] = changed;
+        }
+        count++;
+    }
+    // Relays are active LOW.
+    uint8_t pattern = ~expected;
+    CHECK(PORTB == pattern, "%d/%d: PORTB %02x, expected %02x", in, out, PORTB, pattern);
+    return count;
+}
+
+int main(void) {
+    test_boot(1 << PORF);
+    CHECK(DDRB == 0xFF && PORTB == 0xFF, "relays not all off at power-on");
+
+    // The air in relays come on from the lowest voltage up.
+    uint8_t steps[8];
+    int count = change_modes(4, 0, RELAY(1) | RELAY(2) | RELAY(3), steps);
+    CHECK(count == 3 && steps[0] == RELAY(3) && steps[1] == RELAY(1) && steps[2] == RELAY(2),
+          "order %d: %02x %02x %02x", count, steps[0], steps[1], steps[2]);
+
+    // Only the relays that differ are switched.
+    CHECK(change_modes(5, 0, RELAY(1) | RELAY(2) | RELAY(4), NULL) == 2, "4 -> 5");
+    CHECK(change_modes(0, 0, 0, NULL) == 3, "5 -> 0");
+    CHECK(change_modes(6, 4, RELAY(1) | RELAY(2) | RELAY(3) | RELAY(4) | RELAY(8), NULL) == 5, "0/0 -> 6/4");
+    CHECK(change_modes(1, 1, RELAY(1) | RELAY(5), NULL) == 5, "6/4 -> 1/1");
+    CHECK(change_modes(1, 1, RELAY(1) | RELAY(5), NULL) == 0, "same modes");
+
+    // A new target in the middle of a sequence takes over from wherever the relays are.
+    uint8_t modes[] = {I2C_REG_AIR_IN, 6, 3};
+    test_write(modes, sizeof(modes));
+    fan_control_loop();
+    for (int i = 0; i < 6; i++) {
+        uint8_t before = PORTB;
+        test_ticks(1);
+        tick++;
+        for (int r = 0; r < 8; r++) {
+            if ((before ^ PORTB) & relay_pins[r]) {
+                switches[r]++;
+            }
+        }
+    }
+    change_modes(0, 0, 0, NULL);
+
+    // Every switch is counted, per relay.
+    uint8_t counts[16];
+    test_read(I2C_REG_RELAY_ACTUATIONS, counts, sizeof(counts));
+    for (int r = 0; r < 8; r++) {
+        int counted = counts[2 * r] | counts[2 * r + 1] << 8;
+        CHECK(counted == switches[r], "relay %d switched %d times, counted %d", r + 1, switches[r], counted);
+    }
+
+    // After a reset, the restored modes are driven right away, without the sequencer.
+    change_modes(6, 4, RELAY(1) | RELAY(2) | RELAY(3) | RELAY(4) | RELAY(8), NULL);
+    test_ticks(100);
+    test_boot(1 << PORF);
+    uint8_t pattern = (uint8_t) ~(RELAY(1) | RELAY(2) | RELAY(3) | RELAY(4) | RELAY(8));
+    CHECK(DDRB == 0xFF && PORTB == pattern, "PORTB %02x right after reset, expected %02x", PORTB, pattern);
+    uint8_t before = PORTB;
+    test_ticks(20);
+    CHECK(PORTB == before, "relays switched from %02x to %02x after reset", before, PORTB);
+
+    return test_result();
+}
@@ -0,0 +1,145 @@
+//
+// The on-device schedule, see schedule.h.
+//
+
+#include <string.h>
+
+#include "test_host.h"
+#include "schedule.h"
+
+static void seconds(int n) {
+    test_ticks(n * 100);
+}
+
+// Checks the modes and the schedule registers.
+static void check(uint8_t in, uint8_t out, uint8_t entry, uint8_t remaining, const char *what) {
+    uint8_t regs[I2C_REG_SCHEDULE_REMAINING + 1];
+    test_read(I2C_REG_STATUS, regs, sizeof(regs));
+    CHECK(regs[I2C_REG_AIR_IN] == in && regs[I2C_REG_AIR_OUT] == out, "%s: modes %d %d, expected %d %d", what,
+          regs[I2C_REG_AIR_IN], regs[I2C_REG_AIR_OUT], in, out);
+    CHECK(regs[I2C_REG_SCHEDULE_ENTRY] == entry && regs[I2C_REG_SCHEDULE_REMAINING] == remaining,
+          "%s: entry %d with %d minutes left, expected %d with %d", what, regs[I2C_REG_SCHEDULE_ENTRY],
+          regs[I2C_REG_SCHEDULE_REMAINING], entry, remaining);
+}
+
+// Commits a table of one entry, and cuts the save short after every byte. The firmware must come back with either the
+// previous table or, once the save is done, the new one.
+static void check_torn_commit(uint8_t duration, uint8_t modes, uint8_t prev_length, uint8_t prev_duration) {
+    static uint8_t images[SCHEDULE_RECORD_SIZE + 1][E2END + 1];
+    int n = 0;
+
+    uint8_t table[] = {I2C_REG_SCHEDULE, duration, modes};
+    test_write(table, sizeof(table));
+    test_write_reg(I2C_REG_SCHEDULE_LENGTH, 1);
+    // One byte per main loop pass.
+    do {
+        test_ticks(1);
+        memcpy(images[n++], hal_host_eeprom, sizeof(hal_host_eeprom));
+    } while (schedule_busy() && n <= SCHEDULE_RECORD_SIZE);
+    CHECK(n == SCHEDULE_RECORD_SIZE, "save took %d passes", n);
+
+    for (int i = 0; i < n; i++) {
+        memcpy(hal_host_eeprom, images[i], sizeof(hal_host_eeprom));
+        test_boot(1 << PORF);
+        uint8_t length = test_read_reg(I2C_REG_SCHEDULE_LENGTH);
+        uint8_t first = test_read_reg(I2C_REG_SCHEDULE);
+        if (i == n - 1) {
+            CHECK(length == 1 && first == duration, "complete: length %d, first entry %d minutes", length, first);
+        } else {
+            CHECK(length == prev_length && first == prev_duration,
+                  "torn after %d bytes: length %d, first entry %d minutes", i + 1, length, first);
+        }
+    }
+}
+
+int main(void) {
+    test_boot(1 << PORF);
+
+    // One minute of 1/2, two minutes of 3/4.
+    uint8_t table[] = {I2C_REG_SCHEDULE, 1, 0x21, 2, 0x43};
+    test_write(table, sizeof(table));
+    test_write_reg(I2C_REG_SCHEDULE_LENGTH, 2);
+    test_ticks(1);
+    CHECK(test_read_reg(I2C_REG_SCHEDULE_LENGTH) == 2, "table not committed");
+    check(0, 0, 0, 1, "committed, disabled");
+
+    test_write_reg(I2C_REG_SCHEDULE_CONTROL, SCHEDULE_CONTROL_ENABLED);
+    test_ticks(1);
+    CHECK(test_read_reg(I2C_REG_SCHEDULE_CONTROL) == (SCHEDULE_CONTROL_ENABLED | SCHEDULE_CONTROL_RUNNING),
+          "not running");
+    check(1, 2, 0, 1, "enabled");
+    seconds(30);
+    check(1, 2, 0, 1, "30s");
+    seconds(31);
+    check(3, 4, 1, 2, "61s");
+
+    // I2C writes stay until the next entry starts.
+    uint8_t modes[] = {I2C_REG_AIR_IN, 5, 0};
+    test_write(modes, sizeof(modes));
+    test_ticks(1);
+    check(5, 0, 1, 2, "I2C override");
+    seconds(60);
+    check(5, 0, 1, 1, "121s");
+    seconds(60);
+    check(1, 2, 0, 1, "181s");
+
+    // The button override keeps time, but not the modes.
+    PIND &= ~(1 << PIND5);
+    test_ticks(60);
+    PIND |= (1 << PIND5);
+    test_ticks(3);
+    CHECK(!(test_read_reg(I2C_REG_SCHEDULE_CONTROL) & SCHEDULE_CONTROL_RUNNING), "running while locked");
+    seconds(61);
+    check(1, 2, 1, 2, "locked");
+    // Two more long presses select the right digit and then end the override.
+    PIND &= ~(1 << PIND5);
+    test_ticks(60);
+    PIND |= (1 << PIND5);
+    test_ticks(3);
+    PIND &= ~(1 << PIND5);
+    test_ticks(60);
+    PIND |= (1 << PIND5);
+    test_ticks(3);
+    check(3, 4, 1, 2, "unlocked");
+
+    // Aligning the schedule.
+    uint8_t align[] = {I2C_REG_SCHEDULE_ENTRY, 0, 200};
+    test_write(align, sizeof(align));
+    test_ticks(1);
+    check(1, 2, 0, 200, "jump to 0 with 200 minutes");
+
+    // Invalid tables are ignored.
+    uint8_t bad[] = {I2C_REG_SCHEDULE, 0, 0x11};
+    test_write(bad, sizeof(bad));
+    test_write_reg(I2C_REG_SCHEDULE_LENGTH, 2);
+    test_ticks(1);
+    check(1, 2, 0, 200, "invalid table");
+    test_write_reg(I2C_REG_SCHEDULE_LENGTH, SCHEDULE_MAX_ENTRIES + 1);
+    test_ticks(1);
+    CHECK(test_read_reg(I2C_REG_SCHEDULE_LENGTH) == 2, "too long a table");
+
+    // The table and the control register survive a reset, and the schedule starts over.
+    test_ticks(100);
+    test_boot(1 << PORF);
+    check(1, 2, 0, 1, "after reset");
+    CHECK(test_read_reg(I2C_REG_SCHEDULE) == 1, "table not restored");
+    CHECK(test_read_reg(I2C_REG_SCHEDULE_CONTROL) & SCHEDULE_CONTROL_ENABLED, "control not restored");
+
+    // Requests written between two main loop passes are all processed, in order, and the last value of each wins.
+    uint8_t jump[] = {I2C_REG_SCHEDULE_ENTRY, 0};
+    test_write_reg(I2C_REG_SCHEDULE_REMAINING, 7);
+    test_write_reg(I2C_REG_SCHEDULE_LENGTH, 2);
+    test_write_reg(I2C_REG_SCHEDULE_ENTRY, 0);
+    jump[1] = 1;
+    test_write(jump, sizeof(jump));
+    test_write_reg(I2C_REG_SCHEDULE_REMAINING, 9);
+    test_ticks(1);
+    check(3, 4, 1, 9, "queued requests");
+
+    // A save interrupted by a reset falls back to the previous schedule, whether the slot was erased or not.
+    check_torn_commit(5, 0x12, 2, 1);
+    check_torn_commit(7, 0x31, 1, 5);
+    check(1, 3, 0, 7, "after the torn saves");
+
+    return test_result();
+}
@@ -0,0 +1,44 @@
+//
+// The stack high-water mark, see stack_monitor.h. The stack is hal_host_stack here, and it's only used by this test.
+//
+
+#include <string.h>
+
+#include "test_host.h"
+
+static void check(uint16_t used, uint16_t free, const char *what) {
+    uint8_t block[STACK_MONITOR_SIZE];
+    test_read(I2C_REG_STACK_MONITOR, block, sizeof(block));
+    uint16_t read_used = block[STACK_MONITOR_STACK_USED] | block[STACK_MONITOR_STACK_USED + 1] << 8;
+    uint16_t read_free = block[STACK_MONITOR_STACK_FREE] | block[STACK_MONITOR_STACK_FREE + 1] << 8;
+    CHECK(read_used == used && read_free == free, "%s: used %u free %u, expected %u and %u", what, read_used,
+          read_free, used, free);
+}
+
+int main(void) {
+    // 40 bytes are in use when the firmware starts.
+    hal_host_reset();
+    MCUCSR = 1 << PORF;
+    hal_host_SP = &hal_host_stack[HAL_HOST_STACK_SIZE - 40];
+    fan_control_setup();
+    fan_control_loop();
+
+    // The first scan completes within two seconds.
+    test_ticks(200);
+    check(40, HAL_HOST_STACK_SIZE - 40, "at boot");
+
+    memset(&hal_host_stack[500], 0x11, 10);
+    test_ticks(100);
+    check(HAL_HOST_STACK_SIZE - 500, 500, "deeper");
+
+    // A byte that happens to hold the canary value is missed.
+    hal_host_stack[500] = STACK_MONITOR_CANARY;
+    test_ticks(100);
+    check(HAL_HOST_STACK_SIZE - 501, 501, "canary value on the stack");
+
+    hal_host_stack[100] = 0;
+    test_ticks(100);
+    check(HAL_HOST_STACK_SIZE - 100, 100, "deepest");
+
+    return test_result();
+}
@@ -0,0 +1,67 @@
+//
+// The timer wheel, see timer_wheel.h. Runs a dozen timers next to the firmware's own.
+//
+
+#include "test_host.h"
+#include "timer_wheel.h"
+
+#define TIMERS 12
+
+// Delays and periods, in ticks. Some are beyond one turn of the wheel, or several.
+static const uint8_t delays[TIMERS] = {1, 16, 17, 3, 200, 9, 255, 15, 32, 100, 47, 5};
+static const uint8_t periods[TIMERS] = {0, 16, 0, 10, 0, 0, 0, 1, 0, 178, 0, 33};
+
+static timer_wheel_timer_t timers[TIMERS];
+static uint16_t due[TIMERS];
+static int fired[TIMERS];
+
+static void expired(int i) {
+    fired[i]++;
+    CHECK(timer_wheel_ticks == due[i], "timer %d expired at %u, due at %u", i, timer_wheel_ticks, due[i]);
+    due[i] += periods[i];
+
+    // Callbacks may cancel other timers, and restart themselves.
+    if (i == 3 && fired[i] == 2) {
+        timer_wheel_cancel(&timers[4]);
+    }
+    if (i == 5) {
+        timer_wheel_start(&timers[5], 7, 0);
+        due[5] = timer_wheel_ticks + 7;
+    }
+}
+
+#define CALLBACK(i) static void expired##i(void) { expired(i); }
+CALLBACK(0) CALLBACK(1) CALLBACK(2) CALLBACK(3) CALLBACK(4) CALLBACK(5)
+CALLBACK(6) CALLBACK(7) CALLBACK(8) CALLBACK(9) CALLBACK(10) CALLBACK(11)
+
+static const timer_wheel_callback_t callbacks[TIMERS] = {
+        expired0, expired1, expired2, expired3, expired4, expired5,
+        expired6, expired7, expired8, expired9, expired10, expired11,
+};
+
+int main(void) {
+    test_boot(1 << PORF);
+
+    uint16_t start = timer_wheel_ticks;
+    for (int i = 0; i < TIMERS; i++) {
+        timers[i] = (timer_wheel_timer_t) TIMER_WHEEL_TIMER(callbacks[i]);
+        due[i] = start + delays[i];
+        timer_wheel_start(&timers[i], delays[i], periods[i]);
+    }
+    test_ticks(3000);
+
+    // Every expiry was checked to be on time, so only the count is left to check.
+    for (int i = 0; i < TIMERS; i++) {
+        if (i == 4) {
+            CHECK(fired[i] == 0 && !timer_wheel_pending(&timers[i]), "cancelled timer fired");
+        } else if (i == 5) {
+            CHECK(fired[i] == 1 + (3000 - delays[i]) / 7, "self-restarting timer fired %d times", fired[i]);
+        } else if (periods[i]) {
+            CHECK(fired[i] == 1 + (3000 - delays[i]) / periods[i], "timer %d fired %d times", i, fired[i]);
+        } else {
+            CHECK(fired[i] == 1 && !timer_wheel_pending(&timers[i]), "timer %d fired %d times", i, fired[i]);
+        }
+    }
+
+    return test_result();
+}
@@ -0,0 +1,96 @@
+//
+// Register reads and writes over I2C, see twislave.c.
+//
+
+#include "test_host.h"
+#include "modes.h"
+#include "diagnostics.h"
+
+// Commits new modes once the main loop is about to publish the ones it picked up, i.e. in the middle of a pass.
+static void commit_while_publishing(uint8_t checkpoint) {
+    if (checkpoint == DIAGNOSTICS_CHECKPOINT_OUTPUTS) {
+        hal_host_checkpoint_hook = NULL;
+        uint8_t modes[] = {I2C_REG_AIR_IN, 2, 3};
+        test_write(modes, sizeof(modes));
+    }
+}
+
+int main(void) {
+    test_boot(1 << PORF);
+
+    uint8_t regs[4];
+    test_read(I2C_REG_STATUS, regs, 4);
+    // The WDT bit is set unless the watchdog reset the controller.
+    CHECK(regs[0] == I2C_BIT_WDT_RESET && regs[1] == 0 && regs[2] == 0, "initial registers %02x %02x %02x", regs[0],
+          regs[1], regs[2]);
+    uint8_t seq = regs[3];
+
+    // The modes read back right away, before the main loop has seen them.
+    uint8_t modes[] = {I2C_REG_AIR_IN, 4, 3};
+    test_write(modes, sizeof(modes));
+    test_read(I2C_REG_AIR_IN, regs, 2);
+    CHECK(regs[0] == 4 && regs[1] == 3, "modes %d %d", regs[0], regs[1]);
+    test_ticks(1);
+    CHECK(test_read_reg(I2C_REG_CHANGE_SEQ) == (uint8_t) (seq + 1), "change sequence not incremented");
+
+    // A pure read starts at the status register.
+    test_read_more(regs, 3);
+    CHECK(regs[0] == I2C_BIT_WDT_RESET && regs[1] == 4 && regs[2] == 3, "pure read %02x %02x %02x", regs[0], regs[1], regs[2]);
+
+    // Writing only the air in mode stages it, nothing is committed until air out is written.
+    test_write_reg(I2C_REG_AIR_IN, 1);
+    test_ticks(1);
+    CHECK(test_read_reg(I2C_REG_AIR_IN) == 4, "air in committed without air out");
+    test_write_reg(I2C_REG_AIR_OUT, 2);
+    test_ticks(1);
+    test_read(I2C_REG_AIR_IN, regs, 2);
+    CHECK(regs[0] == 1 && regs[1] == 2, "staged modes %d %d", regs[0], regs[1]);
+
+    // Read-only registers ignore writes.
+    uint8_t telemetry[] = {I2C_REG_TELEMETRY, 0x55, 0x55};
+    uint8_t before[2];
+    test_ticks(1);
+    test_read(I2C_REG_RELAY_ACTUATIONS, before, 2);
+    uint8_t actuations[] = {I2C_REG_RELAY_ACTUATIONS, 9, 9};
+    test_write(actuations, sizeof(actuations));
+    test_write(telemetry, sizeof(telemetry));
+    test_read(I2C_REG_RELAY_ACTUATIONS, regs, 2);
+    CHECK(regs[0] == before[0] && regs[1] == before[1], "relay actuations were written");
+
+    // Modes committed while the main loop publishes older ones read back right away, and stay.
+    uint8_t older[] = {I2C_REG_AIR_IN, 5, 1};
+    test_write(older, sizeof(older));
+    hal_host_checkpoint_hook = commit_while_publishing;
+    fan_control_loop();
+    test_read(I2C_REG_AIR_IN, regs, 2);
+    CHECK(regs[0] == 2 && regs[1] == 3, "modes %d %d after a commit during publishing", regs[0], regs[1]);
+    test_ticks(1);
+    test_read(I2C_REG_AIR_IN, regs, 2);
+    CHECK(regs[0] == 2 && regs[1] == 3, "modes %d %d once the main loop caught up", regs[0], regs[1]);
+
+    // A register address past the end discards the rest of the write, instead of taking the next byte as the address.
+    uint8_t invalid[] = {0xF0, I2C_REG_BRIGHTNESS, 7};
+    test_write(invalid, sizeof(invalid));
+    CHECK(test_read_reg(I2C_REG_BRIGHTNESS) == 255, "write after an invalid register address was applied");
+    test_twi(TW_SR_SLA_ACK);
+    TWDR = 0xF0;
+    test_twi(TW_SR_DATA_ACK);
+    test_twi(TW_SR_STOP);
+    test_twi(TW_ST_SLA_ACK);
+    CHECK(TWDR == 0xFF && !(TWCR & (1 << TWEA)), "read from an invalid register address: %02x, TWCR %02x", TWDR, TWCR);
+    test_twi(TW_ST_LAST_DATA);
+
+    // A register address that ends with a STOP, with the read coming later. The modes change in between, via the
+    // button, and the read must see that.
+    PINC |= BOARD_TWI_PINS;
+    test_press(60);
+    uint8_t air_in = test_read_reg(I2C_REG_AIR_IN);
+    uint8_t addr = I2C_REG_AIR_IN;
+    test_write(&addr, 1);
+    test_press(10);
+    test_read_more(regs, 1);
+    CHECK(regs[0] == (air_in + 1) % NUM_AIR_IN_MODES, "read after STOP returned air in %d, expected %d", regs[0],
+          (air_in + 1) % NUM_AIR_IN_MODES);
+
+    return test_result();
+}
@@ -0,0 +1,72 @@
+//
+// Recovering the TWI from bus hangs, see twislave.c.
+//
+
+#include "test_host.h"
+
+// Runs up to ticks timer ticks and returns the first one after which the TWI was reset, or -1.
+// With progress, the master clocks out one byte per tick.
+static int first_recovery(int ticks, int progress) {
+    for (int i = 1; i <= ticks; i++) {
+        uint8_t before = i2cdata[I2C_REG_TWI_RECOVERIES];
+        if (progress) {
+            test_twi(TW_ST_DATA_ACK);
+        }
+        TIMER1_COMPA_vect();
+        if (i2cdata[I2C_REG_TWI_RECOVERIES] != before) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int main(void) {
+    test_boot(1 << PORF);
+    PINC |= BOARD_TWI_PINS;
+    uint8_t relays = PORTB;
+
+    // Other traffic can hold the lines low while we are not addressed.
+    PINC &= ~(1 << BOARD_TWI_SDA_PIN);
+    CHECK(first_recovery(20, 0) == -1, "recovered while idle");
+
+    // A read in progress with both lines high.
+    PINC |= BOARD_TWI_PINS;
+    test_twi(TW_ST_SLA_ACK);
+    CHECK(first_recovery(20, 0) == -1, "recovered with the lines high");
+
+    // A slow master keeps SDA low, but makes progress.
+    PINC &= ~(1 << BOARD_TWI_SDA_PIN);
+    CHECK(first_recovery(20, 1) == -1, "recovered while the master clocks");
+
+    // The master is gone.
+    int ticks = first_recovery(20, 0);
+    CHECK(ticks == 3, "recovered after %d ticks", ticks);
+    CHECK(TWCR == (1 << TWEA | 1 << TWEN | 1 << TWIE), "TWI not reenabled: %02x", TWCR);
+    PINC |= BOARD_TWI_PINS;
+    CHECK(test_read_reg16(I2C_REG_TWI_RECOVERIES) == 1, "recovery not counted");
+    CHECK(PORTB == relays, "relays touched");
+
+    // The master stalls between the register address and the read, with SCL low.
+    test_twi(TW_SR_SLA_ACK);
+    TWDR = I2C_REG_STATUS;
+    test_twi(TW_SR_DATA_ACK);
+    test_twi(TW_SR_STOP);
+    PINC &= ~(1 << BOARD_TWI_SCL_PIN);
+    ticks = first_recovery(20, 0);
+    CHECK(ticks > 0 && ticks <= 4, "recovered after %d ticks", ticks);
+    PINC |= BOARD_TWI_PINS;
+
+    // A write that ended with a STOP is over, whatever the lines do afterwards.
+    uint8_t modes[] = {I2C_REG_AIR_IN, 5, 3};
+    test_write(modes, sizeof(modes));
+    PINC &= ~(1 << BOARD_TWI_SCL_PIN);
+    CHECK(first_recovery(20, 0) == -1, "recovered after a complete write");
+    PINC |= BOARD_TWI_PINS;
+
+    CHECK(test_read_reg16(I2C_REG_TWI_RECOVERIES) == 2, "recoveries %u", test_read_reg16(I2C_REG_TWI_RECOVERIES));
+    uint8_t regs[3];
+    test_read(I2C_REG_STATUS, regs, 3);
+    CHECK(regs[1] == 5 && regs[2] == 3, "registers after recovery %02x %02x", regs[1], regs[2]);
+
+    return test_result();
+}
@@ -0,0 +1,64 @@
+//
+// The TWI event trace, see twi_trace.h.
+//
+
+#include "test_host.h"
+
+static uint8_t trace[TWI_TRACE_SIZE];
+
+// Reads the trace and returns the event count.
+static uint8_t read_trace(void) {
+    test_read(I2C_REG_TRACE, trace, sizeof(trace));
+    return trace[TWI_TRACE_COUNT];
+}
+
+// The nth newest entry of the trace last read, 0 for the newest.
+static const uint8_t *entry(int nth) {
+    return &trace[TWI_TRACE_FIRST + TWI_TRACE_ENTRY_SIZE * ((trace[TWI_TRACE_COUNT] - 1 - nth) & TWI_TRACE_MASK)];
+}
+
+int main(void) {
+    test_boot(1 << PORF);
+
+    uint8_t regs[3];
+    test_read(I2C_REG_STATUS, regs, 3);
+    CHECK(read_trace() == 0, "recording while disabled");
+    CHECK(entry(0)[TWI_TRACE_STATUS] == TW_NO_INFO, "unused entries not marked");
+
+    // The write enabling the trace is recorded from its STOP on.
+    test_write_reg(I2C_REG_CONFIG, I2C_CONFIG_TRACE);
+    test_read(I2C_REG_AIR_IN, regs, 2);
+    uint8_t count = read_trace();
+    static const uint8_t expected[][2] = {
+            // The read of the trace itself, up to the register address.
+            {TW_SR_DATA_ACK, 0xFF},
+            {TW_SR_SLA_ACK, 0xFF},
+            // The read of the modes, ending with the register of the byte the master didn't take.
+            {TW_ST_DATA_NACK, I2C_REG_CHANGE_SEQ},
+            {TW_ST_DATA_ACK, I2C_REG_AIR_OUT},
+            {TW_ST_SLA_ACK, I2C_REG_AIR_IN},
+            {TW_SR_STOP, I2C_REG_AIR_IN},
+            {TW_SR_DATA_ACK, 0xFF},
+            {TW_SR_SLA_ACK, 0xFF},
+            {TW_SR_STOP, I2C_REG_CONFIG},
+    };
+    int n = sizeof(expected) / sizeof(expected[0]);
+    CHECK(count == n, "%d events", count);
+    for (int i = 0; i < n; i++) {
+        CHECK(entry(i)[TWI_TRACE_STATUS] == expected[i][0] && entry(i)[TWI_TRACE_REGISTER] == expected[i][1],
+              "event %d: %02x at %02x, expected %02x at %02x", i, entry(i)[TWI_TRACE_STATUS],
+              entry(i)[TWI_TRACE_REGISTER], expected[i][0], expected[i][1]);
+    }
+    CHECK(entry(n)[TWI_TRACE_STATUS] == TW_NO_INFO, "more events than expected");
+
+    // Reading the trace again only adds that read.
+    CHECK(read_trace() == count + 2, "reading the trace traced more than its address");
+
+    // Disabling it stops recording right there.
+    test_write_reg(I2C_REG_CONFIG, 0);
+    count = read_trace();
+    test_read(I2C_REG_STATUS, regs, 3);
+    CHECK(read_trace() == count, "recording after disabling");
+
+    return test_result();
+}